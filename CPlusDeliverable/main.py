@@ -32,7 +32,7 @@ def test_example_data():
     f_report=open('pump_report.csv', 'w')
     f_report.write('File Name, Pump State, Checked, Comments' + '\n')
 
-    _ = sp.check_output(['g++', 'classify_pump_state.cpp'])
+    _ = sp.check_output(['g++', 'classify_pump_state.cpp', '../libdynacard/dynacard.cpp', '-pthread'])
     for f in os.listdir(EXAMPLE_DATA_DIR):
         if not f.endswith('.csv'): continue
         print f
@@ -59,7 +59,7 @@ EXAMPLE_FILES = [
 'drag_friction.csv',
 ]
 def test():
-    _ = sp.check_output(['g++', 'classify_pump_state.cpp'])
+    _ = sp.check_output(['g++', 'classify_pump_state.cpp', '../libdynacard/dynacard.cpp', '-pthread'])
     for f in EXAMPLE_FILES:
         #for f in ['gas_interference.csv']:
         if not f.endswith('.csv'): continue
@@ -43,7 +43,7 @@ EXAMPLE_FILES = [
 'drag_friction.csv',
 ]
 def test():
-    _ = sp.check_output(['g++', 'classify_pump_state.cpp'])
+    _ = sp.check_output(['g++', 'classify_pump_state.cpp', '../libdynacard/dynacard.cpp', '-pthread'])
     for f in EXAMPLE_FILES:
         #for f in ['gas_interference.csv']:
         if not f.endswith('.csv'): continue
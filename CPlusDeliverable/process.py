@@ -225,7 +225,7 @@ EXAMPLE_FILES = [
 ]
 import subprocess as sp
 def test():
-    _ = sp.check_output(['g++', 'classify_pump_state.cpp'])
+    _ = sp.check_output(['g++', 'classify_pump_state.cpp', '../libdynacard/dynacard.cpp', '-pthread'])
     for f in EXAMPLE_FILES:
         #for f in ['gas_interference.csv']:
         if not f.endswith('.csv'): continue
@@ -6,532 +6,718 @@ g++ hello.cpp
 */
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
 #include <cmath>
 #include <ctime>
 #include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
 #include <experimental/filesystem>
 
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+#include "../DynaCardCommon/card_file.h"
+#include "../DynaCardCommon/card_header.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/pump_state.h"
+#include "../DynaCardCommon/fused_engine.h"
+#include "../DynaCardCommon/resample.h"
+#include "../DynaCardCommon/knn_classifier.h"
+#include "../DynaCardCommon/stream_classifier.h"
+#include "../DynaCardCommon/stage_pipeline.h"
+#include "../DynaCardCommon/well_trends.h"
+#include "../DynaCardCommon/result_cache.h"
+#include "../DynaCardCommon/dir_watch.h"
+#include "../DynaCardCommon/metrics.h"
+#include "../DynaCardCommon/trace.h"
+
 using namespace std;
 
-string trim(const string& str, const string& whitespace = " \t")
-{
-	const auto strBegin = str.find_first_not_of(whitespace);
-	if (strBegin == string::npos)
-		return ""; // no content
+// Any state a reference library can hold is cached whole
+static_assert(REFERENCE_STATE_NAME <= CACHED_STATE_NAME, "a library's states must fit in a CachedResult");
 
-	const auto strEnd = str.find_last_not_of(whitespace);
-	const auto strRange = strEnd - strBegin + 1;
+// The line of a file with a row that for_each_card_line could not parse
+string not_a_card_error(const string& fname) {
+	return "ERROR: " + fname + " has a row that is not position,length,weight";
+}
 
-	return str.substr(strBegin, strRange);
+// Read the first cycle of a file into card.  False if it can't be opened or parsed.
+bool parse_file(string fname, Card& card) {
+	TRACE_SPAN("parse_file");
+	// Read each column into its own vector
+	CardColumns columns;
+	try {
+		if (!parse_card_file(fname, columns)) {
+			cout << "ERROR: cannot open " << fname << endl;
+			return false;
+		}
+	}
+	catch (...) {
+		cout << not_a_card_error(fname) << endl;
+		return false;
+	}
+	card.assign_first_cycle(columns.position.data(), columns.length.data(), columns.weight.data(), columns.size());
+	return true;
 }
 
-string reduce(const string& str, const string&& fill = "", const string& whitespace = " \t")
-{
-	// trim first
-	auto result = trim(str, whitespace);
+// Same as parse_file for a binary .card, read straight from the mapping.  False if it isn't a readable one.
+bool parse_card(string fname, Card& card) {
+	TRACE_SPAN("parse_card");
+	CardFile card_file;
+	if (!card_file.open(fname)) {
+		cout << "ERROR: " << fname << " is not a readable card file" << endl;
+		return false;
+	}
+	card.assign_first_cycle(card_file.position, card_file.length, card_file.weight, card_file.n_samples());
+	return true;
+}
 
-	// replace sub ranges
-	auto beginSpace = result.find_first_of(whitespace);
-	while (beginSpace != string::npos) {
-		const auto endSpace = result.find_first_not_of(whitespace, beginSpace);
-		const auto range = endSpace - beginSpace;
+// Resample card along its arc length to about n_points points (resample.h); 0 leaves it as it is
+void resample(Card& card, size_t n_points) {
+	if (n_points == 0) return;
+	TRACE_SPAN("resample");
+	thread_local StrokeResampler resampler;
+	resample_card(card, n_points, resampler);
+}
 
-		result.replace(beginSpace, range, fill);
+// The reference library of --knn, loaded before any card is classified; nullptr to classify by guess_pump_state
+const ReferenceLibrary* knn_library = nullptr;
 
-		const auto newStart = beginSpace + fill.length();
-		beginSpace = result.find_first_of(whitespace, newStart);
+// Classify card by guess_pump_state or, with --knn, by its nearest reference cards, which leave fits NaN
+const char* classify(Card& card, double min_acceptable_peak_weight, CornerMethod corner_method, EdgeFit* fits) {
+	if (!knn_library) return classify_card(card, min_acceptable_peak_weight, corner_method, fits);
+	if (fits) {
+		EdgeFit nothing = { NAN, NAN, NAN, NAN, NAN, NAN };
+		fill(fits, fits + 4, nothing);
 	}
-	return result;
+	return classify_card_knn(card, min_acceptable_peak_weight, *knn_library);
 }
 
-// Turn file into triple of pos/x/y vectors
-vector<vector<double> > parse_file(string fname) {
-	// Read each column into its own vector
-	vector <double> positionVec;
-	vector <double> xVec;
-	vector <double> yVec;
-	string line;
-	vector<double> prsd;
-	ifstream ifs(fname);
-	while (ifs.good())
-	{
-		getline(ifs, line, '\n');
-
-		//skip the empty row
-		line = trim(line);
-		if (line.length() == 0) continue; // bug, remove leading and trailing space characters
-
-		if (reduce(line) == "position,length,weight") continue; // bug. remove the white spaces in between
-
-		if (line[0] == '#') continue; // bug if not fixed above
-
-		stringstream ss(line);
-		string number;
-		int i = 0;
-		while (getline(ss, number, ',')) {
-			if (i == 0) positionVec.push_back(stod(number));
-			else if (i == 1) xVec.push_back(stod(number));
-			else if (i == 2) yVec.push_back(stod(number));
-			else throw 20;
-			i++;
-		}
-	}
-	// find indices of first pos=0 and second pos=0, to find one cycle
-	int first_zero_ind = find(positionVec.begin(), positionVec.end(), 0) - positionVec.begin();
-	int second_zero_ind = find(positionVec.begin() + first_zero_ind + 1, positionVec.end(), 0) - (positionVec.begin() + first_zero_ind);
-	if (second_zero_ind == -1) second_zero_ind = positionVec.size();
-	/*cout << "first_zero_ind " << first_zero_ind << endl
-	  << "second_zero_ind " << second_zero_ind << endl;*/
-	  // Make sub-vectors containing only one cycle
-	vector<double> posReturn, xReturn, yReturn;
-	for (int i = first_zero_ind; i < second_zero_ind; i++) {
-		posReturn.push_back(positionVec[i]);
-		xReturn.push_back(xVec[i]);
-		yReturn.push_back(yVec[i]);
-	}
-	/*cout << "  n points " << positionVec.size() << endl
-	  << "  first_zero_ind " << first_zero_ind << endl
-	  << "  second_zero_ind " << second_zero_ind << endl;*/
-	  //
-	vector<vector<double> > to_return;
-	to_return.push_back(posReturn); to_return.push_back(xReturn); to_return.push_back(yReturn);
-	//to_return.push_back(positionVec); to_return.push_back(xVec); to_return.push_back(yVec);
-	return to_return;
+// What --trends follows of a card besides its state (fused_engine.h)
+struct CardMeasures {
+	double area, distance_from_shape;
+};
+
+// classify, measuring the card too; with --knn no edges are fitted to measure it by, so they are NaN
+const char* classify_measured(Card& card, double min_acceptable_peak_weight, CornerMethod corner_method, EdgeFit* fits,
+	CardMeasures& measures) {
+	if (knn_library) {
+		measures.area = measures.distance_from_shape = NAN;
+		return classify(card, min_acceptable_peak_weight, corner_method, fits);
+	}
+	CardRecord record;
+	classify_and_measure(card, min_acceptable_peak_weight, corner_method, record);
+	if (fits) copy(record.fits, record.fits + 4, fits);
+	measures.area = record.area;
+	measures.distance_from_shape = record.distance_from_shape;
+	return record.state;
 }
 
-// Normalize a vector
-vector<double> normalize(vector<double> inVec) {
-	vector<double> outVec;
+// Read a file's first cycle into card, which is only scratch, and classify it; "" if it couldn't be read
+string classify_file(string fname, Card& card, double min_acceptable_peak_weight, CornerMethod corner_method,
+	EdgeFit* fits = nullptr, size_t resample_points = 0)
+{
+	bool read = is_card_file_name(fname) ? parse_card(fname, card) : parse_file(fname, card);
+	if (!read) return "";
+	resample(card, resample_points);
+	return classify(card, min_acceptable_peak_weight, corner_method, fits);
+}
 
-	// re-write the entier block with high performance
-	double min_value = *(min_element(cbegin(inVec), cend(inVec)));
-	double max_value = *(max_element(cbegin(inVec), cend(inVec)));
-	double diff = max_value - min_value;
+string get_pump_state(string fname, double min_acceptable_peak_weight, CornerMethod corner_method, size_t resample_points)
+{
+	METRICS_TIME(STAGE_FILE);
+	TraceCard trace(fname);
+	// Read in the file
+	Card card;
+	string state = classify_file(fname, card, min_acceptable_peak_weight, corner_method, nullptr, resample_points);
+	trace.set_state(state);
+	if (!state.empty()) cout << state << endl;
+	return state;
+}
 
-	for (int i = 0; i < inVec.size(); i++) {
-		outVec.push_back((inVec[i] - min_value) / diff);
+// Write a report row per stroke of fname
+void report_stroke_states(ostream& report, string fname, const vector<CachedResult>& strokes)
+{
+	for (size_t k = 0; k < strokes.size(); k++) {
+		report << fname << "," << strokes[k].state << "," << "" << "," << "stroke " << k + 1
+			<< " rows " << strokes[k].first << "-" << strokes[k].end - 1 << endl;
 	}
+}
 
-	return outVec;
+// today's name for the report called report_file_name
+string report_name(string report_file_name) {
+	// current date/time based on current system
+	std::time_t now = std::time(0);
+	std::tm *ltm = localtime(&now);
 
-	/*
-	double min_val = inVec[0];
-	double max_val = inVec[0];
-	double current_val = 0.0;
-	for (int i = 0; i < inVec.size(); i++) {
-		current_val = inVec[i];
-		if (current_val < min_val) min_val = current_val;
-		if (current_val > max_val) max_val = current_val;
-	}
-	for (int i = 0; i < inVec.size(); i++)
-		outVec.push_back((inVec[i] - min_val) / (max_val - min_val));
-	return outVec;
-	*/
+	// The file name is in the pattern of: filename_year_month_day.csv
+	return report_file_name + "_" + to_string(ltm->tm_year + 1900) + to_string(1 + ltm->tm_mon) + to_string(ltm->tm_mday) + ".csv";
 }
 
-struct FittedLine {
-	double slope;
-	double intercept;
-	double r2;
-};
+// return a file output stream from passed-in filename (string)
+ofstream prepare_report(string report_file_name) {
+	ofstream report_file(report_name(report_file_name));
 
-FittedLine fit_a_line(vector<double> xs, vector<double> ys) {
-	double xsum = 0, x2sum = 0, y2sum = 0, ysum = 0, xysum = 0, r2 = 0;
-	int numberOfPoints = xs.size();
-	for (int i = 0; i < numberOfPoints; i++) {
-		xsum += xs[i];
-		ysum += ys[i];
-		x2sum += pow(xs[i], 2);
-		y2sum += pow(ys[i], 2);
-		xysum += xs[i] * ys[i];
-	}
-	double slope = (numberOfPoints*xysum - xsum * ysum) / (numberOfPoints*x2sum - xsum * xsum);
-	double intercept = (x2sum*ysum - xsum * xysum) / (x2sum*numberOfPoints - xsum * xsum);
-	//slope = (xysum + (ysum/numberOfPoints)*xsum + (xsum/numberOfPoints)*ysum + numberOfPoints*(ysum/numberOfPoints)*(xsum/numberOfPoints));
-	//intercept = (ysum/numberOfPoints) - slope*(xsum/numberOfPoints);
-	// Goodness of fit
-	for (int i = 0; i < numberOfPoints; i++) {
-		double y_pred = slope * xs[i] + intercept;
-		r2 += pow(y_pred - ys[i], 2);
-	}
-	r2 /= numberOfPoints;
-	FittedLine fit;
-	fit.slope = slope; 
-	fit.intercept = intercept; 
-	fit.r2 = r2;
-	return fit;
+	return report_file;
+}
+void report_pump_state(ofstream rfname, string fname, string pump_state, string checked, string comments) {
+
+	rfname << fname << "," << pump_state << "," << checked << comments << endl;
+	rfname.close();
 }
 
-class Edge {
-public:
-	string name;
-	FittedLine normal_fitted_line;
-	FittedLine inverse_fitted_line;
-	// Raw data
-	int numberOfPoints;
-	vector<double> xs, ys;
-	// Fitted data
-	double slope, intercept, r2;
-	double length;
-	//
-	Edge(string nm) {
-		name = nm;
-		numberOfPoints = 0;
-	}
-	void display() {
-		cout << "Name: " << name << endl
-			<< "  n points " << numberOfPoints << endl
-			<< "  slope " << slope << endl
-			<< "  vertical " << vertical() << endl
-			<< "  flat " << flat() << endl
-			<< "  length " << length << endl
-			<< "  r2 " << r2 << endl
-			<< "  inv r2 " << inverse_fitted_line.r2 << endl;
-	}
-	void add_point(double x, double y) {
-		xs.push_back(x);
-		ys.push_back(y);
-		numberOfPoints++;
-	}
-	void finish() {
-		if (numberOfPoints == 0) {
-			cout << "ERROR: " << name << " had no points" << endl;
+// The card files to analyse: every .csv or .card in a directory (and below it
+// if recursive), sorted so the report comes out in the same order every run,
+// or the single file given
+vector<string> list_card_files(string fname, bool recursive) {
+	namespace fs = std::experimental::filesystem;
+
+	vector<string> listOfCSVFiles;
+	const fs::path path(fname);
+	std::error_code ec;
+	auto add_card_file = [&](const fs::path& file) {
+		string extension = file.filename().extension().string();
+		if (extension == ".csv" || extension == ".card") {
+			listOfCSVFiles.push_back(file.string());
 		}
-		normal_fitted_line = fit_a_line(xs, ys);
-		inverse_fitted_line = fit_a_line(ys, xs);
-		slope = normal_fitted_line.slope;
-		intercept = normal_fitted_line.intercept;
-		r2 = normal_fitted_line.r2;
-		double x_diff_sqr = pow(xs[0] - xs[numberOfPoints - 1], 2);
-		double y_diff_sqr = pow(ys[0] - ys[numberOfPoints - 1], 2);
-		length = pow(x_diff_sqr + y_diff_sqr, 0.5);
-	}
-	Edge first_half() {
-		Edge ret("first half of " + name);
-		for (int i = 0; i < numberOfPoints; i++) {
-			double x_diff_sqr = pow(xs[0] - xs[i], 2);
-			double y_diff_sqr = pow(ys[0] - ys[i], 2);
-			double dist_from_start = pow(x_diff_sqr + y_diff_sqr, 0.5);
-			if (dist_from_start <= 0.5*length) {
-				ret.add_point(xs[i], ys[i]);
-			}
-			else {
-				break;
-			}
+	};
+	if (fs::exists(path) && fs::is_directory(path, ec)) {
+		if (recursive) {
+			fs::recursive_directory_iterator iter(path, ec), end;
+			for (; iter != end; iter.increment(ec)) add_card_file(iter->path());
 		}
-		ret.finish();
-		return ret;
-	}
-
-	Edge second_half() {
-		Edge ret("second half of " + name);
-		int index = numberOfPoints - 1;
-		for (int i = numberOfPoints - 1; i >= 0; i--) {
-			double x_diff_sqr = pow(xs[index] - xs[i], 2);
-			double y_diff_sqr = pow(ys[index] - ys[i], 2);
-			double dist_from_end = pow(x_diff_sqr + y_diff_sqr, 0.5);
-			if (dist_from_end <= 0.5 * length)
-			{
-				ret.add_point(xs[i], ys[i]);
-			}
-			else
-			{
-				break;
-			}
+		else {
+			fs::directory_iterator iter(path, ec), end;
+			for (; iter != end; iter.increment(ec)) add_card_file(iter->path());
 		}
-		// TODO: Do we need to swap the points?
-		ret.finish();
-		return ret;
-	}
-	//
-	// Properties an edge might have
-	//
-	bool good_fit() {
-		return (normal_fitted_line.r2 < 0.002) | (inverse_fitted_line.r2 < 0.002);
-	}
-	bool vertical() {
-		return good_fit() & (abs(inverse_fitted_line.slope) < 0.1);
-	}
-	bool slope_up() {
-		// TODO: See question below in flat()
-		return good_fit() & (normal_fitted_line.slope > 0.5);
-	}
-	bool slope_down() {
-		// TODO: See question below in flat()
-		return good_fit() & (normal_fitted_line.slope < -0.5);
+		sort(listOfCSVFiles.begin(), listOfCSVFiles.end());
 	}
-	bool flat() {
-		// TODO: What happends to slope >= 0.1 and slope <= 0.5?
-		return good_fit() & (abs(slope) < 0.1);
+	else {
+		listOfCSVFiles.push_back(fname);
 	}
+	return listOfCSVFiles;
+}
+
+struct AnalysisOptions {
+	bool per_stroke = false;
+	CornerMethod corner_method = HEURISTIC_CORNERS;
+	int n_workers = 1;      // classifying threads, 0 for one per hardware thread
+	int n_readers = 1;      // threads reading and parsing files ahead of them
+	bool stages = false;    // print how busy the reading, classifying and writing were
+	bool recursive = false; // descend into subdirectories
+	bool scaling = false;   // time the run on 1, 2, 4 .. n_workers threads first
+	string cache_path;      // result cache (result_cache.h), "" for none
+	string metrics_path;    // metrics.h files are written to this plus .json and .prom, "" for none
+	string trace_path;      // trace.h Chrome trace of the cards, "" for none
+	uint64_t trace_every = 1;
+	double trace_slower = 0; // microseconds; also trace every card slower than this
+	size_t resample_points = 0; // resample.h: strokes of more points are resampled to about this many, 0 for none
+	string knn_path;        // reference library (knn_classifier.h) to classify against, "" for guess_pump_state
+	uint64_t knn_hash = 0;  // its content_hash with KNN_NEIGHBOURS, for the result cache
+	string trends_path;     // per-well summaries (well_trends.h) are appended to this, "" for none
+	double trend_window = TREND_WINDOW_SECONDS;
+	double trend_every = TREND_SUMMARY_SECONDS;
 };
 
-class Shape {
-public:
-	Edge *left, *top, *right, *bottom;
-	Shape(Edge* e0, Edge* e1, Edge* e2, Edge* e3) {
-		left = e0; top = e1; right = e2; bottom = e3;
-	}
-	//
-	// Properties a shape might have
-	//
-	double top_width() {
-		return top->length;
+// What the results of a run are cached under (result_cache.h)
+uint64_t analysis_config(double min_acceptable_peak_weight, const AnalysisOptions& options) {
+	return run_config_hash(min_acceptable_peak_weight, options.corner_method, options.per_stroke, options.resample_points,
+		options.knn_hash);
+}
+
+// A card file on its way from being read to its report rows
+struct ReadCardFile {
+	string fname;
+	FileHeader header;
+	bool is_card = false;     // a binary .card, classified straight from card_file
+	CardFile card_file;
+	CardColumns cols;         // a .csv's samples, when only its first cycle is classified
+	MappedFile mapped;        // a .csv whose strokes are cut as they are classified, one stroke held at a time
+	bool hashed = false;      // content and size are those of a file with something in it, so its results can be cached
+	uint64_t content = 0;
+	size_t size = 0;
+	bool cached = false;      // results were found in the cache; the file was not parsed
+	vector<CachedResult> results;
+	vector<CardMeasures> measures; // of every result, with --trends
+	string error;             // why the file could not be read, which is then its line
+	string rows, line;        // its report rows and console line
+	TraceEvent read_trace = TraceEvent(); // the reading, handed to the trace of the card (trace.h)
+};
+
+/*
+Map fname and parse it into file, reusing file's buffers, unless the cache
+already has its results.  With --strokes a .csv is only mapped, and read in
+ahead: classify_read_file cuts it into strokes as it parses it, so memory
+stays bounded by the longest stroke rather than the recording.  A file that
+cannot be opened or parsed gets file.error instead.
+*/
+void read_card_file(const string& fname, const AnalysisOptions& options, uint64_t config, ResultCache* cache, ReadCardFile& file) {
+	TraceHandoff trace(file.read_trace, "parse_file");
+	file.fname = fname;
+	file.header = FileHeader();
+	file.is_card = is_card_file_name(fname);
+	file.card_file.close();
+	file.cols.clear();
+	file.hashed = file.cached = false;
+	file.results.clear();
+	file.measures.clear();
+	file.error.clear();
+	MappedFile& mapped = file.mapped;
+	bool opened = (cache || !file.is_card) && mapped.open(fname);
+	if (cache && opened) {
+		file.content = content_hash(mapped.data, mapped.size);
+		file.size = mapped.size;
+		file.hashed = mapped.data != nullptr;
+		file.cached = cache->find(file.content, file.size, config, file.results);
+		if (file.cached) {
+			file.read_trace.detail = "cached";
+			mapped.close();
+			return;
+		}
 	}
-	double bottom_width() {
-		return bottom->length;
+	if (file.is_card) {
+		mapped.close();
+		if (!file.card_file.open(fname)) file.error = "ERROR: " + fname + " is not a readable card file";
+		file.header = file.card_file.file_header();
 	}
-	bool left_edge_vertical() {
-		return isnan(left->slope) | (abs(left->slope) > 50);
+	else if (opened && options.per_stroke) {
+		mapped.will_need();
 	}
-	bool top_edge_flat() {
-		// bug: to be fixed
-		return abs(top->slope) < 0.1;
+	else if (opened) {
+		try {
+			ingest_card_text(mapped.data, mapped.data + mapped.size, file.header, file.cols);
+		}
+		catch (...) {
+			file.error = not_a_card_error(fname);
+		}
+		mapped.close();
 	}
-	bool bottom_edge_flat() {
-		// bug: to be fixed
-		return abs(bottom->slope) < 0.1;
+	else {
+		file.error = "ERROR: cannot open " + fname;
 	}
-};
-
-int increment_with_rollover(int i, int max) {
-	i++;
-	if (i == max) i = 0;
-	return i;
 }
 
-vector<Edge> break_into_edges(vector<double> position, vector<double> xs, vector<double> ys) {
-	// Identify indices of the corners of the trapezoid
-	vector<double> direction_upper_right, direction_lower_right;
-	for (int i = 0; i < position.size(); i++) {
-		direction_upper_right.push_back(xs[i] + 2 * ys[i]);
-		direction_lower_right.push_back(xs[i] - 2 * ys[i]);
-	}
-	int lower_left_ind = min_element(direction_upper_right.begin(), direction_upper_right.end()) - direction_upper_right.begin();
-	int upper_right_ind = max_element(direction_upper_right.begin(), direction_upper_right.end()) - direction_upper_right.begin();
-	int upper_left_ind = min_element(direction_lower_right.begin(), direction_lower_right.end()) - direction_lower_right.begin();
-	int lower_right_ind = max_element(direction_lower_right.begin(), direction_lower_right.end()) - direction_lower_right.begin();
-	// Create edges based on those corners
-	Edge left("left"), top("top"), right("right"), bottom("bottom");
-	int i = lower_left_ind;
-	int max_i = position.size();
-	while (i != upper_left_ind) {
-		left.add_point(xs[i], ys[i]);
-		i = increment_with_rollover(i, max_i);
-	}
-	while (i != upper_right_ind) {
-		top.add_point(xs[i], ys[i]);
-		i = increment_with_rollover(i, max_i);
-	}
-	while (i != lower_right_ind) {
-		right.add_point(xs[i], ys[i]);
-		i = increment_with_rollover(i, max_i);
-	}
-	while (i != lower_left_ind) {
-		bottom.add_point(xs[i], ys[i]);
-		i = increment_with_rollover(i, max_i);
-	}
-	left.finish(); 
-	top.finish(); 
-	right.finish(); 
-	bottom.finish();
-	// Combine them and return
-	vector<Edge> ret;
-	ret.push_back(left); ret.push_back(top); ret.push_back(right); ret.push_back(bottom);
-	return ret;
+/*
+Classify the first cycle of a read file, or every stroke of it, into
+file.results, and with --trends measure them into file.measures, with card
+as scratch
+*/
+void classify_read_file(ReadCardFile& file, double min_acceptable_peak_weight, const AnalysisOptions& options, Card& card) {
+	EdgeFit fits[4];
+	bool measure = !options.trends_path.empty();
+	// The samples in card, which span first..end of the file's
+	auto classify_samples = [&](uint64_t first, uint64_t end) {
+		resample(card, options.resample_points);
+		const char* state;
+		if (measure) {
+			CardMeasures measures;
+			state = classify_measured(card, min_acceptable_peak_weight, options.corner_method, fits, measures);
+			file.measures.push_back(measures);
+		}
+		else {
+			state = classify(card, min_acceptable_peak_weight, options.corner_method, fits);
+		}
+		file.results.push_back(make_cached_result(state, first, end, fits));
+	};
+	const double* position = file.is_card ? file.card_file.position : file.cols.position.data();
+	const double* length = file.is_card ? file.card_file.length : file.cols.length.data();
+	const double* weight = file.is_card ? file.card_file.weight : file.cols.weight.data();
+	size_t n_samples = file.is_card ? file.card_file.n_samples() : file.cols.size();
+	if (!options.per_stroke) {
+		card.assign_first_cycle(position, length, weight, n_samples);
+		classify_samples(0, 0);
+		return;
+	}
+	if (file.is_card) {
+		// Already segmented by csv2card: classify straight from the stroke index
+		const CardFile& card_file = file.card_file;
+		for (size_t k = 0; k < card_file.n_strokes(); k++) {
+			size_t first = card_file.stroke_index[2 * k], end = card_file.stroke_index[2 * k + 1];
+			card.assign(position + first, length + first, weight + first, end - first);
+			classify_samples(first, end);
+		}
+		return;
+	}
+	// Parse the mapping a row at a time, classifying every stroke as it closes, and pick up the header on the way
+	StrokeSegmenter strokes;
+	for_each_card_line(file.mapped.data, file.mapped.data + file.mapped.size, [&](double pos, double x, double y) {
+		if (!strokes.add_sample(pos, x, y)) return;
+		card.assign(strokes.position.data(), strokes.length.data(), strokes.weight.data(), strokes.position.size());
+		classify_samples(strokes.first_sample, strokes.last_sample() + 1);
+	}, [&](const char* p, const char* line_end) {
+		parse_header_line(p, line_end, file.header);
+	});
+	file.mapped.close();
 }
 
-string guess_pump_state(Shape shape) {
-	/*shape.left->display();
-	shape.top->display();
-	shape.right->display();
-	shape.bottom->display();*/
-	// Full pump
-	if (shape.left->vertical()
-		& shape.right->vertical()
-		& shape.top->flat()
-		& shape.bottom->flat())
-		return "full pump";
-	// Tubing movement
-	else if (shape.top->flat()
-		& shape.bottom->flat()
-		& shape.left->slope_up()
-		& shape.left->good_fit()
-		& shape.right->slope_up()
-		& shape.right->good_fit())
-		return "tubing movement";
-	// Fluid pound
-	else if (shape.top->flat()
-		& shape.bottom->flat()
-		& shape.left->vertical()
-		& (shape.bottom->length < 0.8)
-		& (shape.right->normal_fitted_line.r2 > 0.015))
-		return "fluid pound";
-	// Gas interference
-	else if (shape.top->flat()
-		& shape.left->vertical() // TODO: WHY is it vertical? what's difference between "fluid pound" vs "gas interference"?
-		& shape.bottom->flat()
-		& (shape.bottom->length < 0.8))
-		return "gas interference";
-	// Pump hitting
-	else if (shape.left->vertical()
-		& shape.right->vertical()
-		& shape.top->first_half().flat()
-		& shape.bottom->first_half().flat())
-		return "pump hitting";
-	// Bent barrel
-	else if (shape.left->vertical()
-		& shape.right->vertical()
-		& (shape.bottom->length > 0.8) // TODO: ?
-		& (shape.top->length > 0.8))
-		// & shape.bottom->second_half().flat()) // TODO: why not second_half flat comparing to pump hitting above?
-		return "bent barrel";
-	// Worn plunger
-	else if (shape.bottom->flat()
-		& ~shape.left->vertical()
-		& ~shape.right->vertical()
-		& (shape.top->length < 0.9)
-		)
-		//& (shape.top->length < shape.bottom->length)) // TODO: why not ?
-		return "worn plunger";
-	// Worn standing
-	else if (shape.top->flat()
-		& ~shape.left->vertical()
-		& ~shape.right->vertical()
-		& (shape.bottom->length < 0.9)
-		)
-		// & (shape.top->length > shape.bottom->length)) // TODO: why not?
-		return "worn standing"; 
-// Worn or split
-	else if (shape.bottom->flat()
-		& shape.left->vertical()) 
-		return "worn or"; // TODO: why these conditions only? why not the bottom?
-	//else if (shape.bottom->flat()
-	//	& shape.top->flat()
-	//	& shape.left->vertical()
-	//	& shape.top->length < 0.8
-	//	& shape.right->inverse_fitted_line.r2 < 0.015)
-	//	return "worn or";
-
-	// Fluid friction
-	else if (shape.right->vertical()
-			& shape.left->vertical()) 
-			return "fluid friction";
-	// Drag friction
-	else if ((shape.right->length > 0.7)
-			& (shape.left->length > 0.7)) 
-			return "drag friction";
-	else 
-		return "other??";
+/*
+Classify a read file, one stroke or every stroke of it, into its report rows
+and console line, with card as scratch.  A file the cache had results for is
+not classified again, and one it hadn't is added to it.  A file that could
+not be read or parsed gets neither: its error is printed in place of its
+line.
+*/
+void analyse_read_file(ReadCardFile& file, double min_acceptable_peak_weight, const AnalysisOptions& options, uint64_t config,
+	ResultCache* cache, Card& card) {
+	METRICS_TIME(STAGE_FILE);
+	TraceCard trace(file.fname);
+	trace.add_handoff(file.read_trace);
+	if (!file.error.empty()) {
+		file.rows.clear();
+		file.line = file.error;
+		trace.set_state(file.error);
+		return;
+	}
+	if (!file.cached) {
+		try {
+			classify_read_file(file, min_acceptable_peak_weight, options, card);
+		}
+		catch (...) {
+			// A bad row part way through a --strokes parse: none of the file's strokes are reported
+			file.mapped.close();
+			file.results.clear();
+			file.measures.clear();
+			file.error = not_a_card_error(file.fname);
+			file.rows.clear();
+			file.line = file.error;
+			trace.set_state(file.error);
+			return;
+		}
+		if (cache && file.hashed) cache->insert(file.content, file.size, config, file.results);
+	}
+	ostringstream out;
+	if (options.per_stroke) {
+		report_stroke_states(out, file.fname, file.results);
+		file.line = file.fname + ": " + to_string(file.results.size()) + " strokes";
+		trace.set_state(to_string(file.results.size()) + " strokes");
+	}
+	else {
+		out << file.fname << "," << file.results[0].state << "," << "" << "," << "" << endl;
+		file.line = file.results[0].state;
+		trace.set_state(file.line);
+	}
+	file.rows = out.str();
 }
 
-string get_pump_state(string fname, double min_acceptable_peak_weight)
-{
-	// Read in the file
-	vector<vector<double> > position_x_y = parse_file(fname);
-	vector<double> position = position_x_y[0];
-	vector<double> xs = normalize(position_x_y[1]);
-	vector<double> ys = normalize(position_x_y[2]);
-	// Diagnose flowing well based on max weight
-	int max_ind = max_element(ys.begin(), ys.end()) - ys.begin();
-
-	cout << max_ind << endl;
-	cout << "max val " << position_x_y[2][max_ind] << endl;
-	if (position_x_y[2][max_ind] < min_acceptable_peak_weight) {
-		cout << "flowing well" << endl;
-		return "flowing well";
-	}
-	// Otherwise break into edges
-	vector<Edge> edges = break_into_edges(position, xs, ys);
-	Shape shape(&edges[0], &edges[1], &edges[2], &edges[3]);
-	// And classify based on shape
-	string state = guess_pump_state(shape);
-	cout << state << endl;
-	return state;
+/*
+Classifies files in three stages (stage_pipeline.h): options.n_readers
+threads map and parse them (read_card_file) ahead of n_workers threads
+classifying them, each with its own Card, and done(file) gets every file on
+this thread in file order, so the report streams to disk exactly as a
+single threaded run writes it.  Returns how busy every stage was.
+*/
+template<typename Done>
+PipelineStats classify_files(const vector<string>& files, double min_acceptable_peak_weight, const AnalysisOptions& options, int n_workers,
+	ResultCache* cache, Done done) {
+	uint64_t config = analysis_config(min_acceptable_peak_weight, options);
+	vector<Card> cards(n_workers);
+	PipelineThreads threads;
+	threads.n_readers = options.n_readers;
+	threads.n_workers = n_workers;
+	return run_pipeline<ReadCardFile>(files.size(), threads, [&](size_t i, ReadCardFile& file, int) {
+		read_card_file(files[i], options, config, cache, file);
+	}, [&](ReadCardFile& file, int worker) {
+		analyse_read_file(file, min_acceptable_peak_weight, options, config, cache, cards[worker]);
+	}, [&](size_t, const ReadCardFile& file) {
+		done(file);
+	});
 }
 
-// return a file output stream from passed-in filename (string)
-ofstream prepare_report(string report_file_name) {
-	// current date/time based on current system
-	std::time_t now = std::time(0);
-	std::tm *ltm = localtime(&now);
-
-	// The file name is in the pattern of: filename_year_month_day.csv
-	string newfname = report_file_name + "_" + to_string(ltm->tm_year + 1900) + to_string(1 + ltm->tm_mon) + to_string(ltm->tm_mday) + ".csv";
-	ofstream report_file(newfname);
-
-	return report_file;
+// Print files/s for 1, 2, 4 .. n_workers threads; nothing is written
+void report_scaling(const vector<string>& files, double min_acceptable_peak_weight, const AnalysisOptions& options, int n_workers) {
+	double base_rate = 0;
+	cout << "workers  files/s  speedup" << endl;
+	for (int workers = 1; ; workers = min(2 * workers, n_workers)) {
+		auto start = chrono::steady_clock::now();
+		classify_files(files, min_acceptable_peak_weight, options, workers, nullptr, [](const ReadCardFile&) {});
+		double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		double rate = files.size() / secs;
+		if (workers == 1) base_rate = rate;
+		cout << setw(7) << workers << setw(9) << fixed << setprecision(0) << rate
+			<< setw(8) << setprecision(2) << rate / base_rate << "x" << endl;
+		cout.unsetf(ios::floatfield);
+		if (workers == n_workers) break;
+	}
 }
-void report_pump_state(ofstream rfname, string fname, string pump_state, string checked, string comments) {
 
-	rfname << fname << "," << pump_state << "," << checked << comments << endl;
-	rfname.close();
+// Open the --trends file to append to, starting it with the column names if it is new
+bool open_trends(const string& path, ofstream& out) {
+	namespace fs = std::experimental::filesystem;
+	std::error_code ec;
+	bool fresh = !fs::exists(path) || fs::file_size(path, ec) == 0;
+	out.open(path, ios::app);
+	if (!out) return false;
+	if (fresh) WellTrends::write_heading(out);
+	return true;
 }
 
-struct PumpStateReport {
-	string file_name;
-	string pump_state;
-	string checked;
-	string comments;
-};
-void report_pump_states(ofstream rfname, vector<PumpStateReport> pump_states) {
-
-	rfname << "File Name" << "," << "Pump State" << "," << "Checked" << "," << "Comments" << endl;
-	for (int i = 0; i < pump_states.size(); i++) {
-		rfname << pump_states[i].file_name << "," << pump_states[i].pump_state << "," << pump_states[i].checked << "," << pump_states[i].comments << endl;
+/*
+Add every result of a file to the trends of its well at its time, after
+writing the summaries due before it.  The well and time are the Well ID
+Number and Timestamp of its header or, for a card without them, its name
+and modification time.  Files that could not be read are left out.
+*/
+void add_to_trends(const ReadCardFile& file, WellTrends& trends, ostream& out) {
+	namespace fs = std::experimental::filesystem;
+	if (!file.error.empty()) return;
+	string well = well_key(file.header);
+	if (well.empty()) well = file.fname;
+	const char* timestamp = file.header.timestamp.c_str();
+	char* end;
+	int64_t time = strtoll(timestamp, &end, 10);
+	if (end == timestamp) {
+		std::error_code ec;
+		auto modified = fs::last_write_time(file.fname, ec);
+		time = ec ? 0 : static_cast<int64_t>(decltype(modified)::clock::to_time_t(modified));
+	}
+	trends.write_due(out, time);
+	for (size_t k = 0; k < file.results.size(); k++) {
+		double area = k < file.measures.size() ? file.measures[k].area : NAN;
+		double distance = k < file.measures.size() ? file.measures[k].distance_from_shape : NAN;
+		trends.add(well, time, file.results[k].state, area, distance);
 	}
-	rfname.close();
-	return;
+}
+
+// Print each stage's share of its threads' time busy, waiting for work and waiting on the stage after it
+void report_stages(const PipelineStats& stats) {
+	const char* names[3] = { "read", "classify", "write" };
+	const StageStats* stages[3] = { &stats.read, &stats.compute, &stats.write };
+	cout << "stage     threads  files   busy  starved  blocked" << endl;
+	for (int s = 0; s < 3; s++) {
+		double thread_seconds = stages[s]->n_threads * stats.seconds;
+		cout << left << setw(10) << names[s] << right << setw(7) << stages[s]->n_threads << setw(7) << stages[s]->n_items
+			<< fixed << setprecision(1) << setw(6) << 100 * stages[s]->utilization(stats.seconds) << "%"
+			<< setw(8) << 100 * stages[s]->starved_seconds / thread_seconds << "%"
+			<< setw(8) << 100 * stages[s]->blocked_seconds / thread_seconds << "%" << endl;
+	}
+	cout << "over " << setprecision(3) << stats.seconds << " s" << endl;
+	cout.unsetf(ios::floatfield);
 }
 
 // main entry point for running the pump analysis
-void run_analysis(string fname, double min_acceptable_peak_weight) {
+void run_analysis(string fname, double min_acceptable_peak_weight, const AnalysisOptions& options) {
 	namespace fs = std::experimental::filesystem;
 
-	const fs::path path(fname);
+	vector<string> listOfCSVFiles = list_card_files(fname, options.recursive);
+	int n_workers = options.n_workers > 0 ? options.n_workers : default_worker_count();
+	if (options.scaling) report_scaling(listOfCSVFiles, min_acceptable_peak_weight, options, n_workers);
+
 	std::error_code ec;
-	if (fs::exists(path) && fs::is_directory(path, ec)) {
-		fs::directory_iterator itor;
-		vector<string> listOfCSVFiles;
-		fs::directory_iterator iter(path);
-		fs::directory_iterator end;
-		while (iter != end) {
-			if ((iter->path().filename().extension().string()) == ".csv") {
-				listOfCSVFiles.push_back(iter->path().relative_path().string());
-			}
-			iter.increment(ec);
+	if (options.per_stroke || !options.trends_path.empty() || fs::is_directory(fs::path(fname), ec)) {
+		ResultCache cache;
+		if (!options.cache_path.empty()) cache.load(options.cache_path);
+		// One report row per stroke, or per file, written as each file is done
+		ofstream report = prepare_report("pump_report");
+		report << "File Name" << "," << "Pump State" << "," << "Checked" << "," << "Comments" << endl;
+		WellTrends trends(options.trend_window, options.trend_every);
+		ofstream trends_out;
+		bool trending = !options.trends_path.empty();
+		if (trending && !open_trends(options.trends_path, trends_out)) {
+			cout << "ERROR: cannot write the trends to " << options.trends_path << endl;
+			trending = false;
 		}
-
-		vector<PumpStateReport> states;
-		//ofstream reportfile = prepare_report("pump_report");
-		for (int i = 0; i < listOfCSVFiles.size(); i++) {
-			string name = listOfCSVFiles[i];
-			string state = get_pump_state(name, min_acceptable_peak_weight);
-			PumpStateReport psr;
-			psr.file_name = name;
-			psr.pump_state = state;
-			psr.checked = "";
-			psr.comments = "";
-			states.push_back(psr);
+		PipelineStats stats = classify_files(listOfCSVFiles, min_acceptable_peak_weight, options, n_workers,
+			options.cache_path.empty() ? nullptr : &cache, [&](const ReadCardFile& file) {
+			report << file.rows;
+			cout << file.line << endl;
+			if (trending) add_to_trends(file, trends, trends_out);
+		});
+		report.close();
+		if (trending) trends.write_final(trends_out);
+		if (options.stages) report_stages(stats);
+		if (!options.cache_path.empty()) {
+			bool saved = cache.save();
+			cout << "cache: " << cache.hits() << " hits, " << cache.misses() << " misses";
+			if (cache.invalidated() > 0) cout << ", " << cache.invalidated() << " entries dropped for a changed classifier";
+			if (cache.evicted() > 0) cout << ", " << cache.evicted() << " old entries evicted";
+			cout << endl;
+			if (!saved) cout << "ERROR: cannot write the cache to " << options.cache_path << endl;
 		}
-
-		report_pump_states(prepare_report("pump_report"), states);
 	}
 	else {
-		string state = get_pump_state(fname, min_acceptable_peak_weight);
-		report_pump_state(prepare_report("pump_report"), fname, state, "", "");
+		string state = get_pump_state(fname, min_acceptable_peak_weight, options.corner_method, options.resample_points);
+		if (!state.empty()) report_pump_state(prepare_report("pump_report"), fname, state, "", "");
 		//cout << state << endl;
 	}
 	return;
 }
 
+#ifdef __linux__
+/*
+Classify every card file finished in directory from now on, as
+classify_files does, appending its rows to today's report as soon as it is
+done.  A file that cannot be read or parsed gets an ERROR line instead,
+and the watch goes on.
+Runs until killed.
+*/
+void watch_directory(string directory, double min_acceptable_peak_weight, const AnalysisOptions& options) {
+	namespace fs = std::experimental::filesystem;
+
+	DirectoryWatch watch;
+	if (!watch.open(directory)) {
+		cout << "ERROR: cannot watch " << directory << endl;
+		return;
+	}
+	uint64_t config = analysis_config(min_acceptable_peak_weight, options);
+	Card card;
+	ReadCardFile file;
+	string fname, report_file_name;
+	ofstream report;
+	WellTrends trends(options.trend_window, options.trend_every);
+	ofstream trends_out;
+	bool trending = !options.trends_path.empty();
+	if (trending && !open_trends(options.trends_path, trends_out)) {
+		cout << "ERROR: cannot write the trends to " << options.trends_path << endl;
+		trending = false;
+	}
+	while (watch.next(fname)) {
+		string name = fs::path(fname).filename().string();
+		string extension = fs::path(fname).extension().string();
+		// Our own report may well be written to the same directory
+		if ((extension != ".csv" && extension != ".card") || name[0] == '.' || name.compare(0, 12, "pump_report_") == 0) continue;
+		// One bad file must not stop the watch: anything read_card_file and analyse_read_file let through is its line
+		try {
+			read_card_file(fname, options, config, nullptr, file);
+			analyse_read_file(file, min_acceptable_peak_weight, options, config, nullptr, card);
+		}
+		catch (const exception& e) {
+			file.mapped.close();
+			file.rows.clear();
+			file.line = file.error = "ERROR: " + fname + ": " + e.what();
+		}
+		// A new report every day, as for the batch runs, appended to if it exists
+		if (report_name("pump_report") != report_file_name) {
+			report_file_name = report_name("pump_report");
+			std::error_code ec;
+			bool fresh = !fs::exists(report_file_name) || fs::file_size(report_file_name, ec) == 0;
+			report.close();
+			report.open(report_file_name, ios::app);
+			if (fresh) report << "File Name" << "," << "Pump State" << "," << "Checked" << "," << "Comments" << endl;
+		}
+		report << file.rows << flush;
+		cout << file.line << endl;
+		if (trending) {
+			add_to_trends(file, trends, trends_out);
+			trends_out << flush;
+		}
+	}
+	cout << "ERROR: stopped watching " << directory << endl;
+}
+#endif
+
+/*
+Classify the rows of a card arriving on standard input, a sensor piped in
+say, printing every stroke's state the moment the stroke closes rather
+than once the input ends.  '#' and column header lines are skipped, as in
+a card file.
+*/
+void classify_stream(double min_acceptable_peak_weight, const AnalysisOptions& options) {
+	StreamClassifier stream(min_acceptable_peak_weight, options.corner_method);
+	stream.classify_stroke = [&](Card& card, EdgeFit fits[4]) {
+		resample(card, options.resample_points);
+		return classify(card, min_acceptable_peak_weight, options.corner_method, fits);
+	};
+	string line;
+	size_t line_number = 0;
+	while (getline(cin, line)) {
+		line_number++;
+		try {
+			for_each_card_row(line.data(), line.data() + line.size(), [&](double pos, double x, double y) {
+				if (!stream.add_sample(pos, x, y)) return;
+				cout << "stroke " << stream.n_strokes() << " rows " << stream.stroke.first << "-" << stream.stroke.end - 1
+					<< ": " << stream.stroke.state << endl;
+			});
+		}
+		catch (...) {
+			cout << "ERROR: line " << line_number << " is not a position,length,weight row" << endl;
+		}
+	}
+}
+
 int main(int argc, char *argv[]) {
 	// bug fix
-	if (argc != 3) {
-		cout << "Usage: PumpState path_to_pump.csv min_weight" << endl;
+	AnalysisOptions options;
+	bool watch = false, stream = false;
+	bool args_ok = (argc >= 3);
+	for (int i = 3; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "--strokes") options.per_stroke = true;
+		else if (arg == "--corners=optimal") options.corner_method = OPTIMAL_CORNERS;
+		else if (arg == "--corners=heuristic") options.corner_method = HEURISTIC_CORNERS;
+		else if (arg.compare(0, 10, "--workers=") == 0) options.n_workers = atoi(arg.c_str() + 10);
+		else if (arg.compare(0, 10, "--readers=") == 0) options.n_readers = atoi(arg.c_str() + 10);
+		else if (arg == "--stages") options.stages = true;
+		else if (arg == "--recursive") options.recursive = true;
+		else if (arg == "--scaling") options.scaling = true;
+		else if (arg.compare(0, 8, "--cache=") == 0) options.cache_path = arg.substr(8);
+		else if (arg == "--watch") watch = true;
+		else if (arg.compare(0, 10, "--metrics=") == 0) options.metrics_path = arg.substr(10);
+		else if (arg.compare(0, 8, "--trace=") == 0) options.trace_path = arg.substr(8);
+		else if (arg.compare(0, 14, "--trace-every=") == 0) options.trace_every = strtoull(arg.c_str() + 14, nullptr, 10);
+		else if (arg.compare(0, 15, "--trace-slower=") == 0) options.trace_slower = atof(arg.c_str() + 15);
+		else if (arg.compare(0, 11, "--resample=") == 0) options.resample_points = strtoull(arg.c_str() + 11, nullptr, 10);
+		else if (arg.compare(0, 6, "--knn=") == 0) options.knn_path = arg.substr(6);
+		else if (arg.compare(0, 9, "--trends=") == 0) options.trends_path = arg.substr(9);
+		else if (arg.compare(0, 15, "--trend-window=") == 0) options.trend_window = atof(arg.c_str() + 15);
+		else if (arg.compare(0, 14, "--trend-every=") == 0) options.trend_every = atof(arg.c_str() + 14);
+		else if (arg == "--stream") stream = true;
+		else args_ok = false;
+	}
+	if (watch && (options.scaling || options.recursive || !options.cache_path.empty() || options.stages)) args_ok = false;
+	if (stream && (watch || options.scaling || options.recursive || !options.cache_path.empty() || options.stages
+		|| string(argv[1]) != "-")) args_ok = false;
+	// The scaling runs classify every card several times over, which the metrics and the trace would count
+	if (options.scaling && (!options.metrics_path.empty() || !options.trace_path.empty())) args_ok = false;
+	// The cache keeps no measures to follow the trends of
+	if (!options.trends_path.empty() && (stream || !options.cache_path.empty())) args_ok = false;
+	if (!args_ok || options.n_workers < 0 || options.n_readers < 1 || options.trend_window <= 0 || options.trend_every < 1) {
+		cout << "Usage: PumpState path_to_pump.csv|path_to_pump.card|directory min_weight [--strokes] [--corners=heuristic|optimal]" << endl
+			<< "                 [--resample=points] [--knn=library.knn] [--workers=N] [--readers=N] [--stages] [--recursive]" << endl
+			<< "                 [--scaling] [--cache=file] [--trends=file.csv [--trend-window=s] [--trend-every=s]]" << endl
+			<< "                 [--metrics=prefix] [--trace=file.json [--trace-every=N] [--trace-slower=us]]" << endl
+			<< "       PumpState directory min_weight --watch [--strokes] [--corners=heuristic|optimal] [--resample=points]" << endl
+			<< "                 [--knn=library.knn] [--trends=file.csv [--trend-window=s] [--trend-every=s]] [--metrics=prefix]" << endl
+			<< "                 [--trace=file.json [--trace-every=N] [--trace-slower=us]]" << endl
+			<< "       PumpState - min_weight --stream [--corners=heuristic|optimal] [--resample=points] [--knn=library.knn]" << endl
+			<< "                 [--metrics=prefix]" << endl
+			<< "  --strokes    classify every stroke of a multi-cycle recording" << endl
+			<< "  --corners    place the corners with the x+/-2y heuristic (default) or by" << endl
+			<< "               minimizing the edges' line fit residual" << endl
+			<< "  --resample   resample strokes of more points to about this many, evenly" << endl
+			<< "               spaced along the stroke with the corners kept, before" << endl
+			<< "               classifying them" << endl
+			<< "  --knn        classify by the nearest cards of a reference library made by" << endl
+			<< "               knn_library, instead of by the edge rules" << endl
+			<< "  --workers    classify on N threads, 0 for one per core (default 1); the" << endl
+			<< "               report is the same for any N" << endl
+			<< "  --readers    read and parse files ahead of the classifying on N threads" << endl
+			<< "               (default 1)" << endl
+			<< "  --stages     print how much of the time reading, classifying and writing" << endl
+			<< "               the report were busy, waiting for work and waiting on the" << endl
+			<< "               stage after them, for sizing --readers and --workers" << endl
+			<< "  --recursive  also analyse the card files in subdirectories" << endl
+			<< "  --scaling    first print files/s on 1, 2, 4 .. N threads; not with" << endl
+			<< "               --metrics or --trace" << endl
+			<< "  --cache      keep the results in file and only classify the card files" << endl
+			<< "               whose contents are not in it yet" << endl
+			<< "  --trends     append a summary of every well's strokes over the last" << endl
+			<< "               --trend-window seconds (3600) to file.csv every --trend-every" << endl
+			<< "               seconds (300) of the cards' timestamps: the share of every" << endl
+			<< "               state and the median area and distance from the shape, and how" << endl
+			<< "               far those medians are from the well's medians over the run" << endl
+			<< "  --watch      classify card files as they are written to directory, adding" << endl
+			<< "               them to today's report, until killed (Linux only)" << endl
+			<< "  --stream     classify the card rows arriving on standard input, printing" << endl
+			<< "               every stroke's state as soon as it closes" << endl
+			<< "  --metrics    write per-stage latencies and counters to prefix.json and" << endl
+			<< "               prefix.prom every " << METRICS_EXPORT_INTERVAL << " s and at the end (builds with" << endl
+			<< "               -DDYNACARD_METRICS only)" << endl
+			<< "  --trace      write a Chrome trace (chrome://tracing, ui.perfetto.dev) of the" << endl
+			<< "               calls inside every card, or of one card in every N and of every" << endl
+			<< "               card slower than the given microseconds" << endl;
 		return -1;
 	}
 	// get filename and minimum weight from command line
@@ -539,12 +725,65 @@ int main(int argc, char *argv[]) {
 	string fname(argv[1]);
 	// Read in the file
 
-	run_analysis(fname, min_acceptable_peak_weight);
+	ReferenceLibrary library;
+	if (!options.knn_path.empty()) {
+		MappedFile library_file;
+		if (!library.load(options.knn_path) || !library_file.open(options.knn_path)) {
+			cout << "ERROR: " << options.knn_path << " is not a reference library this version reads" << endl;
+			return -1;
+		}
+		// The library and how many neighbours vote decide the states
+		options.knn_hash = content_hash(&KNN_NEIGHBOURS, sizeof(KNN_NEIGHBOURS), content_hash(library_file.data, library_file.size));
+		knn_library = &library;
+	}
+
+	MetricsExporter exporter;
+	if (!options.metrics_path.empty() && !exporter.start(options.metrics_path)) {
+#ifdef DYNACARD_METRICS
+		cout << "ERROR: cannot write metrics to " << options.metrics_path << ".json" << endl;
+#else
+		cout << "ERROR: --metrics needs a build with DYNACARD_METRICS defined" << endl;
+#endif
+	}
+	if (!options.trace_path.empty() && !trace_writer().open(options.trace_path, options.trace_every, options.trace_slower)) {
+		cout << "ERROR: cannot write the trace to " << options.trace_path << endl;
+	}
+	if (stream) {
+		classify_stream(min_acceptable_peak_weight, options);
+		return 0;
+	}
+	if (watch) {
+#ifdef __linux__
+		watch_directory(fname, min_acceptable_peak_weight, options);
+#else
+		cout << "ERROR: --watch needs inotify, which only Linux has" << endl;
+#endif
+		return 0;
+	}
+	run_analysis(fname, min_acceptable_peak_weight, options);
+	if (trace_writer().enabled()) {
+		cout << "trace: " << trace_writer().written() << " cards written to " << options.trace_path << endl;
+		trace_writer().close();
+	}
 
 	return 0;
 }
 
 /*
-g++ classify_pump_state.cpp
+g++ classify_pump_state.cpp -lstdc++fs -pthread
 ./a.out example_data/flowing_well.csv 60.0
-*/
\ No newline at end of file
+./a.out ../CPlusDeliverable/sent_to_onica/TestA2_comb.csv 10.0 --strokes
+./a.out example_data 60.0 --corners=optimal
+./a.out ../CPlusDeliverable/sent_to_onica 60.0 --strokes --resample=128
+./a.out ../CPlusDeliverable/sent_to_onica 60.0 --strokes --knn=../DynaCardTools/reference.knn
+./a.out ../CPlusDeliverable/sent_to_onica 60.0 --strokes --workers=0 --scaling
+./a.out archive 60.0 --recursive --readers=2 --workers=0 --stages
+./a.out example_data 60.0 --cache=example_data.cache
+./a.out ../CPlusDeliverable/sent_to_onica 10.0 --strokes --trends=well_trends.csv --trend-every=60
+./a.out /var/spool/dynacard 60.0 --watch
+./a.out /var/spool/dynacard 60.0 --watch --strokes --trends=/var/lib/dynacard/well_trends.csv
+tail -f -n +1 /var/spool/dynacard/well_17.csv | ./a.out - 10.0 --stream
+g++ -DDYNACARD_METRICS classify_pump_state.cpp -lstdc++fs -pthread
+./a.out example_data 60.0 --metrics=dynacard_metrics
+./a.out ../CPlusDeliverable/sent_to_onica 60.0 --workers=0 --trace=cards.json --trace-every=100 --trace-slower=500
+*/
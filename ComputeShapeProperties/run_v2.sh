@@ -1,6 +1,6 @@
 
 # Compile the program
-g++ compute_shape_properties.cpp;
+g++ compute_shape_properties.cpp ../libdynacard/dynacard.cpp -pthread;
 
 # Run the program and pipe its output to a python script that parses the JSON
 ./a.out gas_interference.csv | python -c "
@@ -0,0 +1,174 @@
+/*
+Cards/s of libdynacard called three ways over the same cards, packed one
+after another into one set of columns as a fleet-wide re-diagnosis would
+hold them:
+
+  context per card     dynacard_create, dynacard_classify, dynacard_destroy
+                       for every card, as an embedder that keeps nothing does
+  one context          dynacard_classify for every card on one context
+  batch                dynacard_classify_batch, batch cards at a time
+
+The cards are synthetic (DynaCardCommon/card_generator.h), every state in
+turn, so the branches of the classifier see what a fleet gives them.  The
+three must agree on every card.
+
+Usage:
+  batch_benchmark [-n cards] [-s samples] [-b batch] [--shape]
+
+  -n cards     of every state (2000)
+  -s samples   per card (200)
+  -b batch     cards per dynacard_classify_batch call, 0 for all (0)
+  --shape      measure the shape properties too, not only classify
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card_generator.h"
+#include "../libdynacard/dynacard.h"
+
+using namespace std;
+
+struct PackedCards {
+	vector<double> position, length, weight;
+	vector<uint64_t> offsets;  // card i is [offsets[i], offsets[i + 1])
+	size_t size() const {
+		return offsets.size() - 1;
+	}
+};
+
+// n_cards of every state, the states taking turns
+PackedCards make_cards(uint64_t n_cards, const GeneratorSettings& settings) {
+	PackedCards cards;
+	cards.offsets.push_back(0);
+	vector<CardGenerator> generators;
+	for (int t = 0; t < N_CARD_TEMPLATES; t++) generators.push_back(CardGenerator(t + 1, settings));
+	CardColumns cols;
+	for (uint64_t card = 0; card < n_cards; card++) {
+		for (int t = 0; t < N_CARD_TEMPLATES; t++) {
+			cols.position.clear();
+			cols.length.clear();
+			cols.weight.clear();
+			generators[t].generate(CARD_TEMPLATES[t], card, cols);
+			cards.position.insert(cards.position.end(), cols.position.begin(), cols.position.end());
+			cards.length.insert(cards.length.end(), cols.length.begin(), cols.length.end());
+			cards.weight.insert(cards.weight.end(), cols.weight.begin(), cols.weight.end());
+			cards.offsets.push_back(cards.position.size());
+		}
+	}
+	return cards;
+}
+
+double seconds_since(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double context_per_card(const PackedCards& cards, const dynacard_options& options, vector<dynacard_result>& results) {
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < cards.size(); i++) {
+		uint64_t first = cards.offsets[i];
+		dynacard_context* ctx = dynacard_create();
+		dynacard_classify(ctx, &cards.position[first], &cards.length[first], &cards.weight[first],
+			cards.offsets[i + 1] - first, &options, &results[i]);
+		dynacard_destroy(ctx);
+	}
+	return seconds_since(start);
+}
+
+double one_context(const PackedCards& cards, const dynacard_options& options, vector<dynacard_result>& results) {
+	auto start = chrono::steady_clock::now();
+	dynacard_context* ctx = dynacard_create();
+	for (size_t i = 0; i < cards.size(); i++) {
+		uint64_t first = cards.offsets[i];
+		dynacard_classify(ctx, &cards.position[first], &cards.length[first], &cards.weight[first],
+			cards.offsets[i + 1] - first, &options, &results[i]);
+	}
+	dynacard_destroy(ctx);
+	return seconds_since(start);
+}
+
+double batch(const PackedCards& cards, const dynacard_options& options, size_t batch_size, vector<dynacard_result>& results) {
+	auto start = chrono::steady_clock::now();
+	dynacard_context* ctx = dynacard_create();
+	for (size_t first = 0; first < cards.size(); first += batch_size) {
+		size_t n = min(batch_size, cards.size() - first);
+		dynacard_classify_batch(ctx, cards.position.data(), cards.length.data(), cards.weight.data(),
+			&cards.offsets[first], n, &options, &results[first], nullptr);
+	}
+	dynacard_destroy(ctx);
+	return seconds_since(start);
+}
+
+// The number of cards on which two runs differ, NaN equal to NaN
+size_t n_disagreeing(const vector<dynacard_result>& a, const vector<dynacard_result>& b) {
+	size_t n = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		bool same = strcmp(a[i].state, b[i].state) == 0
+			&& (a[i].area == b[i].area || (a[i].area != a[i].area && b[i].area != b[i].area));
+		if (!same) n++;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n_cards = 2000;
+	size_t batch_size = 0;
+	GeneratorSettings settings;
+	dynacard_options options;
+	dynacard_default_options(&options);
+	options.what = DYNACARD_CLASSIFY;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc) n_cards = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && i + 1 < argc) settings.n_samples = atoi(argv[++i]);
+		else if (arg == "-b" && i + 1 < argc) batch_size = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--shape") options.what = DYNACARD_CLASSIFY | DYNACARD_SHAPE_PROPERTIES;
+		else {
+			cout << "Usage: batch_benchmark [-n cards] [-s samples] [-b batch] [--shape]" << endl;
+			return -1;
+		}
+	}
+	if (n_cards == 0 || settings.n_samples < 4) {
+		cout << "ERROR: need at least one card of 4 samples" << endl;
+		return -1;
+	}
+
+	PackedCards cards = make_cards(n_cards, settings);
+	if (batch_size == 0) batch_size = cards.size();
+	cout << cards.size() << " cards of " << settings.n_samples << " samples, "
+		<< cards.position.size() * 3 * sizeof(double) / (1 << 20) << " MB" << endl;
+
+	dynacard_result empty;
+	memset(&empty, 0, sizeof(empty));
+	empty.struct_size = sizeof(empty);
+	vector<dynacard_result> per_card(cards.size(), empty), reused(cards.size(), empty), batched(cards.size(), empty);
+	// Warm up the page tables and the allocator, then time each way
+	one_context(cards, options, reused);
+	double seconds[3];
+	seconds[0] = context_per_card(cards, options, per_card);
+	seconds[1] = one_context(cards, options, reused);
+	seconds[2] = batch(cards, options, batch_size, batched);
+	const char* names[3] = { "context per card", "one context", "batch" };
+	for (int m = 0; m < 3; m++) {
+		cout << left << setw(18) << names[m] << right << fixed << setprecision(0) << setw(10) << cards.size() / seconds[m] << " cards/s"
+			<< setprecision(2) << setw(8) << seconds[0] / seconds[m] << "x" << endl;
+	}
+	size_t n_wrong = n_disagreeing(per_card, batched) + n_disagreeing(reused, batched);
+	if (n_wrong > 0) {
+		cout << "ERROR: the results differ on " << n_wrong << " cards" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+g++ -O2 -std=c++17 batch_benchmark.cpp ../libdynacard/dynacard.cpp -o batch_benchmark
+./batch_benchmark -n 2000
+./batch_benchmark -n 2000 -b 64 --shape
+*/
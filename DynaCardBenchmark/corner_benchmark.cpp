@@ -0,0 +1,127 @@
+/*
+What the corner search (DynaCardCommon/corner_search.h) costs against the
+x+/-2y heuristic.
+
+Every stroke StrokeSegmenter finds in the files on the command line is
+classified with both corner methods; a file without strokes (most of the
+example cards) counts as a single stroke.  For each file this prints the time
+per stroke of finding the corners either way, the total edge residual each
+leaves, and how many strokes get the same pump state.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+#include "../DynaCardCommon/pump_state.h"
+
+using namespace std;
+
+struct CornerStats {
+	int n_strokes = 0;
+	int n_agree = 0;
+	double heuristic_secs = 0, optimal_secs = 0;
+	double heuristic_residual = 0, optimal_residual = 0;
+};
+
+double residual_of(const CumulativeSums& sums, const Corners& c) {
+	int corners[4] = { c.lower_left, c.upper_left, c.upper_right, c.lower_right };
+	return corners_residual(sums, corners);
+}
+
+// Time find_corners over repeat runs, returning the seconds taken and the corners found
+double time_corners(const CumulativeSums& sums, CornerMethod method, int repeat, Corners& found) {
+	auto start = chrono::steady_clock::now();
+	for (int r = 0; r < repeat; r++) found = find_corners(sums, method);
+	auto stop = chrono::steady_clock::now();
+	return chrono::duration<double>(stop - start).count();
+}
+
+void compare_stroke(const vector<double>& position, const vector<double>& raw_xs, const vector<double>& raw_ys,
+	double min_acceptable_peak_weight, int repeat, CornerStats& stats) {
+	if (raw_xs.size() < 4) return;
+	vector<double> xs = normalize(raw_xs);
+	vector<double> ys = normalize(raw_ys);
+	CumulativeSums sums(xs, ys);
+	Corners heuristic, optimal;
+	stats.heuristic_secs += time_corners(sums, HEURISTIC_CORNERS, repeat, heuristic) / repeat;
+	stats.optimal_secs += time_corners(sums, OPTIMAL_CORNERS, repeat, optimal) / repeat;
+	stats.heuristic_residual += residual_of(sums, heuristic);
+	stats.optimal_residual += residual_of(sums, optimal);
+	string heuristic_state = classify_cycle(position, raw_xs, raw_ys, min_acceptable_peak_weight, HEURISTIC_CORNERS);
+	string optimal_state = classify_cycle(position, raw_xs, raw_ys, min_acceptable_peak_weight, OPTIMAL_CORNERS);
+	if (heuristic_state == optimal_state) stats.n_agree++;
+	stats.n_strokes++;
+}
+
+int main(int argc, char *argv[]) {
+	int repeat = 20;
+	double min_acceptable_peak_weight = 60.0;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc) repeat = atoi(argv[++i]);
+		else if (arg == "-w" && i + 1 < argc) min_acceptable_peak_weight = atof(argv[++i]);
+		else fnames.push_back(arg);
+	}
+	if (fnames.empty() || repeat < 1) {
+		cout << "Usage: corner_benchmark [-n repeat] [-w min_weight] file.csv [file.csv ...]" << endl;
+		return -1;
+	}
+
+	cout << left << setw(40) << "file" << right
+		<< setw(8) << "strokes"
+		<< setw(14) << "heuristic us"
+		<< setw(12) << "optimal us"
+		<< setw(10) << "cost"
+		<< setw(12) << "resid h"
+		<< setw(12) << "resid opt"
+		<< setw(8) << "agree" << endl;
+	CornerStats all;
+	for (size_t i = 0; i < fnames.size(); i++) {
+		CardColumns cols;
+		if (!parse_card_file(fnames[i], cols)) {
+			cout << "ERROR: cannot open " << fnames[i] << endl;
+			continue;
+		}
+		CornerStats stats;
+		StrokeSegmenter strokes;
+		for (size_t k = 0; k < cols.size(); k++) {
+			if (strokes.add_sample(cols.position[k], cols.length[k], cols.weight[k])) {
+				compare_stroke(strokes.position, strokes.length, strokes.weight, min_acceptable_peak_weight, repeat, stats);
+			}
+		}
+		if (strokes.n_strokes == 0) {
+			compare_stroke(cols.position, cols.length, cols.weight, min_acceptable_peak_weight, repeat, stats);
+		}
+		if (stats.n_strokes == 0) continue;
+		cout << left << setw(40) << fnames[i] << right << fixed
+			<< setw(8) << stats.n_strokes
+			<< setw(14) << setprecision(2) << 1e6 * stats.heuristic_secs / stats.n_strokes
+			<< setw(12) << setprecision(2) << 1e6 * stats.optimal_secs / stats.n_strokes
+			<< setw(9) << setprecision(1) << stats.optimal_secs / stats.heuristic_secs << "x"
+			<< setw(12) << setprecision(5) << stats.heuristic_residual / stats.n_strokes
+			<< setw(12) << setprecision(5) << stats.optimal_residual / stats.n_strokes
+			<< setw(5) << stats.n_agree << "/" << stats.n_strokes << endl;
+		all.n_strokes += stats.n_strokes;
+		all.n_agree += stats.n_agree;
+		all.heuristic_secs += stats.heuristic_secs;
+		all.optimal_secs += stats.optimal_secs;
+	}
+	if (all.n_strokes > 0) {
+		cout << all.n_strokes << " strokes: heuristic " << setprecision(2) << 1e6 * all.heuristic_secs / all.n_strokes
+			<< " us, optimal " << 1e6 * all.optimal_secs / all.n_strokes << " us per stroke, "
+			<< all.n_agree << " agree" << endl;
+	}
+	return 0;
+}
+
+/*
+g++ -O2 -std=c++17 corner_benchmark.cpp
+./a.out ../CPlusDynaCard/example_data/bent_barrel_5degree_left.csv ../CPlusDeliverable/sent_to_onica/TestA2_comb.csv
+*/
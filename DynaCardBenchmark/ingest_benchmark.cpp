@@ -0,0 +1,302 @@
+/*
+Multi-well ingest (DynaCardCommon/well_ingest.h): strokes/s and samples/s
+as the number of wells a gateway serves grows, with the same total work
+spread over more and more wells.
+
+Each well streams a recording of several strokes of one state, synthetic
+(DynaCardCommon/card_generator.h) unless card files are given.  Its reader
+thread feeds its wells in turn, -b samples of one well at a time, as
+samples arriving from many sensors interleave.  Every well's strokes must
+reach on_result numbered 0, 1, 2 .. in order, with the states a
+StreamClassifier gives the well's recording on its own.  Printed next to
+each run: the strokes/s of one thread feeding every well to a
+StreamClassifier of its own, with no queues, and the strokes the readers
+had to hold back because a classifier's queue was full.
+
+Card files are streamed as wells keyed by the Well ID Number of their
+headers; files of the same well one after the other, in the order given.
+
+Usage:
+  ingest_benchmark [-w wells,wells,..] [-k strokes] [-r readers] [-c classifiers]
+                   [-q queue] [-b samples] [-s samples] [file.csv ...]
+
+  -w wells       the well counts to run (1,10,100,1000,4000)
+  -k strokes     over all wells, per run (8000)
+  -r readers     reader threads (2)
+  -c classifiers classifier threads, 0 for one per hardware thread (0)
+  -q queue       strokes a reader can queue for each classifier (64)
+  -b samples     of a well fed at a time (20)
+  -s samples     per synthetic stroke (200)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card_header.h"
+#include "../DynaCardCommon/card_generator.h"
+#include "../DynaCardCommon/stream_classifier.h"
+#include "../DynaCardCommon/well_ingest.h"
+
+using namespace std;
+
+const double MIN_ACCEPTABLE_PEAK_WEIGHT = 60;
+// Different recordings of every state, shared by the wells when there are more of them
+const int RECORDINGS_PER_STATE = 4;
+
+double seconds_since(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// A recording and the states of its strokes, classified on their own
+struct Recording {
+	CardColumns samples;
+	vector<const char*> states;
+};
+
+struct Well {
+	string id;
+	const Recording* recording;
+};
+
+struct BenchmarkOptions {
+	IngestOptions ingest;
+	size_t chunk = 20;
+};
+
+void classify_recording(Recording& recording) {
+	StreamClassifier stream(MIN_ACCEPTABLE_PEAK_WEIGHT);
+	const CardColumns& cols = recording.samples;
+	recording.states.clear();
+	stream.add_samples(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size(),
+		[&](const StreamStroke& stroke) { recording.states.push_back(stroke.state); });
+}
+
+// n_strokes strokes of the template, one after the other
+void generate_recording(CardGenerator& generator, const CardTemplate& shape, uint64_t first_card, size_t n_strokes, Recording& recording) {
+	CardColumns& cols = recording.samples;
+	cols.clear();
+	for (size_t k = 0; k < n_strokes; k++) {
+		size_t first = cols.size();
+		generator.generate(shape, first_card + k, cols);
+		for (size_t i = first; i < cols.size(); i++) cols.position[i] += 360.0 * k;
+	}
+	classify_recording(recording);
+}
+
+// Feed the wells to a StreamClassifier each on one thread, in the same turns as the readers do; returns the seconds taken
+double run_unqueued(const vector<Well>& wells, size_t chunk) {
+	vector<unique_ptr<StreamClassifier> > streams;
+	for (size_t w = 0; w < wells.size(); w++) streams.push_back(unique_ptr<StreamClassifier>(new StreamClassifier(MIN_ACCEPTABLE_PEAK_WEIGHT)));
+	size_t n_strokes = 0;
+	auto count = [&](const StreamStroke&) { n_strokes++; };
+	auto start = chrono::steady_clock::now();
+	for (size_t offset = 0, n_left = wells.size(); n_left > 0; offset += chunk) {
+		n_left = 0;
+		for (size_t w = 0; w < wells.size(); w++) {
+			const CardColumns& cols = wells[w].recording->samples;
+			if (offset >= cols.size()) continue;
+			size_t n = min(chunk, cols.size() - offset);
+			streams[w]->add_samples(cols.position.data() + offset, cols.length.data() + offset, cols.weight.data() + offset, n, count);
+			n_left++;
+		}
+	}
+	return seconds_since(start);
+}
+
+struct IngestRun {
+	double seconds;
+	uint64_t n_samples, n_strokes, n_stalls;
+	size_t n_wrong;             // wells whose strokes came out of order or with other states
+	uint64_t most_classified, least_classified;
+};
+
+// Ingest every well, checking the order and states of its strokes as they come out
+IngestRun run_ingest(const vector<Well>& wells, const BenchmarkOptions& options) {
+	unordered_map<string, size_t> well_index;
+	for (size_t w = 0; w < wells.size(); w++) well_index[wells[w].id] = w;
+	// Each well is only ever touched by the classifier thread it belongs to
+	vector<uint64_t> next_sequence(wells.size(), 0);
+	vector<char> wrong(wells.size(), 0);
+	IngestRun run;
+	auto start = chrono::steady_clock::now();
+	WellIngest ingest(options.ingest, [&](const IngestedStroke& stroke) {
+		size_t w = well_index.find(*stroke.well_id)->second;
+		const vector<const char*>& states = wells[w].recording->states;
+		if (stroke.sequence != next_sequence[w] || stroke.sequence >= states.size()
+			|| strcmp(stroke.state, states[stroke.sequence]) != 0) wrong[w] = 1;
+		next_sequence[w] = stroke.sequence + 1;
+	});
+	vector<thread> readers;
+	for (int r = 0; r < ingest.n_readers(); r++) {
+		readers.push_back(thread([&, r] {
+			WellIngest::Reader& reader = ingest.reader(r);
+			vector<size_t> mine;
+			vector<uint32_t> index;
+			for (size_t w = 0; w < wells.size(); w++) {
+				if (ingest.reader_for(wells[w].id) != r) continue;
+				mine.push_back(w);
+				index.push_back(reader.well(wells[w].id));
+			}
+			for (size_t offset = 0, n_left = mine.size(); n_left > 0; offset += options.chunk) {
+				n_left = 0;
+				for (size_t m = 0; m < mine.size(); m++) {
+					const CardColumns& cols = wells[mine[m]].recording->samples;
+					if (offset >= cols.size()) continue;
+					size_t n = min(options.chunk, cols.size() - offset);
+					reader.add_samples(index[m], cols.position.data() + offset, cols.length.data() + offset, cols.weight.data() + offset, n);
+					n_left++;
+				}
+			}
+		}));
+	}
+	for (size_t r = 0; r < readers.size(); r++) readers[r].join();
+	ingest.finish();
+	run.seconds = seconds_since(start);
+
+	run.n_samples = run.n_strokes = run.n_stalls = 0;
+	for (int r = 0; r < ingest.n_readers(); r++) {
+		run.n_samples += ingest.reader(r).n_samples;
+		run.n_strokes += ingest.reader(r).n_strokes;
+		run.n_stalls += ingest.reader(r).n_stalls;
+	}
+	run.most_classified = 0;
+	run.least_classified = UINT64_MAX;
+	for (int c = 0; c < ingest.n_classifiers(); c++) {
+		run.most_classified = max(run.most_classified, ingest.classified_by(c));
+		run.least_classified = min(run.least_classified, ingest.classified_by(c));
+	}
+	run.n_wrong = 0;
+	for (size_t w = 0; w < wells.size(); w++) {
+		if (wrong[w] || next_sequence[w] != wells[w].recording->states.size()) run.n_wrong++;
+	}
+	return run;
+}
+
+void print_heading() {
+	cout << right << setw(8) << "wells" << setw(9) << "strokes" << setw(13) << "strokes/s" << setw(12) << "Msamples/s"
+		<< setw(14) << "one thread" << setw(8) << "stalls" << setw(16) << "per classifier" << setw(7) << "order" << endl;
+}
+
+void print_run(size_t n_wells, const IngestRun& run, double unqueued_seconds) {
+	cout << right << setw(8) << n_wells << setw(9) << run.n_strokes << fixed << setprecision(0)
+		<< setw(13) << run.n_strokes / run.seconds << setw(12) << setprecision(2) << run.n_samples / run.seconds / 1e6
+		<< setw(14) << setprecision(0) << run.n_strokes / unqueued_seconds << setw(8) << run.n_stalls
+		<< setw(8) << run.least_classified << "-" << left << setw(7) << run.most_classified << right
+		<< setw(7) << (run.n_wrong == 0 ? "ok" : "WRONG") << endl;
+}
+
+vector<size_t> parse_counts(const string& text) {
+	vector<size_t> counts;
+	for (size_t i = 0; i < text.size(); ) {
+		size_t comma = text.find(',', i);
+		if (comma == string::npos) comma = text.size();
+		counts.push_back(strtoull(text.substr(i, comma - i).c_str(), nullptr, 10));
+		i = comma + 1;
+	}
+	return counts;
+}
+
+int main(int argc, char *argv[]) {
+	BenchmarkOptions options;
+	options.ingest.n_readers = 2;
+	options.ingest.min_acceptable_peak_weight = MIN_ACCEPTABLE_PEAK_WEIGHT;
+	vector<size_t> well_counts = parse_counts("1,10,100,1000,4000");
+	size_t total_strokes = 8000;
+	GeneratorSettings settings;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-w" && i + 1 < argc) well_counts = parse_counts(argv[++i]);
+		else if (arg == "-k" && i + 1 < argc) total_strokes = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-r" && i + 1 < argc) options.ingest.n_readers = atoi(argv[++i]);
+		else if (arg == "-c" && i + 1 < argc) options.ingest.n_classifiers = atoi(argv[++i]);
+		else if (arg == "-q" && i + 1 < argc) options.ingest.queue_strokes = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-b" && i + 1 < argc) options.chunk = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && i + 1 < argc) settings.n_samples = atoi(argv[++i]);
+		else if (arg[0] == '-') {
+			cout << "Usage: ingest_benchmark [-w wells,wells,..] [-k strokes] [-r readers] [-c classifiers] [-q queue] [-b samples] [-s samples] [file.csv ...]" << endl;
+			return -1;
+		}
+		else fnames.push_back(arg);
+	}
+	if (total_strokes == 0 || options.ingest.n_readers < 1 || options.ingest.n_classifiers < 0 || options.ingest.queue_strokes == 0
+		|| options.chunk == 0 || settings.n_samples < 4) {
+		cout << "ERROR: need strokes, a reader, a queue and samples to feed" << endl;
+		return -1;
+	}
+	int n_classifiers = options.ingest.n_classifiers == 0 ? default_worker_count() : options.ingest.n_classifiers;
+	cout << options.ingest.n_readers << " readers, " << n_classifiers << " classifiers, queues of "
+		<< options.ingest.queue_strokes << " strokes, " << options.chunk << " samples of a well at a time" << endl;
+	print_heading();
+	int n_failed = 0;
+
+	if (!fnames.empty()) {
+		// A recording per well, its files one after the other
+		map<string, Recording> recordings;
+		vector<Well> wells;
+		for (size_t f = 0; f < fnames.size(); f++) {
+			FileHeader header;
+			CardColumns cols;
+			if (ingest_card_file(fnames[f], header, cols) == 0) {
+				cout << "ERROR: cannot open " << fnames[f] << endl;
+				n_failed++;
+				continue;
+			}
+			string id = well_key(header);
+			CardColumns& samples = recordings[id].samples;
+			samples.position.insert(samples.position.end(), cols.position.begin(), cols.position.end());
+			samples.length.insert(samples.length.end(), cols.length.begin(), cols.length.end());
+			samples.weight.insert(samples.weight.end(), cols.weight.begin(), cols.weight.end());
+		}
+		for (map<string, Recording>::iterator it = recordings.begin(); it != recordings.end(); ++it) {
+			classify_recording(it->second);
+			Well well;
+			well.id = it->first;
+			well.recording = &it->second;
+			wells.push_back(well);
+		}
+		IngestRun run = run_ingest(wells, options);
+		print_run(wells.size(), run, run_unqueued(wells, options.chunk));
+		return run.n_wrong == 0 && n_failed == 0 ? 0 : 1;
+	}
+
+	for (size_t i = 0; i < well_counts.size(); i++) {
+		size_t n_wells = well_counts[i];
+		if (n_wells == 0) continue;
+		size_t strokes_per_well = max<size_t>(2, total_strokes / n_wells);
+		// As many different recordings as there are wells, up to RECORDINGS_PER_STATE of every state
+		size_t n_recordings = min<size_t>(n_wells, N_CARD_TEMPLATES * RECORDINGS_PER_STATE);
+		vector<Recording> recordings(n_recordings);
+		for (size_t k = 0; k < n_recordings; k++) {
+			int t = static_cast<int>(k % N_CARD_TEMPLATES);
+			CardGenerator generator(t + 1, settings);
+			generate_recording(generator, CARD_TEMPLATES[t], (k / N_CARD_TEMPLATES) * strokes_per_well, strokes_per_well, recordings[k]);
+		}
+		vector<Well> wells(n_wells);
+		for (size_t w = 0; w < n_wells; w++) {
+			wells[w].id = "42-477-" + to_string(10000 + w);
+			wells[w].recording = &recordings[w % n_recordings];
+		}
+		IngestRun run = run_ingest(wells, options);
+		print_run(n_wells, run, run_unqueued(wells, options.chunk));
+		if (run.n_wrong > 0) n_failed++;
+	}
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 -pthread ingest_benchmark.cpp -o ingest_benchmark
+./ingest_benchmark -w 1,10,100,1000,4000 -r 2 -c 0
+./ingest_benchmark ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv
+*/
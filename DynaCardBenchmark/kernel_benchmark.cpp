@@ -0,0 +1,96 @@
+/*
+Checks the vector kernels of DynaCardCommon/simd_kernels.h against their
+scalar versions and times both.
+
+For every file on the command line the length and weight columns are
+normalized and their running moment sums built, once with the scalar kernels
+and once with the ones picked for this CPU.  The results must match bit for
+bit; the time per sample of each is printed.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/simd_kernels.h"
+
+using namespace std;
+
+// Normalize both columns and build their running sums, repeat times; returns the seconds taken
+double run_kernels(const SimdKernels& kernels, const CardColumns& cols, int repeat,
+	vector<double>& xs, vector<double>& ys, vector<double>& cum) {
+	size_t n = cols.size();
+	xs.resize(n);
+	ys.resize(n);
+	cum.resize(MOMENT_COUNT * (n + 1));
+	auto start = chrono::steady_clock::now();
+	for (int r = 0; r < repeat; r++) {
+		double min_value, max_value;
+		kernels.min_max(cols.length.data(), n, min_value, max_value);
+		kernels.normalize(cols.length.data(), xs.data(), n, min_value, max_value - min_value);
+		kernels.min_max(cols.weight.data(), n, min_value, max_value);
+		kernels.normalize(cols.weight.data(), ys.data(), n, min_value, max_value - min_value);
+		kernels.running_moments(xs.data(), ys.data(), n, cum.data());
+	}
+	auto stop = chrono::steady_clock::now();
+	return chrono::duration<double>(stop - start).count();
+}
+
+bool same_bits(const vector<double>& a, const vector<double>& b) {
+	return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(double)) == 0;
+}
+
+int main(int argc, char *argv[]) {
+	int repeat = 200;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc) repeat = atoi(argv[++i]);
+		else fnames.push_back(arg);
+	}
+	if (fnames.empty() || repeat < 1) {
+		cout << "Usage: kernel_benchmark [-n repeat] file.csv [file.csv ...]" << endl;
+		return -1;
+	}
+
+	const SimdKernels scalar = scalar_kernels();
+	const SimdKernels& vector_kernels = simd_kernels();
+	cout << left << setw(40) << "file" << right
+		<< setw(10) << "samples"
+		<< setw(12) << "scalar ns"
+		<< setw(12) << vector_kernels.name + string(" ns")
+		<< setw(10) << "speedup"
+		<< setw(8) << "bits" << endl;
+	int mismatches = 0;
+	for (size_t i = 0; i < fnames.size(); i++) {
+		CardColumns cols;
+		if (!parse_card_file(fnames[i], cols)) {
+			cout << "ERROR: cannot open " << fnames[i] << endl;
+			continue;
+		}
+		if (cols.size() == 0) continue;
+		vector<double> scalar_xs, scalar_ys, scalar_cum, vector_xs, vector_ys, vector_cum;
+		double scalar_secs = run_kernels(scalar, cols, repeat, scalar_xs, scalar_ys, scalar_cum);
+		double vector_secs = run_kernels(vector_kernels, cols, repeat, vector_xs, vector_ys, vector_cum);
+		bool same = same_bits(scalar_xs, vector_xs) && same_bits(scalar_ys, vector_ys) && same_bits(scalar_cum, vector_cum);
+		if (!same) mismatches++;
+		double per_sample = 1e9 / (static_cast<double>(repeat) * cols.size());
+		cout << left << setw(40) << fnames[i] << right << fixed
+			<< setw(10) << cols.size()
+			<< setw(12) << setprecision(2) << scalar_secs * per_sample
+			<< setw(12) << setprecision(2) << vector_secs * per_sample
+			<< setw(9) << setprecision(1) << scalar_secs / vector_secs << "x"
+			<< setw(8) << (same ? "same" : "DIFFER") << endl;
+	}
+	return mismatches == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 kernel_benchmark.cpp
+./a.out ../CPlusDynaCard/example_data/full_pump_0.csv ../CPlusDeliverable/sent_to_onica/TestA2_comb.csv
+*/
@@ -0,0 +1,172 @@
+/*
+The nearest neighbour classifier of DynaCardCommon/knn_classifier.h over a
+reference library of synthetic cards (DynaCardCommon/card_generator.h):
+how long the vantage point tree takes to build, us/query through it against
+scanning the whole library, and how often the states come out right, next
+to guess_pump_state on the same cards.
+
+The library holds -n cards of every state but flowing well (which both
+classifiers tell by its load), with the skew and noise varied from card to
+card so the states are clouds rather than points.  The queries are -q more
+cards of every state from further on in the generators, so none of them is
+in the library.  The tree and the scan must find the same neighbours.
+
+Usage:
+  knn_benchmark [-n cards] [-q queries] [-k neighbours] [-s samples] [-o library.knn]
+
+  -n cards       in the library, of every state (10000)
+  -q queries     of every state (200)
+  -k neighbours  voting on a state (5)
+  -s samples     per card (200)
+  -o file        also save the library, for classify_pump_state --knn=file
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card_generator.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/pump_state.h"
+#include "../DynaCardCommon/knn_classifier.h"
+
+using namespace std;
+
+const double MIN_ACCEPTABLE_PEAK_WEIGHT = 60;
+
+double seconds_since(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Card index of the template's generator, varied as generate_varied does
+void generate(CardGenerator& generator, const CardTemplate& shape, uint64_t index, CardColumns& cols) {
+	cols.position.clear();
+	cols.length.clear();
+	cols.weight.clear();
+	generator.generate_varied(shape, index, cols);
+}
+
+struct Query {
+	const char* state;
+	Card card;
+	ShapeDescriptor descriptor;
+};
+
+int main(int argc, char *argv[]) {
+	uint64_t n_cards = 10000, n_queries = 200;
+	int k = KNN_NEIGHBOURS;
+	GeneratorSettings settings;
+	string library_path;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc) n_cards = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-q" && i + 1 < argc) n_queries = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-k" && i + 1 < argc) k = atoi(argv[++i]);
+		else if (arg == "-s" && i + 1 < argc) settings.n_samples = atoi(argv[++i]);
+		else if (arg == "-o" && i + 1 < argc) library_path = argv[++i];
+		else {
+			cout << "Usage: knn_benchmark [-n cards] [-q queries] [-k neighbours] [-s samples] [-o library.knn]" << endl;
+			return -1;
+		}
+	}
+	if (n_cards == 0 || n_queries == 0 || k < 1 || k > KNN_MAX_NEIGHBOURS || settings.n_samples < 4) {
+		cout << "ERROR: need cards, queries, 1 to " << KNN_MAX_NEIGHBOURS << " neighbours and 4 samples a card" << endl;
+		return -1;
+	}
+
+	vector<CardGenerator> generators;
+	for (int t = 0; t < N_CARD_TEMPLATES; t++) generators.push_back(CardGenerator(t + 1, settings));
+	ReferenceLibrary library;
+	CardColumns cols;
+	Card card;
+	auto start = chrono::steady_clock::now();
+	for (uint64_t i = 0; i < n_cards; i++) {
+		for (int t = 0; t < N_CARD_TEMPLATES; t++) {
+			if (strcmp(CARD_TEMPLATES[t].state, "flowing well") == 0) continue;
+			generate(generators[t], CARD_TEMPLATES[t], i, cols);
+			card.assign(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size());
+			ShapeDescriptor descriptor;
+			if (describe_card(card, descriptor)) library.add(descriptor, CARD_TEMPLATES[t].state);
+		}
+	}
+	double describe_seconds = seconds_since(start);
+	start = chrono::steady_clock::now();
+	library.build_index();
+	double build_seconds = seconds_since(start);
+	cout << library.size() << " reference cards of " << library.states.size() << " states, described in "
+		<< fixed << setprecision(2) << describe_seconds << " s, indexed in " << build_seconds << " s" << endl;
+	if (!library_path.empty() && !library.save(library_path)) {
+		cout << "ERROR: cannot write " << library_path << endl;
+		return -1;
+	}
+
+	vector<Query> queries;
+	for (uint64_t i = 0; i < n_queries; i++) {
+		for (int t = 0; t < N_CARD_TEMPLATES; t++) {
+			generate(generators[t], CARD_TEMPLATES[t], n_cards + i, cols);
+			queries.push_back(Query());
+			Query& query = queries.back();
+			query.state = CARD_TEMPLATES[t].state;
+			query.card.assign(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size());
+			describe_card(query.card, query.descriptor);
+		}
+	}
+
+	// Time each way over every query, counting the right states
+	size_t n_right[3] = { 0, 0, 0 }, n_differing = 0;
+	double seconds[3];
+	start = chrono::steady_clock::now();
+	for (size_t q = 0; q < queries.size(); q++) {
+		if (strcmp(classify_card(queries[q].card, MIN_ACCEPTABLE_PEAK_WEIGHT), queries[q].state) == 0) n_right[0]++;
+	}
+	seconds[0] = seconds_since(start);
+	start = chrono::steady_clock::now();
+	for (size_t q = 0; q < queries.size(); q++) {
+		if (strcmp(classify_card_knn(queries[q].card, MIN_ACCEPTABLE_PEAK_WEIGHT, library, k), queries[q].state) == 0) n_right[1]++;
+	}
+	seconds[1] = seconds_since(start);
+	vector<NeighbourList> by_tree(queries.size(), NeighbourList(k));
+	start = chrono::steady_clock::now();
+	for (size_t q = 0; q < queries.size(); q++) library.nearest(queries[q].descriptor, by_tree[q]);
+	double tree_seconds = seconds_since(start);
+	start = chrono::steady_clock::now();
+	for (size_t q = 0; q < queries.size(); q++) {
+		NeighbourList by_scan(k);
+		library.nearest_by_scan(queries[q].descriptor, by_scan);
+		const char* state = strcmp(queries[q].state, "flowing well") == 0 ? queries[q].state : library.vote(by_scan);
+		if (strcmp(state, queries[q].state) == 0) n_right[2]++;
+		for (int j = 0; j < k; j++) {
+			if (by_scan[j].index != by_tree[q][j].index) {
+				n_differing++;
+				break;
+			}
+		}
+	}
+	seconds[2] = seconds_since(start);
+
+	size_t n = queries.size();
+	cout << n << " queries, " << k << " neighbours" << endl;
+	const char* names[3] = { "guess_pump_state", "knn, vp-tree", "knn, scan" };
+	for (int m = 0; m < 3; m++) {
+		cout << left << setw(18) << names[m] << right << setprecision(2) << setw(10) << seconds[m] / n * 1e6 << " us/card"
+			<< setw(8) << setprecision(1) << 100.0 * n_right[m] / n << "% right" << endl;
+	}
+	cout << left << setw(18) << "vp-tree search" << right << setprecision(2) << setw(10) << tree_seconds / n * 1e6 << " us/query"
+		<< setw(8) << setprecision(1) << seconds[2] / tree_seconds << "x the scan" << endl;
+	if (n_differing > 0) {
+		cout << "ERROR: the tree and the scan found different neighbours for " << n_differing << " queries" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+g++ -O2 -std=c++17 knn_benchmark.cpp -o knn_benchmark
+./knn_benchmark -n 10000
+./knn_benchmark -n 1000 -o synthetic.knn
+*/
@@ -0,0 +1,156 @@
+/*
+Compares the shared memory-mapped card parser (DynaCardCommon/card_parser.h)
+with the getline/stringstream/stod loop that parse_file used before it.
+
+For every file on the command line both parsers are run the requested number
+of times, their columns are checked to be identical, and the throughput of
+each is printed in MB/s.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+
+#include "../DynaCardCommon/card_parser.h"
+
+using namespace std;
+
+string trim(const string& str, const string& whitespace = " \t")
+{
+	const auto strBegin = str.find_first_not_of(whitespace);
+	if (strBegin == string::npos)
+		return ""; // no content
+
+	const auto strEnd = str.find_last_not_of(whitespace);
+	const auto strRange = strEnd - strBegin + 1;
+
+	return str.substr(strBegin, strRange);
+}
+
+string reduce(const string& str, const string&& fill = "", const string& whitespace = " \t")
+{
+	// trim first
+	auto result = trim(str, whitespace);
+
+	// replace sub ranges
+	auto beginSpace = result.find_first_of(whitespace);
+	while (beginSpace != string::npos) {
+		const auto endSpace = result.find_first_not_of(whitespace, beginSpace);
+		const auto range = endSpace - beginSpace;
+
+		result.replace(beginSpace, range, fill);
+
+		const auto newStart = beginSpace + fill.length();
+		beginSpace = result.find_first_of(whitespace, newStart);
+	}
+	return result;
+}
+
+// The column reading part of CPlusDynaCard's parse_file, as it was
+void legacy_parse_file(string fname, CardColumns& cols) {
+	vector <double>& positionVec = cols.position;
+	vector <double>& xVec = cols.length;
+	vector <double>& yVec = cols.weight;
+	positionVec.clear(); xVec.clear(); yVec.clear();
+	string line;
+	ifstream ifs(fname);
+	while (ifs.good())
+	{
+		getline(ifs, line, '\n');
+
+		line = trim(line);
+		if (line.length() == 0) continue;
+
+		if (reduce(line) == "position,length,weight") continue;
+
+		if (line[0] == '#') continue;
+
+		stringstream ss(line);
+		string number;
+		int i = 0;
+		while (getline(ss, number, ',')) {
+			if (i == 0) positionVec.push_back(stod(number));
+			else if (i == 1) xVec.push_back(stod(number));
+			else if (i == 2) yVec.push_back(stod(number));
+			else throw 20;
+			i++;
+		}
+	}
+}
+
+bool same_columns(const CardColumns& a, const CardColumns& b) {
+	return a.position == b.position && a.length == b.length && a.weight == b.weight;
+}
+
+// Seconds taken to parse fname `repeat` times with parser
+template <typename Parser>
+double time_parser(Parser parser, const string& fname, int repeat, CardColumns& cols) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < repeat; i++) {
+		parser(fname, cols);
+	}
+	auto stop = chrono::steady_clock::now();
+	return chrono::duration<double>(stop - start).count();
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		cout << "Usage: parse_benchmark [-n repeat] file.csv [file.csv ...]" << endl;
+		return -1;
+	}
+	int repeat = 20;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc) repeat = atoi(argv[++i]);
+		else fnames.push_back(arg);
+	}
+
+	cout << left << setw(40) << "file" << right
+		<< setw(10) << "rows"
+		<< setw(10) << "MB"
+		<< setw(14) << "legacy MB/s"
+		<< setw(14) << "mmap MB/s"
+		<< setw(10) << "speedup" << endl;
+	int mismatches = 0;
+	for (size_t i = 0; i < fnames.size(); i++) {
+		MappedFile file;
+		if (!file.open(fnames[i])) {
+			cout << "ERROR: cannot open " << fnames[i] << endl;
+			continue;
+		}
+		double mb = file.size / 1e6;
+		file.close();
+
+		CardColumns legacy_cols, mmap_cols;
+		// Warm the page cache and check both parsers agree
+		legacy_parse_file(fnames[i], legacy_cols);
+		parse_card_file(fnames[i], mmap_cols);
+		if (!same_columns(legacy_cols, mmap_cols)) {
+			cout << "ERROR: parsers disagree on " << fnames[i] << endl;
+			mismatches++;
+		}
+
+		double legacy_secs = time_parser(legacy_parse_file, fnames[i], repeat, legacy_cols);
+		double mmap_secs = time_parser(parse_card_file, fnames[i], repeat, mmap_cols);
+		double legacy_mbps = mb * repeat / legacy_secs;
+		double mmap_mbps = mb * repeat / mmap_secs;
+		cout << left << setw(40) << fnames[i] << right << fixed
+			<< setw(10) << mmap_cols.size()
+			<< setw(10) << setprecision(3) << mb
+			<< setw(14) << setprecision(1) << legacy_mbps
+			<< setw(14) << setprecision(1) << mmap_mbps
+			<< setw(9) << setprecision(1) << mmap_mbps / legacy_mbps << "x" << endl;
+	}
+	return mismatches == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 parse_benchmark.cpp
+./a.out ../CPlusDeliverable/sent_to_onica/TestA2_comb.csv ../CPlusDynaCard/example_data/full_pump_0.csv
+*/
@@ -0,0 +1,258 @@
+/*
+Times every stage of classifying a card, and of ComputeShapeProperties, one
+stage at a time.
+
+For every file on the command line (a card being its first cycle, as the
+programs take it) each stage is run repeat times on its own, with the output
+of the stage before it prepared up front:
+
+  parse_file           map and parse the file, copy the first cycle to a Card
+  normalize            Card::normalize: ranges, x and y, running sums
+  break_into_edges     corner search and the four edge fits
+  Edge::finish         the four edge fits alone
+  guess_pump_state     the shape tests, halves of edges included
+  classify_card        normalize through guess_pump_state together
+  extract_one_cycle    ComputeShapeProperties' cycle, from the parsed columns
+  fit_FourSidedFigure
+  compute_area
+  distance loops       mean distance from the figure and from it rotated
+  two passes           classify_card and all of ComputeShapeProperties, from
+                       the parsed columns, as the two programs do it
+  classify_and_measure the same in one pass (fused_engine.h)
+
+Prints ns/card, cards/s and heap allocations/card for every file and stage,
+then the mean over all files, and writes the same to a JSON file (-o) so runs
+of different versions can be compared.  run_benchmarks.sh builds this and
+runs it over the example cards.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/pump_state.h"
+#include "../DynaCardCommon/shape_properties.h"
+#include "../DynaCardCommon/fused_engine.h"
+
+using namespace std;
+
+// Every heap allocation of the program is counted
+static size_t n_allocations = 0;
+
+void* operator new(size_t size) {
+	n_allocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p) throw bad_alloc();
+	return p;
+}
+void operator delete(void* p) noexcept {
+	free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+// Somewhere for results to go, so the stages aren't optimized away
+volatile double sink;
+
+struct StageResult {
+	string file;
+	string stage;
+	size_t samples;      // in the card
+	double ns;           // per card
+	double allocations;  // per card
+};
+
+// Run stage repeat times and record what one run costs
+template<typename Stage>
+void time_stage(vector<StageResult>& results, const string& file, const string& name, size_t samples, int repeat, Stage stage) {
+	size_t allocations = n_allocations;
+	auto start = chrono::steady_clock::now();
+	for (int r = 0; r < repeat; r++) stage();
+	auto stop = chrono::steady_clock::now();
+	StageResult result;
+	result.file = file;
+	result.stage = name;
+	result.samples = samples;
+	result.ns = chrono::duration<double, nano>(stop - start).count() / repeat;
+	result.allocations = static_cast<double>(n_allocations - allocations) / repeat;
+	results.push_back(result);
+}
+
+void benchmark_file(const string& fname, double min_acceptable_peak_weight, int repeat, vector<StageResult>& results) {
+	Card card;
+	CardColumns cols;
+	time_stage(results, fname, "parse_file", 0, repeat, [&] {
+		cols = CardColumns();
+		parse_card_file(fname, cols);
+		card.assign_first_cycle(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size());
+	});
+	size_t n = card.size();
+	results.back().samples = n;
+	if (n >= 4) {
+		time_stage(results, fname, "normalize", n, repeat, [&] {
+			card.normalize();
+		});
+		Edge edges[4];
+		time_stage(results, fname, "break_into_edges", n, repeat, [&] {
+			break_into_edges(card.sums(), HEURISTIC_CORNERS, edges);
+		});
+		time_stage(results, fname, "Edge::finish", n, repeat, [&] {
+			for (int i = 0; i < 4; i++) edges[i].finish();
+		});
+		time_stage(results, fname, "guess_pump_state", n, repeat, [&] {
+			Shape shape(&edges[0], &edges[1], &edges[2], &edges[3]);
+			sink = guess_pump_state(shape)[0];
+		});
+		time_stage(results, fname, "classify_card", n, repeat, [&] {
+			sink = classify_card(card, min_acceptable_peak_weight)[0];
+		});
+	}
+
+	vector<vector<double> > cycle;
+	time_stage(results, fname, "extract_one_cycle", cols.size(), repeat, [&] {
+		cycle = extract_one_cycle(cols.position, cols.length, cols.weight);
+	});
+	vector<double> xs = normalize(cycle[1]);
+	vector<double> ys = normalize(cycle[2]);
+	if (xs.size() < 4) return;
+	time_stage(results, fname, "fit_FourSidedFigure", xs.size(), repeat, [&] {
+		delete fit_FourSidedFigure(xs, ys);
+	});
+	time_stage(results, fname, "compute_area", xs.size(), repeat, [&] {
+		sink = compute_area(xs, ys);
+	});
+	FourSidedFigure* trap = fit_FourSidedFigure(xs, ys);
+	FourSidedFigure* rotated_trap = trap->rotate180deg();
+	time_stage(results, fname, "distance loops", xs.size(), repeat, [&] {
+		sink = mean_distance(*trap, xs, ys) + mean_distance(*rotated_trap, xs, ys);
+	});
+	delete trap;
+	delete rotated_trap;
+
+	time_stage(results, fname, "two passes", n, repeat, [&] {
+		card.assign_first_cycle(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size());
+		sink = classify_card(card, min_acceptable_peak_weight)[0];
+		vector<vector<double> > stroke = extract_one_cycle(cols.position, cols.length, cols.weight);
+		vector<double> stroke_xs = normalize(stroke[1]);
+		vector<double> stroke_ys = normalize(stroke[2]);
+		FourSidedFigure* figure = fit_FourSidedFigure(stroke_xs, stroke_ys);
+		FourSidedFigure* rotated_figure = figure->rotate180deg();
+		sink = compute_area(stroke_xs, stroke_ys) + mean_distance(*figure, stroke_xs, stroke_ys)
+			+ mean_distance(*rotated_figure, stroke_xs, stroke_ys);
+		delete figure;
+		delete rotated_figure;
+	});
+	time_stage(results, fname, "classify_and_measure", n, repeat, [&] {
+		card.assign_first_cycle(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size());
+		CardRecord record;
+		sink = classify_and_measure(card, min_acceptable_peak_weight, HEURISTIC_CORNERS, record)[0];
+		sink = record.area + record.distance_from_shape + record.distance_from_rotated_shape;
+	});
+}
+
+void print_result(const StageResult& result) {
+	cout << left << setw(40) << result.file << " " << setw(20) << result.stage << right << fixed
+		<< setw(9) << result.samples
+		<< setw(12) << setprecision(0) << result.ns
+		<< setw(12) << setprecision(0) << 1e9 / result.ns
+		<< setw(12) << setprecision(1) << result.allocations << endl;
+}
+
+void write_json(ostream& out, const StageResult& result) {
+	out << "{\"file\":\"" << result.file << "\", \"stage\":\"" << result.stage << "\", \"samples\":" << result.samples
+		<< ", \"ns_per_card\":" << result.ns << ", \"cards_per_s\":" << 1e9 / result.ns
+		<< ", \"allocations_per_card\":" << result.allocations << "}";
+}
+
+int main(int argc, char *argv[]) {
+	int repeat = 20;
+	double min_acceptable_peak_weight = 60.0;
+	string out_name = "pipeline_benchmark.json";
+	string label;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc) repeat = atoi(argv[++i]);
+		else if (arg == "-w" && i + 1 < argc) min_acceptable_peak_weight = atof(argv[++i]);
+		else if (arg == "-o" && i + 1 < argc) out_name = argv[++i];
+		else if (arg == "-l" && i + 1 < argc) label = argv[++i];
+		else fnames.push_back(arg);
+	}
+	if (fnames.empty() || repeat < 1) {
+		cout << "Usage: pipeline_benchmark [-n repeat] [-w min_weight] [-o results.json] [-l label] file.csv [file.csv ...]" << endl;
+		return -1;
+	}
+
+	vector<StageResult> results;
+	for (size_t i = 0; i < fnames.size(); i++) {
+		MappedFile file;
+		if (!file.open(fnames[i])) {
+			cout << "ERROR: cannot open " << fnames[i] << endl;
+			continue;
+		}
+		benchmark_file(fnames[i], min_acceptable_peak_weight, repeat, results);
+	}
+
+	// Mean over the files of every stage, in the order the stages ran
+	vector<StageResult> totals;
+	vector<int> n_files;
+	for (size_t i = 0; i < results.size(); i++) {
+		size_t k = 0;
+		while (k < totals.size() && totals[k].stage != results[i].stage) k++;
+		if (k == totals.size()) {
+			StageResult total = { "all", results[i].stage, 0, 0, 0 };
+			totals.push_back(total);
+			n_files.push_back(0);
+		}
+		totals[k].samples += results[i].samples;
+		totals[k].ns += results[i].ns;
+		totals[k].allocations += results[i].allocations;
+		n_files[k]++;
+	}
+	for (size_t k = 0; k < totals.size(); k++) {
+		totals[k].samples /= n_files[k];
+		totals[k].ns /= n_files[k];
+		totals[k].allocations /= n_files[k];
+	}
+
+	cout << left << setw(40) << "file" << " " << setw(20) << "stage" << right
+		<< setw(9) << "samples"
+		<< setw(12) << "ns/card"
+		<< setw(12) << "cards/s"
+		<< setw(12) << "allocs/card" << endl;
+	for (size_t i = 0; i < results.size(); i++) print_result(results[i]);
+	for (size_t k = 0; k < totals.size(); k++) print_result(totals[k]);
+
+	ofstream out(out_name);
+	out << "{\"label\":\"" << label << "\", \"kernels\":\"" << simd_kernels().name << "\", \"repeat\":" << repeat
+		<< ", \"min_weight\":" << min_acceptable_peak_weight << "," << endl << "\"stages\":[" << endl;
+	for (size_t k = 0; k < totals.size(); k++) {
+		write_json(out, totals[k]);
+		out << (k + 1 < totals.size() ? "," : "") << endl;
+	}
+	out << "]," << endl << "\"files\":[" << endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		write_json(out, results[i]);
+		out << (i + 1 < results.size() ? "," : "") << endl;
+	}
+	out << "]}" << endl;
+	if (!out) {
+		cout << "ERROR: cannot write " << out_name << endl;
+		return 1;
+	}
+	cout << "results written to " << out_name << endl;
+	return 0;
+}
+
+/*
+g++ -O2 -std=c++17 pipeline_benchmark.cpp
+./a.out -o pipeline.json ../CPlusDynaCard/example_data/full_pump_0.csv ../CPlusDeliverable/sent_to_onica/TestA2_comb.csv
+*/
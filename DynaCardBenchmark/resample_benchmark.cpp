@@ -0,0 +1,199 @@
+/*
+What resampling strokes along their arc length (DynaCardCommon/resample.h)
+saves in classifying them, and whether it changes any classification.
+
+For every file on the command line every stroke (with --strokes) or the
+first cycle is classified repeat times as it is, and repeat times resampled
+to about the given number of points first, the resampling included in the
+time.  Prints per file the points per stroke, us/stroke both ways, the
+speedup and how many strokes came out the same, then the same over all the
+files.
+
+The heuristic corners and the edge fits cost the same for any number of
+points once the running sums are built, so classifying alone gains little;
+the optimal corner search (--corners=optimal) and the distances of the
+shape properties (--shape, classify_and_measure of fused_engine.h) are
+where the points cost.  With --shape the mean difference the resampling
+made to distance_from_shape is printed too.
+
+Usage:
+  resample_benchmark [-p points] [-n repeat] [-w min_weight] [--strokes] [--corners=optimal] [--shape]
+                     file.csv [file.csv ...]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/pump_state.h"
+#include "../DynaCardCommon/resample.h"
+#include "../DynaCardCommon/fused_engine.h"
+
+using namespace std;
+
+// The strokes of a file, or its first cycle, as separate columns
+vector<CardColumns> file_strokes(const string& fname, bool per_stroke) {
+	CardColumns cols;
+	parse_card_file(fname, cols);
+	vector<CardColumns> strokes;
+	if (!per_stroke) {
+		size_t first, end;
+		first_cycle_range(cols.position.data(), cols.size(), first, end);
+		CardColumns cycle;
+		cycle.position.assign(cols.position.begin() + first, cols.position.begin() + end);
+		cycle.length.assign(cols.length.begin() + first, cols.length.begin() + end);
+		cycle.weight.assign(cols.weight.begin() + first, cols.weight.begin() + end);
+		strokes.push_back(cycle);
+		return strokes;
+	}
+	StrokeSegmenter segmenter;
+	for (size_t i = 0; i < cols.size(); i++) {
+		if (!segmenter.add_sample(cols.position[i], cols.length[i], cols.weight[i])) continue;
+		CardColumns stroke;
+		stroke.position = segmenter.position;
+		stroke.length = segmenter.length;
+		stroke.weight = segmenter.weight;
+		strokes.push_back(stroke);
+	}
+	return strokes;
+}
+
+struct BenchmarkOptions {
+	size_t n_points = 128;
+	int repeat = 20;
+	double min_acceptable_peak_weight = 60.0;
+	bool per_stroke = false;
+	CornerMethod corner_method = HEURISTIC_CORNERS;
+	bool shape = false;
+};
+
+struct FileResult {
+	string file;
+	size_t n_strokes = 0, n_samples = 0, n_resampled = 0, n_agreeing = 0;
+	double ns = 0, resampled_ns = 0;   // all the strokes, once
+	size_t n_distances = 0;            // strokes with a distance_from_shape both ways
+	double distance_change = 0;        // summed over them
+};
+
+// Classify card, and measure it with options.shape; returns the state
+const char* run(Card& card, const BenchmarkOptions& options, CardRecord& record) {
+	if (options.shape) return classify_and_measure(card, options.min_acceptable_peak_weight, options.corner_method, record);
+	return classify_card(card, options.min_acceptable_peak_weight, options.corner_method);
+}
+
+FileResult benchmark_file(const string& fname, const BenchmarkOptions& options) {
+	size_t n_points = options.n_points;
+	int repeat = options.repeat;
+	FileResult result;
+	result.file = fname;
+	vector<CardColumns> strokes = file_strokes(fname, options.per_stroke);
+	Card card;
+	StrokeResampler resampler;
+	for (size_t k = 0; k < strokes.size(); k++) {
+		const CardColumns& s = strokes[k];
+		if (s.size() == 0) continue;
+		const char* state = "";
+		CardRecord record, resampled_record;
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < repeat; r++) {
+			card.assign(s.position.data(), s.length.data(), s.weight.data(), s.size());
+			state = run(card, options, record);
+		}
+		auto middle = chrono::steady_clock::now();
+		const char* resampled_state = "";
+		for (int r = 0; r < repeat; r++) {
+			card.assign(s.position.data(), s.length.data(), s.weight.data(), s.size());
+			resample_card(card, n_points, resampler);
+			resampled_state = run(card, options, resampled_record);
+		}
+		auto stop = chrono::steady_clock::now();
+		if (options.shape && !std::isnan(record.distance_from_shape) && !std::isnan(resampled_record.distance_from_shape)) {
+			result.n_distances++;
+			result.distance_change += std::abs(record.distance_from_shape - resampled_record.distance_from_shape);
+		}
+		result.n_strokes++;
+		result.n_samples += s.size();
+		result.n_resampled += card.size();
+		if (strcmp(state, resampled_state) == 0) result.n_agreeing++;
+		result.ns += chrono::duration<double, nano>(middle - start).count() / repeat;
+		result.resampled_ns += chrono::duration<double, nano>(stop - middle).count() / repeat;
+	}
+	return result;
+}
+
+void print_result(const FileResult& r) {
+	if (r.n_strokes == 0) return;
+	cout << left << setw(48) << r.file << right << setw(8) << r.n_strokes
+		<< setw(8) << r.n_samples / r.n_strokes << setw(8) << r.n_resampled / r.n_strokes << fixed
+		<< setw(10) << setprecision(2) << r.ns / r.n_strokes / 1000
+		<< setw(10) << setprecision(2) << r.resampled_ns / r.n_strokes / 1000
+		<< setw(8) << setprecision(2) << r.ns / r.resampled_ns << "x"
+		<< setw(8) << r.n_agreeing << "/" << r.n_strokes;
+	if (r.n_distances > 0) cout << setw(10) << setprecision(4) << r.distance_change / r.n_distances;
+	cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+	BenchmarkOptions options;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-p" && i + 1 < argc) options.n_points = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-n" && i + 1 < argc) options.repeat = atoi(argv[++i]);
+		else if (arg == "-w" && i + 1 < argc) options.min_acceptable_peak_weight = atof(argv[++i]);
+		else if (arg == "--strokes") options.per_stroke = true;
+		else if (arg == "--corners=optimal") options.corner_method = OPTIMAL_CORNERS;
+		else if (arg == "--shape") options.shape = true;
+		else fnames.push_back(arg);
+	}
+	if (fnames.empty() || options.repeat < 1 || options.n_points < 4) {
+		cout << "Usage: resample_benchmark [-p points] [-n repeat] [-w min_weight] [--strokes] [--corners=optimal] [--shape]" << endl
+			<< "                          file.csv [file.csv ...]" << endl;
+		return -1;
+	}
+
+	vector<FileResult> results;
+	for (size_t i = 0; i < fnames.size(); i++) {
+		MappedFile file;
+		if (!file.open(fnames[i])) {
+			cout << "ERROR: cannot open " << fnames[i] << endl;
+			continue;
+		}
+		results.push_back(benchmark_file(fnames[i], options));
+	}
+	FileResult total;
+	total.file = "all";
+	for (size_t i = 0; i < results.size(); i++) {
+		total.n_strokes += results[i].n_strokes;
+		total.n_samples += results[i].n_samples;
+		total.n_resampled += results[i].n_resampled;
+		total.n_agreeing += results[i].n_agreeing;
+		total.ns += results[i].ns;
+		total.resampled_ns += results[i].resampled_ns;
+		total.n_distances += results[i].n_distances;
+		total.distance_change += results[i].distance_change;
+	}
+
+	cout << "resampled to " << options.n_points << " points" << endl;
+	cout << left << setw(48) << "file" << right << setw(8) << "strokes" << setw(8) << "points" << setw(8) << "after"
+		<< setw(10) << "us" << setw(10) << "after" << setw(9) << "speedup" << setw(10) << "same";
+	if (options.shape) cout << setw(10) << "|d dist|";
+	cout << endl;
+	for (size_t i = 0; i < results.size(); i++) print_result(results[i]);
+	print_result(total);
+	return total.n_agreeing == total.n_strokes ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 resample_benchmark.cpp -o resample_benchmark
+find ../CPlusDynaCard/example_data -name '*.csv' | xargs ./resample_benchmark -p 64
+./resample_benchmark --strokes ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv
+./resample_benchmark --strokes --shape -n 3 ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv
+*/
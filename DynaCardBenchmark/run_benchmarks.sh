@@ -0,0 +1,10 @@
+# Build the pipeline benchmark and run it over the example cards and the
+# large multi-cycle recordings.  The results go to pipeline_<revision>.json,
+# so the files of two versions can be compared.
+cd "$(dirname "$0")"
+g++ -O2 -std=c++17 pipeline_benchmark.cpp -o pipeline_benchmark || exit 1
+
+revision=$(git describe --always --dirty 2>/dev/null || echo unknown)
+./pipeline_benchmark -l "$revision" -o "pipeline_$revision.json" \
+	../CPlusDynaCard/example_data/*.csv \
+	../CPlusDeliverable/sent_to_onica/TestA*_comb.csv
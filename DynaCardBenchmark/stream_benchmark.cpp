@@ -0,0 +1,134 @@
+/*
+How soon a stroke is diagnosed when its samples are fed to
+DynaCardCommon/stream_classifier.h as they arrive, against waiting for the
+whole file and classifying its strokes then, as classify_pump_state
+--strokes does.
+
+For every file: the samples are read first (not timed), then fed to a
+StreamClassifier one at a time, repeat times.  Prints ns/sample for the
+samples that only add to the open stroke, and us from the sample that
+closes a stroke to its state (median and worst), against ms to parse and
+classify the whole file once it is there.  A stroke diagnosed from a file
+also waits for every stroke after it to be recorded: half the file's
+strokes on average.  The streamed states must match the file's.
+
+Usage:
+  stream_benchmark [-n repeat] [-w min_weight] file.csv [file.csv ...]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/pump_state.h"
+#include "../DynaCardCommon/stream_classifier.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+double ns_between(Clock::time_point start, Clock::time_point stop) {
+	return chrono::duration<double, nano>(stop - start).count();
+}
+
+// Parse the file and classify every stroke, as classify_pump_state --strokes
+vector<const char*> classify_file_strokes(const string& fname, double min_acceptable_peak_weight) {
+	vector<const char*> states;
+	CardColumns cols;
+	parse_card_file(fname, cols);
+	StrokeSegmenter segmenter;
+	Card card;
+	for (size_t i = 0; i < cols.size(); i++) {
+		if (!segmenter.add_sample(cols.position[i], cols.length[i], cols.weight[i])) continue;
+		card.assign(segmenter.position.data(), segmenter.length.data(), segmenter.weight.data(), segmenter.position.size());
+		states.push_back(classify_card(card, min_acceptable_peak_weight));
+	}
+	return states;
+}
+
+int main(int argc, char *argv[]) {
+	int repeat = 20;
+	double min_acceptable_peak_weight = 10.0;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc) repeat = atoi(argv[++i]);
+		else if (arg == "-w" && i + 1 < argc) min_acceptable_peak_weight = atof(argv[++i]);
+		else fnames.push_back(arg);
+	}
+	if (fnames.empty() || repeat < 1) {
+		cout << "Usage: stream_benchmark [-n repeat] [-w min_weight] file.csv [file.csv ...]" << endl;
+		return -1;
+	}
+
+	cout << left << setw(48) << "file" << right << setw(9) << "samples" << setw(8) << "strokes" << setw(11) << "ns/sample"
+		<< setw(12) << "close p50" << setw(12) << "close max" << setw(10) << "file ms" << setw(8) << "same" << endl;
+	int n_failed = 0;
+	for (size_t f = 0; f < fnames.size(); f++) {
+		CardColumns cols;
+		if (!parse_card_file(fnames[f], cols)) {
+			cout << "ERROR: cannot open " << fnames[f] << endl;
+			n_failed++;
+			continue;
+		}
+		auto start = Clock::now();
+		vector<const char*> file_states;
+		for (int r = 0; r < repeat; r++) file_states = classify_file_strokes(fnames[f], min_acceptable_peak_weight);
+		double file_ns = ns_between(start, Clock::now()) / repeat;
+
+		// Find the closing samples first, so only those calls are timed one by one
+		vector<size_t> closing;
+		{
+			StreamClassifier stream(min_acceptable_peak_weight);
+			for (size_t i = 0; i < cols.size(); i++) {
+				if (stream.add_sample(cols.position[i], cols.length[i], cols.weight[i])) closing.push_back(i);
+			}
+		}
+		vector<double> close_ns;
+		vector<const char*> stream_states;
+		double open_ns = 0;
+		for (int r = 0; r < repeat; r++) {
+			StreamClassifier stream(min_acceptable_peak_weight);
+			stream_states.clear();
+			size_t i = 0;
+			for (size_t c = 0; c <= closing.size(); c++) {
+				size_t stop = c < closing.size() ? closing[c] : cols.size();
+				auto open_start = Clock::now();
+				for (; i < stop; i++) stream.add_sample(cols.position[i], cols.length[i], cols.weight[i]);
+				auto close_start = Clock::now();
+				open_ns += ns_between(open_start, close_start);
+				if (c == closing.size()) break;
+				stream.add_sample(cols.position[i], cols.length[i], cols.weight[i]);
+				close_ns.push_back(ns_between(close_start, Clock::now()));
+				stream_states.push_back(stream.stroke.state);
+				i++;
+			}
+		}
+		size_t n_open = (cols.size() - closing.size()) * repeat;
+		bool same = stream_states.size() == file_states.size()
+			&& equal(stream_states.begin(), stream_states.end(), file_states.begin(),
+				[](const char* a, const char* b) { return strcmp(a, b) == 0; });
+		if (!same) n_failed++;
+		sort(close_ns.begin(), close_ns.end());
+		double p50 = close_ns.empty() ? 0 : close_ns[close_ns.size() / 2];
+		double max_ns = close_ns.empty() ? 0 : close_ns.back();
+		cout << left << setw(48) << fnames[f] << right << setw(9) << cols.size() << setw(8) << closing.size() << fixed
+			<< setw(11) << setprecision(1) << (n_open > 0 ? open_ns / n_open : 0)
+			<< setw(10) << setprecision(1) << p50 / 1000 << "us" << setw(10) << max_ns / 1000 << "us"
+			<< setw(10) << setprecision(2) << file_ns / 1e6 << setw(8) << (same ? "yes" : "NO") << endl;
+	}
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 stream_benchmark.cpp -o stream_benchmark
+./stream_benchmark ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv
+*/
@@ -0,0 +1,147 @@
+/*
+Per-well rolling trends (DynaCardCommon/well_trends.h) fed a synthetic
+fleet: ns to add a stroke, us to write a well's summary, the memory a well
+takes, and how far the sketches' window medians are from the exact medians
+of the same strokes.
+
+Every well strokes every -p seconds for -t hours.  Its strokes' areas and
+distances wander about a level of its own that drifts slowly, and one
+stroke in five is a fluid pound.  The exact medians are selected from a
+copy of each well's window at every summary, which is not timed.
+
+Usage:
+  trends_benchmark [-w wells] [-t hours] [-p seconds] [-e summary_seconds]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "../DynaCardCommon/well_trends.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point start) {
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// splitmix64, to a double in [0, 1)
+struct Random {
+	uint64_t state;
+	explicit Random(uint64_t seed) : state(seed) {}
+	double next() {
+		uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		return (z >> 11) * (1.0 / 9007199254740992.0);
+	}
+};
+
+struct SyntheticWell {
+	string id;
+	double area_level, distance_level;
+	// The exact window, to check the sketches against
+	deque<pair<int64_t, float> > areas;
+};
+
+double exact_median(const deque<pair<int64_t, float> >& window, vector<float>& scratch) {
+	scratch.clear();
+	for (size_t i = 0; i < window.size(); i++) scratch.push_back(window[i].second);
+	if (scratch.empty()) return NAN;
+	// The lower median, as a sketch's quantile(0.5) rounds to
+	size_t rank = max<size_t>(1, static_cast<size_t>(0.5 * scratch.size() + 0.5)) - 1;
+	nth_element(scratch.begin(), scratch.begin() + rank, scratch.end());
+	return scratch[rank];
+}
+
+int main(int argc, char *argv[]) {
+	size_t n_wells = 1000;
+	double hours = 6, period = 8, summary_seconds = TREND_SUMMARY_SECONDS;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-w" && i + 1 < argc) n_wells = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-t" && i + 1 < argc) hours = atof(argv[++i]);
+		else if (arg == "-p" && i + 1 < argc) period = atof(argv[++i]);
+		else if (arg == "-e" && i + 1 < argc) summary_seconds = atof(argv[++i]);
+		else {
+			cout << "Usage: trends_benchmark [-w wells] [-t hours] [-p seconds] [-e summary_seconds]" << endl;
+			return -1;
+		}
+	}
+	if (n_wells == 0 || hours <= 0 || period < 1 || summary_seconds < 1) {
+		cout << "ERROR: need wells, hours, and a stroke period and summary interval of a second or more" << endl;
+		return -1;
+	}
+
+	Random random(1);
+	vector<SyntheticWell> wells(n_wells);
+	for (size_t w = 0; w < n_wells; w++) {
+		wells[w].id = "42-477-" + to_string(10000 + w);
+		wells[w].area_level = 0.4 + 0.4 * random.next();
+		wells[w].distance_level = 0.02 + 0.1 * random.next();
+	}
+	WellTrends trends(TREND_WINDOW_SECONDS, summary_seconds);
+	ostringstream summaries;
+	vector<float> scratch;
+	const int64_t start_time = 1545230005;
+	int64_t end_time = start_time + static_cast<int64_t>(hours * 3600);
+	double add_seconds = 0, summary_seconds_taken = 0, worst_error = 0;
+	uint64_t n_strokes = 0, n_summaries = 0;
+	for (int64_t time = start_time; time < end_time; time += static_cast<int64_t>(period)) {
+		// Before the strokes at time, as classify_pump_state does, so a summary holds only strokes before it
+		summaries.str("");
+		auto summary_start = Clock::now();
+		trends.write_due(summaries, time);
+		summary_seconds_taken += seconds_since(summary_start);
+		// The sketches' window medians against the exact ones
+		string row;
+		istringstream rows(summaries.str());
+		while (getline(rows, row)) {
+			n_summaries++;
+			vector<string> fields;
+			stringstream columns(row);
+			for (string field; getline(columns, field, ','); ) fields.push_back(field);
+			size_t w = strtoull(fields[1].c_str() + 7, nullptr, 10) - 10000;
+			deque<pair<int64_t, float> >& window = wells[w].areas;
+			int64_t summary_time = strtoll(fields[0].c_str(), nullptr, 10);
+			while (!window.empty() && window.front().first <= summary_time - TREND_WINDOW_SECONDS) window.pop_front();
+			double exact = exact_median(window, scratch);
+			worst_error = max(worst_error, fabs(atof(fields[6].c_str()) - exact) / exact);
+		}
+		auto add_start = Clock::now();
+		for (size_t w = 0; w < n_wells; w++) {
+			SyntheticWell& well = wells[w];
+			well.area_level += 0.0005 * (random.next() - 0.5);
+			double area = well.area_level * (0.9 + 0.2 * random.next());
+			double distance = well.distance_level * (0.8 + 0.4 * random.next());
+			const char* state = random.next() < 0.2 ? "fluid pound" : "full pump";
+			trends.add(well.id, time, state, area, distance);
+			well.areas.push_back(make_pair(time, static_cast<float>(area)));
+		}
+		add_seconds += seconds_since(add_start);
+		n_strokes += n_wells;
+	}
+
+	cout << n_wells << " wells, " << n_strokes << " strokes over " << hours << " h, a window of " << TREND_WINDOW_SECONDS
+		<< " s summarized every " << summary_seconds << " s" << endl;
+	cout << fixed << setprecision(1) << setw(10) << add_seconds / n_strokes * 1e9 << " ns/stroke added" << endl;
+	cout << setw(10) << (n_summaries == 0 ? 0 : summary_seconds_taken / n_summaries * 1e6) << " us/well summary written" << endl;
+	cout << setw(10) << trends.bytes_per_well() / 1024.0 << " KiB/well" << endl;
+	cout << setprecision(2) << setw(10) << 100 * worst_error << "% worst error of " << n_summaries << " window area medians" << endl;
+	return worst_error <= 1.0 / 32 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 trends_benchmark.cpp -o trends_benchmark
+./trends_benchmark -w 1000 -t 6
+*/
@@ -0,0 +1,64 @@
+/*
+A blocking queue of at most a fixed number of items between threads, any
+number on each side: push waits while it is full and pop while it is empty.
+Closing it wakes every waiting thread; pushes fail from then on, and pops
+drain what is left before they fail.
+
+Shared by the classify server's workers (classify_server.h) and the stages
+of a batch run (stage_pipeline.h).
+*/
+
+#ifndef DYNACARD_BOUNDED_QUEUE_H
+#define DYNACARD_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+template<typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t cap) {
+		capacity = cap < 1 ? 1 : cap;
+		closed = false;
+	}
+	// Waits while the queue is full.  False if the queue was closed.
+	bool push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [&] { return closed || items.size() < capacity; });
+		if (closed) return false;
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+		return true;
+	}
+	// Waits for an item.  False once the queue is closed and empty.
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [&] { return closed || !items.empty(); });
+		if (items.empty()) return false;
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return items.size();
+	}
+private:
+	std::mutex mutex;
+	std::condition_variable not_empty, not_full;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed;
+};
+
+#endif // DYNACARD_BOUNDED_QUEUE_H
@@ -0,0 +1,154 @@
+/*
+One card (a stroke, or the first cycle of a recording) ready to classify.
+
+Everything the classifier needs lives in a single 64 byte aligned buffer owned
+by the Card, column after column:
+
+  position, length, weight             the raw samples
+  x, y                                 length and weight normalized to 0..1
+  running moment sums                  n + 1 entries, for CumulativeSums
+
+Each column starts on a 64 byte boundary.  The buffer only grows, so a Card
+that is reused for card after card stops allocating once it has held the
+longest of them; Edges are views into it (pump_state.h) and allocate nothing.
+*/
+
+#ifndef DYNACARD_CARD_H
+#define DYNACARD_CARD_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "simd_kernels.h"
+#include "line_fit.h"
+
+const size_t CARD_ALIGNMENT = 64;
+
+/*
+The first cycle of a recording: from the first pos=0 up to, but not including,
+the second pos=0.  The end is found as an offset from the first zero and then
+used as an index, as the programs always have, so a recording that does not
+start at a zero is cut short.
+*/
+inline void first_cycle_range(const double* position, size_t n_samples, size_t& first, size_t& end) {
+	first = end = 0;
+	if (n_samples == 0) return;
+	// find indices of first pos=0 and second pos=0, to find one cycle
+	size_t first_zero_ind = std::find(position, position + n_samples, 0) - position;
+	if (first_zero_ind == n_samples) return;
+	size_t second_zero_ind = std::find(position + first_zero_ind + 1, position + n_samples, 0) - (position + first_zero_ind);
+	first = first_zero_ind;
+	end = std::max(first_zero_ind, second_zero_ind);
+}
+
+class Card {
+public:
+	Card() {
+		base = nullptr;
+		n = capacity = stride = 0;
+		min_length = max_length = min_weight = max_weight = 0;
+		ranges_known = false;
+	}
+	Card(const Card&) = delete;
+	Card& operator=(const Card&) = delete;
+	Card(Card&&) = default;
+	Card& operator=(Card&&) = default;
+
+	size_t size() const {
+		return n;
+	}
+	const double* position() const {
+		return column(0);
+	}
+	const double* length() const {
+		return column(1);
+	}
+	const double* weight() const {
+		return column(2);
+	}
+	// Normalized length and weight, valid after normalize()
+	const double* x() const {
+		return column(3);
+	}
+	const double* y() const {
+		return column(4);
+	}
+	// Running sums over x and y, valid after normalize()
+	const CumulativeSums& sums() const {
+		return cumulative_sums;
+	}
+	// Raw ranges, valid after normalize()
+	double min_length, max_length, min_weight, max_weight;
+
+	// Copy count samples into the card
+	void assign(const double* pos, const double* len, const double* wt, size_t count) {
+		ranges_known = false;
+		resize(count);
+		if (count == 0) return;
+		memcpy(column(0), pos, count * sizeof(double));
+		memcpy(column(1), len, count * sizeof(double));
+		memcpy(column(2), wt, count * sizeof(double));
+	}
+	// assign, with the ranges of len and wt already known (StrokeSegmenter keeps them), so normalize does not scan for them
+	void assign(const double* pos, const double* len, const double* wt, size_t count,
+		double len_min, double len_max, double wt_min, double wt_max) {
+		assign(pos, len, wt, count);
+		min_length = len_min;
+		max_length = len_max;
+		min_weight = wt_min;
+		max_weight = wt_max;
+		ranges_known = true;
+	}
+	// Copy the first cycle (first_cycle_range) of a recording into the card
+	void assign_first_cycle(const double* pos, const double* len, const double* wt, size_t n_samples) {
+		size_t first, end;
+		first_cycle_range(pos, n_samples, first, end);
+		assign(pos + first, len + first, wt + first, end - first);
+	}
+	// Fill x and y and the running sums
+	void normalize() {
+		if (n == 0) return;
+		const SimdKernels& kernels = simd_kernels();
+		if (!ranges_known) {
+			kernels.min_max(column(1), n, min_length, max_length);
+			kernels.min_max(column(2), n, min_weight, max_weight);
+		}
+		kernels.normalize(column(1), column(3), n, min_length, max_length - min_length);
+		kernels.normalize(column(2), column(4), n, min_weight, max_weight - min_weight);
+		cumulative_sums.build_into(column(3), column(4), static_cast<int>(n), moments());
+	}
+
+private:
+	std::vector<double> buffer;
+	double* base;
+	size_t n, capacity;
+	size_t stride; // doubles from the start of one column to the next
+	bool ranges_known; // min/max_length/weight were given with the samples
+	CumulativeSums cumulative_sums;
+
+	double* column(int k) const {
+		return base + k * stride;
+	}
+	Moments* moments() const {
+		return reinterpret_cast<Moments*>(column(5));
+	}
+	void resize(size_t count) {
+		if (count > capacity) reserve(std::max(count, 2 * capacity));
+		n = count;
+	}
+	void reserve(size_t count) {
+		const size_t per_line = CARD_ALIGNMENT / sizeof(double);
+		stride = (count + per_line - 1) / per_line * per_line;
+		size_t doubles = 5 * stride + MOMENT_COUNT * (count + 1);
+		// The slack lets the columns start on an aligned address
+		buffer.assign(doubles + per_line, 0.0);
+		uintptr_t address = reinterpret_cast<uintptr_t>(buffer.data());
+		base = reinterpret_cast<double*>((address + CARD_ALIGNMENT - 1) / CARD_ALIGNMENT * CARD_ALIGNMENT);
+		capacity = count;
+	}
+};
+
+#endif // DYNACARD_CARD_H
@@ -0,0 +1,192 @@
+/*
+Binary columnar card format (".card").
+
+Re-parsing text CSV dominates the cost of re-running diagnostics over archived
+cards, so csv2card converts them once into this format, which is read back by
+mapping the file and pointing straight at the columns.
+
+Layout, all in the byte order of the machine that wrote it (checked on open):
+
+  CardFileHeader                       256 bytes, fixed
+  position[n_samples]                  double
+  length[n_samples]                    double
+  weight[n_samples]                    double
+  stroke_index[2 * n_strokes]          uint64_t, first and one-past-last
+                                       sample of every stroke
+
+Every section starts on an 8 byte boundary.  Strokes are the ones StrokeSegmenter
+finds, so neighbouring strokes share their boundary sample.  A recording that
+never crosses the stroke thresholds simply has no strokes.
+
+Bump CARD_FILE_VERSION whenever the layout changes; readers refuse versions
+newer than their own.
+*/
+
+#ifndef DYNACARD_CARD_FILE_H
+#define DYNACARD_CARD_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "card_parser.h"
+#include "card_header.h"
+
+const char CARD_FILE_MAGIC[8] = { 'D', 'Y', 'N', 'A', 'C', 'A', 'R', 'D' };
+const uint32_t CARD_FILE_VERSION = 1;
+const uint32_t CARD_FILE_BYTE_ORDER = 0x01020304;
+
+struct CardFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t n_samples;
+	uint64_t n_strokes;
+	// Byte offsets of the sections from the start of the file
+	uint64_t position_offset;
+	uint64_t length_offset;
+	uint64_t weight_offset;
+	uint64_t stroke_index_offset;
+	// FileHeader fields, trimmed and NUL terminated
+	char well_id_number[32];
+	char timestamp[32];
+	char device_serial_number[32];
+	char sensor_serial_numbers[64];
+	char reserved[32];
+};
+static_assert(sizeof(CardFileHeader) == 256, "CardFileHeader must stay 256 bytes");
+
+inline void copy_header_field(char* field, size_t field_size, const std::string& value) {
+	size_t first = value.find_first_not_of(" \t\r\n");
+	size_t last = value.find_last_not_of(" \t\r\n");
+	std::string trimmed = (first == std::string::npos) ? "" : value.substr(first, last - first + 1);
+	memset(field, 0, field_size);
+	memcpy(field, trimmed.data(), trimmed.size() < field_size ? trimmed.size() : field_size - 1);
+}
+
+/*
+Write a card.  stroke_index holds first/one-past-last sample pairs, as
+described above.  Returns false if the file could not be written.
+*/
+inline bool write_card_file(const std::string& fname, const FileHeader& file_header,
+	const CardColumns& cols, const std::vector<uint64_t>& stroke_index) {
+	CardFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CARD_FILE_MAGIC, sizeof(header.magic));
+	header.version = CARD_FILE_VERSION;
+	header.byte_order = CARD_FILE_BYTE_ORDER;
+	header.n_samples = cols.size();
+	header.n_strokes = stroke_index.size() / 2;
+	uint64_t column_bytes = header.n_samples * sizeof(double);
+	header.position_offset = sizeof(CardFileHeader);
+	header.length_offset = header.position_offset + column_bytes;
+	header.weight_offset = header.length_offset + column_bytes;
+	header.stroke_index_offset = header.weight_offset + column_bytes;
+	copy_header_field(header.well_id_number, sizeof(header.well_id_number), file_header.well_id_number);
+	copy_header_field(header.timestamp, sizeof(header.timestamp), file_header.timestamp);
+	copy_header_field(header.device_serial_number, sizeof(header.device_serial_number), file_header.deviceSerial_Number);
+	copy_header_field(header.sensor_serial_numbers, sizeof(header.sensor_serial_numbers), file_header.sensorSerial_Numbers);
+
+	FILE* out = fopen(fname.c_str(), "wb");
+	if (out == NULL) return false;
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	if (header.n_samples > 0) {
+		ok = ok && fwrite(cols.position.data(), sizeof(double), cols.size(), out) == cols.size();
+		ok = ok && fwrite(cols.length.data(), sizeof(double), cols.size(), out) == cols.size();
+		ok = ok && fwrite(cols.weight.data(), sizeof(double), cols.size(), out) == cols.size();
+	}
+	if (!stroke_index.empty()) {
+		ok = ok && fwrite(stroke_index.data(), sizeof(uint64_t), stroke_index.size(), out) == stroke_index.size();
+	}
+	ok = (fclose(out) == 0) && ok;
+	return ok;
+}
+
+/*
+A .card file mapped read-only.  The column pointers point into the mapping,
+so nothing is copied, and they stay valid while the CardFile is open.
+*/
+class CardFile {
+public:
+	const CardFileHeader* header;
+	const double* position;
+	const double* length;
+	const double* weight;
+	const uint64_t* stroke_index;
+	CardFile() {
+		reset();
+	}
+	// False if fname can't be read or is not a card this version understands
+	bool open(const std::string& fname) {
+		reset();
+		if (!file.open(fname)) return false;
+		if (file.size < sizeof(CardFileHeader)) return fail();
+		const CardFileHeader* h = reinterpret_cast<const CardFileHeader*>(file.data);
+		if (memcmp(h->magic, CARD_FILE_MAGIC, sizeof(h->magic)) != 0) return fail();
+		if (h->byte_order != CARD_FILE_BYTE_ORDER || h->version > CARD_FILE_VERSION) return fail();
+		if (h->n_samples > file.size / sizeof(double) || h->n_strokes > file.size / (2 * sizeof(uint64_t))) return fail();
+		uint64_t column_bytes = h->n_samples * sizeof(double);
+		if (!section_fits(h->position_offset, column_bytes)
+			|| !section_fits(h->length_offset, column_bytes)
+			|| !section_fits(h->weight_offset, column_bytes)
+			|| !section_fits(h->stroke_index_offset, h->n_strokes * 2 * sizeof(uint64_t))) return fail();
+		header = h;
+		position = reinterpret_cast<const double*>(file.data + h->position_offset);
+		length = reinterpret_cast<const double*>(file.data + h->length_offset);
+		weight = reinterpret_cast<const double*>(file.data + h->weight_offset);
+		stroke_index = reinterpret_cast<const uint64_t*>(file.data + h->stroke_index_offset);
+		for (uint64_t k = 0; k < h->n_strokes; k++) {
+			if (stroke_index[2 * k] >= stroke_index[2 * k + 1] || stroke_index[2 * k + 1] > h->n_samples) {
+				close();
+				return false;
+			}
+		}
+		return true;
+	}
+	void close() {
+		file.close();
+		reset();
+	}
+	size_t n_samples() const {
+		return header == nullptr ? 0 : static_cast<size_t>(header->n_samples);
+	}
+	size_t n_strokes() const {
+		return header == nullptr ? 0 : static_cast<size_t>(header->n_strokes);
+	}
+	FileHeader file_header() const {
+		FileHeader fh;
+		if (header != nullptr) {
+			fh.well_id_number = field(header->well_id_number, sizeof(header->well_id_number));
+			fh.timestamp = field(header->timestamp, sizeof(header->timestamp));
+			fh.deviceSerial_Number = field(header->device_serial_number, sizeof(header->device_serial_number));
+			fh.sensorSerial_Numbers = field(header->sensor_serial_numbers, sizeof(header->sensor_serial_numbers));
+		}
+		return fh;
+	}
+private:
+	MappedFile file;
+	void reset() {
+		header = nullptr;
+		position = length = weight = nullptr;
+		stroke_index = nullptr;
+	}
+	bool fail() {
+		file.close();
+		return false;
+	}
+	bool section_fits(uint64_t offset, uint64_t bytes) const {
+		return offset % 8 == 0 && offset <= file.size && bytes <= file.size - offset;
+	}
+	static std::string field(const char* value, size_t size) {
+		return std::string(value, strnlen(value, size));
+	}
+};
+
+// True if fname has the .card extension
+inline bool is_card_file_name(const std::string& fname) {
+	return fname.size() > 5 && fname.compare(fname.size() - 5, 5, ".card") == 0;
+}
+
+#endif // DYNACARD_CARD_FILE_H
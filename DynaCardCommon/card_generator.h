@@ -0,0 +1,214 @@
+/*
+Synthetic surface cards, one for every pump state guess_pump_state knows,
+for load and scaling tests.
+
+Each state has a template: the outline of its card as a polygon in the unit
+square, walked clockwise from the bottom of the downstroke (left edge up,
+top edge right, right edge down, bottom edge back), every edge of it
+optionally bowed into a curve.  A card is that outline sampled at n_samples
+points spread by arc length, stretched so its length runs from 0 to the
+stroke length, sheared by skew, scaled to the load range, with Gaussian noise
+added to both columns.
+
+Card k of a generator depends only on its seed and k, never on what was
+generated before, so cards can be made in any order or on several threads
+and come out the same.  The random numbers come from splitmix64 and
+Box-Muller rather than <random>'s distributions, whose output differs
+between standard libraries, so a seed gives the same cards everywhere (up to
+the last bits of log, sin and cos).
+*/
+
+#ifndef DYNACARD_CARD_GENERATOR_H
+#define DYNACARD_CARD_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "card_parser.h"
+
+struct GeneratorSettings {
+	size_t n_samples = 200;       // per stroke
+	double stroke_length = 100;   // length units from the bottom to the top of the stroke
+	double min_load = 1000;       // weight at the bottom of the card
+	double max_load = 2500;       // and at the top
+	double noise = 0.002;         // standard deviation, as a fraction of the stroke length and load range
+	double skew = 0;              // shear: length moves by skew * stroke_length from the bottom to the top of the card
+};
+
+// A corner of a template and how far the edge leaving it bows out, as a fraction of its length
+struct TemplateVertex {
+	double x, y, bulge;
+};
+
+struct CardTemplate {
+	const char* state;
+	int n_vertices;
+	TemplateVertex vertices[40];
+};
+
+// Peak load of a flowing well card, below any sensible min_acceptable_peak_weight
+const double GENERATED_FLOWING_WELL_PEAK = 40;
+
+/*
+The outlines were tuned until classify_card gives the template's state for
+nearly every seed at the default settings (fluid friction: 99%, the rest
+sometimes reading as bent barrel).  Worn standing needs 100 samples or more,
+and fluid friction turns into bent barrel as skew grows; card_generator
+--check shows how any other settings fare.
+*/
+const CardTemplate CARD_TEMPLATES[] = {
+	{ "full pump", 4, { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } } },
+	{ "tubing movement", 4, { { 0, 0, 0 }, { 0.3, 1, 0 }, { 1, 1, 0 }, { 0.7, 0, 0 } } },
+	{ "fluid pound", 6, { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 0.75, 0.98, 0 }, { 0.5, 0.4, 0 }, { 0.5, 0, 0 } } },
+	{ "gas interference", 5, { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 0.6, 0.6, 0 }, { 0.5, 0, 0 } } },
+	{ "pump hitting", 6, { { 0, 0, 0 }, { 0, 0.7, 0 }, { 0.8, 0.7, 0 }, { 1, 1, 0 }, { 1, 0.3, 0 }, { 0.2, 0.3, 0 } } },
+	{ "bent barrel", 4, { { 0, 0.1, 0 }, { 0, 0.7, 0 }, { 1, 0.9, 0 }, { 1, 0.3, 0 } } },
+	{ "worn plunger", 4, { { 0, 0, 0 }, { 0.25, 1, 0 }, { 0.75, 1, 0 }, { 1, 0, 0 } } },
+	{ "worn standing", 4, { { 0.25, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 0.75, 0, 0 } } },
+	{ "worn or", 4, { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 0.7, 0 }, { 0.85, 0, 0 } } },
+	{ "fluid friction", 6, { { 0.05, 0.25, 0 }, { 0.05, 0.8, 0 }, { 0.75, 1, 0 }, { 0.85, 0.8, 0 }, { 0.8, 0.15, 0 }, { 0.95, 0, 0 } } },
+	{ "drag friction", 6, { { 0.3, 0.25, 0 }, { 0.3, 0.95, 0 }, { 1, 1, 0 }, { 0.95, 0.85, 0 }, { 0.75, 0.1, 0 }, { 0.3, 0, 0 } } },
+	{ "flowing well", 4, { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } } },
+};
+const int N_CARD_TEMPLATES = sizeof(CARD_TEMPLATES) / sizeof(CARD_TEMPLATES[0]);
+
+// The template for state, or nullptr
+inline const CardTemplate* find_card_template(const std::string& state) {
+	for (int i = 0; i < N_CARD_TEMPLATES; i++) {
+		if (state == CARD_TEMPLATES[i].state) return &CARD_TEMPLATES[i];
+	}
+	return nullptr;
+}
+
+class CardGenerator {
+public:
+	GeneratorSettings settings;
+
+	CardGenerator(uint64_t generator_seed, const GeneratorSettings& generator_settings = GeneratorSettings()) {
+		seed = generator_seed;
+		settings = generator_settings;
+	}
+
+	/*
+	Append card number index of the template's state to cols, as one stroke:
+	position runs from 0 towards 360, so a file of several strokes is a
+	recording and the first cycle of it is the first stroke.
+	*/
+	void generate(const CardTemplate& shape, uint64_t index, CardColumns& cols) {
+		random_state = seed ^ (index * 0xD1B54A32D192ED03ULL);
+		next_random();
+		size_t n = settings.n_samples;
+		double min_load = settings.min_load, max_load = settings.max_load;
+		if (strcmp(shape.state, "flowing well") == 0) {
+			min_load = 0;
+			max_load = GENERATED_FLOWING_WELL_PEAK;
+		}
+		// Arc length of every edge, from a few straight pieces of its curve, and how far left and right the outline goes
+		double edge_length[40], total = 0;
+		double left = shape.vertices[0].x, right = left;
+		for (int e = 0; e < shape.n_vertices; e++) {
+			edge_length[e] = 0;
+			double x0, y0, x1, y1;
+			edge_point(shape, e, 0, x0, y0);
+			for (int k = 1; k <= 16; k++) {
+				edge_point(shape, e, k / 16.0, x1, y1);
+				left = std::min(left, x1);
+				right = std::max(right, x1);
+				edge_length[e] += std::sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+				x0 = x1;
+				y0 = y1;
+			}
+			total += edge_length[e];
+		}
+		size_t first = cols.position.size();
+		cols.position.resize(first + n);
+		cols.length.resize(first + n);
+		cols.weight.resize(first + n);
+		int e = 0;
+		double edge_start = 0;
+		for (size_t i = 0; i < n; i++) {
+			double s = total * i / n;
+			while (e + 1 < shape.n_vertices && s >= edge_start + edge_length[e]) {
+				edge_start += edge_length[e];
+				e++;
+			}
+			double x, y, x_noise, y_noise;
+			edge_point(shape, e, (s - edge_start) / edge_length[e], x, y);
+			// The stroke runs from 0 to stroke_length, so StrokeSegmenter finds its start
+			x = (x - left) / (right - left);
+			gaussian_pair(x_noise, y_noise);
+			x += settings.skew * y + settings.noise * x_noise;
+			y += settings.noise * y_noise;
+			cols.position[first + i] = 360.0 * i / n;
+			cols.length[first + i] = x * settings.stroke_length;
+			cols.weight[first + i] = min_load + y * (max_load - min_load);
+		}
+	}
+
+	/*
+	generate, with the skew moved by -0.06 .. 0.06 and the noise raised by up
+	to 0.008 depending on index, so a run of cards spreads out like cards of
+	one state from many wells do: for the reference libraries of
+	knn_classifier.h.
+	*/
+	void generate_varied(const CardTemplate& shape, uint64_t index, CardColumns& cols) {
+		GeneratorSettings base = settings;
+		settings.skew += 0.03 * (static_cast<int>(index % 5) - 2);
+		settings.noise += 0.004 * (index % 3);
+		generate(shape, index, cols);
+		settings = base;
+	}
+
+private:
+	uint64_t seed;
+	uint64_t random_state;
+
+	// splitmix64
+	uint64_t next_random() {
+		uint64_t z = (random_state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+	// Uniform in (0, 1]
+	double uniform() {
+		return ((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+	}
+	// Two independent standard normal numbers, by Box-Muller
+	void gaussian_pair(double& a, double& b) {
+		const double two_pi = 6.283185307179586;
+		double r = std::sqrt(-2 * std::log(uniform()));
+		double angle = two_pi * uniform();
+		a = r * std::cos(angle);
+		b = r * std::sin(angle);
+	}
+
+	// Point t (0..1) along edge e: a quadratic Bezier whose control point sits bulge * length off the middle
+	static void edge_point(const CardTemplate& shape, int e, double t, double& x, double& y) {
+		const TemplateVertex& a = shape.vertices[e];
+		const TemplateVertex& b = shape.vertices[(e + 1) % shape.n_vertices];
+		// Off to the left of the direction of travel, which is outwards for a clockwise outline
+		double cx = (a.x + b.x) / 2 - a.bulge * (b.y - a.y);
+		double cy = (a.y + b.y) / 2 + a.bulge * (b.x - a.x);
+		double u = 1 - t;
+		x = u * u * a.x + 2 * u * t * cx + t * t * b.x;
+		y = u * u * a.y + 2 * u * t * cy + t * t * b.y;
+	}
+};
+
+// Append cols as card file text, the way the example cards are written
+inline void write_card_csv(const CardColumns& cols, std::string& out) {
+	char line[96];
+	out += "position,length,weight\n";
+	for (size_t i = 0; i < cols.size(); i++) {
+		int n = snprintf(line, sizeof(line), "%.6g,%.6g,%.6g\n", cols.position[i], cols.length[i], cols.weight[i]);
+		out.append(line, n);
+	}
+}
+
+#endif // DYNACARD_CARD_GENERATOR_H
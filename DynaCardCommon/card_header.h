@@ -0,0 +1,90 @@
+/*
+The '#' header lines at the top of a card file, e.g.
+
+# Well ID Number:  42-477-20130-03
+# Timestamp:  1545230005
+# Device Serial Number: 123456789
+# Sensor Serial Numbers: [00000003,00000004]
+*/
+
+#ifndef DYNACARD_CARD_HEADER_H
+#define DYNACARD_CARD_HEADER_H
+
+#include <cstring>
+#include <string>
+
+#include "card_parser.h"
+
+const std::string WELL_ID_NUMBER = "Well ID Number";
+const std::string TIMESTAMP = "Timestamp";
+const std::string DEVICE_SERIAL_NUMBER = "Device Serial Number";
+const std::string SENSOR_SERIAL_NUMBER = "Sensor Serial Numbers";
+
+struct FileHeader {
+	std::string well_id_number;
+	std::string timestamp;
+	std::string deviceSerial_Number;
+	std::string sensorSerial_Numbers;
+};
+
+/*
+If the comment line [p, end) holds one of the header keys, store everything
+after the ':' that follows the key in header and return true.  Values are kept
+untrimmed, as peek_file always did.
+*/
+inline bool parse_header_line(const char* p, const char* end, FileHeader& header) {
+	struct Key {
+		const std::string* name;
+		std::string FileHeader::* value;
+	};
+	static const Key keys[] = {
+		{ &WELL_ID_NUMBER, &FileHeader::well_id_number },
+		{ &TIMESTAMP, &FileHeader::timestamp },
+		{ &DEVICE_SERIAL_NUMBER, &FileHeader::deviceSerial_Number },
+		{ &SENSOR_SERIAL_NUMBER, &FileHeader::sensorSerial_Numbers },
+	};
+	if (p == end || *p != '#') return false;
+	size_t n = end - p;
+	for (int k = 0; k < 4; k++) {
+		const std::string& name = *keys[k].name;
+		for (size_t i = 1; i + name.size() <= n; i++) {
+			if (memcmp(p + i, name.data(), name.size()) != 0) continue;
+			const char* colon = static_cast<const char*>(memchr(p + i + name.size(), ':', n - i - name.size()));
+			if (colon == nullptr) return false;
+			header.*keys[k].value = std::string(colon + 1, end);
+			return true;
+		}
+	}
+	return false;
+}
+
+// The same for the text of a card file already in memory
+inline void ingest_card_text(const char* begin, const char* end, FileHeader& header, CardColumns& cols) {
+	parse_card_text(begin, end, cols, [&](const char* p, const char* line_end) {
+		parse_header_line(p, line_end, header);
+	});
+}
+
+/*
+Read the header keys and the columns of fname in a single sequential pass over
+the mapped file.  Keys may come in any order and any of them may be missing;
+missing ones are left empty.  Returns the number of bytes read, 0 if the file
+can't be opened.
+*/
+inline size_t ingest_card_file(const std::string& fname, FileHeader& header, CardColumns& cols) {
+	cols.clear();
+	MappedFile file;
+	if (!file.open(fname)) return 0;
+	ingest_card_text(file.data, file.data + file.size, header, cols);
+	return file.size;
+}
+
+// The key a well's cards are filed under: the Well ID Number of their header, trimmed
+inline std::string well_key(const FileHeader& header) {
+	const std::string& id = header.well_id_number;
+	size_t first = id.find_first_not_of(" \t\r\n");
+	size_t last = id.find_last_not_of(" \t\r\n");
+	return first == std::string::npos ? "" : id.substr(first, last - first + 1);
+}
+
+#endif // DYNACARD_CARD_HEADER_H
@@ -0,0 +1,288 @@
+/*
+Fast reader for surface card CSV files.  Shared by CPlusDynaCard,
+CPlusDeliverable and ComputeShapeProperties.
+
+The whole file is memory-mapped and scanned in place: no std::string is built
+per line and no stringstream is opened per row.  Numbers are converted with
+std::from_chars straight into the column buffers of a CardColumns, which are
+sized once up front from a newline count.
+
+The accepted format is the one used by every card in example_data:
+- blank lines are ignored
+- lines starting with '#' are comments or header keys and are ignored
+- the "position,length,weight" column header is ignored (blanks allowed)
+- every other line holds exactly three comma separated numbers
+*/
+
+#ifndef DYNACARD_CARD_PARSER_H
+#define DYNACARD_CARD_PARSER_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if (__cplusplus >= 201703L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <charconv>
+#endif
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "metrics.h"
+
+/*
+Read-only view of a whole file.  The mapping is released when the
+object goes out of scope.  An empty file opens fine with size 0.
+*/
+class MappedFile {
+public:
+	const char* data;
+	size_t size;
+	MappedFile() {
+		data = nullptr;
+		size = 0;
+	}
+	~MappedFile() {
+		close();
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& fname) {
+		METRICS_TIME(STAGE_READ);
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size)) {
+			CloseHandle(file);
+			return false;
+		}
+		if (file_size.QuadPart == 0) {
+			CloseHandle(file);
+			return true;
+		}
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (mapping == NULL) return false;
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (view == NULL) return false;
+		data = static_cast<const char*>(view);
+		size = static_cast<size_t>(file_size.QuadPart);
+#else
+		int fd = ::open(fname.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			return false;
+		}
+		if (st.st_size == 0) {
+			::close(fd);
+			return true;
+		}
+		void* view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (view == MAP_FAILED) return false;
+		madvise(view, st.st_size, MADV_SEQUENTIAL);
+		data = static_cast<const char*>(view);
+		size = static_cast<size_t>(st.st_size);
+#endif
+		return true;
+	}
+	// Have the whole file read in the background, so touching it later finds it in memory
+	void will_need() const {
+#ifndef _WIN32
+		if (data != nullptr) madvise(const_cast<char*>(data), size, MADV_WILLNEED);
+#endif
+	}
+	void close() {
+		if (data != nullptr) {
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+#else
+			munmap(const_cast<char*>(data), size);
+#endif
+		}
+		data = nullptr;
+		size = 0;
+	}
+};
+
+// The three columns of a card, one entry per data row
+struct CardColumns {
+	std::vector<double> position;
+	std::vector<double> length;
+	std::vector<double> weight;
+	size_t size() const {
+		return position.size();
+	}
+	void clear() {
+		// Keeps the capacity so a CardColumns can be reused card after card
+		position.clear();
+		length.clear();
+		weight.clear();
+	}
+};
+
+inline const char* card_skip_blanks(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+	return p;
+}
+
+// True if [p, end) reads "position,length,weight", ignoring blanks anywhere
+inline bool card_is_column_header(const char* p, const char* end) {
+	static const char header[] = "position,length,weight";
+	const char* h = header;
+	for (; p < end; p++) {
+		if (*p == ' ' || *p == '\t') continue;
+		if (*h == '\0' || *p != *h) return false;
+		h++;
+	}
+	return *h == '\0';
+}
+
+// Convert the number starting at p into value.  Returns the first character not consumed.
+inline const char* card_parse_double(const char* p, const char* end, double& value) {
+	// stod accepted a leading '+', from_chars does not
+	if (p < end && *p == '+') p++;
+#if defined(__cpp_lib_to_chars)
+	std::from_chars_result res = std::from_chars(p, end, value);
+	if (res.ec != std::errc()) throw std::invalid_argument("card_parse_double");
+	return res.ptr;
+#else
+	// No floating point from_chars in this standard library.  strtod needs
+	// a terminated string and the mapping is not one, so copy the field.
+	char buf[64];
+	size_t n = end - p;
+	if (n > sizeof(buf) - 1) n = sizeof(buf) - 1;
+	memcpy(buf, p, n);
+	buf[n] = '\0';
+	char* stop;
+	value = strtod(buf, &stop);
+	if (stop == buf) throw std::invalid_argument("card_parse_double");
+	return p + (stop - buf);
+#endif
+}
+
+/*
+Scan the card text in [begin, end) in one pass.  handle_row(position, length, weight)
+is called for every data row and handle_comment(p, line_end) for every '#' line
+(trimmed, p pointing at the '#'), in file order.  Nothing is allocated, so a
+caller that keeps only what it needs (e.g. one stroke) has memory bounded by that.
+Throws 20 on a row with more than three columns, like parse_file always did,
+and std::invalid_argument on anything else that is not a number.
+Returns the number of data rows.
+*/
+template <typename RowHandler, typename CommentHandler>
+inline size_t for_each_card_line(const char* begin, const char* end, RowHandler handle_row, CommentHandler handle_comment) {
+	size_t n_rows = 0;
+	const char* p = begin;
+	while (p < end) {
+		const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+		if (eol == nullptr) eol = end;
+		const char* next = (eol == end) ? end : eol + 1;
+		// Trim the line, including the '\r' of DOS line endings
+		const char* line_end = eol;
+		while (line_end > p && (line_end[-1] == ' ' || line_end[-1] == '\t' || line_end[-1] == '\r')) line_end--;
+		p = card_skip_blanks(p, line_end);
+		if (p == line_end || card_is_column_header(p, line_end)) {
+			p = next;
+			continue;
+		}
+		if (*p == '#') {
+			handle_comment(p, line_end);
+			p = next;
+			continue;
+		}
+		double values[3];
+		int n_fields = 0;
+		while (true) {
+			if (n_fields == 3) throw 20;
+			p = card_parse_double(card_skip_blanks(p, line_end), line_end, values[n_fields]);
+			n_fields++;
+			p = card_skip_blanks(p, line_end);
+			if (p == line_end) break;
+			if (*p != ',') throw std::invalid_argument("for_each_card_line: expected ','");
+			p++;
+		}
+		if (n_fields != 3) throw std::invalid_argument("for_each_card_line: expected position,length,weight");
+		handle_row(values[0], values[1], values[2]);
+		n_rows++;
+		p = next;
+	}
+	return n_rows;
+}
+
+// for_each_card_line, skipping the '#' lines
+template <typename RowHandler>
+inline size_t for_each_card_row(const char* begin, const char* end, RowHandler handle_row) {
+	return for_each_card_line(begin, end, handle_row, [](const char*, const char*) {});
+}
+
+/*
+Parse the card text in [begin, end) into cols, replacing what was there.
+Every '#' line is handed to handle_comment(p, line_end) on the way.
+*/
+template <typename CommentHandler>
+inline void parse_card_text(const char* begin, const char* end, CardColumns& cols, CommentHandler handle_comment) {
+	METRICS_TIME(STAGE_PARSE);
+	METRICS_COUNT_BYTES(end - begin);
+	// There can't be more rows than lines, so size the columns once from the
+	// newline count and write into them directly
+	size_t max_rows = 1;
+	for (const char* q = begin; q < end; q++) {
+		q = static_cast<const char*>(memchr(q, '\n', end - q));
+		if (q == nullptr) break;
+		max_rows++;
+	}
+	cols.position.resize(max_rows);
+	cols.length.resize(max_rows);
+	cols.weight.resize(max_rows);
+	double* position = cols.position.data();
+	double* length = cols.length.data();
+	double* weight = cols.weight.data();
+
+	size_t n_rows = for_each_card_line(begin, end, [&](double pos, double x, double y) {
+		*position++ = pos;
+		*length++ = x;
+		*weight++ = y;
+	}, handle_comment);
+	cols.position.resize(n_rows);
+	cols.length.resize(n_rows);
+	cols.weight.resize(n_rows);
+}
+
+// Parse the card text in [begin, end) into cols, replacing what was there
+inline void parse_card_text(const char* begin, const char* end, CardColumns& cols) {
+	parse_card_text(begin, end, cols, [](const char*, const char*) {});
+}
+
+// Map fname and parse it into cols.  Returns false if the file can't be opened.
+inline bool parse_card_file(const std::string& fname, CardColumns& cols) {
+	cols.clear();
+	MappedFile file;
+	if (!file.open(fname)) return false;
+	parse_card_text(file.data, file.data + file.size, cols);
+	return true;
+}
+
+#endif // DYNACARD_CARD_PARSER_H
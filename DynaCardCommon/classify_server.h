@@ -0,0 +1,387 @@
+/*
+A long running classifier that takes cards over a Unix domain socket, so the
+motus app doesn't pay for a new process per card.
+
+Protocol.  A client sends requests one after another on a connection and may
+send the next before the reply to the last has arrived; replies come back in
+request order.  Numbers are text, tokens are separated by single spaces.
+
+  CSV <min_weight> <n_bytes> [<deviceSerial> [<timestamp>]]\n
+      followed by n_bytes of card file text, '#' header lines and all
+  COLUMNS <min_weight> <n_samples> [<deviceSerial> [<timestamp>]]\n
+      followed by n_samples position, then length, then weight doubles,
+      in the byte order of the server
+  STATS\n
+      health and counters of the server, as JSON
+
+deviceSerial and timestamp override the header, as on the command line.
+Every reply is
+
+  OK <n_bytes>\n<n_bytes of reply>       the JSON the program would print
+  ERROR <n_bytes>\n<n_bytes of message>
+
+Classification runs on a fixed pool of workers fed through a bounded queue.
+When the queue is full, connections stop reading requests until it drains.
+Each worker keeps its own Card, so once warm it classifies without allocating.
+Every connection has a reader and a writer thread of its own, so at most
+max_connections are served at once; one beyond that gets
+ERROR 20\ntoo many connections and is closed.
+*/
+
+#ifndef DYNACARD_CLASSIFY_SERVER_H
+#define DYNACARD_CLASSIFY_SERVER_H
+
+#ifndef _WIN32
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bounded_queue.h"
+#include "card.h"
+
+const size_t SERVER_MAX_REQUEST_BYTES = 256 * 1024 * 1024;
+const int SERVER_MAX_CONNECTIONS = 64;
+
+struct ServerRequest {
+	enum Kind { CSV, COLUMNS, STATS } kind;
+	double min_weight;
+	bool has_device_serial, has_timestamp;
+	std::string device_serial, timestamp;
+	std::string text; // CSV
+	std::vector<double> columns; // COLUMNS: position, length, weight back to back
+	size_t n_samples;
+};
+
+/*
+Does the work of one CSV or COLUMNS request with the worker's card.  Returns
+false and puts the message in reply if the request can't be served.
+*/
+typedef std::function<bool(const ServerRequest& request, Card& card, std::string& reply)> ServerHandler;
+
+// Buffered reads from a socket
+class SocketReader {
+public:
+	explicit SocketReader(int socket_fd) {
+		fd = socket_fd;
+		pos = end = 0;
+	}
+	// A line without its '\n'.  False at end of stream.
+	bool read_line(std::string& line, size_t max_length = 4096) {
+		line.clear();
+		while (true) {
+			if (pos == end && !fill()) return false;
+			const char* start = buffer + pos;
+			const char* newline = static_cast<const char*>(memchr(start, '\n', end - pos));
+			if (newline != nullptr) {
+				line.append(start, newline);
+				pos += newline - start + 1;
+				return true;
+			}
+			line.append(start, end - pos);
+			pos = end;
+			if (line.size() > max_length) return false;
+		}
+	}
+	bool read_exact(char* out, size_t n) {
+		while (n > 0) {
+			if (pos == end && !fill()) return false;
+			size_t take = end - pos < n ? end - pos : n;
+			memcpy(out, buffer + pos, take);
+			pos += take;
+			out += take;
+			n -= take;
+		}
+		return true;
+	}
+private:
+	int fd;
+	char buffer[64 * 1024];
+	size_t pos, end;
+	bool fill() {
+		ssize_t got;
+		do {
+			got = read(fd, buffer, sizeof(buffer));
+		} while (got < 0 && errno == EINTR);
+		if (got <= 0) return false;
+		pos = 0;
+		end = static_cast<size_t>(got);
+		return true;
+	}
+};
+
+inline bool write_all(int fd, const char* data, size_t n) {
+	while (n > 0) {
+		ssize_t put = write(fd, data, n);
+		if (put < 0 && errno == EINTR) continue;
+		if (put <= 0) return false;
+		data += put;
+		n -= static_cast<size_t>(put);
+	}
+	return true;
+}
+
+class ClassifyServer {
+public:
+	int max_connections = SERVER_MAX_CONNECTIONS; // served at once, each on two threads
+
+	ClassifyServer(std::string path, int n_workers, size_t queue_capacity, ServerHandler handle)
+		: jobs(queue_capacity) {
+		socket_path = path;
+		workers = n_workers < 1 ? 1 : n_workers;
+		capacity = queue_capacity;
+		handler = handle;
+		listen_fd = -1;
+		requests = errors = bytes_in = busy_ns = 0;
+		connections_open = connections_total = connections_refused = 0;
+	}
+
+	// Listen on the socket and serve until the process is stopped.  Returns non-zero if the socket can't be set up.
+	int run() {
+		signal(SIGPIPE, SIG_IGN);
+		listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd < 0) {
+			std::cout << "ERROR: cannot create socket: " << strerror(errno) << std::endl;
+			return 1;
+		}
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socket_path.size() >= sizeof(address.sun_path)) {
+			std::cout << "ERROR: socket path too long: " << socket_path << std::endl;
+			return 1;
+		}
+		strcpy(address.sun_path, socket_path.c_str());
+		unlink(socket_path.c_str()); // a socket left behind by an earlier run
+		if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listen_fd, 64) < 0) {
+			std::cout << "ERROR: cannot listen on " << socket_path << ": " << strerror(errno) << std::endl;
+			return 1;
+		}
+		started = std::chrono::steady_clock::now();
+		for (int i = 0; i < workers; i++) std::thread(&ClassifyServer::work, this).detach();
+		std::cerr << "serving on " << socket_path << " with " << workers << " workers" << std::endl;
+		while (true) {
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				std::cout << "ERROR: accept failed: " << strerror(errno) << std::endl;
+				return 1;
+			}
+			// Only this thread opens connections, so the count can't pass the cap between the test and the increment
+			if (connections_open >= max_connections) {
+				connections_refused++;
+				std::string refusal = framed(false, "too many connections");
+				write_all(fd, refusal.data(), refusal.size());
+				close(fd);
+				continue;
+			}
+			connections_open++;
+			connections_total++;
+			std::thread(&ClassifyServer::serve_connection, this, fd).detach();
+		}
+	}
+
+private:
+	// Replies of one connection, written back in request order
+	struct Connection {
+		int fd;
+		std::mutex mutex;
+		std::condition_variable ready;
+		std::map<uint64_t, std::string> replies;
+		uint64_t n_submitted = 0;
+		bool reading_done = false;
+	};
+	struct Job {
+		std::shared_ptr<Connection> connection;
+		uint64_t seq;
+		std::shared_ptr<ServerRequest> request;
+	};
+
+	std::string socket_path;
+	int workers;
+	size_t capacity;
+	ServerHandler handler;
+	int listen_fd;
+	BoundedQueue<Job> jobs;
+	std::chrono::steady_clock::time_point started;
+	std::atomic<uint64_t> requests, errors, bytes_in, busy_ns;
+	std::atomic<int> connections_open, connections_total, connections_refused;
+
+	static std::string framed(bool ok, const std::string& body) {
+		return (ok ? "OK " : "ERROR ") + std::to_string(body.size()) + "\n" + body;
+	}
+
+	static void reply(Connection& connection, uint64_t seq, std::string text) {
+		std::lock_guard<std::mutex> lock(connection.mutex);
+		connection.replies[seq] = std::move(text);
+		connection.ready.notify_all();
+	}
+
+	void work() {
+		Card card;
+		Job job;
+		while (jobs.pop(job)) {
+			auto start = std::chrono::steady_clock::now();
+			std::string body;
+			bool ok;
+			try {
+				ok = handler(*job.request, card, body);
+			}
+			catch (...) {
+				ok = false;
+				body = "card could not be parsed";
+			}
+			auto stop = std::chrono::steady_clock::now();
+			busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+			requests++;
+			if (!ok) errors++;
+			reply(*job.connection, job.seq, framed(ok, body));
+			job = Job();
+		}
+	}
+
+	std::string stats_json() {
+		double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		uint64_t served = requests;
+		std::ostringstream json;
+		json << "{\n"
+			<< "\"status\" : \"ok\", \n"
+			<< "\"uptime_s\" : " << uptime << ", \n"
+			<< "\"workers\" : " << workers << ", \n"
+			<< "\"queue_capacity\" : " << capacity << ", \n"
+			<< "\"queued\" : " << jobs.size() << ", \n"
+			<< "\"connections_open\" : " << connections_open << ", \n"
+			<< "\"connections_total\" : " << connections_total << ", \n"
+			<< "\"connections_refused\" : " << connections_refused << ", \n"
+			<< "\"requests\" : " << served << ", \n"
+			<< "\"errors\" : " << errors << ", \n"
+			<< "\"bytes_in\" : " << bytes_in << ", \n"
+			<< "\"mean_service_us\" : " << (served == 0 ? 0.0 : busy_ns / 1e3 / served) << "\n"
+			<< "}\n";
+		return json.str();
+	}
+
+	// Parse the request line; false if it is malformed
+	static bool parse_request_line(const std::string& line, ServerRequest& request, size_t& payload_count) {
+		std::istringstream words(line);
+		std::string kind;
+		words >> kind;
+		request.has_device_serial = request.has_timestamp = false;
+		if (kind == "STATS") {
+			request.kind = ServerRequest::STATS;
+			payload_count = 0;
+			return true;
+		}
+		if (kind == "CSV") request.kind = ServerRequest::CSV;
+		else if (kind == "COLUMNS") request.kind = ServerRequest::COLUMNS;
+		else return false;
+		if (!(words >> request.min_weight >> payload_count)) return false;
+		if (words >> request.device_serial) request.has_device_serial = true;
+		if (words >> request.timestamp) request.has_timestamp = true;
+		return true;
+	}
+
+	// Counted open by run, which accepted it
+	void serve_connection(int fd) {
+		std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+		connection->fd = fd;
+		std::thread writer(&ClassifyServer::write_replies, connection);
+		SocketReader in(fd);
+		std::string line;
+		while (in.read_line(line)) {
+			if (line.empty()) continue;
+			uint64_t seq = connection->n_submitted;
+			std::shared_ptr<ServerRequest> request = std::make_shared<ServerRequest>();
+			size_t count = 0;
+			bool ok = parse_request_line(line, *request, count);
+			size_t bytes_per_count = (request->kind == ServerRequest::COLUMNS) ? 3 * sizeof(double) : 1;
+			if (ok && count > SERVER_MAX_REQUEST_BYTES / bytes_per_count) {
+				// Too big to buffer, and the stream can't be resynchronized
+				submitted(*connection);
+				reply(*connection, seq, framed(false, "request too large"));
+				break;
+			}
+			if (!ok) {
+				submitted(*connection);
+				reply(*connection, seq, framed(false, "bad request: " + line));
+				continue;
+			}
+			if (request->kind == ServerRequest::CSV) {
+				request->text.resize(count);
+				if (!in.read_exact(&request->text[0], count)) break;
+			}
+			else if (request->kind == ServerRequest::COLUMNS) {
+				request->n_samples = count;
+				request->columns.resize(3 * count);
+				if (!in.read_exact(reinterpret_cast<char*>(request->columns.data()), count * bytes_per_count)) break;
+			}
+			bytes_in += line.size() + 1 + count * bytes_per_count;
+			submitted(*connection);
+			if (request->kind == ServerRequest::STATS) {
+				reply(*connection, seq, framed(true, stats_json()));
+				continue;
+			}
+			Job job;
+			job.connection = connection;
+			job.seq = seq;
+			job.request = request;
+			if (!jobs.push(std::move(job))) break;
+		}
+		{
+			std::lock_guard<std::mutex> lock(connection->mutex);
+			connection->reading_done = true;
+			connection->ready.notify_all();
+		}
+		writer.join();
+		close(fd);
+		connections_open--;
+	}
+
+	static void submitted(Connection& connection) {
+		std::lock_guard<std::mutex> lock(connection.mutex);
+		connection.n_submitted++;
+	}
+
+	static void write_replies(std::shared_ptr<Connection> connection) {
+		uint64_t next = 0;
+		bool writable = true;
+		while (true) {
+			std::string text;
+			{
+				std::unique_lock<std::mutex> lock(connection->mutex);
+				connection->ready.wait(lock, [&] {
+					return connection->replies.count(next) > 0 || (connection->reading_done && next == connection->n_submitted);
+				});
+				if (connection->replies.count(next) == 0) return;
+				text = std::move(connection->replies[next]);
+				connection->replies.erase(next);
+			}
+			// Once the client is gone keep draining, so workers never wait on us
+			if (writable) writable = write_all(connection->fd, text.data(), text.size());
+			next++;
+		}
+	}
+};
+
+#endif // _WIN32
+
+#endif // DYNACARD_CLASSIFY_SERVER_H
@@ -0,0 +1,206 @@
+/*
+Where to put the four corners of a stroke.
+
+The heuristic takes the extremes of x+2y and x-2y.  It is cheap, but on skewed
+cards (bent_barrel_5degree_*, tubing_movement_*) the extremes slide along an
+edge and the edges come out cut in the wrong places.
+
+The search instead places the corners to minimize the total line fit residual
+of the four edges of the closed stroke.  An edge costs its sum of squared
+residuals against the better of its normal and inverse fits, so vertical
+edges are not penalized, and with CumulativeSums every edge costs O(1):
+
+1. Coarse pass: the corners may only sit on every step-th point, at most
+   CORNER_SEARCH_CANDIDATES candidates.  For every choice of the first corner
+   a dynamic program over the other three finds the cheapest split, O(M^3)
+   additions in all over the M^2 edge costs, which are computed once.
+   Partial costs that already exceed the best split found so far (seeded
+   with the heuristic's corners) are pruned.
+2. Refinement: each corner in turn moves to the cheapest point within one
+   step of where it is, until no corner moves.
+
+Strokes of up to CORNER_SEARCH_CANDIDATES points are searched exhaustively.
+*/
+
+#ifndef DYNACARD_CORNER_SEARCH_H
+#define DYNACARD_CORNER_SEARCH_H
+
+#include <cmath>
+
+#include "line_fit.h"
+
+enum CornerMethod { HEURISTIC_CORNERS, OPTIMAL_CORNERS };
+
+const int CORNER_SEARCH_CANDIDATES = 48;
+const int CORNER_SEARCH_MIN_EDGE_POINTS = 3; // fewer points don't define a line
+const int CORNER_SEARCH_MAX_PASSES = 16;
+
+/*
+Indices of the corners, in the order the stroke passes them: lower left,
+upper left, upper right, lower right.  Edge k runs from corner k up to
+(not including) corner k+1, rolling over the end of the card.
+*/
+struct Corners {
+	int lower_left, upper_left, upper_right, lower_right;
+};
+
+inline int count_with_rollover(int from, int to, int n) {
+	return (to - from + n) % n;
+}
+
+// The extremes of x+2y (lower left/upper right) and x-2y (upper left/lower right).
+// Ties go to the first point, like min_element/max_element.
+inline Corners find_heuristic_corners(const CumulativeSums& sums) {
+	Corners c = { 0, 0, 0, 0 };
+	double min_upper_right = INFINITY, max_upper_right = -INFINITY;
+	double min_lower_right = INFINITY, max_lower_right = -INFINITY;
+	for (int i = 0; i < sums.n_points; i++) {
+		double direction_upper_right = sums.xs[i] + 2 * sums.ys[i];
+		double direction_lower_right = sums.xs[i] - 2 * sums.ys[i];
+		if (direction_upper_right < min_upper_right) { min_upper_right = direction_upper_right; c.lower_left = i; }
+		if (direction_upper_right > max_upper_right) { max_upper_right = direction_upper_right; c.upper_right = i; }
+		if (direction_lower_right < min_lower_right) { min_lower_right = direction_lower_right; c.upper_left = i; }
+		if (direction_lower_right > max_lower_right) { max_lower_right = direction_lower_right; c.lower_right = i; }
+	}
+	return c;
+}
+
+// Sum of squared residuals of count points starting at first, against the better of the two fits
+inline double edge_residual(const CumulativeSums& sums, int first, int count) {
+	if (count < CORNER_SEARCH_MIN_EDGE_POINTS) return INFINITY;
+	double normal_r2 = sums.fit(first, count).r2;
+	double inverse_r2 = sums.inverse_fit(first, count).r2;
+	// NaN (all points on one x, or one y) means the other fit is exact
+	if (std::isnan(normal_r2)) normal_r2 = inverse_r2;
+	if (std::isnan(inverse_r2)) inverse_r2 = normal_r2;
+	double r2 = normal_r2 < inverse_r2 ? normal_r2 : inverse_r2;
+	return std::isnan(r2) ? 0 : r2 * count;
+}
+
+// Total residual of the four edges between corners c[0..3], in stroke order
+inline double corners_residual(const CumulativeSums& sums, const int c[4]) {
+	int n = sums.n_points;
+	double total = 0;
+	for (int k = 0; k < 4; k++) {
+		int count = count_with_rollover(c[k], c[(k + 1) % 4], n);
+		if (count == 0) count = n; // a single corner would make one edge of everything
+		total += edge_residual(sums, c[k], count);
+	}
+	return total;
+}
+
+/*
+Label four corners found in stroke order: the one closest to the heuristic's
+idea of lower left (smallest x+2y) becomes lower left and the rest follow.
+*/
+inline Corners label_corners(const CumulativeSums& sums, const int c[4]) {
+	int first = 0;
+	for (int k = 1; k < 4; k++) {
+		if (sums.xs[c[k]] + 2 * sums.ys[c[k]] < sums.xs[c[first]] + 2 * sums.ys[c[first]]) first = k;
+	}
+	Corners ret = { c[first], c[(first + 1) % 4], c[(first + 2) % 4], c[(first + 3) % 4] };
+	return ret;
+}
+
+inline Corners find_optimal_corners(const CumulativeSums& sums) {
+	int n = sums.n_points;
+	Corners heuristic = find_heuristic_corners(sums);
+	if (n < 4 * CORNER_SEARCH_MIN_EDGE_POINTS) return heuristic;
+
+	// Candidates every step points, starting at the heuristic lower left so
+	// that it is tried first
+	int step = (n + CORNER_SEARCH_CANDIDATES - 1) / CORNER_SEARCH_CANDIDATES;
+	int m = n / step;
+	int candidates[CORNER_SEARCH_CANDIDATES];
+	for (int j = 0; j < m; j++) candidates[j] = (heuristic.lower_left + j * step) % n;
+
+	// The heuristic corners, in stroke order, bound the search
+	int best[4] = { heuristic.lower_left, heuristic.upper_left, heuristic.upper_right, heuristic.lower_right };
+	double best_cost = corners_residual(sums, best);
+	bool heuristic_in_order = 0 < count_with_rollover(best[0], best[1], n)
+		&& count_with_rollover(best[0], best[1], n) < count_with_rollover(best[0], best[2], n)
+		&& count_with_rollover(best[0], best[2], n) < count_with_rollover(best[0], best[3], n);
+	if (!heuristic_in_order || std::isnan(best_cost)) best_cost = INFINITY;
+
+	// Every edge between two candidates, whichever corner comes first
+	static_assert(CORNER_SEARCH_CANDIDATES <= 64, "the search tables live on the stack");
+	double edge_cost[CORNER_SEARCH_CANDIDATES * CORNER_SEARCH_CANDIDATES];
+	for (int a = 0; a < m; a++) {
+		for (int b = 0; b < m; b++) {
+			edge_cost[a * m + b] = (a == b) ? INFINITY : edge_residual(sums, candidates[a], count_with_rollover(candidates[a], candidates[b], n));
+		}
+	}
+
+	// cost[k][j]: cheapest k+1 edges from the first corner to candidate j;
+	// from[k][j]: where the last of those edges starts
+	double cost[3][CORNER_SEARCH_CANDIDATES];
+	int from[3][CORNER_SEARCH_CANDIDATES];
+	for (int i0 = 0; i0 < m; i0++) {
+		// Candidates in stroke order starting from this first corner
+		int c0 = candidates[i0];
+		for (int j = 1; j < m; j++) {
+			cost[0][j] = edge_cost[i0 * m + (i0 + j) % m];
+			from[0][j] = 0;
+		}
+		for (int k = 1; k < 3; k++) {
+			for (int j = 0; j < m; j++) cost[k][j] = INFINITY;
+			for (int i = k; i < m; i++) {
+				double so_far = cost[k - 1][i];
+				if (!(so_far < best_cost)) continue;
+				const double* from_i = &edge_cost[((i0 + i) % m) * m];
+				for (int j = i + 1; j < m; j++) {
+					double c = so_far + from_i[(i0 + j) % m];
+					if (c < cost[k][j]) {
+						cost[k][j] = c;
+						from[k][j] = i;
+					}
+				}
+			}
+		}
+		for (int j = 3; j < m; j++) {
+			if (!(cost[2][j] < best_cost)) continue;
+			int cj = candidates[(i0 + j) % m];
+			double c = cost[2][j] + edge_cost[((i0 + j) % m) * m + i0];
+			if (c < best_cost) {
+				best_cost = c;
+				int j2 = from[2][j], j1 = from[1][j2];
+				best[0] = c0;
+				best[1] = candidates[(i0 + j1) % m];
+				best[2] = candidates[(i0 + j2) % m];
+				best[3] = cj;
+			}
+		}
+	}
+	if (best_cost == INFINITY) return heuristic;
+
+	// Refine each corner to the exact point within a step of it
+	for (int pass = 0; pass < CORNER_SEARCH_MAX_PASSES && step > 1; pass++) {
+		bool moved = false;
+		for (int k = 0; k < 4; k++) {
+			int prev = best[(k + 3) % 4], next = best[(k + 1) % 4];
+			int keep = best[k];
+			for (int d = -step; d <= step; d++) {
+				int c = ((keep + d) % n + n) % n;
+				// Stay strictly between the neighbouring corners
+				if (count_with_rollover(prev, c, n) >= count_with_rollover(prev, next, n)) continue;
+				if (c == prev) continue;
+				int trial[4] = { best[0], best[1], best[2], best[3] };
+				trial[k] = c;
+				double t = corners_residual(sums, trial);
+				if (t < best_cost) {
+					best_cost = t;
+					best[k] = c;
+					moved = true;
+				}
+			}
+		}
+		if (!moved) break;
+	}
+	return label_corners(sums, best);
+}
+
+inline Corners find_corners(const CumulativeSums& sums, CornerMethod method) {
+	return method == OPTIMAL_CORNERS ? find_optimal_corners(sums) : find_heuristic_corners(sums);
+}
+
+#endif // DYNACARD_CORNER_SEARCH_H
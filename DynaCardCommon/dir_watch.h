@@ -0,0 +1,72 @@
+/*
+Waits for files to be finished in a directory, using inotify (Linux only).
+
+A file counts as finished when a writer that had it open for writing closes
+it (IN_CLOSE_WRITE), or when it is renamed into the directory (IN_MOVED_TO),
+which is how loggers that write to a temporary name first deliver their
+files.  A file that is rewritten in place is reported again when it is
+closed.  Nothing is ever rescanned: a file that was already there before the
+watch started is only reported once it is written to again.
+*/
+
+#ifndef DYNACARD_DIR_WATCH_H
+#define DYNACARD_DIR_WATCH_H
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstddef>
+#include <deque>
+#include <string>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+class DirectoryWatch {
+public:
+	DirectoryWatch() {
+		fd = -1;
+	}
+	~DirectoryWatch() {
+		if (fd >= 0) close(fd);
+	}
+	DirectoryWatch(const DirectoryWatch&) = delete;
+	DirectoryWatch& operator=(const DirectoryWatch&) = delete;
+
+	// Start watching directory; false if it cannot be watched
+	bool open(const std::string& directory) {
+		dir = directory;
+		if (!dir.empty() && dir[dir.size() - 1] != '/') dir += '/';
+		fd = inotify_init1(IN_CLOEXEC);
+		if (fd < 0) return false;
+		return inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0;
+	}
+
+	// Block until the next file is finished and return its path; false on error
+	bool next(std::string& path) {
+		while (pending.empty()) {
+			// Room for many events, each with a name of up to NAME_MAX bytes
+			alignas(struct inotify_event) char buffer[64 * 1024];
+			ssize_t n = read(fd, buffer, sizeof(buffer));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			for (char* p = buffer; p < buffer + n; ) {
+				const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+				if (event->len > 0 && !(event->mask & IN_ISDIR)) pending.push_back(dir + event->name);
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+		path = pending.front();
+		pending.pop_front();
+		return true;
+	}
+
+private:
+	int fd;
+	std::string dir;
+	std::deque<std::string> pending;
+};
+
+#endif // __linux__
+
+#endif // DYNACARD_DIR_WATCH_H
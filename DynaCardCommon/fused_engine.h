@@ -0,0 +1,90 @@
+/*
+The pump state and the shape properties of ComputeShapeProperties in one
+pass over a card.  The card is parsed and normalized once and its four edges
+fitted once: the classifier's rules test the edges, and the FourSidedFigure
+is built from the same fitted lines, so the cycle extraction, normalization,
+corner search and line fits of fit_FourSidedFigure are not done a second
+time.
+
+The state is exactly classify_card's.  The shape properties are measured on
+the classifier's cycle (first_cycle_range, by position) rather than on
+extract_one_cycle's (by length), with the figure's corners where the
+classifier placed them, so they come close to what compute_shape_properties
+prints for the same file but are not the same numbers.
+*/
+
+#ifndef DYNACARD_FUSED_ENGINE_H
+#define DYNACARD_FUSED_ENGINE_H
+
+#include <cmath>
+
+#include "card.h"
+#include "pump_state.h"
+#include "shape_properties.h"
+#include "metrics.h"
+#include "trace.h"
+
+// Everything known about one card after classify_and_measure
+struct CardRecord {
+	const char* state;
+	EdgeFit fits[4];     // as classify_card gives them
+	double area;         // NaN for a card too short for four corners
+	double distance_from_shape;
+	double distance_from_rotated_shape;
+};
+
+// The classifier's edge as a Line of the shape properties: the same points, the same fit
+inline Line line_of_edge(const Edge& edge) {
+	Line line(edge.name);
+	line.first = edge.first;
+	line.n_points = edge.numberOfPoints;
+	line.normal_fitted_line = edge.normal_fitted_line;
+	line.inverse_fitted_line = edge.inverse_fitted_line;
+	line.slope = edge.slope;
+	line.intercept = edge.intercept;
+	line.r2 = edge.r2;
+	line.length = edge.length;
+	return line;
+}
+
+/*
+Classify card as classify_card does, then measure the area of the card and
+the distances of its points from the FourSidedFigure of its four edges, and
+from that rotated 180 degrees.  Returns the state.
+*/
+inline const char* classify_and_measure(Card& card, double min_acceptable_peak_weight, CornerMethod corner_method, CardRecord& record) {
+	record.area = record.distance_from_shape = record.distance_from_rotated_shape = NAN;
+	Edge edges[4];
+	record.state = classify_card(card, min_acceptable_peak_weight, corner_method, record.fits, edges);
+	int n = static_cast<int>(card.size());
+	if (n < 4) return record.state;
+	{
+		METRICS_TIME(STAGE_AREA);
+		TRACE_SPAN("compute_area");
+		record.area = compute_area(card.x(), card.y(), n);
+	}
+	// Vertex 1 of a FourSidedFigure is its leftmost corner, the edges going clockwise from it
+	int first = 0;
+	for (int k = 1; k < 4; k++) {
+		if (card.x()[edges[k].first] < card.x()[edges[first].first]) first = k;
+	}
+	FourSidedFigure* trap;
+	{
+		METRICS_TIME(STAGE_FIGURE);
+		TRACE_SPAN("FourSidedFigure");
+		trap = new FourSidedFigure(line_of_edge(edges[first]), line_of_edge(edges[(first + 1) % 4]),
+			line_of_edge(edges[(first + 2) % 4]), line_of_edge(edges[(first + 3) % 4]));
+	}
+	{
+		METRICS_TIME(STAGE_DISTANCE);
+		TRACE_SPAN("mean_distance");
+		record.distance_from_shape = mean_distance(*trap, card.x(), card.y(), n);
+		FourSidedFigure* rotated_trap = trap->rotate180deg();
+		record.distance_from_rotated_shape = mean_distance(*rotated_trap, card.x(), card.y(), n);
+		delete rotated_trap;
+	}
+	delete trap;
+	return record.state;
+}
+
+#endif // DYNACARD_FUSED_ENGINE_H
@@ -0,0 +1,376 @@
+/*
+A pump state classifier by nearest neighbours: a card is given the state
+most of the KNN_NEIGHBOURS reference cards whose shape descriptors
+(shape_descriptor.h) lie nearest to its own are labelled with.  Unlike
+guess_pump_state it needs no rule per state, and a state it has no rule
+for is learnt by adding labelled cards of it to the library.
+
+The library is indexed by a vantage point tree, which needs nothing of the
+descriptors but that their distance is a metric, so it stays fast in the
+26 dimensions of a descriptor where a KD-tree degenerates into scanning.
+Every node holds a vantage point and the median distance of the points
+below it from it: the nearer half go left, the farther right, and a query
+skips a side its current k-th nearest distance cannot reach into.  Small
+ranges are scanned as they are.
+
+Reference library file (".knn"), in the byte order of the machine that
+wrote it (checked on open):
+
+  ReferenceLibraryHeader               64 bytes, fixed
+  state names[n_states]                24 bytes each, NUL terminated
+  labels[n_cards]                      uint16_t, index into the names
+  descriptors[n_cards]                 DESCRIPTOR_SIZE floats each, from
+                                       the next 8 byte boundary
+
+The tree is not stored; it is built when the library is loaded.  Bump
+REFERENCE_LIBRARY_VERSION whenever the layout or the descriptor changes;
+readers refuse any version but their own.
+*/
+
+#ifndef DYNACARD_KNN_CLASSIFIER_H
+#define DYNACARD_KNN_CLASSIFIER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "card_parser.h"
+#include "card.h"
+#include "shape_descriptor.h"
+#include "metrics.h"
+#include "trace.h"
+
+const int KNN_NEIGHBOURS = 5;
+const int KNN_MAX_NEIGHBOURS = 64;
+const size_t VP_TREE_LEAF_SIZE = 8;
+
+// A reference card found by a query, by its index in the order the cards were added
+struct Neighbour {
+	float distance;
+	uint32_t index;
+	bool operator<(const Neighbour& other) const {
+		return distance < other.distance || (distance == other.distance && index < other.index);
+	}
+};
+
+// The k nearest so far, nearest first
+class NeighbourList {
+public:
+	NeighbourList(int k_wanted) {
+		k = std::max(1, std::min(k_wanted, KNN_MAX_NEIGHBOURS));
+		n = 0;
+	}
+	void offer(float distance, uint32_t index) {
+		Neighbour candidate = { distance, index };
+		if (n == k && !(candidate < found[n - 1])) return;
+		int i = n < k ? n++ : n - 1;
+		while (i > 0 && candidate < found[i - 1]) {
+			found[i] = found[i - 1];
+			i--;
+		}
+		found[i] = candidate;
+	}
+	// The distance a point must beat to be one of the k
+	float reach() const {
+		return n < k ? std::numeric_limits<float>::infinity() : found[n - 1].distance;
+	}
+	int size() const {
+		return n;
+	}
+	const Neighbour& operator[](int i) const {
+		return found[i];
+	}
+private:
+	Neighbour found[KNN_MAX_NEIGHBOURS];
+	int k, n;
+};
+
+class VantagePointTree {
+public:
+	// Index points, which are copied in tree order
+	void build(const std::vector<ShapeDescriptor>& points) {
+		nodes.clear();
+		order.resize(points.size());
+		for (size_t i = 0; i < order.size(); i++) order[i] = static_cast<uint32_t>(i);
+		random_state = 0x2545F4914F6CDD1DULL;
+		std::vector<float> scratch(points.size());
+		if (!points.empty()) build_range(points, 0, static_cast<uint32_t>(points.size()), scratch);
+		ordered.resize(points.size());
+		for (size_t i = 0; i < order.size(); i++) ordered[i] = points[order[i]];
+	}
+
+	size_t size() const {
+		return ordered.size();
+	}
+
+	// The k nearest points to query, nearest first
+	void nearest(const ShapeDescriptor& query, NeighbourList& best) const {
+		if (!nodes.empty()) search(0, query, best);
+	}
+
+	// The same by comparing query with every point, to check and time the tree against
+	void nearest_by_scan(const ShapeDescriptor& query, NeighbourList& best) const {
+		for (size_t i = 0; i < ordered.size(); i++) best.offer(descriptor_distance(query, ordered[i]), order[i]);
+	}
+
+private:
+	// Points [first, end) of ordered; first is the vantage point of an inner node
+	struct Node {
+		uint32_t first, end;
+		uint32_t inside, outside;   // nodes of the points nearer and farther than threshold; NO_NODE for none
+		float threshold;
+	};
+	static const uint32_t NO_NODE = 0xFFFFFFFF;
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> order;            // ordered[i] is point order[i] of build
+	std::vector<ShapeDescriptor> ordered;
+	uint64_t random_state;
+
+	// splitmix64, so the same points always make the same tree
+	uint64_t next_random() {
+		uint64_t z = (random_state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	uint32_t build_range(const std::vector<ShapeDescriptor>& points, uint32_t first, uint32_t end, std::vector<float>& distance) {
+		uint32_t node = static_cast<uint32_t>(nodes.size());
+		Node leaf = { first, end, NO_NODE, NO_NODE, 0 };
+		nodes.push_back(leaf);
+		if (end - first <= VP_TREE_LEAF_SIZE) return node;
+		std::swap(order[first], order[first + next_random() % (end - first)]);
+		const ShapeDescriptor& vantage = points[order[first]];
+		for (uint32_t i = first + 1; i < end; i++) distance[order[i]] = descriptor_distance(vantage, points[order[i]]);
+		uint32_t middle = first + 1 + (end - first - 1) / 2;
+		std::nth_element(order.begin() + first + 1, order.begin() + middle, order.begin() + end,
+			[&](uint32_t a, uint32_t b) { return distance[a] < distance[b]; });
+		float threshold = distance[order[middle]];
+		uint32_t inside = build_range(points, first + 1, middle, distance);
+		uint32_t outside = build_range(points, middle, end, distance);
+		nodes[node].inside = inside;
+		nodes[node].outside = outside;
+		nodes[node].threshold = threshold;
+		return node;
+	}
+
+	void search(uint32_t n, const ShapeDescriptor& query, NeighbourList& best) const {
+		const Node& node = nodes[n];
+		if (node.inside == NO_NODE) {
+			for (uint32_t i = node.first; i < node.end; i++) best.offer(descriptor_distance(query, ordered[i]), order[i]);
+			return;
+		}
+		float d = descriptor_distance(query, ordered[node.first]);
+		best.offer(d, order[node.first]);
+		// The inside points are no farther than threshold from the vantage point, the outside ones no nearer
+		if (d < node.threshold) {
+			search(node.inside, query, best);
+			if (d + best.reach() >= node.threshold) search(node.outside, query, best);
+		}
+		else {
+			search(node.outside, query, best);
+			if (d - best.reach() <= node.threshold) search(node.inside, query, best);
+		}
+	}
+};
+
+const char REFERENCE_LIBRARY_MAGIC[8] = { 'D', 'Y', 'N', 'A', 'K', 'N', 'N', 0 };
+const uint32_t REFERENCE_LIBRARY_VERSION = 1;
+const uint32_t REFERENCE_LIBRARY_BYTE_ORDER = 0x01020304;
+const size_t REFERENCE_STATE_NAME = 24;
+
+struct ReferenceLibraryHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t descriptor_size;    // DESCRIPTOR_SIZE of the writer
+	uint32_t n_states;
+	uint64_t n_cards;
+	char reserved[32];
+};
+static_assert(sizeof(ReferenceLibraryHeader) == 64, "ReferenceLibraryHeader must stay 64 bytes");
+
+/*
+Labelled shape descriptors and their tree.  Add cards, then build_index (or
+load a saved library, which builds it) before classifying.  classify and
+nearest may be called from several threads at once.
+*/
+class ReferenceLibrary {
+public:
+	// The state names the cards are labelled with
+	std::vector<std::string> states;
+
+	// False, adding nothing, if state is too long to save with its NUL in REFERENCE_STATE_NAME bytes
+	bool add(const ShapeDescriptor& descriptor, const std::string& state) {
+		if (state.size() >= REFERENCE_STATE_NAME) return false;
+		size_t label = std::find(states.begin(), states.end(), state) - states.begin();
+		if (label == states.size()) states.push_back(state);
+		descriptors.push_back(descriptor);
+		labels.push_back(static_cast<uint16_t>(label));
+		return true;
+	}
+
+	void build_index() {
+		tree.build(descriptors);
+	}
+
+	size_t size() const {
+		return descriptors.size();
+	}
+	const char* state_of(uint32_t card) const {
+		return states[labels[card]].c_str();
+	}
+
+	void nearest(const ShapeDescriptor& descriptor, NeighbourList& best) const {
+		tree.nearest(descriptor, best);
+	}
+	void nearest_by_scan(const ShapeDescriptor& descriptor, NeighbourList& best) const {
+		tree.nearest_by_scan(descriptor, best);
+	}
+
+	/*
+	The state most of the k nearest reference cards have, a tie going to the
+	state of the nearest of them; "other??" for an empty library or when
+	even the nearest card is farther than max_distance.
+	*/
+	const char* classify(const ShapeDescriptor& descriptor, int k = KNN_NEIGHBOURS,
+		float max_distance = std::numeric_limits<float>::infinity()) const {
+		NeighbourList best(k);
+		tree.nearest(descriptor, best);
+		if (best.size() == 0 || best[0].distance > max_distance) return "other??";
+		return vote(best);
+	}
+
+	// The state most of best have, a tie going to the nearest
+	const char* vote(const NeighbourList& best) const {
+		int votes[KNN_MAX_NEIGHBOURS] = { 0 };   // votes[j]: of best for the state of best[j], the nearest of that state
+		for (int i = 0; i < best.size(); i++) {
+			int j = 0;
+			while (labels[best[j].index] != labels[best[i].index]) j++;
+			votes[j]++;
+		}
+		int winner = 0;
+		for (int j = 1; j < best.size(); j++) {
+			if (votes[j] > votes[winner]) winner = j;
+		}
+		return state_of(best[winner].index);
+	}
+
+	// Returns false if the file could not be written
+	bool save(const std::string& fname) const {
+		ReferenceLibraryHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, REFERENCE_LIBRARY_MAGIC, sizeof(header.magic));
+		header.version = REFERENCE_LIBRARY_VERSION;
+		header.byte_order = REFERENCE_LIBRARY_BYTE_ORDER;
+		header.descriptor_size = DESCRIPTOR_SIZE;
+		header.n_states = static_cast<uint32_t>(states.size());
+		header.n_cards = descriptors.size();
+		std::vector<char> names(states.size() * REFERENCE_STATE_NAME, 0);
+		for (size_t s = 0; s < states.size(); s++) memcpy(&names[s * REFERENCE_STATE_NAME], states[s].data(), states[s].size());
+		char padding[8] = { 0 };
+
+		FILE* out = fopen(fname.c_str(), "wb");
+		if (out == NULL) return false;
+		bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+		ok = ok && (names.empty() || fwrite(names.data(), 1, names.size(), out) == names.size());
+		ok = ok && (labels.empty() || fwrite(labels.data(), sizeof(uint16_t), labels.size(), out) == labels.size());
+		ok = ok && fwrite(padding, 1, padding_after(header), out) == padding_after(header);
+		ok = ok && (descriptors.empty() || fwrite(descriptors.data(), sizeof(ShapeDescriptor), descriptors.size(), out) == descriptors.size());
+		ok = (fclose(out) == 0) && ok;
+		return ok;
+	}
+
+	// Replace the library by the one in fname and index it; false, leaving it empty, if fname is not one this version reads
+	bool load(const std::string& fname) {
+		states.clear();
+		labels.clear();
+		descriptors.clear();
+		MappedFile file;
+		bool ok = file.open(fname) && read(file.data, file.size);
+		if (!ok) {
+			states.clear();
+			labels.clear();
+			descriptors.clear();
+		}
+		build_index();
+		return ok;
+	}
+
+private:
+	std::vector<ShapeDescriptor> descriptors;
+	std::vector<uint16_t> labels;
+	VantagePointTree tree;
+
+	static size_t padding_after(const ReferenceLibraryHeader& header) {
+		size_t used = sizeof(header) + header.n_states * REFERENCE_STATE_NAME + header.n_cards * sizeof(uint16_t);
+		return (8 - used % 8) % 8;
+	}
+
+	bool read(const char* data, size_t size) {
+		if (size < sizeof(ReferenceLibraryHeader)) return false;
+		ReferenceLibraryHeader header;
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.magic, REFERENCE_LIBRARY_MAGIC, sizeof(header.magic)) != 0) return false;
+		if (header.byte_order != REFERENCE_LIBRARY_BYTE_ORDER || header.version != REFERENCE_LIBRARY_VERSION) return false;
+		if (header.descriptor_size != DESCRIPTOR_SIZE || header.n_states > 0xFFFF) return false;
+		if (header.n_cards > size / (sizeof(uint16_t) + sizeof(ShapeDescriptor))) return false;
+		size_t names_offset = sizeof(header);
+		size_t labels_offset = names_offset + header.n_states * REFERENCE_STATE_NAME;
+		size_t descriptors_offset = labels_offset + header.n_cards * sizeof(uint16_t) + padding_after(header);
+		if (descriptors_offset + header.n_cards * sizeof(ShapeDescriptor) > size) return false;
+		for (uint32_t s = 0; s < header.n_states; s++) {
+			const char* name = data + names_offset + s * REFERENCE_STATE_NAME;
+			if (memchr(name, 0, REFERENCE_STATE_NAME) == nullptr) return false;
+			states.push_back(std::string(name));
+		}
+		labels.resize(header.n_cards);
+		descriptors.resize(header.n_cards);
+		if (header.n_cards > 0) {
+			memcpy(labels.data(), data + labels_offset, header.n_cards * sizeof(uint16_t));
+			memcpy(descriptors.data(), data + descriptors_offset, header.n_cards * sizeof(ShapeDescriptor));
+		}
+		for (size_t i = 0; i < labels.size(); i++) {
+			if (labels[i] >= states.size()) return false;
+		}
+		return true;
+	}
+};
+
+/*
+Classify a card by its nearest reference cards.  A stroke whose peak weight
+stays below min_acceptable_peak_weight is a flowing well, as classify_card
+has it, since normalizing leaves nothing of the load for the descriptor to
+tell it by; anything else gets library.classify's state.  Normalizes the
+card.
+*/
+inline const char* classify_card_knn(Card& card, double min_acceptable_peak_weight, const ReferenceLibrary& library,
+	int k = KNN_NEIGHBOURS) {
+	TRACE_SPAN("classify_card_knn");
+	if (card.size() == 0) return METRICS_COUNT_CARD("other??");
+	{
+		METRICS_TIME(STAGE_NORMALIZE);
+		TRACE_SPAN("normalize");
+		card.normalize();
+	}
+	if (card.max_weight < min_acceptable_peak_weight) return METRICS_COUNT_CARD("flowing well");
+	METRICS_TIME(STAGE_KNN);
+	TRACE_SPAN("nearest reference cards");
+	ShapeDescriptor descriptor;
+	if (!describe_shape(card.x(), card.y(), card.size(), descriptor)) return METRICS_COUNT_CARD("other??");
+	return METRICS_COUNT_CARD(library.classify(descriptor, k));
+}
+
+// Describe a card as classify_card_knn does, without classifying it; false if it has no shape to describe
+inline bool describe_card(Card& card, ShapeDescriptor& descriptor) {
+	if (card.size() == 0) return false;
+	card.normalize();
+	return describe_shape(card.x(), card.y(), card.size(), descriptor);
+}
+
+#endif // DYNACARD_KNN_CLASSIFIER_H
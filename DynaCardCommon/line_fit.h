@@ -0,0 +1,132 @@
+/*
+Least squares line fits over any run of consecutive points of a card in
+constant time.
+
+CumulativeSums keeps running totals of x, y, x^2, y^2 and xy over the
+normalized stroke.  The sums over a run of points are the difference of two
+entries, and a fitted line, its inverse (x as a function of y) and the mean
+squared residual follow from those five sums.  Splitting a card into edges,
+or an edge into halves, then costs nothing more than picking index ranges.
+*/
+
+#ifndef DYNACARD_LINE_FIT_H
+#define DYNACARD_LINE_FIT_H
+
+#include <cmath>
+#include <vector>
+
+#include "simd_kernels.h"
+
+struct FittedLine {
+	double slope;
+	double intercept;
+	double r2;
+};
+
+// Sums of the five moments over some points
+struct Moments {
+	double x, y, xx, yy, xy;
+};
+static_assert(sizeof(Moments) == MOMENT_COUNT * sizeof(double), "Moments must be laid out as running_moments writes them");
+
+// Below this fraction of n*sxx, n*sxx - sx*sx is rounding left over from the running sums
+const double LINE_FIT_MIN_SPREAD = 1e-10;
+
+/*
+Fit a line for y as a function of x from the sums over n points, using least
+squares.  r2 is the mean squared residual, computed from the centered sums
+(the same value as summing (slope*x + intercept - y)^2 point by point).
+
+Fewer than two points, or points all on one x, have no line: slope,
+intercept and r2 are NaN, as the point by point fit's 0/0 made them, so the
+edge is neither a good fit nor flat.  The differences of running sums leave a
+tiny spread there instead of an exact 0, hence the relative test.
+*/
+inline FittedLine fit_line_from_moments(double n, double sx, double sy, double sxx, double syy, double sxy) {
+	FittedLine fit;
+	double spread = n * sxx - sx * sx;
+	if (n < 2 || !(fabs(spread) > LINE_FIT_MIN_SPREAD * fabs(n * sxx))) {
+		fit.slope = fit.intercept = fit.r2 = NAN;
+		return fit;
+	}
+	fit.slope = (n*sxy - sx * sy) / spread;
+	fit.intercept = (sxx*sy - sx * sxy) / spread;
+	double syy_centered = syy - sy * sy / n;
+	double sxy_centered = sxy - sx * sy / n;
+	fit.r2 = (syy_centered - fit.slope * sxy_centered) / n;
+	// Rounding can leave a perfect fit a hair below zero
+	if (fit.r2 < 0) fit.r2 = 0;
+	return fit;
+}
+
+/*
+Running totals of the moments of a card's points.  The points themselves stay
+with the caller and must outlive this object.  The totals are kept in a vector
+of their own, or with build_into in storage the caller provides (Card keeps
+them in its buffer).  Index ranges may roll over the end of the card, since a
+stroke is a closed loop.
+*/
+class CumulativeSums {
+public:
+	const double* xs;
+	const double* ys;
+	int n_points;
+	CumulativeSums() {
+		xs = ys = nullptr;
+		n_points = 0;
+		cum = nullptr;
+	}
+	CumulativeSums(const std::vector<double>& x, const std::vector<double>& y) {
+		build(x.data(), y.data(), static_cast<int>(x.size()));
+	}
+	CumulativeSums(const CumulativeSums&) = delete;
+	CumulativeSums& operator=(const CumulativeSums&) = delete;
+	CumulativeSums(CumulativeSums&&) = default;
+	CumulativeSums& operator=(CumulativeSums&&) = default;
+	void build(const double* x, const double* y, int n) {
+		owned.resize(n + 1);
+		build_into(x, y, n, owned.data());
+	}
+	// storage must hold n + 1 entries and outlive this object
+	void build_into(const double* x, const double* y, int n, Moments* storage) {
+		xs = x;
+		ys = y;
+		n_points = n;
+		cum = storage;
+		simd_kernels().running_moments(x, y, n, reinterpret_cast<double*>(storage));
+	}
+	// Sums over count points starting at first, rolling over the end of the card
+	Moments range(int first, int count) const {
+		if (first + count <= n_points) return difference(cum[first + count], cum[first]);
+		Moments tail = difference(cum[n_points], cum[first]);
+		const Moments& head = cum[first + count - n_points];
+		Moments m = { tail.x + head.x, tail.y + head.y, tail.xx + head.xx, tail.yy + head.yy, tail.xy + head.xy };
+		return m;
+	}
+	// y as a function of x over count points starting at first
+	FittedLine fit(int first, int count) const {
+		Moments m = range(first, count);
+		return fit_line_from_moments(count, m.x, m.y, m.xx, m.yy, m.xy);
+	}
+	// x as a function of y over the same points
+	FittedLine inverse_fit(int first, int count) const {
+		Moments m = range(first, count);
+		return fit_line_from_moments(count, m.y, m.x, m.yy, m.xx, m.xy);
+	}
+	// Coordinates of point i, rolling over the end of the card
+	double x(int i) const {
+		return xs[i % n_points];
+	}
+	double y(int i) const {
+		return ys[i % n_points];
+	}
+private:
+	const Moments* cum; // cum[i] holds the sums over points [0, i)
+	std::vector<Moments> owned;
+	static Moments difference(const Moments& a, const Moments& b) {
+		Moments m = { a.x - b.x, a.y - b.y, a.xx - b.xx, a.yy - b.yy, a.xy - b.xy };
+		return m;
+	}
+};
+
+#endif // DYNACARD_LINE_FIT_H
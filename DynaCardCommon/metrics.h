@@ -0,0 +1,366 @@
+/*
+Per-stage latency histograms and counters, for finding out where a slow card
+spends its time in production.
+
+Built only when DYNACARD_METRICS is defined (g++ -DDYNACARD_METRICS, or the
+project's preprocessor definitions).  Without it the METRICS_ macros expand
+to nothing, MetricsExporter::start fails, and not a single instruction is
+left in the classifier.
+
+Every stage keeps a log-linear latency histogram in the manner of
+HdrHistogram: exact below 32 ns, then 16 buckets per power of two, so a
+reported quantile is within 1/16 (6%) of the true one from nanoseconds to
+hours in under a thousand buckets.  Counts are relaxed atomics, so several
+worker threads record without taking a lock.
+
+The counters are the cards classified per pump state and the bytes of card
+text parsed.
+
+MetricsExporter writes everything, every interval and once more when it is
+stopped, to prefix.json and to prefix.prom in the Prometheus text format
+(for node_exporter's textfile collector, say).  Both are written to a
+temporary name and renamed, so a reader never sees half a file.
+*/
+
+#ifndef DYNACARD_METRICS_H
+#define DYNACARD_METRICS_H
+
+#include <string>
+
+enum MetricStage {
+	STAGE_FILE,        // one file to its report rows; batch runs read and parse it beforehand, on threads of their own
+	STAGE_READ,        // opening and mapping a card file
+	STAGE_PARSE,       // card text to columns
+	STAGE_NORMALIZE,   // Card::normalize
+	STAGE_EDGES,       // corner search and edge fits
+	STAGE_CLASSIFY,    // guess_pump_state
+	STAGE_CYCLE,       // ComputeShapeProperties: extract_one_cycle and normalize
+	STAGE_FIGURE,      // fit_FourSidedFigure
+	STAGE_AREA,        // compute_area
+	STAGE_DISTANCE,    // mean distances from the figure and from it rotated
+	STAGE_KNN,         // knn_classifier.h: shape descriptor and nearest reference cards
+	N_METRIC_STAGES
+};
+
+const char* const METRIC_STAGE_NAMES[N_METRIC_STAGES] = {
+	"file", "read", "parse", "normalize", "edges", "classify", "extract_cycle", "fit_figure", "area", "distance", "knn"
+};
+
+// Seconds between exports
+const double METRICS_EXPORT_INTERVAL = 10;
+
+#ifdef DYNACARD_METRICS
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Lock-free latency histogram of nanosecond values
+class LatencyHistogram {
+public:
+	static const int SUB_BUCKETS = 16;
+	static const int N_BUCKETS = 2 * SUB_BUCKETS + 60 * SUB_BUCKETS;
+
+	LatencyHistogram() {
+		for (int i = 0; i < N_BUCKETS; i++) counts[i] = 0;
+		total = 0;
+		sum = 0;
+		maximum = 0;
+	}
+
+	void record(uint64_t ns) {
+		counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+		total.fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(ns, std::memory_order_relaxed);
+		uint64_t seen = maximum.load(std::memory_order_relaxed);
+		while (ns > seen && !maximum.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+	}
+
+	uint64_t count() const {
+		return total.load(std::memory_order_relaxed);
+	}
+	uint64_t sum_ns() const {
+		return sum.load(std::memory_order_relaxed);
+	}
+	uint64_t max_ns() const {
+		return maximum.load(std::memory_order_relaxed);
+	}
+
+	// The value below which fraction q of the recorded values lie, to within a bucket
+	uint64_t quantile(double q) const {
+		uint64_t n = count();
+		if (n == 0) return 0;
+		uint64_t rank = static_cast<uint64_t>(q * n + 0.5);
+		if (rank < 1) rank = 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < N_BUCKETS; i++) {
+			seen += counts[i].load(std::memory_order_relaxed);
+			if (seen >= rank) {
+				// The middle of the bucket, but never past the largest value seen
+				uint64_t low = bucket_low(i), high = bucket_low(i + 1);
+				uint64_t value = low + (high - low) / 2;
+				return value < max_ns() ? value : max_ns();
+			}
+		}
+		return max_ns();
+	}
+
+private:
+	std::atomic<uint64_t> counts[N_BUCKETS];
+	std::atomic<uint64_t> total, sum, maximum;
+
+	static int highest_bit(uint64_t v) {
+#if defined(__GNUC__)
+		return 63 - __builtin_clzll(v);
+#elif defined(_MSC_VER) && defined(_WIN64)
+		unsigned long bit;
+		_BitScanReverse64(&bit, v);
+		return static_cast<int>(bit);
+#else
+		int bit = 0;
+		while (v >>= 1) bit++;
+		return bit;
+#endif
+	}
+	// Values below 2 * SUB_BUCKETS have a bucket each; above that the top 5 bits pick it
+	static int bucket(uint64_t v) {
+		if (v < 2 * SUB_BUCKETS) return static_cast<int>(v);
+		int shift = highest_bit(v) - 4;
+		return SUB_BUCKETS * (shift + 1) + static_cast<int>(v >> shift) - SUB_BUCKETS;
+	}
+	static uint64_t bucket_low(int i) {
+		if (i < 2 * SUB_BUCKETS) return i;
+		int shift = i / SUB_BUCKETS - 1;
+		return static_cast<uint64_t>(i % SUB_BUCKETS + SUB_BUCKETS) << shift;
+	}
+};
+
+class Metrics {
+public:
+	static const int MAX_STATES = 32;
+
+	LatencyHistogram stages[N_METRIC_STAGES];
+	std::atomic<uint64_t> bytes_parsed;
+
+	Metrics() {
+		bytes_parsed = 0;
+		for (int i = 0; i < MAX_STATES; i++) {
+			states[i] = nullptr;
+			cards[i] = 0;
+		}
+	}
+
+	/*
+	Count a card classified as state.  The states are the string literals
+	guess_pump_state returns, so a slot is claimed once per state and after
+	that found by comparing pointers.
+	*/
+	const char* count_card(const char* state) {
+		for (int i = 0; i < MAX_STATES; i++) {
+			const char* slot = states[i].load(std::memory_order_acquire);
+			if (slot == nullptr) {
+				if (!states[i].compare_exchange_strong(slot, state, std::memory_order_acq_rel)) {
+					// Another thread claimed it first; it may have been for this state
+					if (slot != state && strcmp(slot, state) != 0) continue;
+				}
+				cards[i].fetch_add(1, std::memory_order_relaxed);
+				return state;
+			}
+			if (slot == state || strcmp(slot, state) == 0) {
+				cards[i].fetch_add(1, std::memory_order_relaxed);
+				return state;
+			}
+		}
+		return state;
+	}
+
+	std::string json() const {
+		std::ostringstream out;
+		out << "{\"stages\":[" << std::endl;
+		bool first = true;
+		for (int s = 0; s < N_METRIC_STAGES; s++) {
+			const LatencyHistogram& h = stages[s];
+			if (h.count() == 0) continue;
+			out << (first ? "" : ",\n") << "{\"stage\":\"" << METRIC_STAGE_NAMES[s] << "\", \"count\":" << h.count()
+				<< ", \"mean_ns\":" << h.sum_ns() / h.count() << ", \"p50_ns\":" << h.quantile(0.5)
+				<< ", \"p99_ns\":" << h.quantile(0.99) << ", \"max_ns\":" << h.max_ns() << "}";
+			first = false;
+		}
+		out << std::endl << "]," << std::endl << "\"cards\":{";
+		for (int i = 0; i < MAX_STATES && states[i].load() != nullptr; i++) {
+			out << (i == 0 ? "" : ", ") << "\"" << states[i].load() << "\":" << cards[i].load();
+		}
+		out << "}," << std::endl << "\"bytes_parsed\":" << bytes_parsed.load() << "}" << std::endl;
+		return out.str();
+	}
+
+	std::string prometheus() const {
+		std::ostringstream out;
+		out << "# HELP dynacard_stage_seconds Latency of every stage of classifying a card." << std::endl
+			<< "# TYPE dynacard_stage_seconds summary" << std::endl;
+		for (int s = 0; s < N_METRIC_STAGES; s++) {
+			const LatencyHistogram& h = stages[s];
+			if (h.count() == 0) continue;
+			std::string label = std::string("stage=\"") + METRIC_STAGE_NAMES[s] + "\"";
+			out << "dynacard_stage_seconds{" << label << ",quantile=\"0.5\"} " << h.quantile(0.5) * 1e-9 << std::endl
+				<< "dynacard_stage_seconds{" << label << ",quantile=\"0.99\"} " << h.quantile(0.99) * 1e-9 << std::endl
+				<< "dynacard_stage_seconds_sum{" << label << "} " << h.sum_ns() * 1e-9 << std::endl
+				<< "dynacard_stage_seconds_count{" << label << "} " << h.count() << std::endl;
+		}
+		out << "# HELP dynacard_stage_max_seconds Slowest run of every stage." << std::endl
+			<< "# TYPE dynacard_stage_max_seconds gauge" << std::endl;
+		for (int s = 0; s < N_METRIC_STAGES; s++) {
+			if (stages[s].count() == 0) continue;
+			out << "dynacard_stage_max_seconds{stage=\"" << METRIC_STAGE_NAMES[s] << "\"} " << stages[s].max_ns() * 1e-9 << std::endl;
+		}
+		out << "# HELP dynacard_cards_total Cards classified, by pump state." << std::endl
+			<< "# TYPE dynacard_cards_total counter" << std::endl;
+		for (int i = 0; i < MAX_STATES && states[i].load() != nullptr; i++) {
+			out << "dynacard_cards_total{state=\"" << states[i].load() << "\"} " << cards[i].load() << std::endl;
+		}
+		out << "# HELP dynacard_bytes_parsed_total Bytes of card text parsed." << std::endl
+			<< "# TYPE dynacard_bytes_parsed_total counter" << std::endl
+			<< "dynacard_bytes_parsed_total " << bytes_parsed.load() << std::endl;
+		return out.str();
+	}
+
+private:
+	std::atomic<const char*> states[MAX_STATES];
+	std::atomic<uint64_t> cards[MAX_STATES];
+};
+
+// The process' metrics
+inline Metrics& metrics() {
+	static Metrics process_metrics;
+	return process_metrics;
+}
+
+// Records the time from its construction to its destruction against a stage
+class StageTimer {
+public:
+	explicit StageTimer(MetricStage timed_stage) {
+		stage = timed_stage;
+		start = std::chrono::steady_clock::now();
+	}
+	~StageTimer() {
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		metrics().stages[stage].record(static_cast<uint64_t>(ns));
+	}
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+	MetricStage stage;
+	std::chrono::steady_clock::time_point start;
+};
+
+// Write text to path by way of a temporary file
+inline bool write_metrics_file(const std::string& path, const std::string& text) {
+	std::string temp_path = path + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (!file) return false;
+	bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+	ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+	// rename does not replace an existing file here
+	if (ok) remove(path.c_str());
+#endif
+	if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+#define METRICS_CONCAT2(a, b) a##b
+#define METRICS_CONCAT(a, b) METRICS_CONCAT2(a, b)
+// Time the rest of the enclosing block as stage
+#define METRICS_TIME(stage) StageTimer METRICS_CONCAT(stage_timer_, __LINE__)(stage)
+// Evaluates to state, counting a card classified as it
+#define METRICS_COUNT_CARD(state) metrics().count_card(state)
+#define METRICS_COUNT_BYTES(n) metrics().bytes_parsed.fetch_add(n, std::memory_order_relaxed)
+
+#else
+
+#define METRICS_TIME(stage)
+#define METRICS_COUNT_CARD(state) (state)
+#define METRICS_COUNT_BYTES(n)
+
+#endif // DYNACARD_METRICS
+
+/*
+Writes prefix.json and prefix.prom every interval seconds from a thread of
+its own, and a last time when stopped or destroyed.
+*/
+class MetricsExporter {
+public:
+#ifdef DYNACARD_METRICS
+	MetricsExporter() {
+		running = false;
+	}
+	~MetricsExporter() {
+		stop();
+	}
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	bool start(const std::string& path_prefix, double interval = METRICS_EXPORT_INTERVAL) {
+		prefix = path_prefix;
+		if (!export_now()) return false;
+		running = true;
+		thread = std::thread([this, interval] {
+			std::unique_lock<std::mutex> lock(mutex);
+			while (running) {
+				stopping.wait_for(lock, std::chrono::duration<double>(interval));
+				if (running) export_now();
+			}
+		});
+		return true;
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running) return;
+			running = false;
+		}
+		stopping.notify_one();
+		thread.join();
+		export_now();
+	}
+
+	bool export_now() {
+		const Metrics& m = metrics();
+		return write_metrics_file(prefix + ".json", m.json()) && write_metrics_file(prefix + ".prom", m.prometheus());
+	}
+
+private:
+	std::string prefix;
+	bool running;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable stopping;
+#else
+	// Built without DYNACARD_METRICS: there is nothing to export
+	MetricsExporter() {}
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	bool start(const std::string&, double = METRICS_EXPORT_INTERVAL) {
+		return false;
+	}
+	void stop() {}
+#endif
+};
+
+#endif // DYNACARD_METRICS_H
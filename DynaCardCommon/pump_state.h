@@ -0,0 +1,379 @@
+/*
+Pump state classification of one stroke, shared by CPlusDynaCard and
+CPlusDeliverable.
+
+The stroke is normalized, split into left/top/right/bottom edges at the corners
+of the trapezoid, a line is fitted to each edge, and guess_pump_state matches
+the edge properties against the shapes of the known pump states.
+
+Edges are index ranges into the card.  Their lines come from the card's
+CumulativeSums (line_fit.h), so neither the edges nor the halves that
+guess_pump_state asks for copy points or refit them.  classify_card works on a
+Card (card.h) and allocates nothing: the edges live on the stack and the state
+is a string literal.
+*/
+
+#ifndef DYNACARD_PUMP_STATE_H
+#define DYNACARD_PUMP_STATE_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "simd_kernels.h"
+#include "line_fit.h"
+#include "corner_search.h"
+#include "card.h"
+#include "metrics.h"
+#include "trace.h"
+
+// Normalize a vector to range from 0.0 to 1.0
+inline std::vector<double> normalize(const std::vector<double>& inVec) {
+	std::vector<double> outVec(inVec.size());
+	if (inVec.empty()) return outVec;
+	const SimdKernels& kernels = simd_kernels();
+	double min_value, max_value;
+	kernels.min_max(inVec.data(), inVec.size(), min_value, max_value);
+	kernels.normalize(inVec.data(), outVec.data(), inVec.size(), min_value, max_value - min_value);
+	return outVec;
+}
+
+/*
+Thresholds of the edge and shape tests below.  result_cache.h hashes them
+together with CLASSIFIER_VERSION, so changing any of them invalidates the
+cached classifications; bump the version for changes to the tests themselves.
+*/
+const int CLASSIFIER_VERSION = 2;
+const double GOOD_FIT_R2 = 0.002;            // r2 of a line fitted to a straight edge
+const double VERTICAL_INVERSE_SLOPE = 0.1;   // |dx/dy| of a vertical edge
+const double SLOPE_UP = 0.5;
+const double SLOPE_DOWN = -0.5;
+const double FLAT_SLOPE = 0.1;               // |dy/dx| of a flat edge
+const double SHORT_EDGE = 0.8;               // fluid pound, gas interference, bent barrel
+const double FLUID_POUND_RIGHT_R2 = 0.015;
+const double WORN_EDGE = 0.9;                // worn plunger and worn standing
+const double DRAG_FRICTION_EDGE = 0.7;
+const double CLASSIFIER_THRESHOLDS[] = { GOOD_FIT_R2, VERTICAL_INVERSE_SLOPE, SLOPE_UP, SLOPE_DOWN, FLAT_SLOPE,
+	SHORT_EDGE, FLUID_POUND_RIGHT_R2, WORN_EDGE, DRAG_FRICTION_EDGE };
+
+/*
+An edge of the stroke: numberOfPoints points of the card starting at index
+first, rolling over the end of the card.
+*/
+class Edge {
+public:
+	const char* name;
+	const char* half; // "" for a whole edge, or which half of edge name this is
+	FittedLine normal_fitted_line;
+	FittedLine inverse_fitted_line;
+	// Raw data
+	const CumulativeSums* sums;
+	int first;
+	int numberOfPoints;
+	// Fitted data
+	double slope, intercept, r2;
+	double length;
+	//
+	Edge() {
+		name = half = "";
+		sums = nullptr;
+		first = numberOfPoints = 0;
+	}
+	Edge(const char* nm, const CumulativeSums& card_sums, int first_ind, int n_points) {
+		name = nm;
+		half = "";
+		sums = &card_sums;
+		first = first_ind;
+		numberOfPoints = n_points;
+	}
+	void display() {
+		std::cout << "Name: " << half << name << std::endl
+			<< "  n points " << numberOfPoints << std::endl
+			<< "  slope " << slope << std::endl
+			<< "  vertical " << vertical() << std::endl
+			<< "  flat " << flat() << std::endl
+			<< "  length " << length << std::endl
+			<< "  r2 " << r2 << std::endl
+			<< "  inv r2 " << inverse_fitted_line.r2 << std::endl;
+	}
+	double x(int i) const {
+		return sums->x(first + i);
+	}
+	double y(int i) const {
+		return sums->y(first + i);
+	}
+	void finish() {
+		TRACE_SPAN("Edge::finish", half, name);
+		if (numberOfPoints == 0) {
+			std::cout << "ERROR: " << half << name << " had no points" << std::endl;
+			// Nothing to fit.  NaN fails every slope and fit test below
+			FittedLine nothing = { NAN, NAN, NAN };
+			normal_fitted_line = inverse_fitted_line = nothing;
+			slope = intercept = r2 = NAN;
+			length = 0;
+			return;
+		}
+		normal_fitted_line = sums->fit(first, numberOfPoints);
+		inverse_fitted_line = sums->inverse_fit(first, numberOfPoints);
+		slope = normal_fitted_line.slope;
+		intercept = normal_fitted_line.intercept;
+		r2 = normal_fitted_line.r2;
+		double x_diff = x(0) - x(numberOfPoints - 1);
+		double y_diff = y(0) - y(numberOfPoints - 1);
+		length = std::sqrt(x_diff * x_diff + y_diff * y_diff);
+	}
+	// The points within half the edge length of its start
+	Edge first_half() {
+		TRACE_SPAN("Edge::first_half", "", name);
+		int n = 0;
+		while (n < numberOfPoints) {
+			double x_diff = x(0) - x(n);
+			double y_diff = y(0) - y(n);
+			if (std::sqrt(x_diff * x_diff + y_diff * y_diff) > 0.5 * length) break;
+			n++;
+		}
+		Edge ret(name, *sums, first, n);
+		ret.half = "first half of ";
+		ret.finish();
+		return ret;
+	}
+	// The points within half the edge length of its end
+	Edge second_half() {
+		TRACE_SPAN("Edge::second_half", "", name);
+		int n = 0;
+		int index = numberOfPoints - 1;
+		while (n < numberOfPoints) {
+			double x_diff = x(index) - x(index - n);
+			double y_diff = y(index) - y(index - n);
+			if (std::sqrt(x_diff * x_diff + y_diff * y_diff) > 0.5 * length) break;
+			n++;
+		}
+		// The fit doesn't depend on the order of the points, so unlike the
+		// old point by point copy this keeps them in card order
+		Edge ret(name, *sums, first + numberOfPoints - n, n);
+		ret.half = "second half of ";
+		ret.finish();
+		return ret;
+	}
+	//
+	// Properties an edge might have
+	//
+	bool good_fit() {
+		return (normal_fitted_line.r2 < GOOD_FIT_R2) | (inverse_fitted_line.r2 < GOOD_FIT_R2);
+	}
+	bool vertical() {
+		return good_fit() & (std::abs(inverse_fitted_line.slope) < VERTICAL_INVERSE_SLOPE);
+	}
+	bool slope_up() {
+		// TODO: See question below in flat()
+		return good_fit() & (normal_fitted_line.slope > SLOPE_UP);
+	}
+	bool slope_down() {
+		// TODO: See question below in flat()
+		return good_fit() & (normal_fitted_line.slope < SLOPE_DOWN);
+	}
+	bool flat() {
+		// TODO: What happends to slope >= 0.1 and slope <= 0.5?
+		return good_fit() & (std::abs(slope) < FLAT_SLOPE);
+	}
+};
+
+class Shape {
+public:
+	Edge *left, *top, *right, *bottom;
+	Shape(Edge* e0, Edge* e1, Edge* e2, Edge* e3) {
+		left = e0; top = e1; right = e2; bottom = e3;
+	}
+	//
+	// Properties a shape might have
+	//
+	double top_width() {
+		return top->length;
+	}
+	double bottom_width() {
+		return bottom->length;
+	}
+	bool left_edge_vertical() {
+		return std::isnan(left->slope) | (std::abs(left->slope) > 50);
+	}
+	bool top_edge_flat() {
+		// bug: to be fixed
+		return std::abs(top->slope) < 0.1;
+	}
+	bool bottom_edge_flat() {
+		// bug: to be fixed
+		return std::abs(bottom->slope) < 0.1;
+	}
+};
+
+/*
+Split the stroke whose points sums was built over into left/top/right/bottom edges,
+with the corners placed by method (corner_search.h).
+The edges point into sums, which must outlive them.
+*/
+inline void break_into_edges(const CumulativeSums& sums, CornerMethod method, Edge edges[4]) {
+	int n = sums.n_points;
+	Corners corners = find_corners(sums, method);
+	int lower_left_ind = corners.lower_left, upper_left_ind = corners.upper_left;
+	int upper_right_ind = corners.upper_right, lower_right_ind = corners.lower_right;
+	// Create edges based on those corners, going around the stroke
+	edges[0] = Edge("left", sums, lower_left_ind, count_with_rollover(lower_left_ind, upper_left_ind, n));
+	edges[1] = Edge("top", sums, upper_left_ind, count_with_rollover(upper_left_ind, upper_right_ind, n));
+	edges[2] = Edge("right", sums, upper_right_ind, count_with_rollover(upper_right_ind, lower_right_ind, n));
+	edges[3] = Edge("bottom", sums, lower_right_ind, count_with_rollover(lower_right_ind, lower_left_ind, n));
+	for (int i = 0; i < 4; i++) edges[i].finish();
+}
+
+inline const char* guess_pump_state(Shape shape) {
+	/*shape.left->display();
+	shape.top->display();
+	shape.right->display();
+	shape.bottom->display();*/
+	// Full pump
+	if (shape.left->vertical()
+		& shape.right->vertical()
+		& shape.top->flat()
+		& shape.bottom->flat())
+		return "full pump";
+	// Tubing movement
+	else if (shape.top->flat()
+		& shape.bottom->flat()
+		& shape.left->slope_up()
+		& shape.left->good_fit()
+		& shape.right->slope_up()
+		& shape.right->good_fit())
+		return "tubing movement";
+	// Fluid pound
+	else if (shape.top->flat()
+		& shape.bottom->flat()
+		& shape.left->vertical()
+		& (shape.bottom->length < SHORT_EDGE)
+		& (shape.right->normal_fitted_line.r2 > FLUID_POUND_RIGHT_R2))
+		return "fluid pound";
+	// Gas interference
+	else if (shape.top->flat()
+		& shape.left->vertical() // TODO: WHY is it vertical? what's difference between "fluid pound" vs "gas interference"?
+		& shape.bottom->flat()
+		& (shape.bottom->length < SHORT_EDGE))
+		return "gas interference";
+	// Pump hitting
+	else if (shape.left->vertical()
+		& shape.right->vertical()
+		& shape.top->first_half().flat()
+		& shape.bottom->first_half().flat())
+		return "pump hitting";
+	// Bent barrel
+	else if (shape.left->vertical()
+		& shape.right->vertical()
+		& (shape.bottom->length > SHORT_EDGE) // TODO: ?
+		& (shape.top->length > SHORT_EDGE))
+		// & shape.bottom->second_half().flat()) // TODO: why not second_half flat comparing to pump hitting above?
+		return "bent barrel";
+	// Worn plunger
+	else if (shape.bottom->flat()
+		& ~shape.left->vertical()
+		& ~shape.right->vertical()
+		& (shape.top->length < WORN_EDGE)
+		)
+		//& (shape.top->length < shape.bottom->length)) // TODO: why not ?
+		return "worn plunger";
+	// Worn standing
+	else if (shape.top->flat()
+		& ~shape.left->vertical()
+		& ~shape.right->vertical()
+		& (shape.bottom->length < WORN_EDGE)
+		)
+		// & (shape.top->length > shape.bottom->length)) // TODO: why not?
+		return "worn standing"; 
+// Worn or split
+	else if (shape.bottom->flat()
+		& shape.left->vertical()) 
+		return "worn or"; // TODO: why these conditions only? why not the bottom?
+	//else if (shape.bottom->flat()
+	//	& shape.top->flat()
+	//	& shape.left->vertical()
+	//	& shape.top->length < 0.8
+	//	& shape.right->inverse_fitted_line.r2 < 0.015)
+	//	return "worn or";
+
+	// Fluid friction
+	else if (shape.right->vertical()
+			& shape.left->vertical()) 
+			return "fluid friction";
+	// Drag friction
+	else if ((shape.right->length > DRAG_FRICTION_EDGE)
+			& (shape.left->length > DRAG_FRICTION_EDGE)) 
+			return "drag friction";
+	else 
+		return "other??";
+}
+
+// What a classification found out about one edge, kept once the edge is gone
+struct EdgeFit {
+	double slope, intercept, r2;
+	double inverse_slope, inverse_r2;
+	double length;
+};
+
+/*
+Classify a card.  A stroke whose peak weight stays below min_acceptable_peak_weight
+is a flowing well; anything else is classified by shape, with the corners of the
+shape placed by corner_method.  Normalizes the card.
+If fits is given the left/top/right/bottom edge lines are stored there, or
+NaN when the card was not classified by shape.
+If edges is given the four edges are left there, fitted for a flowing well
+too, for the shape properties of fused_engine.h; they are not touched for an
+empty card.
+*/
+inline const char* classify_card(Card& card, double min_acceptable_peak_weight, CornerMethod corner_method = HEURISTIC_CORNERS,
+	EdgeFit* fits = nullptr, Edge* edges = nullptr) {
+	TRACE_SPAN("classify_card");
+	if (fits) {
+		EdgeFit nothing = { NAN, NAN, NAN, NAN, NAN, NAN };
+		std::fill(fits, fits + 4, nothing);
+	}
+	if (card.size() == 0) return METRICS_COUNT_CARD("other??");
+	{
+		METRICS_TIME(STAGE_NORMALIZE);
+		TRACE_SPAN("normalize");
+		card.normalize();
+	}
+	// Diagnose flowing well based on max weight
+	bool flowing = card.max_weight < min_acceptable_peak_weight;
+	if (flowing && !edges) {
+		return METRICS_COUNT_CARD("flowing well");
+	}
+	// Otherwise break into edges
+	Edge card_edges[4];
+	if (!edges) edges = card_edges;
+	{
+		METRICS_TIME(STAGE_EDGES);
+		TRACE_SPAN("break_into_edges");
+		break_into_edges(card.sums(), corner_method, edges);
+	}
+	if (flowing) {
+		return METRICS_COUNT_CARD("flowing well");
+	}
+	for (int i = 0; fits && i < 4; i++) {
+		EdgeFit fit = { edges[i].slope, edges[i].intercept, edges[i].r2,
+			edges[i].inverse_fitted_line.slope, edges[i].inverse_fitted_line.r2, edges[i].length };
+		fits[i] = fit;
+	}
+	Shape shape(&edges[0], &edges[1], &edges[2], &edges[3]);
+	// And classify based on shape
+	METRICS_TIME(STAGE_CLASSIFY);
+	TRACE_SPAN("guess_pump_state");
+	return METRICS_COUNT_CARD(guess_pump_state(shape));
+}
+
+// Classify one cycle worth of raw data, as classify_card
+inline std::string classify_cycle(const std::vector<double>& position, const std::vector<double>& raw_xs,
+	const std::vector<double>& raw_ys, double min_acceptable_peak_weight, CornerMethod corner_method = HEURISTIC_CORNERS) {
+	Card card;
+	card.assign(position.data(), raw_xs.data(), raw_ys.data(), position.size());
+	return classify_card(card, min_acceptable_peak_weight, corner_method);
+}
+
+#endif // DYNACARD_PUMP_STATE_H
@@ -0,0 +1,136 @@
+/*
+Arc-length resampling of a stroke, so that classifying it costs about the
+same however densely the sensor sampled it: every edge fit and corner
+search is linear in the points of the stroke, and a card sampled every
+0.167 units of position has thousands of them where 120 give the same
+shape.
+
+The stroke is measured in normalized units (length and weight both scaled
+to 0..1, as Card::normalize scales them) and resampled to about n_points
+points evenly spaced along it by linear interpolation.  The corners are
+kept exactly: the samples at the extremes of x, y, x+2y and x-2y (the
+directions find_heuristic_corners looks in) and the first and the last
+sample stay in the stroke, and the other points are shared out between the
+pieces between them in proportion to their length, at least one per piece,
+so a corner crowded by others may add a few points over n_points.
+Position, length and weight are all interpolated, so the result is a stroke
+like any other.  A stroke of n_points samples or fewer is left as it is.
+*/
+
+#ifndef DYNACARD_RESAMPLE_H
+#define DYNACARD_RESAMPLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "card_parser.h"
+#include "card.h"
+#include "simd_kernels.h"
+
+class StrokeResampler {
+public:
+	// The resampled stroke, valid until the next call
+	CardColumns stroke;
+
+	/*
+	Resample the n samples of pos/len/wt to about n_points points into
+	stroke.  Returns false, leaving stroke alone, if the stroke has n_points
+	or fewer samples or no length to resample along; use it as it is then.
+	*/
+	bool resample(const double* pos, const double* len, const double* wt, size_t n, size_t n_points) {
+		if (n <= n_points || n_points < 2) return false;
+		const SimdKernels& kernels = simd_kernels();
+		double min_len, max_len, min_wt, max_wt;
+		kernels.min_max(len, n, min_len, max_len);
+		kernels.min_max(wt, n, min_wt, max_wt);
+		double x_scale = max_len > min_len ? 1 / (max_len - min_len) : 0;
+		double y_scale = max_wt > min_wt ? 1 / (max_wt - min_wt) : 0;
+		// Arc length up to every sample, and the corners on the way
+		arc.resize(n);
+		arc[0] = 0;
+		Extremes extremes(len[0] * x_scale, wt[0] * y_scale);
+		for (size_t i = 1; i < n; i++) {
+			double x = len[i] * x_scale, y = wt[i] * y_scale;
+			double dx = (len[i] - len[i - 1]) * x_scale, dy = (wt[i] - wt[i - 1]) * y_scale;
+			arc[i] = arc[i - 1] + std::sqrt(dx * dx + dy * dy);
+			extremes.add(i, x, y);
+		}
+		double total = arc[n - 1];
+		if (!(total > 0)) return false;
+		corners.clear();
+		corners.push_back(0);
+		corners.push_back(n - 1);
+		extremes.append_to(corners);
+		std::sort(corners.begin(), corners.end());
+		corners.erase(std::unique(corners.begin(), corners.end()), corners.end());
+
+		stroke.position.clear();
+		stroke.length.clear();
+		stroke.weight.clear();
+		size_t i = 0;          // arc[i] <= the arc of the point being placed < arc[i + 1]
+		size_t placed = 0;     // points placed before the corner being walked to
+		for (size_t k = 0; k + 1 < corners.size(); k++) {
+			size_t from = corners[k], to = corners[k + 1];
+			// The point count this corner ends at, had the points been spaced evenly over the whole stroke
+			size_t target = static_cast<size_t>(std::lround((n_points - 1) * arc[to] / total));
+			size_t m = std::max(target, placed + 1) - placed;
+			for (size_t s = 0; s < m; s++) {
+				double a = arc[from] + (arc[to] - arc[from]) * s / m;
+				if (i < from) i = from;
+				while (i + 1 < to && arc[i + 1] <= a) i++;
+				double span = arc[i + 1] - arc[i];
+				double t = span > 0 ? (a - arc[i]) / span : 0;
+				stroke.position.push_back(pos[i] + (pos[i + 1] - pos[i]) * t);
+				stroke.length.push_back(len[i] + (len[i + 1] - len[i]) * t);
+				stroke.weight.push_back(wt[i] + (wt[i + 1] - wt[i]) * t);
+			}
+			placed += m;
+		}
+		stroke.position.push_back(pos[n - 1]);
+		stroke.length.push_back(len[n - 1]);
+		stroke.weight.push_back(wt[n - 1]);
+		return true;
+	}
+
+private:
+	std::vector<double> arc;
+	std::vector<size_t> corners;
+
+	// The samples at the extremes of x, y, x+2y and x-2y
+	struct Extremes {
+		double value[8];   // min and max of each direction
+		size_t index[8];
+		Extremes(double x, double y) {
+			double v[4] = { x, y, x + 2 * y, x - 2 * y };
+			for (int d = 0; d < 4; d++) {
+				value[2 * d] = value[2 * d + 1] = v[d];
+				index[2 * d] = index[2 * d + 1] = 0;
+			}
+		}
+		void add(size_t i, double x, double y) {
+			update(0, i, x);
+			update(2, i, y);
+			update(4, i, x + 2 * y);
+			update(6, i, x - 2 * y);
+		}
+		void update(int d, size_t i, double v) {
+			if (v < value[d]) { value[d] = v; index[d] = i; }
+			if (v > value[d + 1]) { value[d + 1] = v; index[d + 1] = i; }
+		}
+		void append_to(std::vector<size_t>& corners) const {
+			corners.insert(corners.end(), index, index + 8);
+		}
+	};
+};
+
+// Resample card in place to about n_points points, with resampler as scratch; false if it was left as it is
+inline bool resample_card(Card& card, size_t n_points, StrokeResampler& resampler) {
+	if (!resampler.resample(card.position(), card.length(), card.weight(), card.size(), n_points)) return false;
+	const CardColumns& stroke = resampler.stroke;
+	card.assign(stroke.position.data(), stroke.length.data(), stroke.weight.data(), stroke.size());
+	return true;
+}
+
+#endif // DYNACARD_RESAMPLE_H
@@ -0,0 +1,341 @@
+/*
+On-disk cache of classification results, so a re-run over a card directory
+only classifies the cards that are new or have changed.
+
+Entries are keyed by a hash of the card file's bytes together with a hash of
+the run's configuration (min_acceptable_peak_weight, corner method and
+whether strokes are classified one by one); the file is mapped and hashed,
+never parsed, to look it up.  Every entry holds the pump state and the edge
+fits of each card classified from the file.
+
+The cache file starts with classifier_hash(): CLASSIFIER_VERSION, the
+thresholds of pump_state.h, the stroke thresholds of stroke_segmenter.h and
+the limits of the corner search.  When that no longer matches, everything in
+it is dropped, so changing any of them invalidates the cache without anyone
+having to remember to delete it.  Entries for other configurations are kept:
+switching back and forth between two minimum weights hits for both.
+
+Every entry remembers when a run last found or added it.  save() evicts the
+entries no run has used for max_age_seconds, and beyond max_entries the
+least recently used, so a cache kept across many directories doesn't grow
+without bound.
+
+Layout, in the byte order of the machine that wrote it (checked on load):
+
+  ResultCacheHeader
+  for every entry: ResultCacheEntry, then n_results CachedResult
+
+The whole file is rewritten by save(), to a temporary name that is then
+renamed over it, so a run that is killed leaves the previous cache intact.
+*/
+
+#ifndef DYNACARD_RESULT_CACHE_H
+#define DYNACARD_RESULT_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "card_file.h"
+#include "corner_search.h"
+#include "pump_state.h"
+#include "stroke_segmenter.h"
+
+// Entries no run has found or added for this long are evicted
+const int64_t RESULT_CACHE_MAX_AGE_SECONDS = 90 * 24 * 3600;
+// Beyond this many, the least recently used entries are evicted
+const size_t RESULT_CACHE_MAX_ENTRIES = 1000000;
+
+/*
+64 bit hash of size bytes, computed as XXH64: four lanes of 8 bytes take a
+multiply and a rotate each, so it runs at memory speed.  Words are read in
+the machine's byte order, which is fine for a cache that checks it anyway.
+*/
+inline uint64_t content_hash(const void* data, size_t size, uint64_t seed = 0) {
+	const uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL;
+	const uint64_t P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+	auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+	auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+	auto read64 = [](const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; };
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + size;
+	uint64_t h;
+	if (size >= 32) {
+		uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+		for (; p + 32 <= end; p += 32) {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		uint64_t lanes[4] = { v1, v2, v3, v4 };
+		for (int i = 0; i < 4; i++) h = (h ^ round(0, lanes[i])) * P1 + P4;
+	}
+	else {
+		h = seed + P5;
+	}
+	h += size;
+	for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+	if (p + 4 <= end) {
+		uint32_t v;
+		memcpy(&v, p, 4);
+		h = rotl(h ^ (v * P1), 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; p++) h = rotl(h ^ (*p * P5), 11) * P1;
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/*
+Hash of what the classifier itself does: changes whenever a threshold does,
+or anything else that decides where a stroke starts and ends or where its
+corners go
+*/
+inline uint64_t classifier_hash() {
+	uint64_t h = content_hash(CLASSIFIER_THRESHOLDS, sizeof(CLASSIFIER_THRESHOLDS));
+	h = content_hash(&CLASSIFIER_VERSION, sizeof(CLASSIFIER_VERSION), h);
+	const double strokes[2] = { LENGTH_STARTING_THRESH, LENGTH_STARTED_THRESH };
+	const int corners[3] = { CORNER_SEARCH_CANDIDATES, CORNER_SEARCH_MIN_EDGE_POINTS, CORNER_SEARCH_MAX_PASSES };
+	h = content_hash(strokes, sizeof(strokes), h);
+	return content_hash(corners, sizeof(corners), h);
+}
+
+/*
+Hash of the settings of one run.  knn_library is a hash of the reference
+library classified against and of how it is searched (knn_classifier.h), 0
+for guess_pump_state.  Runs without resampling or a library hash as they did
+before either was added.
+*/
+inline uint64_t run_config_hash(double min_acceptable_peak_weight, CornerMethod corner_method, bool per_stroke,
+	size_t resample_points = 0, uint64_t knn_library = 0) {
+	double config[4] = { min_acceptable_peak_weight, static_cast<double>(corner_method), per_stroke ? 1.0 : 0.0,
+		static_cast<double>(resample_points) };
+	uint64_t h = content_hash(config, resample_points > 0 ? sizeof(config) : 3 * sizeof(double));
+	return knn_library == 0 ? h : content_hash(&knn_library, sizeof(knn_library), h);
+}
+
+// The longest state a result holds, with its NUL
+const size_t CACHED_STATE_NAME = 24;
+
+// One classified card of a file
+struct CachedResult {
+	char state[CACHED_STATE_NAME];  // NUL terminated
+	uint64_t first, end;            // its samples in the file; 0, 0 for a file's first cycle
+	EdgeFit edges[4];               // left, top, right, bottom
+};
+
+/*
+state must be shorter than CACHED_STATE_NAME.  guess_pump_state's are, and a
+reference library's are refused when it is built or loaded (knn_classifier.h).
+*/
+inline CachedResult make_cached_result(const char* state, uint64_t first, uint64_t end, const EdgeFit edges[4]) {
+	CachedResult result;
+	memset(&result, 0, sizeof(result));
+	strncpy(result.state, state, sizeof(result.state) - 1);
+	result.first = first;
+	result.end = end;
+	memcpy(result.edges, edges, sizeof(result.edges));
+	return result;
+}
+
+const char RESULT_CACHE_MAGIC[8] = { 'D', 'Y', 'N', 'A', 'C', 'A', 'C', 'H' };
+const uint32_t RESULT_CACHE_VERSION = 2;
+
+struct ResultCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;      // CARD_FILE_BYTE_ORDER
+	uint64_t classifier;      // classifier_hash() of the writer
+	uint64_t n_entries;
+};
+
+struct ResultCacheEntry {
+	uint64_t content;         // content_hash of the file
+	uint64_t n_bytes;         // and its size
+	uint64_t config;          // run_config_hash
+	uint64_t n_results;
+	int64_t last_used;        // time() of the last run that found or added it
+};
+
+/*
+find and insert may be called from several threads at once; load and save
+must not overlap with anything else.
+*/
+class ResultCache {
+public:
+	int64_t max_age_seconds = RESULT_CACHE_MAX_AGE_SECONDS;
+	size_t max_entries = RESULT_CACHE_MAX_ENTRIES;
+
+	ResultCache() {
+		n_invalidated = n_evicted = 0;
+		n_hits = n_misses = 0;
+		run_time = static_cast<int64_t>(std::time(nullptr));
+	}
+
+	// Read the cache at path; a missing or unusable file leaves it empty
+	bool load(const std::string& cache_path) {
+		path = cache_path;
+		entries.clear();
+		n_invalidated = 0;
+		FILE* file = fopen(path.c_str(), "rb");
+		if (!file) return false;
+		ResultCacheHeader header;
+		bool ok = fread(&header, sizeof(header), 1, file) == 1
+			&& memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC)) == 0
+			&& header.version == RESULT_CACHE_VERSION && header.byte_order == CARD_FILE_BYTE_ORDER;
+		if (ok && header.classifier != classifier_hash()) {
+			// The classifier changed since these were cached
+			n_invalidated = header.n_entries;
+			ok = false;
+		}
+		for (uint64_t i = 0; ok && i < header.n_entries; i++) {
+			ResultCacheEntry entry;
+			Results results;
+			ok = fread(&entry, sizeof(entry), 1, file) == 1;
+			if (!ok || entry.n_results > (1u << 24)) {
+				ok = false;
+				break;
+			}
+			results.results.resize(entry.n_results);
+			ok = entry.n_results == 0 || fread(results.results.data(), sizeof(CachedResult), entry.n_results, file) == entry.n_results;
+			results.content = entry.content;
+			results.n_bytes = entry.n_bytes;
+			results.config = entry.config;
+			results.last_used = entry.last_used;
+			if (ok) entries[key(entry.content, entry.config)] = results;
+		}
+		fclose(file);
+		return ok;
+	}
+
+	// Evict what is too old or too many, then write every other entry back to the file load was given
+	bool save() {
+		evict();
+		std::string temp_path = path + ".tmp";
+		FILE* file = fopen(temp_path.c_str(), "wb");
+		if (!file) return false;
+		ResultCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC));
+		header.version = RESULT_CACHE_VERSION;
+		header.byte_order = CARD_FILE_BYTE_ORDER;
+		header.classifier = classifier_hash();
+		header.n_entries = entries.size();
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		for (auto it = entries.begin(); ok && it != entries.end(); ++it) {
+			const Results& results = it->second;
+			ResultCacheEntry entry = { results.content, results.n_bytes, results.config, results.results.size(), results.last_used };
+			ok = fwrite(&entry, sizeof(entry), 1, file) == 1
+				&& fwrite(results.results.data(), sizeof(CachedResult), results.results.size(), file) == results.results.size();
+		}
+		ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+		// rename does not replace an existing file here
+		if (ok) remove(path.c_str());
+#endif
+		if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+			remove(temp_path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// The results cached for a file of size bytes hashing to content, counting a hit or a miss
+	bool find(uint64_t content, size_t size, uint64_t config, std::vector<CachedResult>& results) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = entries.find(key(content, config));
+			if (it != entries.end() && it->second.content == content && it->second.n_bytes == size && it->second.config == config) {
+				results = it->second.results;
+				it->second.last_used = run_time;
+				n_hits++;
+				return true;
+			}
+		}
+		n_misses++;
+		return false;
+	}
+
+	void insert(uint64_t content, size_t size, uint64_t config, const std::vector<CachedResult>& results) {
+		Results entry;
+		entry.content = content;
+		entry.n_bytes = size;
+		entry.config = config;
+		entry.results = results;
+		entry.last_used = run_time;
+		std::lock_guard<std::mutex> lock(mutex);
+		entries[key(entry.content, config)] = entry;
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+	size_t hits() const {
+		return n_hits;
+	}
+	size_t misses() const {
+		return n_misses;
+	}
+	// Entries dropped by load because the classifier had changed
+	size_t invalidated() const {
+		return n_invalidated;
+	}
+	// Entries dropped by save for being too old or too many
+	size_t evicted() const {
+		return n_evicted;
+	}
+
+private:
+	struct Results {
+		uint64_t content, n_bytes, config;
+		std::vector<CachedResult> results;
+		int64_t last_used;
+	};
+	std::string path;
+	std::unordered_map<uint64_t, Results> entries;
+	std::mutex mutex;
+	size_t n_invalidated, n_evicted;
+	std::atomic<size_t> n_hits, n_misses;
+	int64_t run_time;  // when this run started, what the entries it uses are stamped with
+
+	void evict() {
+		for (auto it = entries.begin(); it != entries.end(); ) {
+			if (run_time - it->second.last_used > max_age_seconds) {
+				it = entries.erase(it);
+				n_evicted++;
+			}
+			else {
+				++it;
+			}
+		}
+		if (entries.size() <= max_entries) return;
+		// Keep the max_entries used most recently
+		std::vector<std::pair<int64_t, uint64_t> > by_use;  // last_used, key
+		by_use.reserve(entries.size());
+		for (auto it = entries.begin(); it != entries.end(); ++it) by_use.push_back(std::make_pair(it->second.last_used, it->first));
+		std::nth_element(by_use.begin(), by_use.begin() + max_entries, by_use.end(), std::greater<std::pair<int64_t, uint64_t> >());
+		for (size_t i = max_entries; i < by_use.size(); i++) entries.erase(by_use[i].second);
+		n_evicted += by_use.size() - max_entries;
+	}
+
+	static uint64_t key(uint64_t content, uint64_t config) {
+		return content ^ (config * 0x9E3779B97F4A7C15ULL);
+	}
+};
+
+#endif // DYNACARD_RESULT_CACHE_H
@@ -0,0 +1,114 @@
+/*
+A fixed-length descriptor of the shape of a card, for classifying cards by
+their nearest neighbours in a library of labelled ones (knn_classifier.h)
+rather than by the rules of guess_pump_state.
+
+The normalized card (x and y in 0..1, as Card::normalize leaves them) is
+taken as a closed outline from its first sample round to its first sample
+again, resampled to DESCRIPTOR_POINTS points evenly spaced along it, and
+written as the complex numbers z = x + iy.  The descriptor is the low
+frequency Fourier coefficients of that outline, c[-K] .. c[K] with K =
+DESCRIPTOR_HARMONICS, real and imaginary parts.
+
+The coefficients are not made invariant to rotation, scale or start point:
+a card upside down is another pump state, the normalization has already
+fixed the scale, and every card starts at the bottom of its downstroke.  So
+by Parseval the Euclidean distance between two descriptors is the root mean
+square distance between the two outlines smoothed to K harmonics, in
+normalized units, which is what the nearest neighbour search compares.
+*/
+
+#ifndef DYNACARD_SHAPE_DESCRIPTOR_H
+#define DYNACARD_SHAPE_DESCRIPTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+const int DESCRIPTOR_POINTS = 64;
+const int DESCRIPTOR_HARMONICS = 6;
+const int DESCRIPTOR_SIZE = 2 * (2 * DESCRIPTOR_HARMONICS + 1);
+
+struct ShapeDescriptor {
+	// Re c[k], Im c[k] for k = 0, 1, -1, 2, -2 .. K, -K
+	float v[DESCRIPTOR_SIZE];
+};
+
+// Euclidean distance between two descriptors
+inline float descriptor_distance(const ShapeDescriptor& a, const ShapeDescriptor& b) {
+	float sum = 0;
+	for (int i = 0; i < DESCRIPTOR_SIZE; i++) {
+		float d = a.v[i] - b.v[i];
+		sum += d * d;
+	}
+	return std::sqrt(sum);
+}
+
+// cos and sin of 2 pi j / DESCRIPTOR_POINTS
+struct DescriptorTwiddles {
+	double cos_table[DESCRIPTOR_POINTS], sin_table[DESCRIPTOR_POINTS];
+	DescriptorTwiddles() {
+		const double two_pi = 6.283185307179586;
+		for (int j = 0; j < DESCRIPTOR_POINTS; j++) {
+			cos_table[j] = std::cos(two_pi * j / DESCRIPTOR_POINTS);
+			sin_table[j] = std::sin(two_pi * j / DESCRIPTOR_POINTS);
+		}
+	}
+};
+
+inline double segment_length(const double* x, const double* y, size_t from, size_t to) {
+	double dx = x[to] - x[from], dy = y[to] - y[from];
+	return std::sqrt(dx * dx + dy * dy);
+}
+
+/*
+Describe the closed outline of the n points x, y.  Returns false, leaving
+descriptor alone, for fewer than 3 points or an outline of no length.
+Allocates nothing: the resampled points go straight into the sums.
+*/
+inline bool describe_shape(const double* x, const double* y, size_t n, ShapeDescriptor& descriptor) {
+	if (n < 3) return false;
+	static const DescriptorTwiddles twiddles;
+	double perimeter = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t next = i + 1 < n ? i + 1 : 0;
+		perimeter += segment_length(x, y, i, next);
+	}
+	if (!(perimeter > 0)) return false;
+
+	// c[k] = 1/M sum_j z_j e^(-2 pi i k j / M), for k = 0, 1, -1 .. K, -K
+	double re[2 * DESCRIPTOR_HARMONICS + 1] = { 0 }, im[2 * DESCRIPTOR_HARMONICS + 1] = { 0 };
+	size_t i = 0;                // the sample the segment being walked starts at
+	double segment_start = 0;    // arc length to sample i
+	double segment = segment_length(x, y, 0, 1);
+	for (int j = 0; j < DESCRIPTOR_POINTS; j++) {
+		double s = perimeter * j / DESCRIPTOR_POINTS;
+		while (i + 1 < n && s > segment_start + segment) {
+			segment_start += segment;
+			i++;
+			size_t next = i + 1 < n ? i + 1 : 0;
+			segment = segment_length(x, y, i, next);
+		}
+		size_t next = i + 1 < n ? i + 1 : 0;
+		double t = segment > 0 ? std::min(1.0, (s - segment_start) / segment) : 0;
+		double px = x[i] + (x[next] - x[i]) * t, py = y[i] + (y[next] - y[i]) * t;
+		re[0] += px;
+		im[0] += py;
+		for (int k = 1; k <= DESCRIPTOR_HARMONICS; k++) {
+			int phase = (k * j) % DESCRIPTOR_POINTS;
+			double c = twiddles.cos_table[phase], sn = twiddles.sin_table[phase];
+			// z e^(-i theta) for c[k], z e^(+i theta) for c[-k]
+			re[2 * k - 1] += px * c + py * sn;
+			im[2 * k - 1] += py * c - px * sn;
+			re[2 * k] += px * c - py * sn;
+			im[2 * k] += py * c + px * sn;
+		}
+	}
+	for (int k = 0; k < 2 * DESCRIPTOR_HARMONICS + 1; k++) {
+		descriptor.v[2 * k] = static_cast<float>(re[k] / DESCRIPTOR_POINTS);
+		descriptor.v[2 * k + 1] = static_cast<float>(im[k] / DESCRIPTOR_POINTS);
+	}
+	return true;
+}
+
+#endif // DYNACARD_SHAPE_DESCRIPTOR_H
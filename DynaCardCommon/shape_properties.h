@@ -0,0 +1,333 @@
+/*
+The geometry of ComputeShapeProperties: a FourSidedFigure fitted to one cycle
+of a card, the area of the cycle, and the distance of its points from the
+figure.  Kept here so the benchmarks can time each step on its own.
+*/
+
+#ifndef DYNACARD_SHAPE_PROPERTIES_H
+#define DYNACARD_SHAPE_PROPERTIES_H
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "stroke_segmenter.h"
+#include "line_fit.h"
+#include "corner_search.h"
+
+/*
+The first full cycle of a recording by its lengths xs (StrokeSegmenter cuts
+every one), as samples [first, end), defined as follows:
+  - Cycle starts at first place where x<=LENGTH_STARTING_THRESH
+  - Cycle is done starting as soon as x>=LENGTH_STARTED_THRESH
+  - Cycle is finished when x<=LENGTH_STARTING_THRESH again, that sample included
+A cycle that never finishes runs to the end of the recording; first == end
+when none starts.
+*/
+inline void first_stroke_range(const double* xs, size_t n, size_t& first, size_t& end) {
+	bool cycle_started = false;
+	bool cycle_finished_starting = false;
+	first = end = 0;
+	for (size_t i = 0; i < n; i++) {
+		double x = xs[i];
+		if ((x > LENGTH_STARTING_THRESH) & !cycle_started) {
+			// Data file starts in middle of a cycle.  Ignore starting numbers
+			continue;
+		}
+		if (!cycle_started) {
+			// Cycle starts first time x<=LENGTH_STARTING_THRESH
+			cycle_started = true;
+			first = i;
+		}
+		else if ((x >= LENGTH_STARTED_THRESH) & !cycle_finished_starting) {
+			// Cycle finished starting when x>=LENGTH_STARTED_THRESH
+			cycle_finished_starting = true;
+		}
+		else if ((x <= LENGTH_STARTING_THRESH) & cycle_finished_starting) {
+			// Cycle ends when x drop back below LENGTH_STARTING_THRESH
+			end = i + 1;
+			return;
+		}
+		end = i + 1;
+	}
+}
+
+// The first full cycle (first_stroke_range) as copies of the three columns
+inline std::vector<std::vector<double> > extract_one_cycle(const std::vector<double>& positions, const std::vector<double>& xs, const std::vector<double>& ys) {
+	size_t first, end;
+	first_stroke_range(xs.data(), xs.size(), first, end);
+	std::vector<std::vector<double> > to_return;
+	to_return.push_back(std::vector<double>(positions.begin() + first, positions.begin() + end));
+	to_return.push_back(std::vector<double>(xs.begin() + first, xs.begin() + end));
+	to_return.push_back(std::vector<double>(ys.begin() + first, ys.begin() + end));
+	return to_return;
+}
+
+/*
+An Line is a run of consecutive points of the cycle and a line that has
+been fitted to them.  It is NOT the same as a LineSegment.
+The fits come from the running sums over the whole cycle, so a Line
+keeps no copy of its points.
+*/
+class Line {
+public:
+	std::string name;
+	FittedLine normal_fitted_line;
+	FittedLine inverse_fitted_line;
+	// Raw data
+	int first, n_points;
+	// Fitted data
+	double slope, intercept, r2;
+	double length;
+	Line(std::string nm) {
+		name = nm;
+		first = 0;
+		n_points = 0;
+	}
+	void display() {
+		// Useful in debugging.
+		std::cout << "Name: " << name << std::endl
+			<< "  points " << first << " to " << first + n_points - 1 << std::endl
+			<< "  slope " << slope << std::endl
+			<< "  length " << length << std::endl
+			<< "  r2 " << r2 << std::endl
+			<< "  inv r2 " << inverse_fitted_line.r2 << std::endl;
+	}
+	void finish(const CumulativeSums& sums, int first_ind, int count) {
+		first = first_ind;
+		n_points = count;
+		if (n_points == 0) {
+			return;
+		}
+		normal_fitted_line = sums.fit(first, n_points);
+		inverse_fitted_line = sums.inverse_fit(first, n_points);
+		slope = normal_fitted_line.slope;
+		intercept = normal_fitted_line.intercept;
+		r2 = normal_fitted_line.r2;
+		double x_diff_sqr = std::pow(sums.x(first) - sums.x(first + n_points - 1), 2);
+		double y_diff_sqr = std::pow(sums.y(first) - sums.y(first + n_points - 1), 2);
+		length = std::pow(x_diff_sqr + y_diff_sqr, 0.5);
+	}
+};
+
+/*
+Geometric line segment defined by two endpoints.
+A fitted FourSidedFigure consists of 4 of these.
+*/
+class LineSegment {
+public:
+	double x1, x2, y1, y2;
+	double length;
+	LineSegment(double xx1, double xx2, double yy1, double yy2) {
+		x1 = xx1; x2 = xx2; y1 = yy1; y2 = yy2;
+		length = std::pow(std::pow(y2 - y1, 2) + std::pow(x2 - x1, 2), 0.5);
+	}
+	double dist(double x, double y) {
+		// Distance from the line segment
+		double dot_prod = (y2 - y1)*(y - y1) / length + (x2 - x1)*(x - x1) / length;  // direction from pt1 to pt2
+		if (dot_prod < 0) {
+			// (x, y) is closest to endpoint 1
+			double sqrd = std::pow(x - x1, 2) + std::pow(y - y1, 2);
+			return std::pow(sqrd, 0.5);
+		}
+		else if (dot_prod > 1) {
+			// (x, y) is closest to endpoint 2
+			double sqrd = std::pow(x - x2, 2) + std::pow(y - y2, 2);
+			return std::pow(sqrd, 0.5);
+		}
+		else {
+			// (x, y) is closest to the Line itself between the endpoints
+			double dist_to_pt1_sqrd = std::pow(x - x1, 2) + std::pow(y - y1, 2);
+			double dist_sqrd = dist_to_pt1_sqrd - std::pow(dot_prod, 2);
+			// A point on the segment can come out a rounding error below zero
+			if (dist_sqrd < 0) dist_sqrd = 0;
+			return std::pow(dist_sqrd, 0.5);
+		}
+	}
+};
+
+/*
+A 4-sided shape fit to the data, which is ideally a trapezoid.
+
+Note the conventions:
+- Leftmost point is Vertex 1
+- Vertices 2, 3 and 4 are clockwise from Vertex 1
+- The line segment immediately clockwise from Vertex 1 is LineSegment 1,
+  and so on clockwise
+
+Note that I'm abusing terminology here.  Technically a geometric FourSidedFigure must
+have opposite sides of equal length.  The FourSidedFigure class here can have sides
+of any length.  Technically I should probably call it a Quadrilateral?
+*/
+class FourSidedFigure {
+public:
+	double x1, x2, x3, x4, y1, y2, y3, y4;
+	LineSegment *s1, *s2, *s3, *s4;
+	FourSidedFigure(std::vector<double> x_coords, std::vector<double> y_coords) {
+		// Input: coordinates of vertices
+		x1 = x_coords[0]; x2 = x_coords[1]; x3 = x_coords[2]; x4 = x_coords[3];
+		y1 = y_coords[0]; y2 = y_coords[1]; y3 = y_coords[2]; y4 = y_coords[3];
+		s1 = new LineSegment(x1, x2, y1, y2); s2 = new LineSegment(x2, x3, y2, y3);
+		s3 = new LineSegment(x3, x4, y3, y4); s4 = new LineSegment(x4, x1, y4, y1);
+	}
+	FourSidedFigure(Line e1, Line e2, Line e3, Line e4) {
+		// Input: an Line for te line segments of the FourSidedFigure
+		x1 = x_of_intersection(e1, e4); y1 = y_of_intersection(e1, e4);
+		x2 = x_of_intersection(e1, e2); y2 = y_of_intersection(e1, e2);
+		x3 = x_of_intersection(e2, e3); y3 = y_of_intersection(e2, e3);
+		x4 = x_of_intersection(e3, e4); y4 = y_of_intersection(e3, e4);
+		s1 = new LineSegment(x1, x2, y1, y2); s2 = new LineSegment(x2, x3, y2, y3);
+		s3 = new LineSegment(x3, x4, y3, y4); s4 = new LineSegment(x4, x1, y4, y1);
+	}
+	~FourSidedFigure() {
+		delete s1; delete s2; delete s3; delete s4;
+	}
+	FourSidedFigure(const FourSidedFigure&) = delete;
+	FourSidedFigure& operator=(const FourSidedFigure&) = delete;
+	FourSidedFigure* rotate180deg() {
+		double new_x4 = x3 - (x2 - x1);
+		double new_y4 = y3 - (y2 - y1);
+		double new_x2 = x3 - (x4 - x1);
+		double new_y2 = y3 - (y4 - y1);
+		std::vector<double> new_xs;
+		new_xs.push_back(x1); new_xs.push_back(new_x2); new_xs.push_back(x3); new_xs.push_back(new_x4);
+		std::vector<double> new_ys;
+		new_ys.push_back(y1); new_ys.push_back(new_y2); new_ys.push_back(y3); new_ys.push_back(new_y4);
+		return new FourSidedFigure(new_xs, new_ys);
+	}
+	void display() {
+		std::cout << "Point1:  " << x1 << "  " << y1 << std::endl
+			<< "Point2:  " << x2 << "  " << y2 << std::endl
+			<< "Point3:  " << x3 << "  " << y3 << std::endl
+			<< "Point4:  " << x4 << "  " << y4 << std::endl;
+	}
+	double dist(double x, double y) {
+		// Distance from the FourSidedFigure
+		double d1 = s1->dist(x, y);
+		double d2 = s2->dist(x, y);
+		double d3 = s3->dist(x, y);
+		double d4 = s4->dist(x, y);
+		if (d1 <= d2 & d1 <= d3 & d1 <= d4) return d1;
+		else if (d2 <= d3 & d2 <= d4) return d2;
+		else if (d3 <= d4) return d3;
+		else return d4;
+	}
+	// Find points of intersection between the fitted Lines.
+	// These intersections will be the vertices of the fitted
+	// FourSidedFigure, i.e the endpoints of the 4 line segments that comprise it
+	double x_of_intersection(Line eA, Line eB) {
+		return (eB.intercept - eA.intercept) / (eA.slope - eB.slope);
+	}
+	double y_of_intersection(Line eA, Line eB) {
+		double x = x_of_intersection(eA, eB);
+		return eA.intercept + eA.slope*x;
+	}
+};
+
+/*
+To fit a FourSidedFigure to one cycle worth of data:
+- Identify vertices 1 and 3 by finding the min/max x values
+- The line between them is the axis of symmetry
+- Identify vertices 2 and 4 as the farthest ones from the axis of symmetry
+- fit a Line to the points from 1 to 2, 2 to 3, etc
+- the intersections of these lines will be the coordinates of the fitted FourSidedFigure
+With OPTIMAL_CORNERS the corners are instead placed to minimize the residual of
+the 4 Lines (see corner_search.h), and vertex 1 is the leftmost of them.
+*/
+inline FourSidedFigure* fit_FourSidedFigure(const std::vector<double>& xs, const std::vector<double>& ys, CornerMethod corner_method = HEURISTIC_CORNERS) {
+	// Input: coordinates of a polygon in clockwise direction
+	// Breaks it into 4 Lines
+	int n = xs.size();
+	if (corner_method == OPTIMAL_CORNERS) {
+		CumulativeSums sums(xs, ys);
+		Corners found = find_optimal_corners(sums);
+		int c[4] = { found.lower_left, found.upper_left, found.upper_right, found.lower_right };
+		int first = 0;
+		for (int k = 1; k < 4; k++) {
+			if (xs[c[k]] < xs[c[first]]) first = k;
+		}
+		Line lines[4] = { Line("l1"), Line("l2"), Line("l3"), Line("l4") };
+		for (int k = 0; k < 4; k++) {
+			int from = c[(first + k) % 4], to = c[(first + k + 1) % 4];
+			lines[k].finish(sums, from, count_with_rollover(from, to, n));
+		}
+		return new FourSidedFigure(lines[0], lines[1], lines[2], lines[3]);
+	}
+	// Axis of symmetry goes from point of min X to point of max X.
+	// Find indices of the 4 corners
+	int ind_of_corner_1 = 0;
+	int ind_of_max_x = std::max_element(xs.begin(), xs.end()) - xs.begin();
+	int ind_of_corner_3 = ind_of_max_x;
+	double slope_of_symmetry_axis = (ys[ind_of_corner_3] - ys[ind_of_corner_1]) /
+		(xs[ind_of_corner_3] - xs[ind_of_corner_1]);
+	/*
+	Calculate displacement using dot product.  Symmetry axis runs along
+	vector <1, slope_of_symmetry_axis>.  Perpendicular to this is
+	the vector v=<slope_of_symmetry_axis, -1>.  The "displacement"
+	from the symmetry axis is the dot product of it with v.
+	The axis of symmetry will in general have non-zero displacement.  The points
+	whose displacements are furthest from the displacement of the line
+	are vertices 2 and 3.
+	*/
+	std::vector<double> displacements_from_symmetry_axis;
+	double disp_of_axis = xs[ind_of_corner_1] * slope_of_symmetry_axis - ys[ind_of_corner_1];
+	for (int i = 0; i < n; i++) {
+		double disp = xs[i] * slope_of_symmetry_axis - ys[i];
+		displacements_from_symmetry_axis.push_back(std::abs(disp - disp_of_axis));
+	}
+	int ind_of_corner_2 = std::max_element(displacements_from_symmetry_axis.begin() + 1,
+		displacements_from_symmetry_axis.begin() + ind_of_max_x - 1) - displacements_from_symmetry_axis.begin();
+	int ind_of_corner_4 = std::max_element(displacements_from_symmetry_axis.begin() + ind_of_max_x + 1,
+		displacements_from_symmetry_axis.end() - 1) - displacements_from_symmetry_axis.begin();
+	// Create Lines, clockwise from further left point
+	CumulativeSums sums(xs, ys);
+	Line e1("l1"), e2("l2"), e3("l3"), e4("l4");
+	e1.finish(sums, 0, ind_of_corner_2);
+	e2.finish(sums, ind_of_corner_2, ind_of_corner_3 - ind_of_corner_2);
+	e3.finish(sums, ind_of_corner_3, ind_of_corner_4 - ind_of_corner_3);
+	e4.finish(sums, ind_of_corner_4, n - ind_of_corner_4);
+	//e1.display(); e2.display(); e3.display(); e4.display();
+	FourSidedFigure* trap = new FourSidedFigure(e1, e2, e3, e4);
+	return trap;
+}
+
+inline double compute_area(const double* xs, const double* ys, int n) {
+	// Input: coordinates of a polygon in clockwise direction
+	// Computes area as described at:
+	//   https://math.blogoverflow.com/2014/06/04/greens-theorem-and-area-of-polygons/
+	double area = 0.0, avgx, dy;
+	double delt;
+	int i;
+	for (i = 0; i < n - 1; i++) {
+		avgx = (xs[i + 1] + xs[i]) / 2;
+		dy = (ys[i] - ys[i + 1]);
+		delt = avgx * dy;
+		area += delt;
+	}
+	delt = (xs[0] + xs[n - 1])*(ys[n - 1] - ys[0]) / 2;
+	area += delt;
+	return area;
+}
+
+inline double compute_area(const std::vector<double>& xs, const std::vector<double>& ys) {
+	return compute_area(xs.data(), ys.data(), static_cast<int>(xs.size()));
+}
+
+// Average distance of the points from figure
+inline double mean_distance(FourSidedFigure& figure, const double* xs, const double* ys, int n) {
+	double distances_sum = 0.0;
+	for (int i = 0; i < n; i++) {
+		double d = figure.dist(xs[i], ys[i]);
+		distances_sum += d;
+	}
+	return distances_sum / n;
+}
+
+inline double mean_distance(FourSidedFigure& figure, const std::vector<double>& xs, const std::vector<double>& ys) {
+	return mean_distance(figure, xs.data(), ys.data(), static_cast<int>(xs.size()));
+}
+
+#endif // DYNACARD_SHAPE_PROPERTIES_H
@@ -0,0 +1,231 @@
+/*
+Vector kernels for the per-card arithmetic that is left once parsing is fast:
+finding the min and max of a column, normalizing it, and accumulating the
+running moment sums behind CumulativeSums.
+
+Every kernel has a scalar version, and the vector versions are written to give
+the same bits:
+- min/max involve no rounding, so the order they are taken in doesn't matter
+- normalization keeps (v - min) / (max - min), a true division, per element
+- the running sums put the moments in the lanes, not the samples, so every
+  sum is still taken one sample at a time in card order.  No fused
+  multiply-add is enabled, so x*x is rounded before it is added, as in the
+  scalar loop.
+
+x86: the AVX2 versions are picked at run time if the CPU has AVX2 (GCC and
+clang only; MSVC builds use the scalar versions).
+ARM: NEON only holds doubles on AArch64, which uses them.  The 32-bit armhf
+build of motus_app.out runs the scalar versions, on the VFP unit.
+
+Setting DYNACARD_SIMD=scalar in the environment forces the scalar versions,
+to check the two against each other.
+*/
+
+#ifndef DYNACARD_SIMD_KERNELS_H
+#define DYNACARD_SIMD_KERNELS_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DYNACARD_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define DYNACARD_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Running sums are stored as 5 doubles per entry: x, y, xx, yy, xy
+const int MOMENT_COUNT = 5;
+
+//
+// Scalar versions
+//
+
+inline void min_max_scalar(const double* v, size_t n, double& min_value, double& max_value) {
+	double lo = v[0], hi = v[0];
+	for (size_t i = 1; i < n; i++) {
+		if (v[i] < lo) lo = v[i];
+		if (v[i] > hi) hi = v[i];
+	}
+	min_value = lo;
+	max_value = hi;
+}
+
+inline void normalize_scalar(const double* in, double* out, size_t n, double min_value, double diff) {
+	for (size_t i = 0; i < n; i++) out[i] = (in[i] - min_value) / diff;
+}
+
+// cum[0] is zero and cum[i + 1] holds the sums over points [0, i]
+inline void running_moments_scalar(const double* x, const double* y, size_t n, double* cum) {
+	double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+	memset(cum, 0, MOMENT_COUNT * sizeof(double));
+	for (size_t i = 0; i < n; i++) {
+		sx += x[i];
+		sy += y[i];
+		sxx += x[i] * x[i];
+		syy += y[i] * y[i];
+		sxy += x[i] * y[i];
+		double* c = cum + MOMENT_COUNT * (i + 1);
+		c[0] = sx; c[1] = sy; c[2] = sxx; c[3] = syy; c[4] = sxy;
+	}
+}
+
+//
+// AVX2 versions
+//
+
+#if DYNACARD_SIMD_AVX2
+
+__attribute__((target("avx2")))
+inline void min_max_avx2(const double* v, size_t n, double& min_value, double& max_value) {
+	if (n < 4) {
+		min_max_scalar(v, n, min_value, max_value);
+		return;
+	}
+	__m256d lo = _mm256_loadu_pd(v), hi = lo;
+	size_t i = 4;
+	for (; i + 4 <= n; i += 4) {
+		__m256d a = _mm256_loadu_pd(v + i);
+		lo = _mm256_min_pd(lo, a);
+		hi = _mm256_max_pd(hi, a);
+	}
+	double l[4], h[4];
+	_mm256_storeu_pd(l, lo);
+	_mm256_storeu_pd(h, hi);
+	double lo_value = l[0], hi_value = h[0];
+	for (int k = 1; k < 4; k++) {
+		if (l[k] < lo_value) lo_value = l[k];
+		if (h[k] > hi_value) hi_value = h[k];
+	}
+	for (; i < n; i++) {
+		if (v[i] < lo_value) lo_value = v[i];
+		if (v[i] > hi_value) hi_value = v[i];
+	}
+	min_value = lo_value;
+	max_value = hi_value;
+}
+
+__attribute__((target("avx2")))
+inline void normalize_avx2(const double* in, double* out, size_t n, double min_value, double diff) {
+	__m256d offset = _mm256_set1_pd(min_value), scale = _mm256_set1_pd(diff);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(in + i), offset), scale));
+	}
+	for (; i < n; i++) out[i] = (in[i] - min_value) / diff;
+}
+
+__attribute__((target("avx2")))
+inline void running_moments_avx2(const double* x, const double* y, size_t n, double* cum) {
+	// Lanes hold x, y, xx, yy; xy is summed alongside
+	__m256d total = _mm256_setzero_pd();
+	double sxy = 0;
+	memset(cum, 0, MOMENT_COUNT * sizeof(double));
+	for (size_t i = 0; i < n; i++) {
+		__m256d xy = _mm256_set_pd(y[i], x[i], y[i], x[i]);
+		__m256d one_or_xy = _mm256_set_pd(y[i], x[i], 1.0, 1.0);
+		total = _mm256_add_pd(total, _mm256_mul_pd(xy, one_or_xy));
+		sxy += x[i] * y[i];
+		double* c = cum + MOMENT_COUNT * (i + 1);
+		_mm256_storeu_pd(c, total);
+		c[4] = sxy;
+	}
+}
+
+#endif // DYNACARD_SIMD_AVX2
+
+//
+// AArch64 NEON versions
+//
+
+#if DYNACARD_SIMD_NEON
+
+inline void min_max_neon(const double* v, size_t n, double& min_value, double& max_value) {
+	if (n < 2) {
+		min_max_scalar(v, n, min_value, max_value);
+		return;
+	}
+	float64x2_t lo = vld1q_f64(v), hi = lo;
+	size_t i = 2;
+	for (; i + 2 <= n; i += 2) {
+		float64x2_t a = vld1q_f64(v + i);
+		lo = vminq_f64(lo, a);
+		hi = vmaxq_f64(hi, a);
+	}
+	double lo_value = vminvq_f64(lo), hi_value = vmaxvq_f64(hi);
+	for (; i < n; i++) {
+		if (v[i] < lo_value) lo_value = v[i];
+		if (v[i] > hi_value) hi_value = v[i];
+	}
+	min_value = lo_value;
+	max_value = hi_value;
+}
+
+inline void normalize_neon(const double* in, double* out, size_t n, double min_value, double diff) {
+	float64x2_t offset = vdupq_n_f64(min_value), scale = vdupq_n_f64(diff);
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		vst1q_f64(out + i, vdivq_f64(vsubq_f64(vld1q_f64(in + i), offset), scale));
+	}
+	for (; i < n; i++) out[i] = (in[i] - min_value) / diff;
+}
+
+inline void running_moments_neon(const double* x, const double* y, size_t n, double* cum) {
+	// One vector holds x, y and the other xx, yy; xy is summed alongside
+	float64x2_t sums = vdupq_n_f64(0), squares = vdupq_n_f64(0);
+	double sxy = 0;
+	memset(cum, 0, MOMENT_COUNT * sizeof(double));
+	for (size_t i = 0; i < n; i++) {
+		double point[2] = { x[i], y[i] };
+		float64x2_t p = vld1q_f64(point);
+		sums = vaddq_f64(sums, p);
+		squares = vaddq_f64(squares, vmulq_f64(p, p));
+		sxy += x[i] * y[i];
+		double* c = cum + MOMENT_COUNT * (i + 1);
+		vst1q_f64(c, sums);
+		vst1q_f64(c + 2, squares);
+		c[4] = sxy;
+	}
+}
+
+#endif // DYNACARD_SIMD_NEON
+
+//
+// Dispatch, decided once per process
+//
+
+struct SimdKernels {
+	const char* name;
+	void (*min_max)(const double* v, size_t n, double& min_value, double& max_value);
+	void (*normalize)(const double* in, double* out, size_t n, double min_value, double diff);
+	void (*running_moments)(const double* x, const double* y, size_t n, double* cum);
+};
+
+inline SimdKernels scalar_kernels() {
+	SimdKernels k = { "scalar", min_max_scalar, normalize_scalar, running_moments_scalar };
+	return k;
+}
+
+inline SimdKernels pick_kernels() {
+	const char* forced = getenv("DYNACARD_SIMD");
+	if (forced != NULL && strcmp(forced, "scalar") == 0) return scalar_kernels();
+#if DYNACARD_SIMD_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		SimdKernels k = { "avx2", min_max_avx2, normalize_avx2, running_moments_avx2 };
+		return k;
+	}
+#elif DYNACARD_SIMD_NEON
+	SimdKernels k = { "neon", min_max_neon, normalize_neon, running_moments_neon };
+	return k;
+#endif
+	return scalar_kernels();
+}
+
+inline const SimdKernels& simd_kernels() {
+	static const SimdKernels kernels = pick_kernels();
+	return kernels;
+}
+
+#endif // DYNACARD_SIMD_KERNELS_H
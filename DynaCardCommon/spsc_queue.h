@@ -0,0 +1,92 @@
+/*
+A bounded queue between exactly one producer thread and one consumer thread,
+with no lock: each side owns one counter, which only it writes, and reads
+the other's with acquire ordering.  The counters sit on cache lines of their
+own, next to each side's cached copy of the other's counter, so a producer
+and consumer that keep up with each other touch the shared lines about once
+per wrap of the queue rather than once per item.
+
+The slots are allocated up front and reused: the producer fills the slot
+claim() gives it in place and publish()es it, the consumer reads front() in
+place and pop()s it.  A slot that holds vectors keeps their capacity from
+one item to the next, so nothing is allocated once every slot has held the
+largest item.
+*/
+
+#ifndef DYNACARD_SPSC_QUEUE_H
+#define DYNACARD_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Keeps the producer's and consumer's counters off each other's cache line
+const size_t SPSC_CACHE_LINE = 64;
+
+template<typename T>
+class SpscQueue {
+public:
+	// Holds capacity items, rounded up to a power of two
+	explicit SpscQueue(size_t capacity) {
+		size_t n = 1;
+		while (n < capacity) n *= 2;
+		slots.resize(n);
+		mask = n - 1;
+		head = 0;
+		tail = 0;
+		head_seen = 0;
+		tail_seen = 0;
+	}
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	size_t capacity() const {
+		return slots.size();
+	}
+
+	// Producer: the slot to fill next, or nullptr while the queue is full
+	T* claim() {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head_seen == slots.size()) {
+			head_seen = head.load(std::memory_order_acquire);
+			if (t - head_seen == slots.size()) return nullptr;
+		}
+		return &slots[t & mask];
+	}
+	// Producer: hand the slot claim() gave over to the consumer
+	void publish() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer: the oldest item, or nullptr while the queue is empty
+	T* front() {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail_seen) {
+			tail_seen = tail.load(std::memory_order_acquire);
+			if (h == tail_seen) return nullptr;
+		}
+		return &slots[h & mask];
+	}
+	// Consumer: give the slot front() gave back to the producer
+	void pop() {
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Either side, or anyone once both are done: no item waiting
+	bool empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector<T> slots;
+	size_t mask;
+	// Written by the consumer only
+	alignas(SPSC_CACHE_LINE) std::atomic<size_t> head;
+	size_t tail_seen;
+	// Written by the producer only
+	alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail;
+	size_t head_seen;
+	char pad[SPSC_CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
+#endif // DYNACARD_SPSC_QUEUE_H
@@ -0,0 +1,185 @@
+/*
+Runs a batch of items through three stages, each on threads of its own:
+read (n_readers threads), compute (n_workers threads) and write (the
+calling thread, in input order).  Bounded queues between the stages let
+the readers fetch and parse the next files while the workers classify
+earlier ones, and the writer writes results from before those, so the
+disk and the CPUs stay busy together.
+
+Items travel in a fixed pool of slots, and a slot goes back to the readers
+once it is written.  A reader waits for a free slot before it takes the
+next item, so no more than n_slots items are ever read but not yet
+written, however far one stage falls behind.  A slot's buffers are reused
+from item to item.  Items are taken in order and only by a reader that
+already holds a slot, so the item the writer waits for is always on its
+way.
+
+Every thread adds up the time it spent in its stage's function (busy),
+waiting for something to work on (starved) and waiting for room further
+on (blocked).  A stage's utilization is its busy time over its threads x
+the wall time.  A stage near 100% while the others wait on it wants more
+threads; a mostly starved stage can do with fewer.
+*/
+
+#ifndef DYNACARD_STAGE_PIPELINE_H
+#define DYNACARD_STAGE_PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+
+// Items a stage can get ahead of the next one by, between each pair of stages
+const size_t PIPELINE_QUEUE_ITEMS = 8;
+
+// Number of workers to use when asked for 0: one per hardware thread
+inline int default_worker_count() {
+	unsigned n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : static_cast<int>(n);
+}
+
+struct StageStats {
+	int n_threads = 0;
+	uint64_t n_items = 0;
+	double busy_seconds = 0;      // in the stage's function
+	double starved_seconds = 0;   // waiting for an item to work on
+	double blocked_seconds = 0;   // waiting for room in the next queue, or for a free slot
+	// Fraction of its threads' time the stage was busy, over wall_seconds
+	double utilization(double wall_seconds) const {
+		return n_threads == 0 || wall_seconds <= 0 ? 0 : busy_seconds / (n_threads * wall_seconds);
+	}
+};
+
+struct PipelineStats {
+	double seconds = 0;
+	StageStats read, compute, write;
+};
+
+struct PipelineThreads {
+	int n_readers = 1;
+	int n_workers = 1;
+	size_t queue_items = PIPELINE_QUEUE_ITEMS;
+};
+
+/*
+For every item 0..n_items-1: read(i, slot, reader) on a reader thread, then
+compute(slot, worker) on a worker thread, then write(i, slot) on the calling
+thread, in order of i.  reader and worker are 0..n-1 of their stage, to
+index per-thread scratch.  Slot is whatever the stages hand on; it is
+default constructed once per slot and reused.
+*/
+template<typename Slot, typename Read, typename Compute, typename Write>
+PipelineStats run_pipeline(size_t n_items, const PipelineThreads& threads, Read read, Compute compute, Write write) {
+	typedef std::chrono::steady_clock Clock;
+	struct Entry {
+		size_t index;
+		Slot slot;
+	};
+	int n_readers = threads.n_readers < 1 ? 1 : threads.n_readers;
+	int n_workers = threads.n_workers < 1 ? 1 : threads.n_workers;
+	size_t queue_items = threads.queue_items < 1 ? 1 : threads.queue_items;
+	// One for every thread to hold and every place in the queues between them
+	size_t n_slots = n_readers + n_workers + 2 * queue_items;
+	std::vector<Entry> entries(n_slots);
+	BoundedQueue<Entry*> free_slots(n_slots), read_slots(queue_items), computed_slots(queue_items);
+	for (size_t s = 0; s < n_slots; s++) free_slots.push(&entries[s]);
+
+	PipelineStats stats;
+	stats.read.n_threads = n_readers;
+	stats.compute.n_threads = n_workers;
+	stats.write.n_threads = 1;
+	std::mutex stats_mutex;
+	auto seconds_between = [](Clock::time_point start, Clock::time_point stop) {
+		return std::chrono::duration<double>(stop - start).count();
+	};
+	// Each thread keeps its own totals and adds them to its stage's once it is done
+	auto add_stats = [&](StageStats& stage, const StageStats& thread_stats) {
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stage.n_items += thread_stats.n_items;
+		stage.busy_seconds += thread_stats.busy_seconds;
+		stage.starved_seconds += thread_stats.starved_seconds;
+		stage.blocked_seconds += thread_stats.blocked_seconds;
+	};
+
+	Clock::time_point start = Clock::now();
+	std::atomic<size_t> next_item(0);
+	std::atomic<int> readers_left(n_readers), workers_left(n_workers);
+	std::vector<std::thread> stage_threads;
+	for (int r = 0; r < n_readers; r++) {
+		stage_threads.push_back(std::thread([&, r] {
+			StageStats mine;
+			Entry* entry;
+			Clock::time_point t0 = Clock::now();
+			while (free_slots.pop(entry)) {
+				size_t i = next_item.fetch_add(1);
+				if (i >= n_items) break;
+				Clock::time_point t1 = Clock::now();
+				entry->index = i;
+				read(i, entry->slot, r);
+				Clock::time_point t2 = Clock::now();
+				read_slots.push(entry);
+				Clock::time_point t3 = Clock::now();
+				mine.blocked_seconds += seconds_between(t0, t1) + seconds_between(t2, t3);
+				mine.busy_seconds += seconds_between(t1, t2);
+				mine.n_items++;
+				t0 = t3;
+			}
+			add_stats(stats.read, mine);
+			if (--readers_left == 0) read_slots.close();
+		}));
+	}
+	for (int w = 0; w < n_workers; w++) {
+		stage_threads.push_back(std::thread([&, w] {
+			StageStats mine;
+			Entry* entry;
+			Clock::time_point t0 = Clock::now();
+			while (read_slots.pop(entry)) {
+				Clock::time_point t1 = Clock::now();
+				compute(entry->slot, w);
+				Clock::time_point t2 = Clock::now();
+				computed_slots.push(entry);
+				Clock::time_point t3 = Clock::now();
+				mine.starved_seconds += seconds_between(t0, t1);
+				mine.busy_seconds += seconds_between(t1, t2);
+				mine.blocked_seconds += seconds_between(t2, t3);
+				mine.n_items++;
+				t0 = t3;
+			}
+			add_stats(stats.compute, mine);
+			if (--workers_left == 0) computed_slots.close();
+		}));
+	}
+
+	// Items in flight are within n_slots of the next one to write, so index % n_slots is a place of their own
+	std::vector<Entry*> waiting(n_slots, nullptr);
+	size_t next_write = 0;
+	Entry* entry;
+	Clock::time_point t0 = Clock::now();
+	while (next_write < n_items && computed_slots.pop(entry)) {
+		Clock::time_point t1 = Clock::now();
+		stats.write.starved_seconds += seconds_between(t0, t1);
+		waiting[entry->index % n_slots] = entry;
+		Entry* next;
+		while ((next = waiting[next_write % n_slots]) != nullptr && next->index == next_write) {
+			waiting[next_write % n_slots] = nullptr;
+			write(next_write, next->slot);
+			free_slots.push(next);
+			next_write++;
+			stats.write.n_items++;
+		}
+		t0 = Clock::now();
+		stats.write.busy_seconds += seconds_between(t1, t0);
+	}
+	// Readers waiting for a slot to find there is nothing left to read
+	free_slots.close();
+	for (size_t t = 0; t < stage_threads.size(); t++) stage_threads[t].join();
+	stats.seconds = seconds_between(start, Clock::now());
+	return stats;
+}
+
+#endif // DYNACARD_STAGE_PIPELINE_H
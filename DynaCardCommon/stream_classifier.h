@@ -0,0 +1,101 @@
+/*
+Classifies a card stream as it arrives, sample by sample, rather than a file
+once it is complete: the moment a sample closes a stroke the stroke is
+classified, so a diagnosis lags the pump by one stroke instead of by one
+file upload.
+
+The strokes are cut by StrokeSegmenter, the hysteresis state machine of
+extract_one_cycle, so they are exactly the strokes classify_pump_state
+--strokes finds in the same samples written to a file, and get the same
+states.  What can be kept up to date per sample is: the stroke's samples and
+the ranges of its length and weight, so closing it copies it into a Card
+that needs no scan for them.  The running moment sums the edges are fitted
+from cannot be: they are over the normalized stroke, and the stroke's range
+is not known before it closes (the sample that closes it is usually its
+smallest length).  They are summed in one pass at the close, after which
+every edge fit is constant time (line_fit.h).
+
+Memory is bounded by the longest stroke.  Nothing is allocated once the
+buffers have grown to it.
+*/
+
+#ifndef DYNACARD_STREAM_CLASSIFIER_H
+#define DYNACARD_STREAM_CLASSIFIER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "card.h"
+#include "pump_state.h"
+#include "stroke_segmenter.h"
+#include "trace.h"
+
+// A stroke of the stream, classified
+struct StreamStroke {
+	const char* state;
+	uint64_t first, end;     // its samples, counted over every sample added
+	EdgeFit fits[4];         // left, top, right, bottom, as classify_card gives them
+};
+
+class StreamClassifier {
+public:
+	/*
+	Classifies every stroke as it closes; classify_card by default.  Set it to
+	classify some other way (resampled, by nearest neighbours).
+	*/
+	std::function<const char* (Card& card, EdgeFit fits[4])> classify_stroke;
+	// The stroke closed by the last add_sample that returned true, until the next call
+	StreamStroke stroke;
+
+	StreamClassifier(double min_acceptable_peak_weight, CornerMethod corner_method = HEURISTIC_CORNERS) {
+		classify_stroke = [min_acceptable_peak_weight, corner_method](Card& card, EdgeFit fits[4]) {
+			return classify_card(card, min_acceptable_peak_weight, corner_method, fits);
+		};
+		stroke.state = nullptr;
+		stroke.first = stroke.end = 0;
+	}
+
+	// Add the next sample.  Returns true if it closed a stroke, which is then classified in stroke.
+	bool add_sample(double pos, double len, double wt) {
+		if (!segmenter.add_sample(pos, len, wt)) return false;
+		TRACE_SPAN("close stroke");
+		card.assign(segmenter.position.data(), segmenter.length.data(), segmenter.weight.data(), segmenter.position.size(),
+			segmenter.min_length, segmenter.max_length, segmenter.min_weight, segmenter.max_weight);
+		stroke.state = classify_stroke(card, stroke.fits);
+		stroke.first = segmenter.first_sample;
+		stroke.end = segmenter.last_sample() + 1;
+		return true;
+	}
+
+	// Add n samples, calling done(stroke) for every stroke they close; returns how many they closed
+	template <typename Done>
+	size_t add_samples(const double* pos, const double* len, const double* wt, size_t n, Done done) {
+		size_t closed = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (!add_sample(pos[i], len[i], wt[i])) continue;
+			done(static_cast<const StreamStroke&>(stroke));
+			closed++;
+		}
+		return closed;
+	}
+
+	uint64_t n_samples() const {
+		return segmenter.n_samples;
+	}
+	uint64_t n_strokes() const {
+		return segmenter.n_strokes;
+	}
+	// Start over, as for a sensor that was restarted
+	void reset() {
+		segmenter.reset();
+		stroke.state = nullptr;
+		stroke.first = stroke.end = 0;
+	}
+
+private:
+	StrokeSegmenter segmenter;
+	Card card;
+};
+
+#endif // DYNACARD_STREAM_CLASSIFIER_H
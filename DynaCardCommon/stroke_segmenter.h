@@ -0,0 +1,117 @@
+/*
+Cuts a continuous position/length/weight recording into strokes.
+
+This is the hysteresis state machine of extract_one_cycle in
+ComputeShapeProperties, run over the whole recording instead of stopping
+after the first cycle:
+  - A stroke starts at the first sample where x<=LENGTH_STARTING_THRESH
+  - It is done starting as soon as x>=LENGTH_STARTED_THRESH
+  - It is finished when x<=LENGTH_STARTING_THRESH again
+The sample that finishes one stroke also starts the next one, so strokes of
+a continuous recording join end to end.  Samples before the first start are
+dropped, as is an unfinished stroke at the end of the recording.
+
+Samples are fed one at a time and only the stroke being collected is kept,
+so memory is bounded by the longest stroke, not by the recording.  The
+ranges of its length and weight are kept up to date as it grows, so the
+Card it is classified in need not scan for them again (Card::assign).
+*/
+
+#ifndef DYNACARD_STROKE_SEGMENTER_H
+#define DYNACARD_STROKE_SEGMENTER_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+Identify start/end of a cycle when x<=LENGTH_STARTING_THRESH.
+When x moves above LENGTH_STARTED_THRESH the cycle is finished starting -
+this is in case x fluctuates around LENGTH_STARTING_THRESH a little bit at first.
+*/
+const double LENGTH_STARTING_THRESH = 1.0;  // below this starts a cycle
+const double LENGTH_STARTED_THRESH = 5.0; // above this the cycle is considered to have started
+
+class StrokeSegmenter {
+public:
+	double starting_thresh, started_thresh;
+	// Samples of the stroke being collected.  After add_sample returns true
+	// these hold the finished stroke until the next call.
+	std::vector<double> position, length, weight;
+	// Index (counted over every sample added) of the first sample in position/length/weight
+	size_t first_sample;
+	// Smallest and largest length and weight of the stroke held
+	double min_length, max_length, min_weight, max_weight;
+	size_t n_samples;
+	size_t n_strokes;
+
+	StrokeSegmenter(double starting = LENGTH_STARTING_THRESH, double started = LENGTH_STARTED_THRESH) {
+		starting_thresh = starting;
+		started_thresh = started;
+		reset();
+	}
+	void reset() {
+		position.clear(); length.clear(); weight.clear();
+		first_sample = 0;
+		min_length = max_length = min_weight = max_weight = 0;
+		n_samples = 0;
+		n_strokes = 0;
+		cycle_started = false;
+		cycle_finished_starting = false;
+		stroke_finished = false;
+	}
+	// Add the next sample.  Returns true if it finished a stroke.
+	bool add_sample(double pos, double x, double y) {
+		if (stroke_finished) {
+			// The last sample of the previous stroke is the first of this one
+			double last_pos = position.back(), last_x = length.back(), last_y = weight.back();
+			first_sample += position.size() - 1;
+			position.clear(); length.clear(); weight.clear();
+			keep(last_pos, last_x, last_y);
+			cycle_finished_starting = false;
+			stroke_finished = false;
+		}
+		n_samples++;
+		if (!cycle_started) {
+			// Recording starts in the middle of a cycle.  Ignore starting samples
+			if (x > starting_thresh) return false;
+			cycle_started = true;
+			first_sample = n_samples - 1;
+			keep(pos, x, y);
+			return false;
+		}
+		keep(pos, x, y);
+		if (!cycle_finished_starting) {
+			if (x >= started_thresh) cycle_finished_starting = true;
+			return false;
+		}
+		if (x <= starting_thresh) {
+			stroke_finished = true;
+			n_strokes++;
+			return true;
+		}
+		return false;
+	}
+	// Index of the last sample of the stroke currently held
+	size_t last_sample() const {
+		return first_sample + position.size() - 1;
+	}
+private:
+	bool cycle_started, cycle_finished_starting, stroke_finished;
+	void keep(double pos, double x, double y) {
+		if (position.empty()) {
+			min_length = max_length = x;
+			min_weight = max_weight = y;
+		}
+		else {
+			if (x < min_length) min_length = x;
+			if (x > max_length) max_length = x;
+			if (y < min_weight) min_weight = y;
+			if (y > max_weight) max_weight = y;
+		}
+		position.push_back(pos);
+		length.push_back(x);
+		weight.push_back(y);
+	}
+};
+
+#endif // DYNACARD_STROKE_SEGMENTER_H
@@ -0,0 +1,279 @@
+/*
+Chrome trace-event output of the calls that classify a card, for seeing
+where the time of the worst cards in a batch goes.  The file opens in
+chrome://tracing or ui.perfetto.dev.
+
+A TraceCard around the work on one card decides whether the card is traced.
+It traces one card in every one_in.  With slower_than_us set, it also traces
+every card that takes longer than that.  For those, every card is recorded
+and only the sampled and slow ones are written out.  While a card is traced,
+every TRACE_SPAN on its thread records a complete ("X") event into a
+thread-local buffer.  The TraceCard adds a "card" event tagged with the file
+and the state, and hands the lot to the writer.  TRACE_SPAN costs a
+thread-local load and a branch on a card that is not traced.
+
+Work on a card that happens on another thread before its TraceCard, such
+as a pipeline's reader parsing the file ahead of the worker, is timed with
+a TraceHandoff and handed to the TraceCard with add_handoff.  The span
+keeps its own thread, and the card event gets how long the card waited in
+between as queued_us.
+
+Events are appended to the file a card at a time and flushed, so the trace
+of a run that is killed is still readable: both viewers accept a
+traceEvents array that was never closed.
+*/
+
+#ifndef DYNACARD_TRACE_H
+#define DYNACARD_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+	const char* name;
+	const char* detail_prefix;   // args.detail is these two joined, "" for no args
+	const char* detail;
+	int64_t start_ns;            // since the writer was opened
+	int64_t duration_ns;
+	int tid;                     // the thread it ran on, 0 for the card's own
+};
+
+class TraceWriter {
+public:
+	TraceWriter() {
+		file = nullptr;
+		one_in = 1;
+		slower_than_ns = 0;
+		n_cards = 0;
+		n_written = 0;
+		origin = std::chrono::steady_clock::now();
+	}
+	~TraceWriter() {
+		close();
+	}
+	TraceWriter(const TraceWriter&) = delete;
+	TraceWriter& operator=(const TraceWriter&) = delete;
+
+	// Start tracing to path: one card in every sample_one_in, and every card slower than slower_than_us (0: none)
+	bool open(const std::string& path, uint64_t sample_one_in, double slower_than_us) {
+		close();
+		file = fopen(path.c_str(), "w");
+		if (!file) return false;
+		one_in = sample_one_in < 1 ? 1 : sample_one_in;
+		slower_than_ns = static_cast<int64_t>(slower_than_us * 1000);
+		n_cards = 0;
+		n_written = 0;
+		origin = std::chrono::steady_clock::now();
+		fputs("{\"traceEvents\":[\n", file);
+		fputs("{\"name\":\"process_name\", \"ph\":\"M\", \"pid\":1, \"args\":{\"name\":\"dynacard\"}}", file);
+		return true;
+	}
+	void close() {
+		if (!file) return;
+		fputs("\n]}\n", file);
+		fclose(file);
+		file = nullptr;
+	}
+	bool enabled() const {
+		return file != nullptr;
+	}
+	// Whether the next card is to be recorded at all, and whether it is one of the sampled ones
+	bool record_next(bool& sampled) {
+		sampled = n_cards.fetch_add(1, std::memory_order_relaxed) % one_in == 0;
+		return sampled || slower_than_ns > 0;
+	}
+	bool slow(int64_t duration_ns) const {
+		return slower_than_ns > 0 && duration_ns > slower_than_ns;
+	}
+	int64_t now_ns() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+	}
+	// Cards written so far
+	uint64_t written() const {
+		return n_written;
+	}
+
+	/*
+	Write the events of one card, recorded on thread tid, the last of them the
+	card's own, which waited queued_ns after the work handed off to it (-1: none)
+	*/
+	void write(const std::vector<TraceEvent>& events, int tid, const std::string& fname, const std::string& state,
+		int64_t queued_ns = -1) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!file) return;
+		for (size_t i = 0; i < events.size(); i++) {
+			const TraceEvent& e = events[i];
+			fprintf(file, ",\n{\"name\":\"%s\", \"ph\":\"X\", \"pid\":1, \"tid\":%d, \"ts\":%.3f, \"dur\":%.3f",
+				e.name, e.tid != 0 ? e.tid : tid, e.start_ns / 1000.0, e.duration_ns / 1000.0);
+			if (i + 1 == events.size()) {
+				fputs(", \"args\":{\"file\":", file);
+				write_string(fname.c_str());
+				fputs(", \"state\":", file);
+				write_string(state.c_str());
+				if (queued_ns >= 0) fprintf(file, ", \"queued_us\":%.3f", queued_ns / 1000.0);
+				fputs("}", file);
+			}
+			else if (e.detail[0] != '\0' || e.detail_prefix[0] != '\0') {
+				fprintf(file, ", \"args\":{\"detail\":\"%s%s\"}", e.detail_prefix, e.detail);
+			}
+			fputs("}", file);
+		}
+		fflush(file);
+		n_written++;
+	}
+
+private:
+	FILE* file;
+	uint64_t one_in;
+	int64_t slower_than_ns;
+	std::atomic<uint64_t> n_cards;
+	std::atomic<uint64_t> n_written;
+	std::chrono::steady_clock::time_point origin;
+	std::mutex mutex;
+
+	// s as a JSON string; file names may hold backslashes and quotes
+	void write_string(const char* s) {
+		fputc('"', file);
+		for (; *s; s++) {
+			if (*s == '"' || *s == '\\') fputc('\\', file);
+			if (static_cast<unsigned char>(*s) >= 0x20) fputc(*s, file);
+		}
+		fputc('"', file);
+	}
+};
+
+// The process' trace, not enabled until opened
+inline TraceWriter& trace_writer() {
+	static TraceWriter writer;
+	return writer;
+}
+
+// Events of the card being traced on this thread, nullptr if it is not
+inline std::vector<TraceEvent>*& active_trace() {
+	thread_local std::vector<TraceEvent>* events = nullptr;
+	return events;
+}
+
+// Small number for this thread, to be the events' tid
+inline int trace_thread_id() {
+	static std::atomic<int> n_threads(0);
+	thread_local int id = ++n_threads;
+	return id;
+}
+
+// Records the time from its construction to its destruction if the card on this thread is traced
+class TraceSpan {
+public:
+	TraceSpan(const char* name, const char* detail_prefix = "", const char* detail = "") {
+		events = active_trace();
+		if (!events) return;
+		event.name = name;
+		event.detail_prefix = detail_prefix;
+		event.detail = detail;
+		event.tid = 0;
+		event.start_ns = trace_writer().now_ns();
+	}
+	~TraceSpan() {
+		if (!events) return;
+		event.duration_ns = trace_writer().now_ns() - event.start_ns;
+		events->push_back(event);
+	}
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	std::vector<TraceEvent>* events;
+	TraceEvent event;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+// Trace the rest of the enclosing block as name, with an optional detail ("left", "first half of ", "top")
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+
+/*
+Times the rest of the enclosing block into event, on this thread, for a
+card whose TraceCard comes later on another thread; whether the card is
+traced is only known then.  Leaves event's name null when no trace is open.
+*/
+class TraceHandoff {
+public:
+	TraceHandoff(TraceEvent& handed_off, const char* name, const char* detail = "") : event(handed_off) {
+		event.name = nullptr;
+		if (!trace_writer().enabled()) return;
+		event.name = name;
+		event.detail_prefix = "";
+		event.detail = detail;
+		event.tid = trace_thread_id();
+		event.start_ns = trace_writer().now_ns();
+	}
+	~TraceHandoff() {
+		if (event.name) event.duration_ns = trace_writer().now_ns() - event.start_ns;
+	}
+	TraceHandoff(const TraceHandoff&) = delete;
+	TraceHandoff& operator=(const TraceHandoff&) = delete;
+
+private:
+	TraceEvent& event;
+};
+
+/*
+The work on one card file: traces the spans inside it if the writer picks
+the card.  Call set_state with the result before it goes out of scope.
+*/
+class TraceCard {
+public:
+	explicit TraceCard(const std::string& card_fname) {
+		recording = false;
+		sampled = false;
+		queued_ns = -1;
+		TraceWriter& writer = trace_writer();
+		if (!writer.enabled() || !writer.record_next(sampled)) return;
+		recording = true;
+		fname = card_fname;
+		events().clear();
+		active_trace() = &events();
+		start_ns = writer.now_ns();
+	}
+	~TraceCard() {
+		if (!recording) return;
+		active_trace() = nullptr;
+		TraceWriter& writer = trace_writer();
+		int64_t duration_ns = writer.now_ns() - start_ns;
+		if (!sampled && !writer.slow(duration_ns)) return;
+		TraceEvent card = { "card", "", "", start_ns, duration_ns, 0 };
+		events().push_back(card);
+		writer.write(events(), trace_thread_id(), fname, state, queued_ns);
+	}
+	TraceCard(const TraceCard&) = delete;
+	TraceCard& operator=(const TraceCard&) = delete;
+
+	void set_state(const std::string& card_state) {
+		if (recording) state = card_state;
+	}
+	// A span a TraceHandoff timed on another thread before this card
+	void add_handoff(const TraceEvent& event) {
+		if (!recording || !event.name) return;
+		events().push_back(event);
+		queued_ns = start_ns - (event.start_ns + event.duration_ns);
+	}
+
+private:
+	bool recording, sampled;
+	std::string fname, state;
+	int64_t start_ns;
+	int64_t queued_ns;
+
+	// Reused card after card, so a thread allocates for its first traced card only
+	static std::vector<TraceEvent>& events() {
+		thread_local std::vector<TraceEvent> card_events;
+		return card_events;
+	}
+};
+
+#endif // DYNACARD_TRACE_H
@@ -0,0 +1,296 @@
+/*
+Ingest for a gateway serving many wells: the sample streams of every well
+come in on a few reader (I/O) threads, each well's strokes are cut on the
+thread that reads it, and the finished strokes are classified by a pool of
+classifier threads.
+
+A well is known by the Well ID Number of its card header (well_key in
+card_header.h).  Every well is read on one reader, reader_for(well_id),
+which keeps its stroke state: a StrokeSegmenter (stroke_segmenter.h) and a
+count of its strokes.
+Every well is also classified on one classifier, picked from the same hash.
+Between each reader and each classifier is a lock-free single producer,
+single consumer queue (spsc_queue.h), R x C of them, so no two threads ever
+write the same queue and neither side takes a lock.
+
+Ordering: a well's strokes are cut in order on its reader and go through the
+one queue from that reader to its classifier, so on_result sees them in
+order, numbered 0, 1, 2 ..  Strokes of different wells come out in any
+order, from any classifier thread, at the same time.
+
+Backpressure: a reader that finds its queue to a classifier full waits for
+a slot (counted in n_stalls) instead of dropping or reordering, so a
+classifier that can't keep up slows down the readers feeding it, which
+leave their sockets or files unread.  Memory stays bounded: R x C queues of
+queue_strokes strokes, and per well the stroke being cut.
+
+The stroke slots are copied into in place and keep their buffers, so once
+every slot has held the longest stroke nothing more is allocated but the
+state of wells seen for the first time.
+*/
+
+#ifndef DYNACARD_WELL_INGEST_H
+#define DYNACARD_WELL_INGEST_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "card_parser.h"
+#include "card_header.h"
+#include "card.h"
+#include "pump_state.h"
+#include "stroke_segmenter.h"
+#include "spsc_queue.h"
+#include "stage_pipeline.h"
+
+// Strokes a reader can have queued for each classifier before it waits
+const size_t INGEST_QUEUE_STROKES = 64;
+// Empty polls a classifier spins through, yielding, before it starts sleeping between polls
+const int INGEST_IDLE_SPINS = 64;
+const int INGEST_IDLE_SLEEP_US = 50;
+
+// A stroke of a well, classified, as on_result gets it
+struct IngestedStroke {
+	const std::string* well_id;
+	uint64_t sequence;       // 0, 1, 2 .. over the well's strokes
+	uint64_t first, end;     // its samples, counted over every sample of the well
+	const char* state;
+	int classifier;          // the thread it was classified on
+};
+
+struct IngestOptions {
+	int n_readers = 1;
+	int n_classifiers = 0;   // 0 for one per hardware thread
+	size_t queue_strokes = INGEST_QUEUE_STROKES;
+	double min_acceptable_peak_weight = 60;
+	CornerMethod corner_method = HEURISTIC_CORNERS;
+	/*
+	Classifies every stroke; classify_card by default.  Called on every
+	classifier thread at once, so it must be safe to.
+	*/
+	std::function<const char* (Card& card, EdgeFit fits[4])> classify_stroke;
+};
+
+class WellIngest {
+public:
+	typedef std::function<void(const IngestedStroke& stroke)> ResultCallback;
+
+	// A finished stroke on its way from a reader to a classifier
+	struct QueuedStroke {
+		const std::string* well_id;
+		uint64_t sequence, first, end;
+		CardColumns samples;
+		double min_length, max_length, min_weight, max_weight;
+	};
+
+	// The producer side, used by one reader thread only
+	class Reader {
+	public:
+		uint64_t n_samples = 0;
+		uint64_t n_strokes = 0;
+		// Strokes that had to wait for their queue to have room
+		uint64_t n_stalls = 0;
+
+		// The reader's index of the well, which it takes on the first time it is seen
+		uint32_t well(const std::string& well_id) {
+			std::unordered_map<std::string, uint32_t>::const_iterator found = index.find(well_id);
+			if (found != index.end()) return found->second;
+			uint32_t w = static_cast<uint32_t>(wells.size());
+			wells.push_back(WellState());
+			wells.back().id = well_id;
+			wells.back().n_strokes = 0;
+			wells.back().classifier = owner->classifier_for(well_id);
+			index[well_id] = w;
+			return w;
+		}
+		size_t n_wells() const {
+			return wells.size();
+		}
+
+		// The next n samples of a well; waits while its classifier is a queue behind
+		void add_samples(uint32_t well, const double* pos, const double* len, const double* wt, size_t n) {
+			WellState& state = wells[well];
+			for (size_t i = 0; i < n; i++) {
+				if (state.segmenter.add_sample(pos[i], len[i], wt[i])) push(state);
+			}
+			n_samples += n;
+		}
+		void add_samples(const std::string& well_id, const double* pos, const double* len, const double* wt, size_t n) {
+			add_samples(well(well_id), pos, len, wt, n);
+		}
+
+	private:
+		friend class WellIngest;
+		struct WellState {
+			std::string id;
+			StrokeSegmenter segmenter;
+			uint64_t n_strokes;
+			int classifier;
+		};
+		WellIngest* owner;
+		// A deque, so the ids the queued strokes point at stay put as wells are added
+		std::deque<WellState> wells;
+		std::unordered_map<std::string, uint32_t> index;
+		// To each classifier
+		std::vector<std::unique_ptr<SpscQueue<QueuedStroke> > > queues;
+
+		void push(WellState& state) {
+			SpscQueue<QueuedStroke>& queue = *queues[state.classifier];
+			QueuedStroke* slot = queue.claim();
+			if (slot == nullptr) {
+				n_stalls++;
+				while ((slot = queue.claim()) == nullptr) std::this_thread::yield();
+			}
+			const StrokeSegmenter& segmenter = state.segmenter;
+			slot->well_id = &state.id;
+			slot->sequence = state.n_strokes++;
+			slot->first = segmenter.first_sample;
+			slot->end = segmenter.last_sample() + 1;
+			slot->samples.position.assign(segmenter.position.begin(), segmenter.position.end());
+			slot->samples.length.assign(segmenter.length.begin(), segmenter.length.end());
+			slot->samples.weight.assign(segmenter.weight.begin(), segmenter.weight.end());
+			slot->min_length = segmenter.min_length;
+			slot->max_length = segmenter.max_length;
+			slot->min_weight = segmenter.min_weight;
+			slot->max_weight = segmenter.max_weight;
+			queue.publish();
+			n_strokes++;
+		}
+	};
+
+	// Starts the classifier threads.  on_result is called on them, once per stroke.
+	WellIngest(const IngestOptions& options, ResultCallback on_result)
+		: options(options), on_result(on_result), finishing(false)
+	{
+		int n_readers = options.n_readers < 1 ? 1 : options.n_readers;
+		int n_classifiers = options.n_classifiers == 0 ? default_worker_count() : options.n_classifiers;
+		if (n_classifiers < 1) n_classifiers = 1;
+		if (!this->options.classify_stroke) {
+			double min_w = options.min_acceptable_peak_weight;
+			CornerMethod corner_method = options.corner_method;
+			this->options.classify_stroke = [min_w, corner_method](Card& card, EdgeFit fits[4]) {
+				return classify_card(card, min_w, corner_method, fits);
+			};
+		}
+		n_classified.assign(n_classifiers, 0);
+		for (int r = 0; r < n_readers; r++) {
+			readers.push_back(std::unique_ptr<Reader>(new Reader()));
+			readers.back()->owner = this;
+			for (int c = 0; c < n_classifiers; c++) {
+				readers.back()->queues.push_back(std::unique_ptr<SpscQueue<QueuedStroke> >(new SpscQueue<QueuedStroke>(options.queue_strokes)));
+			}
+		}
+		for (int c = 0; c < n_classifiers; c++) classifiers.push_back(std::thread([this, c] { classify_queued(c); }));
+	}
+	WellIngest(const WellIngest&) = delete;
+	WellIngest& operator=(const WellIngest&) = delete;
+	~WellIngest() {
+		finish();
+	}
+
+	int n_readers() const {
+		return static_cast<int>(readers.size());
+	}
+	int n_classifiers() const {
+		return static_cast<int>(n_classified.size());
+	}
+	// The reader whose thread must feed the well, always the same one, so its strokes are cut in order
+	int reader_for(const std::string& well_id) const {
+		return static_cast<int>(well_hash(well_id) % readers.size());
+	}
+	Reader& reader(int r) {
+		return *readers[r];
+	}
+
+	/*
+	Once every reader is done: classify what is still queued and stop the
+	classifiers.  Afterwards classified_by(c) is the strokes classifier c did.
+	*/
+	void finish() {
+		finishing.store(true, std::memory_order_release);
+		for (size_t c = 0; c < classifiers.size(); c++) classifiers[c].join();
+		classifiers.clear();
+	}
+	uint64_t classified_by(int c) const {
+		return n_classified[c];
+	}
+
+private:
+	IngestOptions options;
+	ResultCallback on_result;
+	std::vector<std::unique_ptr<Reader> > readers;
+	std::vector<std::thread> classifiers;
+	std::vector<uint64_t> n_classified;
+	std::atomic<bool> finishing;
+
+	// FNV-1a, finished as splitmix64 is: ids that differ in their last digits differ little in FNV's high bits
+	static uint64_t well_hash(const std::string& well_id) {
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < well_id.size(); i++) hash = (hash ^ static_cast<unsigned char>(well_id[i])) * 1099511628211ULL;
+		hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+		return hash ^ (hash >> 31);
+	}
+	// Other bits of the hash than reader_for takes, so a reader's wells spread over every classifier
+	int classifier_for(const std::string& well_id) const {
+		return static_cast<int>((well_hash(well_id) >> 32) % n_classified.size());
+	}
+
+	/*
+	Classifier c: poll its queue from every reader in turn, taking at most a
+	queue's worth from each so a busy reader can't starve the others.  Spins
+	while idle, then sleeps between polls.
+	*/
+	void classify_queued(int c) {
+		Card card;
+		EdgeFit fits[4];
+		IngestedStroke result;
+		result.classifier = c;
+		uint64_t n_done = 0;
+		int n_idle = 0;
+		for (;;) {
+			// Read first: once it is set every stroke is already queued, so an empty pass after it means done
+			bool last_pass = finishing.load(std::memory_order_acquire);
+			size_t n_taken = 0;
+			for (size_t r = 0; r < readers.size(); r++) {
+				SpscQueue<QueuedStroke>& queue = *readers[r]->queues[c];
+				for (size_t k = 0; k < queue.capacity(); k++) {
+					QueuedStroke* stroke = queue.front();
+					if (stroke == nullptr) break;
+					const CardColumns& samples = stroke->samples;
+					card.assign(samples.position.data(), samples.length.data(), samples.weight.data(), samples.size(),
+						stroke->min_length, stroke->max_length, stroke->min_weight, stroke->max_weight);
+					result.well_id = stroke->well_id;
+					result.sequence = stroke->sequence;
+					result.first = stroke->first;
+					result.end = stroke->end;
+					// The card has its own copy: the slot can go back to the reader before the stroke is classified
+					queue.pop();
+					result.state = options.classify_stroke(card, fits);
+					on_result(result);
+					n_taken++;
+				}
+			}
+			n_done += n_taken;
+			if (n_taken > 0) {
+				n_idle = 0;
+				continue;
+			}
+			if (last_pass) break;
+			if (++n_idle < INGEST_IDLE_SPINS) std::this_thread::yield();
+			else std::this_thread::sleep_for(std::chrono::microseconds(INGEST_IDLE_SLEEP_US));
+		}
+		n_classified[c] = n_done;
+	}
+};
+
+#endif // DYNACARD_WELL_INGEST_H
@@ -0,0 +1,291 @@
+/*
+Per-well trends over a rolling window of classified strokes, for
+dashboards that want "what fraction of this well's strokes were fluid
+pound over the last hour" and "how far has its median card area moved"
+without reading the cards again.
+
+Every well keeps the strokes of its window in a ring buffer of fixed size,
+together with its counts per state and quantile sketches of the area and
+the distance_from_shape (fused_engine.h) of those strokes.  A stroke added
+at the back of the window is counted in; one dropped off the front is
+counted out again.  The window is the last window_seconds, or the last
+window_strokes strokes if the well strokes faster than that.  A second
+pair of sketches keeps everything the well has ever sent and is never
+counted out.  The drift of a median is the window's median minus that
+lifetime median.
+
+Memory is constant per well, whatever the window and however long the
+run: the ring, two counts per state and four sketches of SUB_BUCKETS
+buckets per power of two.
+
+Times are seconds since the epoch, the Timestamp of the card header, and
+are expected to arrive in about their order.  write_due writes a summary
+of every well with strokes in its window each time the strokes' time
+crosses a multiple of summary_seconds, and write_final one more as of the
+latest stroke at the end of a run.
+*/
+
+#ifndef DYNACARD_WELL_TRENDS_H
+#define DYNACARD_WELL_TRENDS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+const double TREND_WINDOW_SECONDS = 3600;
+const double TREND_SUMMARY_SECONDS = 300;
+// Strokes kept per well: an hour of 17 strokes a minute
+const size_t TREND_WINDOW_STROKES = 1024;
+
+/*
+A log-linear histogram of positive values that values can be taken out of
+again, so it can follow a sliding window: SUB_BUCKETS buckets per power of
+two, so a quantile is within 1/32 (3%) of the true one.  The areas and
+distances of a normalized card are fractions of the unit square; values up
+to 2^MIN_EXPONENT share the lowest bucket and values from 2^MAX_EXPONENT
+the highest.
+*/
+class QuantileSketch {
+public:
+	static const int SUB_BUCKETS = 16;
+	static const int MIN_EXPONENT = -14;
+	static const int MAX_EXPONENT = 4;
+	static const int N_BUCKETS = (MAX_EXPONENT - MIN_EXPONENT) * SUB_BUCKETS + 2;
+
+	QuantileSketch() {
+		clear();
+	}
+	void clear() {
+		memset(counts, 0, sizeof(counts));
+		total = 0;
+	}
+	// NaN, a value that wasn't measured, is left out
+	void add(double v) {
+		if (std::isnan(v)) return;
+		counts[bucket(v)]++;
+		total++;
+	}
+	// Take out a value added before
+	void remove(double v) {
+		if (std::isnan(v)) return;
+		counts[bucket(v)]--;
+		total--;
+	}
+	uint32_t count() const {
+		return total;
+	}
+
+	// The value below which fraction q of the values lie, to within a bucket; NaN if there are none
+	double quantile(double q) const {
+		if (total == 0) return NAN;
+		uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+		if (rank < 1) rank = 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < N_BUCKETS; i++) {
+			seen += counts[i];
+			if (seen >= rank) return i == 0 || i == N_BUCKETS - 1 ? bucket_low(i) : (bucket_low(i) + bucket_low(i + 1)) / 2;
+		}
+		return bucket_low(N_BUCKETS - 1);
+	}
+
+private:
+	uint32_t counts[N_BUCKETS];
+	uint32_t total;
+
+	static int bucket(double v) {
+		if (!(v > std::ldexp(1.0, MIN_EXPONENT))) return 0;
+		if (v >= std::ldexp(1.0, MAX_EXPONENT)) return N_BUCKETS - 1;
+		int exponent;
+		double mantissa = std::frexp(v, &exponent); // v = mantissa * 2^exponent, mantissa in [0.5, 1)
+		return 1 + (exponent - 1 - MIN_EXPONENT) * SUB_BUCKETS + static_cast<int>((2 * mantissa - 1) * SUB_BUCKETS);
+	}
+	static double bucket_low(int i) {
+		if (i == 0) return 0;
+		if (i == N_BUCKETS - 1) return std::ldexp(1.0, MAX_EXPONENT);
+		int octave = (i - 1) / SUB_BUCKETS + MIN_EXPONENT;
+		return std::ldexp(1.0 + static_cast<double>((i - 1) % SUB_BUCKETS) / SUB_BUCKETS, octave);
+	}
+};
+
+class WellTrends {
+public:
+	double window_seconds, summary_seconds;
+	size_t window_strokes;
+
+	WellTrends(double window_seconds = TREND_WINDOW_SECONDS, double summary_seconds = TREND_SUMMARY_SECONDS,
+		size_t window_strokes = TREND_WINDOW_STROKES)
+		: window_seconds(window_seconds), summary_seconds(summary_seconds), window_strokes(window_strokes < 1 ? 1 : window_strokes)
+	{
+		next_summary = 0;
+		latest = 0;
+		last_summary = INT64_MIN;
+		started = false;
+	}
+
+	// The column names of write_summaries' rows
+	static void write_heading(std::ostream& out) {
+		out << "Time" << "," << "Well ID Number" << "," << "Strokes" << "," << "Window Start" << "," << "Window End" << ","
+			<< "States" << "," << "Area Median" << "," << "Area Drift" << "," << "Distance Median" << "," << "Distance Drift" << std::endl;
+	}
+
+	/*
+	Add a classified stroke of a well at time.  An area or distance of NaN,
+	not measured, is left out of its sketches.
+	*/
+	void add(const std::string& well_id, int64_t time, const char* state, double area, double distance_from_shape) {
+		if (!started) {
+			// The first summary is at the first multiple of summary_seconds after the first stroke
+			next_summary = static_cast<int64_t>((std::floor(time / summary_seconds) + 1) * summary_seconds);
+			latest = time;
+			started = true;
+		}
+		if (time > latest) latest = time;
+		WellWindow& well = window_of(well_id);
+		drop_older(well, time);
+		if (well.n_strokes == window_strokes) drop_oldest(well);
+		TrendStroke& stroke = well.ring[(well.first + well.n_strokes) % window_strokes];
+		stroke.time = time;
+		// Rounded to the floats the ring keeps first, so taking a stroke out hits the buckets it went into
+		stroke.area = static_cast<float>(area);
+		stroke.distance = static_cast<float>(distance_from_shape);
+		stroke.state = state_index(state);
+		well.n_strokes++;
+		if (stroke.state >= well.state_counts.size()) well.state_counts.resize(stroke.state + 1, 0);
+		well.state_counts[stroke.state]++;
+		well.area.add(stroke.area);
+		well.distance.add(stroke.distance);
+		well.lifetime_area.add(stroke.area);
+		well.lifetime_distance.add(stroke.distance);
+	}
+
+	// Write the summaries due by time: one set as of every multiple of summary_seconds it has passed
+	void write_due(std::ostream& out, int64_t time) {
+		while (started && time >= next_summary) {
+			write_summaries(out, next_summary);
+			next_summary += static_cast<int64_t>(summary_seconds);
+			// Across a gap in the strokes, skip the summaries it leaves every window empty for
+			if (time >= next_summary && next_summary >= latest + window_seconds) {
+				int64_t n_empty = static_cast<int64_t>(std::floor((time - next_summary) / summary_seconds)) + 1;
+				next_summary += n_empty * static_cast<int64_t>(summary_seconds);
+			}
+		}
+	}
+
+	// At the end of a run: the summaries as of the latest stroke, unless they were just written
+	void write_final(std::ostream& out) {
+		if (started && latest != last_summary) write_summaries(out, latest);
+	}
+
+	// A row for every well with strokes in the window ending at time
+	void write_summaries(std::ostream& out, int64_t time) {
+		last_summary = time;
+		std::streamsize precision = out.precision();
+		out << std::setprecision(5);
+		std::vector<std::pair<uint32_t, uint16_t> > counts;
+		for (size_t w = 0; w < wells.size(); w++) {
+			WellWindow& well = wells[w];
+			drop_older(well, time);
+			if (well.n_strokes == 0) continue;
+			const TrendStroke& oldest = well.ring[well.first];
+			const TrendStroke& newest = well.ring[(well.first + well.n_strokes - 1) % window_strokes];
+			out << time << "," << well.id << "," << well.n_strokes << "," << oldest.time << "," << newest.time << ",";
+			// Most frequent states first
+			counts.clear();
+			for (size_t s = 0; s < well.state_counts.size(); s++) {
+				if (well.state_counts[s] > 0) counts.push_back(std::make_pair(well.state_counts[s], static_cast<uint16_t>(s)));
+			}
+			std::sort(counts.begin(), counts.end(), [](const std::pair<uint32_t, uint16_t>& a, const std::pair<uint32_t, uint16_t>& b) {
+				return a.first != b.first ? a.first > b.first : a.second < b.second;
+			});
+			for (size_t c = 0; c < counts.size(); c++) {
+				out << (c == 0 ? "" : ";") << states[counts[c].second] << ":" << std::fixed << std::setprecision(3)
+					<< static_cast<double>(counts[c].first) / well.n_strokes;
+				out.unsetf(std::ios::floatfield);
+				out << std::setprecision(5);
+			}
+			write_median(out, well.area, well.lifetime_area);
+			write_median(out, well.distance, well.lifetime_distance);
+			out << std::endl;
+		}
+		out.precision(precision);
+	}
+
+	size_t n_wells() const {
+		return wells.size();
+	}
+	// Memory a well takes, but for its id and its counts of the states it has sent
+	size_t bytes_per_well() const {
+		return sizeof(WellWindow) + window_strokes * sizeof(TrendStroke);
+	}
+
+private:
+	struct TrendStroke {
+		int64_t time;
+		float area, distance;
+		uint16_t state;
+	};
+	struct WellWindow {
+		std::string id;
+		std::vector<TrendStroke> ring;
+		size_t first, n_strokes;
+		std::vector<uint32_t> state_counts;  // of the window, by state_index
+		QuantileSketch area, distance, lifetime_area, lifetime_distance;
+	};
+	// A deque, so adding a well doesn't copy every other one's sketches
+	std::deque<WellWindow> wells;
+	std::unordered_map<std::string, size_t> index;
+	std::vector<std::string> states;
+	int64_t next_summary;
+	int64_t latest;         // the time of the latest stroke
+	int64_t last_summary;   // the time of the summaries written last
+	bool started;
+
+	WellWindow& window_of(const std::string& well_id) {
+		std::unordered_map<std::string, size_t>::const_iterator found = index.find(well_id);
+		if (found != index.end()) return wells[found->second];
+		index[well_id] = wells.size();
+		wells.push_back(WellWindow());
+		WellWindow& well = wells.back();
+		well.id = well_id;
+		well.ring.resize(window_strokes);
+		well.first = well.n_strokes = 0;
+		return well;
+	}
+	uint16_t state_index(const char* state) {
+		for (size_t s = 0; s < states.size(); s++) {
+			if (states[s] == state) return static_cast<uint16_t>(s);
+		}
+		states.push_back(state);
+		return static_cast<uint16_t>(states.size() - 1);
+	}
+	void drop_oldest(WellWindow& well) {
+		const TrendStroke& stroke = well.ring[well.first];
+		well.state_counts[stroke.state]--;
+		well.area.remove(stroke.area);
+		well.distance.remove(stroke.distance);
+		well.first = (well.first + 1) % window_strokes;
+		well.n_strokes--;
+	}
+	// Drop the strokes that are out of the window ending at time
+	void drop_older(WellWindow& well, int64_t time) {
+		while (well.n_strokes > 0 && well.ring[well.first].time <= time - window_seconds) drop_oldest(well);
+	}
+	static void write_median(std::ostream& out, const QuantileSketch& window, const QuantileSketch& lifetime) {
+		double median = window.quantile(0.5);
+		out << ",";
+		if (!std::isnan(median)) out << median;
+		out << ",";
+		if (!std::isnan(median)) out << median - lifetime.quantile(0.5);
+	}
+};
+
+#endif // DYNACARD_WELL_TRENDS_H
@@ -0,0 +1,199 @@
+/*
+Checks the optimal corner search of DynaCardCommon/corner_search.h against
+the x+/-2y heuristic it starts from.
+
+Made-up quadrilaterals of up to CORNER_SEARCH_CANDIDATES points, which the
+search covers exhaustively, must get the four corners that a brute force
+over every choice of four finds cheapest.  A skewed one drawn without noise
+must get the corners it was drawn with, which the heuristic misses.  Cards
+too short to search keep the heuristic's corners.  Every stroke of the
+files on the command line (a file without strokes counts as one) must get
+corners in stroke order, at least CORNER_SEARCH_MIN_EDGE_POINTS apart,
+whose total residual is no more than the heuristic's.
+
+Usage:
+  corner_test [file.csv ...]
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+#include "../DynaCardCommon/pump_state.h"
+
+using namespace std;
+
+int n_checks = 0, n_failed = 0;
+
+void check(bool ok, const string& what) {
+	n_checks++;
+	if (ok) return;
+	n_failed++;
+	cout << "FAILED: " << what << endl;
+}
+
+// splitmix64, to a double in [0, 1)
+struct Random {
+	uint64_t state;
+	explicit Random(uint64_t seed) : state(seed) {}
+	double next() {
+		uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		return (z >> 11) * (1.0 / 9007199254740992.0);
+	}
+};
+
+double residual_of(const CumulativeSums& sums, const Corners& c) {
+	int corners[4] = { c.lower_left, c.upper_left, c.upper_right, c.lower_right };
+	return corners_residual(sums, corners);
+}
+
+bool same_residual(double a, double b) {
+	return fabs(a - b) <= 1e-9 * (1 + fabs(b));
+}
+
+// Corners in stroke order from lower left, with edges long enough to fit
+bool in_stroke_order(const Corners& c, int n) {
+	int upper_left = count_with_rollover(c.lower_left, c.upper_left, n);
+	int upper_right = count_with_rollover(c.lower_left, c.upper_right, n);
+	int lower_right = count_with_rollover(c.lower_left, c.lower_right, n);
+	return upper_left >= CORNER_SEARCH_MIN_EDGE_POINTS && upper_right - upper_left >= CORNER_SEARCH_MIN_EDGE_POINTS
+		&& lower_right - upper_right >= CORNER_SEARCH_MIN_EDGE_POINTS && n - lower_right >= CORNER_SEARCH_MIN_EDGE_POINTS;
+}
+
+/*
+A card up the left edge, across the top, down the right and back along the
+bottom of the quadrilateral with corners x[k], y[k], edge k holding points[k]
+points from corner k, each moved by up to noise.
+*/
+void draw_card(const double x[4], const double y[4], const int points[4], double noise, Random& random,
+	vector<double>& xs, vector<double>& ys) {
+	xs.clear();
+	ys.clear();
+	for (int k = 0; k < 4; k++) {
+		for (int i = 0; i < points[k]; i++) {
+			double t = static_cast<double>(i) / points[k];
+			xs.push_back(x[k] + t * (x[(k + 1) % 4] - x[k]) + noise * (random.next() - 0.5));
+			ys.push_back(y[k] + t * (y[(k + 1) % 4] - y[k]) + noise * (random.next() - 0.5));
+		}
+	}
+}
+
+// The cheapest residual over every four corners in stroke order
+double brute_force_residual(const CumulativeSums& sums) {
+	int n = sums.n_points;
+	double best = INFINITY;
+	int c[4];
+	for (c[0] = 0; c[0] < n; c[0]++)
+		for (c[1] = c[0] + 1; c[1] < n; c[1]++)
+			for (c[2] = c[1] + 1; c[2] < n; c[2]++)
+				for (c[3] = c[2] + 1; c[3] < n; c[3]++) {
+					double r = corners_residual(sums, c);
+					if (r < best) best = r;
+				}
+	return best;
+}
+
+void check_made_up_cards() {
+	Random random(1);
+	vector<double> xs, ys;
+	// A card whose top falls so far that the heuristic takes its upper left
+	// corner for its upper right too, drawn exactly.  A corner point lies on
+	// both of its edges, so the search may put it one point either way.
+	const double skewed_x[4] = { 0, 0.15, 1, 0.9 }, skewed_y[4] = { 0, 1, 0.45, 0.05 };
+	const int skewed_points[4] = { 10, 12, 10, 12 };
+	draw_card(skewed_x, skewed_y, skewed_points, 0, random, xs, ys);
+	CumulativeSums exact(xs, ys);
+	Corners found = find_optimal_corners(exact), guessed = find_heuristic_corners(exact);
+	check(guessed.upper_right == guessed.upper_left, "the heuristic misses the upper right corner of the skewed card");
+	check(abs(found.lower_left - 0) <= 1 && abs(found.upper_left - 10) <= 1 && abs(found.upper_right - 22) <= 1
+		&& abs(found.lower_right - 32) <= 1, "the corners of an exact skewed card are where it was drawn");
+	check(residual_of(exact, found) < 1e-12, "the edges of an exact skewed card fit exactly");
+
+	// Noisy cards of every size the search covers exhaustively
+	int n_cards = 0, n_cheapest = 0, n_no_worse = 0;
+	for (int t = 0; t < 20; t++) {
+		double x[4], y[4];
+		int points[4];
+		for (int k = 0; k < 4; k++) {
+			points[k] = 3 + static_cast<int>(random.next() * 8);
+			x[k] = (k >= 2 ? 0.7 : 0) + 0.3 * random.next();
+			y[k] = (k == 1 || k == 2 ? 0.7 : 0) + 0.3 * random.next();
+		}
+		draw_card(x, y, points, 0.05, random, xs, ys);
+		if (xs.size() > static_cast<size_t>(CORNER_SEARCH_CANDIDATES)) continue;
+		CumulativeSums sums(xs, ys);
+		Corners heuristic = find_heuristic_corners(sums), optimal = find_optimal_corners(sums);
+		double optimal_residual = residual_of(sums, optimal);
+		n_cards++;
+		if (same_residual(optimal_residual, brute_force_residual(sums))) n_cheapest++;
+		if (!in_stroke_order(heuristic, sums.n_points) || optimal_residual <= residual_of(sums, heuristic) * (1 + 1e-12)) n_no_worse++;
+	}
+	check(n_cards > 0 && n_cheapest == n_cards, "the search finds the cheapest corners of every noisy card");
+	check(n_no_worse == n_cards, "the search is never worse than the heuristic on a noisy card");
+
+	// Too short to search
+	const int short_points[4] = { 2, 3, 2, 3 };
+	draw_card(skewed_x, skewed_y, short_points, 0.05, random, xs, ys);
+	CumulativeSums short_sums(xs, ys);
+	Corners heuristic = find_heuristic_corners(short_sums), optimal = find_optimal_corners(short_sums);
+	check(heuristic.lower_left == optimal.lower_left && heuristic.upper_left == optimal.upper_left
+		&& heuristic.upper_right == optimal.upper_right && heuristic.lower_right == optimal.lower_right,
+		"a card too short to search keeps the heuristic's corners");
+}
+
+// Every stroke of fname, or its first cycle if it has none
+void check_file(const string& fname) {
+	CardColumns cols;
+	if (!parse_card_file(fname, cols)) {
+		check(false, "cannot open " + fname);
+		return;
+	}
+	vector<vector<double> > stroke_xs, stroke_ys;
+	StrokeSegmenter segmenter;
+	for (size_t i = 0; i < cols.size(); i++) {
+		if (!segmenter.add_sample(cols.position[i], cols.length[i], cols.weight[i])) continue;
+		stroke_xs.push_back(segmenter.length);
+		stroke_ys.push_back(segmenter.weight);
+	}
+	if (stroke_xs.empty()) {
+		stroke_xs.push_back(cols.length);
+		stroke_ys.push_back(cols.weight);
+	}
+	size_t n_strokes = 0, n_ordered = 0, n_no_worse = 0;
+	for (size_t k = 0; k < stroke_xs.size(); k++) {
+		if (stroke_xs[k].size() < static_cast<size_t>(4 * CORNER_SEARCH_MIN_EDGE_POINTS)) continue;
+		vector<double> xs = normalize(stroke_xs[k]), ys = normalize(stroke_ys[k]);
+		CumulativeSums sums(xs, ys);
+		Corners heuristic = find_heuristic_corners(sums), optimal = find_optimal_corners(sums);
+		double heuristic_residual = residual_of(sums, heuristic), optimal_residual = residual_of(sums, optimal);
+		n_strokes++;
+		bool heuristic_ordered = in_stroke_order(heuristic, sums.n_points);
+		// The search falls back on the heuristic's corners when it finds none
+		bool fell_back = optimal.lower_left == heuristic.lower_left && optimal.upper_left == heuristic.upper_left
+			&& optimal.upper_right == heuristic.upper_right && optimal.lower_right == heuristic.lower_right;
+		if (in_stroke_order(optimal, sums.n_points) || (fell_back && !heuristic_ordered)) n_ordered++;
+		if (!heuristic_ordered || std::isnan(heuristic_residual) || optimal_residual <= heuristic_residual * (1 + 1e-12)) n_no_worse++;
+	}
+	cout << fname << ": " << n_strokes << " strokes" << endl;
+	check(n_ordered == n_strokes, "the corners of every stroke of " + fname + " are in stroke order");
+	check(n_no_worse == n_strokes, "the search is never worse than the heuristic on " + fname);
+}
+
+int main(int argc, char *argv[]) {
+	check_made_up_cards();
+	for (int i = 1; i < argc; i++) check_file(argv[i]);
+	cout << "corner_test: " << n_checks << " checks, " << n_failed << " failed" << endl;
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 corner_test.cpp -o corner_test
+./corner_test ../CPlusDynaCard/example_data/bent_barrel_5degree_left.csv ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv
+*/
@@ -0,0 +1,128 @@
+/*
+Checks that the vector kernels of DynaCardCommon/simd_kernels.h give the
+same bits as their scalar versions.
+
+min_max, normalize and running_moments are run both ways over made-up
+columns of every length from 1 to 70, so every vector tail is covered,
+starting at every offset into the buffer, so every alignment is too, and
+with the extremes at the first and last element.  Then the same over the
+length and weight columns of every file on the command line.  When the
+scalar versions are the ones picked (no vector kernels on this CPU, or
+DYNACARD_SIMD=scalar) they are checked against themselves, and this says so.
+
+Usage:
+  kernel_test [file.csv ...]
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/simd_kernels.h"
+
+using namespace std;
+
+int n_checks = 0, n_failed = 0;
+
+void check(bool ok, const string& what) {
+	n_checks++;
+	if (ok) return;
+	n_failed++;
+	cout << "FAILED: " << what << endl;
+}
+
+// splitmix64, to a double in [0, 1)
+struct Random {
+	uint64_t state;
+	explicit Random(uint64_t seed) : state(seed) {}
+	double next() {
+		uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		return (z >> 11) * (1.0 / 9007199254740992.0);
+	}
+};
+
+bool same_bits(const double* a, const double* b, size_t n) {
+	return memcmp(a, b, n * sizeof(double)) == 0;
+}
+
+// Every kernel over x[0..n) and y[0..n) both ways; false if any result differs by a bit
+bool kernels_agree(const SimdKernels& scalar, const SimdKernels& vector_kernels, const double* x, const double* y, size_t n) {
+	double scalar_min, scalar_max, vector_min, vector_max;
+	scalar.min_max(x, n, scalar_min, scalar_max);
+	vector_kernels.min_max(x, n, vector_min, vector_max);
+	if (!same_bits(&scalar_min, &vector_min, 1) || !same_bits(&scalar_max, &vector_max, 1)) return false;
+
+	vector<double> scalar_out(n), vector_out(n);
+	scalar.normalize(x, scalar_out.data(), n, scalar_min, scalar_max - scalar_min);
+	vector_kernels.normalize(x, vector_out.data(), n, scalar_min, scalar_max - scalar_min);
+	if (!same_bits(scalar_out.data(), vector_out.data(), n)) return false;
+
+	vector<double> scalar_cum(MOMENT_COUNT * (n + 1)), vector_cum(MOMENT_COUNT * (n + 1));
+	scalar.running_moments(x, y, n, scalar_cum.data());
+	vector_kernels.running_moments(x, y, n, vector_cum.data());
+	return same_bits(scalar_cum.data(), vector_cum.data(), scalar_cum.size());
+}
+
+void check_made_up_columns(const SimdKernels& scalar, const SimdKernels& vector_kernels) {
+	Random random(7);
+	const size_t max_n = 70, max_offset = 4;
+	vector<double> xs(max_n + max_offset), ys(max_n + max_offset);
+	size_t n_cases = 0, n_agree = 0;
+	for (size_t n = 1; n <= max_n; n++) {
+		for (size_t offset = 0; offset < max_offset; offset++) {
+			// Values of mixed sign and magnitude, so the sums round
+			for (size_t i = 0; i < xs.size(); i++) {
+				xs[i] = (random.next() - 0.3) * (i % 3 == 0 ? 1e6 : 1.0);
+				ys[i] = (random.next() - 0.5) * 250;
+			}
+			for (int extremes = 0; extremes < 3; extremes++) {
+				// Then with the smallest first and the largest last, and the other way round
+				if (extremes == 1) {
+					xs[offset] = -2e6;
+					xs[offset + n - 1] = 2e6;
+				}
+				else if (extremes == 2) {
+					xs[offset] = 3e6;
+					xs[offset + n - 1] = -3e6;
+				}
+				n_cases++;
+				if (kernels_agree(scalar, vector_kernels, xs.data() + offset, ys.data() + offset, n)) n_agree++;
+				else cout << "  n " << n << ", offset " << offset << ", extremes " << extremes << " differ" << endl;
+			}
+		}
+	}
+	check(n_agree == n_cases, "the kernels agree on every made-up column");
+}
+
+void check_file(const string& fname, const SimdKernels& scalar, const SimdKernels& vector_kernels) {
+	CardColumns cols;
+	if (!parse_card_file(fname, cols)) {
+		check(false, "cannot open " + fname);
+		return;
+	}
+	if (cols.size() == 0) return;
+	check(kernels_agree(scalar, vector_kernels, cols.length.data(), cols.weight.data(), cols.size())
+		&& kernels_agree(scalar, vector_kernels, cols.weight.data(), cols.length.data(), cols.size()),
+		"the kernels agree on " + fname);
+}
+
+int main(int argc, char *argv[]) {
+	const SimdKernels scalar = scalar_kernels();
+	const SimdKernels& vector_kernels = simd_kernels();
+	if (strcmp(vector_kernels.name, "scalar") == 0) cout << "scalar kernels picked: checking them against themselves" << endl;
+	else cout << vector_kernels.name << " kernels against scalar" << endl;
+	check_made_up_columns(scalar, vector_kernels);
+	for (int i = 1; i < argc; i++) check_file(argv[i], scalar, vector_kernels);
+	cout << "kernel_test: " << n_checks << " checks, " << n_failed << " failed" << endl;
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 kernel_test.cpp -o kernel_test
+./kernel_test ../CPlusDynaCard/example_data/full_pump_0.csv ../CPlusDeliverable/sent_to_onica/TestA2_comb.csv
+*/
@@ -0,0 +1,151 @@
+/*
+Checks the constant time line fits of DynaCardCommon/line_fit.h against the
+point by point least squares fit the classifier used before them.
+
+Edges are cut from made-up strokes, behind a long run of other points so the
+running sums have rounding of their own to leave behind, and fitted both
+ways.  On ordinary edges the slope, intercept and r2 must agree to 1e-9.
+On degenerate ones, no points, one point, or points all on one x, there is
+no line: both ways must give NaN, so the edge is neither a good fit nor
+flat.  Then the first cycle of Anchored Tbg - Surface.csv, whose edges run
+into that, must still be classified as drag friction at a minimum weight of
+0, as it was before the sums.
+
+Usage:
+  line_fit_test
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/pump_state.h"
+
+using namespace std;
+
+int n_checks = 0, n_failed = 0;
+
+void check(bool ok, const string& what) {
+	n_checks++;
+	if (ok) return;
+	n_failed++;
+	cout << "FAILED: " << what << endl;
+}
+
+const char* const ANCHORED_TUBING = "../ComputeShapeProperties/real_data/Anchored Tbg - Surface.csv";
+
+// The point by point fit of points [first, first + count), as the classifier fitted edges before line_fit.h
+FittedLine fit_point_by_point(const vector<double>& xs, const vector<double>& ys, int first, int count) {
+	double xsum = 0, x2sum = 0, ysum = 0, xysum = 0, r2 = 0;
+	for (int i = first; i < first + count; i++) {
+		xsum += xs[i];
+		ysum += ys[i];
+		x2sum += pow(xs[i], 2);
+		xysum += xs[i] * ys[i];
+	}
+	double slope = (count*xysum - xsum * ysum) / (count*x2sum - xsum * xsum);
+	double intercept = (x2sum*ysum - xsum * xysum) / (x2sum*count - xsum * xsum);
+	for (int i = first; i < first + count; i++) r2 += pow(slope * xs[i] + intercept - ys[i], 2);
+	r2 /= count;
+	FittedLine fit = { slope, intercept, r2 };
+	return fit;
+}
+
+bool close(double a, double b) {
+	return fabs(a - b) <= 1e-9 * (1 + fabs(b));
+}
+
+bool no_line(const FittedLine& fit) {
+	return std::isnan(fit.slope) && std::isnan(fit.intercept) && std::isnan(fit.r2);
+}
+
+// A stroke of 500 points of a wobbling loop, then the edge; returns where the edge starts
+int stroke_with_edge(const vector<double>& edge_xs, const vector<double>& edge_ys, vector<double>& xs, vector<double>& ys) {
+	xs.clear();
+	ys.clear();
+	for (int i = 0; i < 500; i++) {
+		double t = 2 * M_PI * i / 500;
+		xs.push_back(0.5 + 0.5 * cos(t) + 0.01 * sin(37.0 * i));
+		ys.push_back(0.5 + 0.5 * sin(t) + 0.01 * cos(53.0 * i));
+	}
+	int first = static_cast<int>(xs.size());
+	xs.insert(xs.end(), edge_xs.begin(), edge_xs.end());
+	ys.insert(ys.end(), edge_ys.begin(), edge_ys.end());
+	return first;
+}
+
+void check_edges() {
+	vector<double> xs, ys;
+	// Ordinary edges: sloped, near vertical, flat, and noisy
+	const vector<vector<double> > edge_xs = {
+		{ 0.1, 0.2, 0.3, 0.4, 0.5 },
+		{ 0.9, 0.902, 0.906, 0.904, 0.908, 0.91 },
+		{ 0.1, 0.3, 0.5, 0.7 },
+		{ 0.05, 0.42, 0.13, 0.77, 0.61, 0.29, 0.98 },
+	};
+	const vector<vector<double> > edge_ys = {
+		{ 0.2, 0.4, 0.6, 0.8, 1.0 },
+		{ 0.1, 0.3, 0.5, 0.7, 0.8, 0.95 },
+		{ 0.95, 0.95, 0.95, 0.95 },
+		{ 0.11, 0.52, 0.2, 0.71, 0.66, 0.3, 0.9 },
+	};
+	bool agree = true;
+	for (size_t e = 0; e < edge_xs.size(); e++) {
+		int first = stroke_with_edge(edge_xs[e], edge_ys[e], xs, ys);
+		int count = static_cast<int>(edge_xs[e].size());
+		CumulativeSums sums(xs, ys);
+		FittedLine fast = sums.fit(first, count), slow = fit_point_by_point(xs, ys, first, count);
+		bool same = close(fast.slope, slow.slope) && close(fast.intercept, slow.intercept) && close(fast.r2, slow.r2);
+		if (!same) cout << "  edge " << e << ": slope " << fast.slope << " against " << slow.slope << ", r2 " << fast.r2 << " against " << slow.r2 << endl;
+		agree = agree && same;
+	}
+	check(agree, "the fit from the sums agrees with the point by point fit on ordinary edges");
+
+	// Degenerate edges: one point, and points stacked on one x, after the stroke
+	const vector<vector<double> > stacked_xs = { { 0.37 }, { 0.37, 0.37 }, { 0.37, 0.37, 0.37, 0.37 }, { 0, 0, 0 } };
+	const vector<vector<double> > stacked_ys = { { 0.5 }, { 0.2, 0.8 }, { 0.1, 0.4, 0.6, 0.9 }, { 0, 0.5, 1 } };
+	for (size_t e = 0; e < stacked_xs.size(); e++) {
+		int first = stroke_with_edge(stacked_xs[e], stacked_ys[e], xs, ys);
+		int count = static_cast<int>(stacked_xs[e].size());
+		CumulativeSums sums(xs, ys);
+		FittedLine fast = sums.fit(first, count), slow = fit_point_by_point(xs, ys, first, count);
+		string what = to_string(count) + " point(s) on one x";
+		check(no_line(slow), "the point by point fit finds no line through " + what);
+		check(no_line(fast), "the fit from the sums finds no line through " + what);
+	}
+	CumulativeSums sums(xs, ys);
+	check(no_line(sums.fit(10, 0)) && no_line(sums.inverse_fit(10, 0)), "no line through no points");
+	// The inverse fit of a flat edge is the degenerate one
+	vector<double> flat_xs = { 0.1, 0.3, 0.5, 0.7 }, flat_ys = { 0.95, 0.95, 0.95, 0.95 };
+	int first = stroke_with_edge(flat_xs, flat_ys, xs, ys);
+	CumulativeSums flat_sums(xs, ys);
+	FittedLine fit = flat_sums.fit(first, 4), inverse = flat_sums.inverse_fit(first, 4);
+	check(fabs(fit.slope) < 1e-9 && fit.r2 < 1e-12 && no_line(inverse), "a flat edge fits, and its inverse does not");
+}
+
+// The card that found the fits from the sums calling a stacked edge flat
+void check_anchored_tubing() {
+	CardColumns cols;
+	if (!parse_card_file(ANCHORED_TUBING, cols)) {
+		check(false, string("cannot open ") + ANCHORED_TUBING);
+		return;
+	}
+	Card card;
+	card.assign_first_cycle(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size());
+	string state = classify_card(card, 0, HEURISTIC_CORNERS);
+	check(state == "drag friction", "Anchored Tbg - Surface.csv is drag friction at a minimum weight of 0, not " + state);
+}
+
+int main() {
+	check_edges();
+	check_anchored_tubing();
+	cout << "line_fit_test: " << n_checks << " checks, " << n_failed << " failed" << endl;
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 line_fit_test.cpp -o line_fit_test
+./line_fit_test
+*/
@@ -0,0 +1,102 @@
+/*
+Checks that run_pipeline (DynaCardCommon/stage_pipeline.h) writes every item
+once, in input order, with what its own read and compute made of it.
+
+Items are run with 1 to 4 readers, 1 to 8 workers and queues of 1 to 8
+items, and some items are read or computed slowly, so that they finish out
+of order.  The write stage must see 0, 1, 2, ... with the value read and
+computed for that item.  No more items may be in flight, read but not yet
+written, than the pipeline has slots.  Every stage must count every item,
+and reader and worker numbers must be in range.
+
+Usage:
+  pipeline_test
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "../DynaCardCommon/stage_pipeline.h"
+
+using namespace std;
+
+int n_checks = 0, n_failed = 0;
+
+void check(bool ok, const string& what) {
+	n_checks++;
+	if (ok) return;
+	n_failed++;
+	cout << "FAILED: " << what << endl;
+}
+
+struct TestSlot {
+	size_t item;
+	uint64_t value;
+	vector<uint64_t> computed;   // reused from item to item, as the classifier's buffers are
+};
+
+uint64_t value_of(size_t item) {
+	return item * 0x9E3779B97F4A7C15ULL;
+}
+
+void run_one(size_t n_items, int n_readers, int n_workers, size_t queue_items) {
+	string what = to_string(n_items) + " items, " + to_string(n_readers) + " readers, " + to_string(n_workers)
+		+ " workers, queues of " + to_string(queue_items);
+	PipelineThreads threads;
+	threads.n_readers = n_readers;
+	threads.n_workers = n_workers;
+	threads.queue_items = queue_items;
+	size_t n_slots = n_readers + n_workers + 2 * queue_items;
+	atomic<size_t> in_flight(0), most_in_flight(0);
+	atomic<bool> threads_in_range(true);
+	size_t next_write = 0;
+	bool in_order = true, intact = true;
+	PipelineStats stats = run_pipeline<TestSlot>(n_items, threads,
+		[&](size_t i, TestSlot& slot, int reader) {
+			size_t now = ++in_flight, most = most_in_flight;
+			while (now > most && !most_in_flight.compare_exchange_weak(most, now)) {}
+			if (reader < 0 || reader >= n_readers) threads_in_range = false;
+			if (i % 5 == 0) this_thread::sleep_for(chrono::microseconds(100));
+			slot.item = i;
+			slot.value = value_of(i);
+		},
+		[&](TestSlot& slot, int worker) {
+			if (worker < 0 || worker >= n_workers) threads_in_range = false;
+			if (slot.item % 7 == 0) this_thread::sleep_for(chrono::microseconds(300));
+			slot.computed.assign(1 + slot.item % 4, slot.value + 1);
+		},
+		[&](size_t i, TestSlot& slot) {
+			in_order = in_order && i == next_write && slot.item == i;
+			intact = intact && slot.value == value_of(i) && slot.computed.size() == 1 + i % 4 && slot.computed.back() == value_of(i) + 1;
+			next_write++;
+			in_flight--;
+		});
+	check(in_order && next_write == n_items, what + ": every item is written once, in order");
+	check(intact, what + ": every item is written with what was read and computed for it");
+	check(most_in_flight <= n_slots, what + ": no more items in flight than slots");
+	check(threads_in_range, what + ": reader and worker numbers are in range");
+	check(stats.read.n_items == n_items && stats.compute.n_items == n_items && stats.write.n_items == n_items,
+		what + ": every stage counts every item");
+}
+
+int main() {
+	const size_t item_counts[] = { 0, 1, 5, 300 };
+	const int reader_counts[] = { 1, 2, 4 };
+	const int worker_counts[] = { 1, 3, 8 };
+	const size_t queue_sizes[] = { 1, 2, 8 };
+	for (size_t n : item_counts)
+		for (int readers : reader_counts)
+			for (int workers : worker_counts)
+				for (size_t queue_items : queue_sizes) run_one(n, readers, workers, queue_items);
+	cout << "pipeline_test: " << n_checks << " checks, " << n_failed << " failed" << endl;
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 -pthread pipeline_test.cpp -o pipeline_test
+./pipeline_test
+*/
@@ -0,0 +1,180 @@
+/*
+Checks the result cache of DynaCardCommon/result_cache.h: what hits and what
+misses, what survives save and load, and what load and save drop.
+
+Made-up results are cached under made-up content hashes and checked for:
+  - a hit only on the same content, size and run configuration, counted
+  - every result coming back bit for bit after save and load
+  - everything dropped, and counted, when the file was written by a
+    classifier whose classifier_hash differs, and nothing read from a file
+    of another version or none at all
+  - entries unused for max_age_seconds, and the least recently used beyond
+    max_entries, evicted by save, while a hit keeps an old entry
+The cache file is written to result_cache_test.cache in the current directory
+and removed at the end.
+
+Usage:
+  result_cache_test
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <ctime>
+
+#include "../DynaCardCommon/result_cache.h"
+
+using namespace std;
+
+int n_checks = 0, n_failed = 0;
+
+void check(bool ok, const string& what) {
+	n_checks++;
+	if (ok) return;
+	n_failed++;
+	cout << "FAILED: " << what << endl;
+}
+
+const char* const CACHE_PATH = "result_cache_test.cache";
+
+// n results for the file hashing to content, all different
+vector<CachedResult> made_up_results(uint64_t content, size_t n) {
+	static const char* const states[] = { "full pump", "fluid pound", "gas interference" };
+	vector<CachedResult> results;
+	for (size_t k = 0; k < n; k++) {
+		EdgeFit edges[4];
+		for (int e = 0; e < 4; e++) {
+			EdgeFit fit = { 0.1 * e, static_cast<double>(content), 0.9, -0.5 * e, 0.8, static_cast<double>(k) };
+			edges[e] = fit;
+		}
+		results.push_back(make_cached_result(states[(content + k) % 3], 100 * k, 100 * (k + 1), edges));
+	}
+	return results;
+}
+
+bool same_results(const vector<CachedResult>& a, const vector<CachedResult>& b) {
+	return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(CachedResult)) == 0);
+}
+
+// Overwrite size bytes at offset of the cache file
+bool patch_cache_file(long offset, const void* data, size_t size) {
+	FILE* file = fopen(CACHE_PATH, "r+b");
+	if (!file) return false;
+	bool ok = fseek(file, offset, SEEK_SET) == 0 && fwrite(data, size, 1, file) == 1;
+	return (fclose(file) == 0) && ok;
+}
+
+void check_hits_and_misses() {
+	uint64_t config = run_config_hash(60.0, HEURISTIC_CORNERS, false);
+	uint64_t other_config = run_config_hash(60.0, OPTIMAL_CORNERS, false);
+	check(config != other_config, "the corner method changes the run configuration");
+	check(config != run_config_hash(60.0, HEURISTIC_CORNERS, true), "classifying strokes changes the run configuration");
+	check(config != run_config_hash(60.0, HEURISTIC_CORNERS, false, 0, 12345), "a reference library changes the run configuration");
+
+	ResultCache cache;
+	vector<CachedResult> found;
+	check(!cache.find(1, 1000, config, found), "an empty cache misses");
+	cache.insert(1, 1000, config, made_up_results(1, 3));
+	cache.insert(2, 2000, config, made_up_results(2, 1));
+	check(cache.find(1, 1000, config, found) && same_results(found, made_up_results(1, 3)), "the same file and configuration hit");
+	check(!cache.find(1, 1001, config, found), "the same hash with another size misses");
+	check(!cache.find(3, 1000, config, found), "another hash misses");
+	check(!cache.find(1, 1000, other_config, found), "another configuration misses");
+	cache.insert(1, 1000, other_config, made_up_results(1, 2));
+	check(cache.find(1, 1000, other_config, found) && same_results(found, made_up_results(1, 2))
+		&& cache.find(1, 1000, config, found) && same_results(found, made_up_results(1, 3)),
+		"one file is cached under two configurations at once");
+	check(cache.size() == 3 && cache.hits() == 3 && cache.misses() == 4, "hits and misses are counted");
+}
+
+void check_save_and_load() {
+	uint64_t config = run_config_hash(60.0, HEURISTIC_CORNERS, true);
+	remove(CACHE_PATH);
+	ResultCache cache;
+	check(!cache.load(CACHE_PATH) && cache.size() == 0 && cache.invalidated() == 0, "a missing cache file loads empty");
+	for (uint64_t content = 1; content <= 10; content++) cache.insert(content, 100 * content, config, made_up_results(content, content % 4));
+	check(cache.save(), "the cache is written");
+
+	ResultCache loaded;
+	check(loaded.load(CACHE_PATH) && loaded.size() == 10, "every entry is read back");
+	bool all_same = true;
+	vector<CachedResult> found;
+	for (uint64_t content = 1; content <= 10; content++) {
+		all_same = all_same && loaded.find(content, 100 * content, config, found) && same_results(found, made_up_results(content, content % 4));
+	}
+	check(all_same, "every result is read back bit for bit, with files of no results too");
+
+	// The file as a different classifier would have written it
+	uint64_t other_classifier = classifier_hash() ^ 1;
+	check(patch_cache_file(offsetof(ResultCacheHeader, classifier), &other_classifier, sizeof(other_classifier)), "the cache file is patched");
+	ResultCache invalidated;
+	check(!invalidated.load(CACHE_PATH) && invalidated.size() == 0 && invalidated.invalidated() == 10,
+		"a cache of another classifier is dropped and counted");
+	check(!invalidated.find(1, 100, config, found), "nothing of a dropped cache hits");
+
+	// And as a later version of the file would have been
+	check(cache.save(), "the cache is written again");
+	uint32_t other_version = RESULT_CACHE_VERSION + 1;
+	check(patch_cache_file(offsetof(ResultCacheHeader, version), &other_version, sizeof(other_version)), "the cache file is patched");
+	ResultCache other;
+	check(!other.load(CACHE_PATH) && other.size() == 0 && other.invalidated() == 0, "a cache file of another version is not read");
+}
+
+void check_eviction() {
+	uint64_t config = run_config_hash(60.0, HEURISTIC_CORNERS, false);
+	remove(CACHE_PATH);
+	ResultCache cache;
+	cache.load(CACHE_PATH);
+	cache.insert(1, 100, config, made_up_results(1, 1));
+	cache.insert(2, 200, config, made_up_results(2, 1));
+	check(cache.save() && cache.evicted() == 0, "nothing new is evicted");
+
+	// Make the first entry, whichever it is, older than max_age_seconds
+	int64_t long_ago = static_cast<int64_t>(std::time(nullptr)) - RESULT_CACHE_MAX_AGE_SECONDS - 3600;
+	check(patch_cache_file(sizeof(ResultCacheHeader) + offsetof(ResultCacheEntry, last_used), &long_ago, sizeof(long_ago)),
+		"the cache file is patched");
+	ResultCache aged;
+	check(aged.load(CACHE_PATH) && aged.size() == 2, "an old entry is still read");
+	check(aged.save() && aged.evicted() == 1 && aged.size() == 1, "an entry unused for max_age_seconds is evicted");
+
+	// The same, but this run finds it
+	check(cache.save() && patch_cache_file(sizeof(ResultCacheHeader) + offsetof(ResultCacheEntry, last_used), &long_ago, sizeof(long_ago)),
+		"the cache file is written and patched");
+	ResultCache refreshed;
+	refreshed.load(CACHE_PATH);
+	vector<CachedResult> found;
+	refreshed.find(1, 100, config, found);
+	refreshed.find(2, 200, config, found);
+	check(refreshed.save() && refreshed.evicted() == 0 && refreshed.size() == 2, "an old entry a run hits is kept");
+
+	// Too many: the first entry, last used yesterday, goes before those of this run
+	int64_t yesterday = static_cast<int64_t>(std::time(nullptr)) - 24 * 3600;
+	check(patch_cache_file(sizeof(ResultCacheHeader) + offsetof(ResultCacheEntry, last_used), &yesterday, sizeof(yesterday)),
+		"the cache file is patched");
+	ResultCache full;
+	full.max_entries = 3;
+	full.load(CACHE_PATH);
+	for (uint64_t content = 10; content < 12; content++) full.insert(content, 100 * content, config, made_up_results(content, 1));
+	check(full.save() && full.evicted() == 1 && full.size() == 3, "beyond max_entries the least recently used is evicted");
+	ResultCache kept;
+	kept.load(CACHE_PATH);
+	check(kept.find(10, 1000, config, found) && kept.find(11, 1100, config, found)
+		&& kept.find(1, 100, config, found) != kept.find(2, 200, config, found), "the entries used this run are kept");
+}
+
+int main() {
+	check_hits_and_misses();
+	check_save_and_load();
+	check_eviction();
+	remove(CACHE_PATH);
+	cout << "result_cache_test: " << n_checks << " checks, " << n_failed << " failed" << endl;
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 result_cache_test.cpp -o result_cache_test
+./result_cache_test
+*/
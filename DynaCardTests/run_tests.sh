@@ -0,0 +1,19 @@
+# Build every check and run it over the example recordings.  Exits 1 if any
+# of them does not build or fails.
+cd "$(dirname "$0")"
+failed=0
+
+g++ -O2 -std=c++17 segmenter_test.cpp -o segmenter_test && \
+	./segmenter_test ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv || failed=1
+g++ -O2 -std=c++17 corner_test.cpp -o corner_test && \
+	./corner_test ../CPlusDynaCard/example_data/*.csv ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv || failed=1
+g++ -O2 -std=c++17 kernel_test.cpp -o kernel_test && \
+	./kernel_test ../CPlusDynaCard/example_data/*.csv ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv || failed=1
+g++ -O2 -std=c++17 -pthread result_cache_test.cpp -o result_cache_test && \
+	./result_cache_test || failed=1
+g++ -O2 -std=c++17 -pthread pipeline_test.cpp -o pipeline_test && \
+	./pipeline_test || failed=1
+g++ -O2 -std=c++17 line_fit_test.cpp -o line_fit_test && \
+	./line_fit_test || failed=1
+
+exit $failed
@@ -0,0 +1,126 @@
+/*
+Checks where DynaCardCommon/stroke_segmenter.h cuts a recording into strokes.
+
+Short made-up recordings pin the rules: samples before the first start are
+dropped, a stroke is not finished by a dip below LENGTH_STARTING_THRESH
+while it is still starting, the sample that finishes a stroke starts the
+next, and an unfinished stroke at the end is dropped.  Every file on the
+command line is then cut whole, and its strokes must join end to end, each
+starting and ending at or below LENGTH_STARTING_THRESH and reaching
+LENGTH_STARTED_THRESH in between.
+
+Usage:
+  segmenter_test [file.csv ...]
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+
+using namespace std;
+
+int n_checks = 0, n_failed = 0;
+
+void check(bool ok, const string& what) {
+	n_checks++;
+	if (ok) return;
+	n_failed++;
+	cout << "FAILED: " << what << endl;
+}
+
+// The first and last sample of every stroke the lengths xs are cut into; positions are the sample indices
+vector<pair<size_t, size_t> > cut(StrokeSegmenter& segmenter, const vector<double>& xs) {
+	vector<pair<size_t, size_t> > strokes;
+	for (size_t i = 0; i < xs.size(); i++) {
+		if (!segmenter.add_sample(static_cast<double>(i), xs[i], 10.0 * i)) continue;
+		strokes.push_back(make_pair(segmenter.first_sample, segmenter.last_sample()));
+		check(segmenter.position.front() == segmenter.first_sample && segmenter.position.back() == i,
+			"a finished stroke holds its own samples");
+	}
+	return strokes;
+}
+
+void check_made_up_recordings() {
+	StrokeSegmenter segmenter;
+	// Starts mid-stroke, dips to 0.9 while starting, ends mid-stroke
+	vector<double> xs = { 3, 0.5, 2, 0.9, 6, 8, 4, 1.0, 3, 7, 0.2, 4 };
+	vector<pair<size_t, size_t> > strokes = cut(segmenter, xs);
+	check(strokes.size() == 2 && segmenter.n_strokes == 2, "two strokes in the made-up recording");
+	if (strokes.size() == 2) {
+		check(strokes[0] == make_pair<size_t, size_t>(1, 7), "the first stroke is samples 1..7");
+		check(strokes[1] == make_pair<size_t, size_t>(7, 10), "the second stroke is samples 7..10");
+	}
+	check(segmenter.n_samples == xs.size(), "every sample is counted");
+
+	// The ranges of the stroke held
+	segmenter.reset();
+	xs = { 0.5, 6, 8, 1.0 };
+	strokes = cut(segmenter, xs);
+	check(strokes.size() == 1 && segmenter.min_length == 0.5 && segmenter.max_length == 8
+		&& segmenter.min_weight == 0 && segmenter.max_weight == 30, "the ranges of a stroke");
+
+	// reset starts over, counting samples from 0 again
+	segmenter.reset();
+	xs = { 9, 9, 0.1, 5, 0.1 };
+	strokes = cut(segmenter, xs);
+	check(strokes.size() == 1 && strokes[0] == make_pair<size_t, size_t>(2, 4), "a stroke after reset");
+
+	// Never below the starting threshold, and never done starting
+	segmenter.reset();
+	check(cut(segmenter, vector<double>(100, 3.0)).empty(), "no stroke that never starts");
+	segmenter.reset();
+	xs = { 0.5, 4.9, 0.5, 4.9, 0.5 };
+	check(cut(segmenter, xs).empty(), "no stroke that never reaches LENGTH_STARTED_THRESH");
+
+	// Thresholds of its own
+	StrokeSegmenter wide(10, 50);
+	xs = { 9, 20, 9, 60, 10, 70, 5 };
+	strokes = cut(wide, xs);
+	check(strokes.size() == 2 && strokes[0] == make_pair<size_t, size_t>(0, 4) && strokes[1] == make_pair<size_t, size_t>(4, 6),
+		"strokes with thresholds 10 and 50");
+}
+
+// The strokes of a whole recording join end to end and each is a full cycle
+void check_file(const string& fname) {
+	CardColumns cols;
+	if (!parse_card_file(fname, cols)) {
+		check(false, "cannot open " + fname);
+		return;
+	}
+	size_t first_start = 0;
+	while (first_start < cols.size() && cols.length[first_start] > LENGTH_STARTING_THRESH) first_start++;
+	StrokeSegmenter segmenter;
+	size_t n_strokes = 0, previous_last = 0;
+	bool joined = true, bounded = true, reached = true;
+	for (size_t i = 0; i < cols.size(); i++) {
+		if (!segmenter.add_sample(cols.position[i], cols.length[i], cols.weight[i])) continue;
+		if (n_strokes == 0) joined = joined && segmenter.first_sample == first_start;
+		else joined = joined && segmenter.first_sample == previous_last;
+		bounded = bounded && segmenter.last_sample() == i
+			&& segmenter.length.front() <= LENGTH_STARTING_THRESH && segmenter.length.back() <= LENGTH_STARTING_THRESH;
+		reached = reached && segmenter.max_length >= LENGTH_STARTED_THRESH;
+		previous_last = segmenter.last_sample();
+		n_strokes++;
+	}
+	cout << fname << ": " << n_strokes << " strokes" << endl;
+	check(n_strokes > 0, fname + " has strokes");
+	check(joined, "the strokes of " + fname + " join end to end");
+	check(bounded, "the strokes of " + fname + " start and end below LENGTH_STARTING_THRESH");
+	check(reached, "the strokes of " + fname + " reach LENGTH_STARTED_THRESH");
+}
+
+int main(int argc, char *argv[]) {
+	check_made_up_recordings();
+	for (int i = 1; i < argc; i++) check_file(argv[i]);
+	cout << "segmenter_test: " << n_checks << " checks, " << n_failed << " failed" << endl;
+	return n_failed == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 segmenter_test.cpp -o segmenter_test
+./segmenter_test ../CPlusDeliverable/sent_to_onica/TestA*_comb.csv
+*/
@@ -0,0 +1,233 @@
+/*
+Makes synthetic surface cards of every pump state, from the templates in
+DynaCardCommon/card_generator.h, for load and scaling tests.
+
+Usage:
+  card_generator [options] -o directory    write the cards as CSV files
+  card_generator [options] --check         classify them in memory and print,
+                                           per state, how many come back as it
+  card_generator [options] --speed         only generate them, in memory, and
+                                           print cards/s
+
+Options:
+  -c state|all       the state to make cards of (all)
+  -n cards           cards of every state (10)
+  -s samples         samples per stroke (200)
+  -l stroke_length   (100)
+  --noise=fraction   standard deviation of the noise, as a fraction of the
+                     stroke length and load range (0.002)
+  --skew=fraction    shear of the card, as a fraction of the stroke length (0)
+  --seed=number      (1)
+  --strokes=k        strokes per card: a recording of k cards of the state (1)
+  --workers=N        threads for --check and --speed, 0 for one per core (1)
+  -w min_weight      min_acceptable_peak_weight for --check (60)
+
+The same options and seed always give the same cards, with any number of
+workers.  Files are named after the state and the card
+number, e.g. fluid_pound_3.csv.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/pump_state.h"
+#include "../DynaCardCommon/card_generator.h"
+#include "../DynaCardCommon/stage_pipeline.h"
+
+using namespace std;
+
+// Cards handed to a worker at a time by --check and --speed
+const size_t GENERATOR_BLOCK = 4096;
+
+struct GeneratorOptions {
+	GeneratorSettings settings;
+	uint64_t seed = 1;
+	uint64_t n_cards = 10;
+	int n_strokes = 1;
+	int n_workers = 1;
+	double min_acceptable_peak_weight = 60;
+};
+
+// Each state has its own generator, so adding a template leaves the cards of the others as they were
+CardGenerator make_generator(const GeneratorOptions& options, const CardTemplate& shape) {
+	uint64_t state_hash = 14695981039346656037ULL;
+	for (const char* c = shape.state; *c; c++) state_hash = (state_hash ^ static_cast<unsigned char>(*c)) * 1099511628211ULL;
+	return CardGenerator(options.seed ^ state_hash, options.settings);
+}
+
+// Card number card of the options, all its strokes, into cols
+void generate_card(CardGenerator& generator, const CardTemplate& shape, const GeneratorOptions& options, uint64_t card, CardColumns& cols) {
+	cols.position.clear();
+	cols.length.clear();
+	cols.weight.clear();
+	for (int k = 0; k < options.n_strokes; k++) {
+		size_t first = cols.size();
+		generator.generate(shape, card * options.n_strokes + k, cols);
+		for (size_t i = first; i < cols.size(); i++) cols.position[i] += 360.0 * k;
+	}
+}
+
+string file_name(const string& directory, const CardTemplate& shape, uint64_t card) {
+	string name = shape.state;
+	for (size_t i = 0; i < name.size(); i++) {
+		if (name[i] == ' ') name[i] = '_';
+	}
+	return directory + "/" + name + "_" + to_string(card) + ".csv";
+}
+
+bool write_cards(const vector<const CardTemplate*>& shapes, const GeneratorOptions& options, const string& directory) {
+	CardColumns cols;
+	string text;
+	for (size_t t = 0; t < shapes.size(); t++) {
+		CardGenerator generator = make_generator(options, *shapes[t]);
+		for (uint64_t card = 0; card < options.n_cards; card++) {
+			generate_card(generator, *shapes[t], options, card, cols);
+			text.clear();
+			write_card_csv(cols, text);
+			string fname = file_name(directory, *shapes[t], card);
+			ofstream out(fname, ios::binary);
+			out.write(text.data(), text.size());
+			if (!out) {
+				cout << "ERROR: cannot write " << fname << endl;
+				return false;
+			}
+		}
+	}
+	cout << options.n_cards * shapes.size() << " cards written to " << directory << endl;
+	return true;
+}
+
+// A block of cards of one state on its way through run_pipeline
+struct GeneratorBlock {
+	size_t t;                   // index of the state in shapes
+	uint64_t first, end;        // card numbers
+	uint64_t n_ok;              // strokes that came back as their state
+	vector<string> disagreeing; // the first few states that came back wrong
+};
+
+/*
+Generate every card of every state on the workers, in blocks, classifying
+each stroke when check is set.  The blocks are tallied on this thread, in
+order.  Returns the seconds taken.
+*/
+double run_in_memory(const vector<const CardTemplate*>& shapes, const GeneratorOptions& options, bool check,
+	vector<uint64_t>& n_agreeing, vector<vector<string> >& disagreeing)
+{
+	uint64_t n_blocks = (options.n_cards + GENERATOR_BLOCK - 1) / GENERATOR_BLOCK;
+	int n_workers = options.n_workers == 0 ? default_worker_count() : options.n_workers;
+	n_agreeing.assign(shapes.size(), 0);
+	disagreeing.assign(shapes.size(), vector<string>());
+	vector<CardColumns> scratch(n_workers);
+	vector<Card> cards(n_workers);
+	PipelineThreads threads;
+	threads.n_workers = n_workers;
+	auto start = chrono::steady_clock::now();
+	run_pipeline<GeneratorBlock>(shapes.size() * n_blocks, threads, [&](size_t item, GeneratorBlock& block, int) {
+		block.t = item / n_blocks;
+		block.first = (item % n_blocks) * GENERATOR_BLOCK;
+		block.end = min<uint64_t>(block.first + GENERATOR_BLOCK, options.n_cards);
+		block.n_ok = 0;
+		block.disagreeing.clear();
+	}, [&](GeneratorBlock& block, int worker) {
+		const CardTemplate& shape = *shapes[block.t];
+		CardGenerator generator = make_generator(options, shape);
+		CardColumns& cols = scratch[worker];
+		for (uint64_t card = block.first; card < block.end; card++) {
+			generate_card(generator, shape, options, card, cols);
+			if (!check) continue;
+			size_t n = options.settings.n_samples;
+			for (int k = 0; k < options.n_strokes; k++) {
+				cards[worker].assign(cols.position.data() + k * n, cols.length.data() + k * n, cols.weight.data() + k * n, n);
+				string state = classify_card(cards[worker], options.min_acceptable_peak_weight);
+				if (state == shape.state) block.n_ok++;
+				else if (block.disagreeing.size() < 3) block.disagreeing.push_back(state);
+			}
+		}
+	}, [&](size_t, const GeneratorBlock& block) {
+		n_agreeing[block.t] += block.n_ok;
+		for (size_t i = 0; i < block.disagreeing.size() && disagreeing[block.t].size() < 3; i++) {
+			disagreeing[block.t].push_back(block.disagreeing[i]);
+		}
+	});
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return seconds;
+}
+
+int main(int argc, char *argv[]) {
+	GeneratorOptions options;
+	string state = "all";
+	string directory;
+	bool check = false, speed = false;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-c" && i + 1 < argc) state = argv[++i];
+		else if (arg == "-n" && i + 1 < argc) options.n_cards = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && i + 1 < argc) options.settings.n_samples = atoi(argv[++i]);
+		else if (arg == "-l" && i + 1 < argc) options.settings.stroke_length = atof(argv[++i]);
+		else if (arg == "-w" && i + 1 < argc) options.min_acceptable_peak_weight = atof(argv[++i]);
+		else if (arg == "-o" && i + 1 < argc) directory = argv[++i];
+		else if (arg.compare(0, 8, "--noise=") == 0) options.settings.noise = atof(arg.c_str() + 8);
+		else if (arg.compare(0, 7, "--skew=") == 0) options.settings.skew = atof(arg.c_str() + 7);
+		else if (arg.compare(0, 7, "--seed=") == 0) options.seed = strtoull(arg.c_str() + 7, nullptr, 10);
+		else if (arg.compare(0, 10, "--strokes=") == 0) options.n_strokes = atoi(arg.c_str() + 10);
+		else if (arg.compare(0, 10, "--workers=") == 0) options.n_workers = atoi(arg.c_str() + 10);
+		else if (arg == "--check") check = true;
+		else if (arg == "--speed") speed = true;
+		else {
+			cout << "ERROR: unknown option " << arg << endl;
+			return -1;
+		}
+	}
+	if ((directory.empty() ? 0 : 1) + (check ? 1 : 0) + (speed ? 1 : 0) != 1
+		|| options.settings.n_samples < 4 || options.n_strokes < 1 || options.n_workers < 0) {
+		cout << "Usage: card_generator [-c state|all] [-n cards] [-s samples] [-l stroke_length] [--noise=fraction] [--skew=fraction]" << endl
+			<< "                      [--seed=number] [--strokes=k] [--workers=N] [-w min_weight] -o directory|--check|--speed" << endl;
+		return -1;
+	}
+
+	vector<const CardTemplate*> shapes;
+	if (state == "all") {
+		for (int t = 0; t < N_CARD_TEMPLATES; t++) shapes.push_back(&CARD_TEMPLATES[t]);
+	}
+	else if (find_card_template(state)) {
+		shapes.push_back(find_card_template(state));
+	}
+	else {
+		cout << "ERROR: no template for " << state << "; the states are:" << endl;
+		for (int t = 0; t < N_CARD_TEMPLATES; t++) cout << "  " << CARD_TEMPLATES[t].state << endl;
+		return -1;
+	}
+
+	if (!directory.empty()) return write_cards(shapes, options, directory) ? 0 : 1;
+
+	vector<uint64_t> n_agreeing;
+	vector<vector<string> > disagreeing;
+	double seconds = run_in_memory(shapes, options, check, n_agreeing, disagreeing);
+	uint64_t n_cards = options.n_cards * shapes.size();
+	if (check) {
+		uint64_t n_strokes = options.n_cards * options.n_strokes;
+		for (size_t t = 0; t < shapes.size(); t++) {
+			cout << left << setw(20) << shapes[t]->state << right << setw(12) << n_agreeing[t] << " / " << n_strokes
+				<< fixed << setprecision(1) << setw(7) << 100.0 * n_agreeing[t] / n_strokes << "%";
+			for (size_t i = 0; i < disagreeing[t].size(); i++) cout << (i == 0 ? "  e.g. " : ", ") << disagreeing[t][i];
+			cout << endl;
+		}
+	}
+	cout << n_cards << " cards of " << options.settings.n_samples * options.n_strokes << " samples in "
+		<< fixed << setprecision(3) << seconds << " s, " << setprecision(0) << n_cards / seconds << " cards/s" << endl;
+	return 0;
+}
+
+/*
+g++ -O2 -std=c++17 -pthread card_generator.cpp -o card_generator
+./card_generator -n 5 -o /tmp/cards
+./card_generator -n 1000 --check
+./card_generator -n 1000000 --speed --workers=0
+*/
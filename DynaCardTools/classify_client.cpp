@@ -0,0 +1,119 @@
+/*
+Sends card files to a classifier started with
+  classify_pump_state --serve socket_path
+and prints the JSON replies, in the order of the files.  All requests are
+written before the replies are read, so the server works on them in parallel.
+
+Usage:
+  classify_client [-w min_weight] [-n repeat] socket_path file.csv [file.csv ...]
+  classify_client --stats socket_path
+
+With -n every file is sent repeat times and only the time taken is printed.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/classify_server.h"
+
+using namespace std;
+
+int connect_to(const string& socket_path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+	if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+		cout << "ERROR: cannot connect to " << socket_path << endl;
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Read one reply; false if the server hung up
+bool read_reply(SocketReader& in, bool& ok, string& body) {
+	string line;
+	if (!in.read_line(line)) return false;
+	size_t space = line.find(' ');
+	if (space == string::npos) return false;
+	ok = line.compare(0, space, "OK") == 0;
+	body.resize(strtoul(line.c_str() + space + 1, NULL, 10));
+	return body.empty() || in.read_exact(&body[0], body.size());
+}
+
+int main(int argc, char *argv[]) {
+	string min_weight = "60";
+	int repeat = 0;
+	bool stats = false;
+	vector<string> args;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-w" && i + 1 < argc) min_weight = argv[++i];
+		else if (arg == "-n" && i + 1 < argc) repeat = atoi(argv[++i]);
+		else if (arg == "--stats") stats = true;
+		else args.push_back(arg);
+	}
+	if (args.empty() || (!stats && args.size() < 2)) {
+		cout << "Usage: classify_client [-w min_weight] [-n repeat] socket_path file.csv [file.csv ...]" << endl
+			<< "       classify_client --stats socket_path" << endl;
+		return -1;
+	}
+	int fd = connect_to(args[0]);
+	if (fd < 0) return 1;
+
+	// Build every request up front
+	vector<string> requests;
+	if (stats) requests.push_back("STATS\n");
+	for (size_t i = 1; i < args.size(); i++) {
+		MappedFile file;
+		if (!file.open(args[i])) {
+			cout << "ERROR: cannot open " << args[i] << endl;
+			return 1;
+		}
+		requests.push_back("CSV " + min_weight + " " + to_string(file.size) + "\n" + string(file.data, file.size));
+	}
+	int rounds = repeat > 0 ? repeat : 1;
+
+	auto start = chrono::steady_clock::now();
+	// Write from a second thread so a full socket buffer can't deadlock us
+	thread writer([&] {
+		for (int r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < requests.size(); i++) write_all(fd, requests[i].data(), requests[i].size());
+		}
+		shutdown(fd, SHUT_WR);
+	});
+	SocketReader in(fd);
+	int failures = 0;
+	size_t n_replies = 0;
+	bool ok;
+	string body;
+	while (read_reply(in, ok, body)) {
+		if (!ok) failures++;
+		if (repeat == 0 || !ok) cout << (ok ? "" : "ERROR: ") << body << (ok ? "" : "\n");
+		n_replies++;
+	}
+	writer.join();
+	close(fd);
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (repeat > 0) {
+		cout << n_replies << " replies in " << secs << " s, " << n_replies / secs << " cards/s" << endl;
+	}
+	return (failures == 0 && n_replies == rounds * requests.size()) ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 -pthread classify_client.cpp -o classify_client
+./classify_client /tmp/dynacard.sock ../CPlusDeliverable/example_data/full_pump_0.csv
+*/
@@ -0,0 +1,88 @@
+/*
+Converts surface card CSV files into the binary .card format described in
+DynaCardCommon/card_file.h, so archived cards can be re-diagnosed without
+parsing text again.
+
+The '#' header keys (well ID, timestamp, device and sensor serials) go into
+the fixed header, the three columns are stored as they are, and the strokes
+StrokeSegmenter finds are recorded in the stroke index.
+
+Usage:
+  csv2card file.csv [file.csv ...]     writes file.card next to each input
+  csv2card -o out.card file.csv        writes one input to a chosen name
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card_header.h"
+#include "../DynaCardCommon/card_file.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+
+using namespace std;
+
+// Stroke boundaries as first/one-past-last sample pairs
+vector<uint64_t> index_strokes(const CardColumns& cols) {
+	vector<uint64_t> stroke_index;
+	StrokeSegmenter strokes;
+	for (size_t i = 0; i < cols.size(); i++) {
+		if (strokes.add_sample(cols.position[i], cols.length[i], cols.weight[i])) {
+			stroke_index.push_back(strokes.first_sample);
+			stroke_index.push_back(strokes.last_sample() + 1);
+		}
+	}
+	return stroke_index;
+}
+
+bool convert(const string& csv_name, const string& card_name) {
+	FileHeader header;
+	CardColumns cols;
+	if (ingest_card_file(csv_name, header, cols) == 0) {
+		cout << "ERROR: cannot open " << csv_name << endl;
+		return false;
+	}
+	vector<uint64_t> stroke_index = index_strokes(cols);
+	if (!write_card_file(card_name, header, cols, stroke_index)) {
+		cout << "ERROR: cannot write " << card_name << endl;
+		return false;
+	}
+	cout << csv_name << " -> " << card_name << ": " << cols.size() << " samples, "
+		<< stroke_index.size() / 2 << " strokes" << endl;
+	return true;
+}
+
+string card_name_for(const string& csv_name) {
+	size_t dot = csv_name.find_last_of('.');
+	size_t slash = csv_name.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash)) return csv_name + ".card";
+	return csv_name.substr(0, dot) + ".card";
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		cout << "Usage: csv2card file.csv [file.csv ...]" << endl
+			<< "       csv2card -o out.card file.csv" << endl;
+		return -1;
+	}
+	int failures = 0;
+	if (string(argv[1]) == "-o") {
+		if (argc != 4) {
+			cout << "Usage: csv2card -o out.card file.csv" << endl;
+			return -1;
+		}
+		if (!convert(argv[3], argv[2])) failures++;
+	}
+	else {
+		for (int i = 1; i < argc; i++) {
+			if (!convert(argv[i], card_name_for(argv[i]))) failures++;
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+/*
+g++ -O2 -std=c++17 csv2card.cpp -o csv2card
+./csv2card ../CPlusDeliverable/sent_to_onica/TestA2_comb.csv
+*/
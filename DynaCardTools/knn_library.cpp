@@ -0,0 +1,209 @@
+/*
+Builds a reference library (.knn, ../DynaCardCommon/knn_classifier.h) of
+labelled cards for classify_pump_state --knn.
+
+Every card file on the command line adds its first cycle, or with --strokes
+every stroke of it, labelled with its state.  The state is looked up in a
+--labels file, CSV rows of file name and state as classify_pump_state
+writes its report (so a checked report can be fed straight back), by the
+name as given or without its directory; failing that it is read off the
+file name, as the example cards are named (full_pump_3.csv is a full pump,
+bent_barrel_5degree_left.csv a bent barrel).  Files with no state are left
+out and listed.  Flowing wells are left out too: classify_card_knn tells
+them by their load, before it looks at any shape.
+
+--generate=N adds N synthetic cards of every state but flowing well
+(../DynaCardCommon/card_generator.h), with the skew and noise varied from
+card to card, for a library to start from before enough real cards are
+labelled.
+
+Usage:
+  knn_library -o library.knn [--strokes] [--labels=report.csv] [--generate=N] [-s samples] [file ...]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card_file.h"
+#include "../DynaCardCommon/card_generator.h"
+#include "../DynaCardCommon/stroke_segmenter.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/knn_classifier.h"
+
+using namespace std;
+
+string base_name(const string& fname) {
+	size_t slash = fname.find_last_of("/\\");
+	return slash == string::npos ? fname : fname.substr(slash + 1);
+}
+
+// File name to state, from the first two columns of a CSV; false if it can't be read
+bool read_labels(const string& fname, map<string, string>& labels) {
+	ifstream in(fname);
+	if (!in) return false;
+	string line;
+	while (getline(in, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		size_t comma = line.find(',');
+		if (comma == string::npos) continue;
+		size_t end = line.find(',', comma + 1);
+		string file = line.substr(0, comma);
+		string state = line.substr(comma + 1, end == string::npos ? string::npos : end - comma - 1);
+		if (file == "File Name" || state.empty()) continue;
+		labels[file] = state;
+	}
+	return true;
+}
+
+// The longest state whose name, spaces as underscores, starts the file name and is followed by _, a digit or the end; "" for none
+string state_from_name(const string& fname) {
+	string name = base_name(fname);
+	name = name.substr(0, name.find_last_of('.'));
+	string best;
+	for (int t = 0; t < N_CARD_TEMPLATES; t++) {
+		string state = CARD_TEMPLATES[t].state;
+		string prefix = state;
+		for (size_t i = 0; i < prefix.size(); i++) {
+			if (prefix[i] == ' ') prefix[i] = '_';
+		}
+		if (name.compare(0, prefix.size(), prefix) != 0) continue;
+		if (name.size() > prefix.size() && name[prefix.size()] != '_' && !isdigit(static_cast<unsigned char>(name[prefix.size()]))) continue;
+		if (state.size() > best.size()) best = state;
+	}
+	return best;
+}
+
+string state_of_file(const string& fname, const map<string, string>& labels) {
+	map<string, string>::const_iterator found = labels.find(fname);
+	if (found == labels.end()) found = labels.find(base_name(fname));
+	if (found != labels.end()) return found->second;
+	return state_from_name(fname);
+}
+
+// The strokes of a file, or its first cycle, as separate columns
+vector<CardColumns> file_strokes(const string& fname, bool per_stroke) {
+	CardColumns cols;
+	if (is_card_file_name(fname)) {
+		CardFile card;
+		if (card.open(fname)) {
+			cols.position.assign(card.position, card.position + card.n_samples());
+			cols.length.assign(card.length, card.length + card.n_samples());
+			cols.weight.assign(card.weight, card.weight + card.n_samples());
+		}
+	}
+	else {
+		parse_card_file(fname, cols);
+	}
+	vector<CardColumns> strokes;
+	if (!per_stroke) {
+		size_t first, end;
+		first_cycle_range(cols.position.data(), cols.size(), first, end);
+		CardColumns cycle;
+		cycle.position.assign(cols.position.begin() + first, cols.position.begin() + end);
+		cycle.length.assign(cols.length.begin() + first, cols.length.begin() + end);
+		cycle.weight.assign(cols.weight.begin() + first, cols.weight.begin() + end);
+		strokes.push_back(cycle);
+		return strokes;
+	}
+	StrokeSegmenter segmenter;
+	for (size_t i = 0; i < cols.size(); i++) {
+		if (!segmenter.add_sample(cols.position[i], cols.length[i], cols.weight[i])) continue;
+		CardColumns stroke;
+		stroke.position = segmenter.position;
+		stroke.length = segmenter.length;
+		stroke.weight = segmenter.weight;
+		strokes.push_back(stroke);
+	}
+	return strokes;
+}
+
+int main(int argc, char *argv[]) {
+	string library_path, labels_path;
+	bool per_stroke = false;
+	uint64_t n_generated = 0;
+	GeneratorSettings settings;
+	vector<string> fnames;
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "-o" && i + 1 < argc) library_path = argv[++i];
+		else if (arg == "-s" && i + 1 < argc) settings.n_samples = atoi(argv[++i]);
+		else if (arg == "--strokes") per_stroke = true;
+		else if (arg.compare(0, 9, "--labels=") == 0) labels_path = arg.substr(9);
+		else if (arg.compare(0, 11, "--generate=") == 0) n_generated = strtoull(arg.c_str() + 11, nullptr, 10);
+		else fnames.push_back(arg);
+	}
+	if (library_path.empty() || (fnames.empty() && n_generated == 0) || settings.n_samples < 4) {
+		cout << "Usage: knn_library -o library.knn [--strokes] [--labels=report.csv] [--generate=N] [-s samples] [file ...]" << endl;
+		return -1;
+	}
+	map<string, string> labels;
+	if (!labels_path.empty() && !read_labels(labels_path, labels)) {
+		cout << "ERROR: cannot read " << labels_path << endl;
+		return -1;
+	}
+
+	ReferenceLibrary library;
+	Card card;
+	ShapeDescriptor descriptor;
+	vector<string> unlabelled;
+	for (size_t f = 0; f < fnames.size(); f++) {
+		string state = state_of_file(fnames[f], labels);
+		if (state.empty()) {
+			unlabelled.push_back(fnames[f]);
+			continue;
+		}
+		if (state == "flowing well") continue;
+		if (state.size() >= REFERENCE_STATE_NAME) {
+			cout << "ERROR: the state of " << fnames[f] << ", " << state << ", is longer than " << REFERENCE_STATE_NAME - 1 << " characters" << endl;
+			return -1;
+		}
+		vector<CardColumns> strokes = file_strokes(fnames[f], per_stroke);
+		for (size_t k = 0; k < strokes.size(); k++) {
+			card.assign(strokes[k].position.data(), strokes[k].length.data(), strokes[k].weight.data(), strokes[k].size());
+			if (describe_card(card, descriptor)) library.add(descriptor, state);
+		}
+	}
+	CardColumns cols;
+	for (int t = 0; t < N_CARD_TEMPLATES && n_generated > 0; t++) {
+		if (strcmp(CARD_TEMPLATES[t].state, "flowing well") == 0) continue;
+		CardGenerator generator(t + 1, settings);
+		for (uint64_t i = 0; i < n_generated; i++) {
+			cols.position.clear();
+			cols.length.clear();
+			cols.weight.clear();
+			generator.generate_varied(CARD_TEMPLATES[t], i, cols);
+			card.assign(cols.position.data(), cols.length.data(), cols.weight.data(), cols.size());
+			if (describe_card(card, descriptor)) library.add(descriptor, CARD_TEMPLATES[t].state);
+		}
+	}
+
+	for (size_t i = 0; i < unlabelled.size(); i++) cout << "no state for " << unlabelled[i] << endl;
+	if (library.size() == 0) {
+		cout << "ERROR: no labelled cards" << endl;
+		return -1;
+	}
+	if (!library.save(library_path)) {
+		cout << "ERROR: cannot write " << library_path << endl;
+		return -1;
+	}
+	vector<size_t> per_state(library.states.size(), 0);
+	for (uint32_t i = 0; i < library.size(); i++) {
+		per_state[find(library.states.begin(), library.states.end(), string(library.state_of(i))) - library.states.begin()]++;
+	}
+	for (size_t s = 0; s < library.states.size(); s++) cout << left << setw(20) << library.states[s] << right << setw(10) << per_state[s] << endl;
+	cout << library_path << ": " << library.size() << " cards" << endl;
+	return 0;
+}
+
+/*
+g++ -O2 -std=c++17 knn_library.cpp -o knn_library
+./knn_library -o example.knn ../CPlusDynaCard/example_data/full_pump_*.csv ../CPlusDynaCard/example_data/tubing_movement_*.csv
+./knn_library -o reference.knn --generate=10000 --labels=pump_report_checked.csv archive/well_*.card
+*/
@@ -0,0 +1,310 @@
+/*
+The C ABI of dynacard.h over the classifier and shape properties of
+DynaCardCommon.
+*/
+
+#define DYNACARD_BUILD
+#include "dynacard.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+#include "../DynaCardCommon/card_parser.h"
+#include "../DynaCardCommon/card_file.h"
+#include "../DynaCardCommon/card.h"
+#include "../DynaCardCommon/pump_state.h"
+#include "../DynaCardCommon/shape_properties.h"
+#include "../DynaCardCommon/fused_engine.h"
+#include "../DynaCardCommon/resample.h"
+#include "../DynaCardCommon/metrics.h"
+#include "../DynaCardCommon/trace.h"
+
+using namespace std;
+
+struct dynacard_context {
+	Card card;
+	CardColumns columns;    // text parsed by dynacard_classify_file
+	vector<double> xs, ys;  // normalized cycle of the shape properties
+	StrokeResampler resampler;
+};
+
+/*
+The struct sizes of ABI version 1, each up to the end of its last version 1
+field.  Fields added later go after these, and callers built before them are
+served no more than these many bytes.  The sizes are frozen: if an assert
+below fails, a version 1 field has moved.
+*/
+const uint32_t OPTIONS_V1_SIZE = offsetof(dynacard_options, resample_points);
+const uint32_t RESULT_V1_SIZE = offsetof(dynacard_result, distance_from_rotated_shape) + sizeof(double);
+static_assert(OPTIONS_V1_SIZE == 24, "dynacard_options changed within ABI version 1");
+static_assert(RESULT_V1_SIZE == 272, "dynacard_result changed within ABI version 1");
+
+// in[0..n) scaled to 0..1 into out, as normalize() in pump_state.h
+static void normalize_into(const double* in, size_t n, vector<double>& out) {
+	out.resize(n);
+	if (n == 0) return;
+	const SimdKernels& kernels = simd_kernels();
+	double min_value, max_value;
+	kernels.min_max(in, n, min_value, max_value);
+	kernels.normalize(in, out.data(), n, min_value, max_value - min_value);
+}
+
+// Whether fit_FourSidedFigure's heuristic finds four corners: the rightmost point may not be one of the outer two at either end
+static bool heuristic_corners_fit(const vector<double>& xs) {
+	size_t rightmost = max_element(xs.begin(), xs.end()) - xs.begin();
+	return rightmost >= 2 && rightmost + 2 < xs.size();
+}
+
+// Area and distances of the first stroke, as ComputeShapeProperties prints them
+static int measure(dynacard_context* ctx, const double* position, const double* length, const double* weight, size_t n_samples,
+	CornerMethod corner_method, size_t resample_points, dynacard_result& result) {
+	size_t first, end;
+	{
+		METRICS_TIME(STAGE_CYCLE);
+		TRACE_SPAN("extract_one_cycle");
+		first_stroke_range(length, n_samples, first, end);
+		StrokeResampler& resampler = ctx->resampler;
+		if (resample_points > 0 && resampler.resample(position + first, length + first, weight + first, end - first, resample_points)) {
+			normalize_into(resampler.stroke.length.data(), resampler.stroke.size(), ctx->xs);
+			normalize_into(resampler.stroke.weight.data(), resampler.stroke.size(), ctx->ys);
+		}
+		else {
+			normalize_into(length + first, end - first, ctx->xs);
+			normalize_into(weight + first, end - first, ctx->ys);
+		}
+	}
+	if (end - first == 0) return DYNACARD_ERROR_NO_CYCLE;
+	{
+		METRICS_TIME(STAGE_AREA);
+		TRACE_SPAN("compute_area");
+		result.area = compute_area(ctx->xs, ctx->ys);
+	}
+	if (ctx->xs.size() < 4 || (corner_method == HEURISTIC_CORNERS && !heuristic_corners_fit(ctx->xs))) return DYNACARD_ERROR_NO_CYCLE;
+	FourSidedFigure* trap;
+	{
+		METRICS_TIME(STAGE_FIGURE);
+		TRACE_SPAN("fit_FourSidedFigure");
+		trap = fit_FourSidedFigure(ctx->xs, ctx->ys, corner_method);
+	}
+	{
+		METRICS_TIME(STAGE_DISTANCE);
+		TRACE_SPAN("mean_distance");
+		result.distance_from_shape = mean_distance(*trap, ctx->xs, ctx->ys);
+		FourSidedFigure* rotated_trap = trap->rotate180deg();
+		result.distance_from_rotated_shape = mean_distance(*rotated_trap, ctx->xs, ctx->ys);
+		delete rotated_trap;
+	}
+	delete trap;
+	return DYNACARD_OK;
+}
+
+// A result with nothing found yet
+static void clear_result(dynacard_result& result) {
+	memset(&result, 0, sizeof(result));
+	result.area = result.distance_from_shape = result.distance_from_rotated_shape = NAN;
+	for (int i = 0; i < 4; i++) {
+		dynacard_edge_fit nothing = { NAN, NAN, NAN, NAN, NAN, NAN };
+		result.edges[i] = nothing;
+	}
+}
+
+// The caller's options, or the defaults where the caller's struct ends; false if they cannot be read
+static bool read_options(const dynacard_options* caller_options, dynacard_options& options) {
+	dynacard_default_options(&options);
+	if (!caller_options || caller_options->struct_size < OPTIONS_V1_SIZE) return false;
+	memcpy(&options, caller_options, min<size_t>(caller_options->struct_size, sizeof(options)));
+	return true;
+}
+
+// One recording, the arguments checked
+static int classify_one(dynacard_context* ctx, const double* position, const double* length, const double* weight, size_t n_samples,
+	const dynacard_options& options, dynacard_result& result) {
+	clear_result(result);
+	CornerMethod corner_method = options.corner_method == DYNACARD_CORNERS_OPTIMAL ? OPTIMAL_CORNERS : HEURISTIC_CORNERS;
+	bool one_pass = (options.what & DYNACARD_ONE_PASS) != 0;
+	if (one_pass || (options.what & DYNACARD_CLASSIFY)) {
+		size_t first, end;
+		first_cycle_range(position, n_samples, first, end);
+		ctx->card.assign(position + first, length + first, weight + first, end - first);
+		if (options.resample_points > 0) resample_card(ctx->card, options.resample_points, ctx->resampler);
+		CardRecord record;
+		if (one_pass) {
+			classify_and_measure(ctx->card, options.min_acceptable_peak_weight, corner_method, record);
+			result.area = record.area;
+			result.distance_from_shape = record.distance_from_shape;
+			result.distance_from_rotated_shape = record.distance_from_rotated_shape;
+		}
+		else {
+			record.state = classify_card(ctx->card, options.min_acceptable_peak_weight, corner_method, record.fits);
+		}
+		strncpy(result.state, record.state, sizeof(result.state) - 1);
+		for (int i = 0; i < 4; i++) {
+			const EdgeFit& f = record.fits[i];
+			dynacard_edge_fit fit = { f.slope, f.intercept, f.r2, f.inverse_slope, f.inverse_r2, f.length };
+			result.edges[i] = fit;
+		}
+		result.cycle_first = first;
+		result.cycle_end = end;
+		if (end == first || (one_pass && end - first < 4)) return DYNACARD_ERROR_NO_CYCLE;
+		if (one_pass) return DYNACARD_OK;
+	}
+	if (options.what & DYNACARD_SHAPE_PROPERTIES) {
+		return measure(ctx, position, length, weight, n_samples, corner_method, options.resample_points, result);
+	}
+	return DYNACARD_OK;
+}
+
+// result into the caller's, no more of it than the caller's struct_size
+static void write_result(dynacard_result& result, dynacard_result* caller_result, uint32_t struct_size) {
+	result.struct_size = struct_size;
+	memcpy(caller_result, &result, min<size_t>(struct_size, sizeof(result)));
+}
+
+static int classify(dynacard_context* ctx, const double* position, const double* length, const double* weight, size_t n_samples,
+	const dynacard_options* caller_options, dynacard_result* caller_result) {
+	if (!caller_result || caller_result->struct_size < RESULT_V1_SIZE) return DYNACARD_ERROR_ARGUMENT;
+	dynacard_result result;
+	dynacard_options options;
+	int code;
+	if (!ctx || !read_options(caller_options, options) || (n_samples > 0 && (!position || !length || !weight))) {
+		clear_result(result);
+		code = DYNACARD_ERROR_ARGUMENT;
+	}
+	else {
+		code = classify_one(ctx, position, length, weight, n_samples, options, result);
+	}
+	write_result(result, caller_result, caller_result->struct_size);
+	return code;
+}
+
+// Ask for the columns of the next card to be brought into the L2 cache while this one is classified
+static void prefetch_card(const double* position, const double* length, const double* weight, size_t n_samples) {
+	const size_t DOUBLES_PER_LINE = 64 / sizeof(double);
+	for (size_t i = 0; i < n_samples; i += DOUBLES_PER_LINE) {
+#if defined(__GNUC__)
+		__builtin_prefetch(position + i, 0, 2);
+		__builtin_prefetch(length + i, 0, 2);
+		__builtin_prefetch(weight + i, 0, 2);
+#elif defined(_M_X64) || defined(_M_IX86)
+		_mm_prefetch(reinterpret_cast<const char*>(position + i), _MM_HINT_T1);
+		_mm_prefetch(reinterpret_cast<const char*>(length + i), _MM_HINT_T1);
+		_mm_prefetch(reinterpret_cast<const char*>(weight + i), _MM_HINT_T1);
+#endif
+	}
+}
+
+static int classify_batch(dynacard_context* ctx, const double* position, const double* length, const double* weight,
+	const uint64_t* offsets, size_t n_cards, const dynacard_options* caller_options, dynacard_result* caller_results, int32_t* codes) {
+	dynacard_options options;
+	if (!ctx || !offsets || !read_options(caller_options, options)) return DYNACARD_ERROR_ARGUMENT;
+	if (n_cards == 0) return DYNACARD_OK;
+	if (!caller_results || caller_results->struct_size < RESULT_V1_SIZE) return DYNACARD_ERROR_ARGUMENT;
+	for (size_t i = 0; i < n_cards; i++) {
+		if (offsets[i + 1] < offsets[i]) return DYNACARD_ERROR_ARGUMENT;
+	}
+	if (offsets[n_cards] > offsets[0] && (!position || !length || !weight)) return DYNACARD_ERROR_ARGUMENT;
+	// The results are packed at the caller's struct size
+	uint32_t stride = caller_results->struct_size;
+	char* results = reinterpret_cast<char*>(caller_results);
+	dynacard_result result;
+	for (size_t i = 0; i < n_cards; i++) {
+		if (i + 1 < n_cards) {
+			uint64_t next = offsets[i + 1];
+			prefetch_card(position + next, length + next, weight + next, offsets[i + 2] - next);
+		}
+		uint64_t first = offsets[i];
+		int code = classify_one(ctx, position + first, length + first, weight + first, offsets[i + 1] - first, options, result);
+		write_result(result, reinterpret_cast<dynacard_result*>(results + i * stride), stride);
+		if (codes) codes[i] = code;
+	}
+	return DYNACARD_OK;
+}
+
+extern "C" {
+
+DYNACARD_API int dynacard_abi_version(void) {
+	return DYNACARD_ABI_VERSION;
+}
+
+DYNACARD_API void dynacard_default_options(dynacard_options* options) {
+	if (!options) return;
+	memset(options, 0, sizeof(*options));
+	options->struct_size = sizeof(*options);
+	options->what = DYNACARD_CLASSIFY | DYNACARD_SHAPE_PROPERTIES;
+	options->min_acceptable_peak_weight = 60.0;
+	options->corner_method = DYNACARD_CORNERS_HEURISTIC;
+}
+
+DYNACARD_API dynacard_context* dynacard_create(void) {
+	return new (nothrow) dynacard_context;
+}
+
+DYNACARD_API void dynacard_destroy(dynacard_context* ctx) {
+	delete ctx;
+}
+
+DYNACARD_API int dynacard_classify(dynacard_context* ctx, const double* position, const double* length, const double* weight,
+	size_t n_samples, const dynacard_options* options, dynacard_result* result) {
+	try {
+		return classify(ctx, position, length, weight, n_samples, options, result);
+	}
+	catch (...) {
+		return DYNACARD_ERROR_INTERNAL;
+	}
+}
+
+DYNACARD_API int dynacard_classify_batch(dynacard_context* ctx, const double* position, const double* length, const double* weight,
+	const uint64_t* offsets, size_t n_cards, const dynacard_options* options, dynacard_result* results, int32_t* codes) {
+	try {
+		return classify_batch(ctx, position, length, weight, offsets, n_cards, options, results, codes);
+	}
+	catch (...) {
+		return DYNACARD_ERROR_INTERNAL;
+	}
+}
+
+DYNACARD_API int dynacard_classify_file(dynacard_context* ctx, const char* path, const dynacard_options* options,
+	dynacard_result* result) {
+	try {
+		if (!ctx || !path) return classify(nullptr, nullptr, nullptr, nullptr, 0, options, result);
+		string fname(path);
+		if (is_card_file_name(fname)) {
+			// Straight from the mapping
+			CardFile card;
+			if (!card.open(fname)) return DYNACARD_ERROR_FILE;
+			return classify(ctx, card.position, card.length, card.weight, card.n_samples(), options, result);
+		}
+		if (!parse_card_file(fname, ctx->columns)) return DYNACARD_ERROR_FILE;
+		CardColumns& cols = ctx->columns;
+		return classify(ctx, cols.position.data(), cols.length.data(), cols.weight.data(), cols.size(), options, result);
+	}
+	catch (...) {
+		return DYNACARD_ERROR_INTERNAL;
+	}
+}
+
+DYNACARD_API const char* dynacard_error_message(int code) {
+	switch (code) {
+	case DYNACARD_OK: return "ok";
+	case DYNACARD_ERROR_ARGUMENT: return "invalid argument";
+	case DYNACARD_ERROR_FILE: return "cannot read the card file";
+	case DYNACARD_ERROR_NO_CYCLE: return "no complete cycle in the card";
+	case DYNACARD_ERROR_INTERNAL: return "internal error";
+	default: return "unknown error";
+	}
+}
+
+}
+
+/*
+g++ -O2 -std=c++17 -shared -fPIC -fvisibility=hidden dynacard.cpp -o libdynacard.so
+cl /O2 /std:c++17 /LD dynacard.cpp /Fe:dynacard.dll
+*/
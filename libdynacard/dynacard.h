@@ -0,0 +1,152 @@
+/*
+libdynacard: the pump state classifier and the ComputeShapeProperties
+metrics as a library with a C ABI, for programs that would otherwise start
+classify_pump_state or compute_shape_properties for every card and parse the
+JSON they print.
+
+Usage:
+
+  dynacard_context* ctx = dynacard_create();
+  dynacard_options options;
+  dynacard_default_options(&options);
+  options.min_acceptable_peak_weight = 60.0;
+  dynacard_result result;
+  result.struct_size = sizeof(result);
+  if (dynacard_classify(ctx, position, length, weight, n_samples, &options, &result) == DYNACARD_OK)
+      printf("%s, area %g\n", result.state, result.area);
+  dynacard_destroy(ctx);
+
+The three columns stay the caller's: each call copies the cycle it classifies
+into the context's card and keeps nothing of them once it returns.
+A recording is cut to its first cycle the way each program always has (the
+classifier from the first position 0 to the next, the shape properties by
+the length thresholds of extract_one_cycle), so the results are the ones the
+programs print.  A context holds the scratch memory of one card at a time
+and stops allocating once it has seen the longest card; use one context per
+thread.
+
+ABI: the structs below only ever grow at the end.  Callers say how big they
+think the structs are in struct_size (dynacard_default_options does that for
+the options), and the library reads and writes no more than that, so a
+program built against an older dynacard.h keeps working with a newer
+library.  DYNACARD_ABI_VERSION changes only if that promise has to be
+broken.  No C++ exception ever leaves the library.
+*/
+
+#ifndef DYNACARD_H
+#define DYNACARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(DYNACARD_STATIC)
+#define DYNACARD_API
+#elif defined(_WIN32)
+#ifdef DYNACARD_BUILD
+#define DYNACARD_API __declspec(dllexport)
+#else
+#define DYNACARD_API __declspec(dllimport)
+#endif
+#else
+#define DYNACARD_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DYNACARD_ABI_VERSION 1
+
+/* Return codes */
+#define DYNACARD_OK 0
+#define DYNACARD_ERROR_ARGUMENT -1      /* a null pointer, or a struct_size too small */
+#define DYNACARD_ERROR_FILE -2          /* the card file cannot be read */
+#define DYNACARD_ERROR_NO_CYCLE -3      /* no cycle in the recording to classify or measure */
+#define DYNACARD_ERROR_INTERNAL -4      /* out of memory, or a bug */
+
+/* What dynacard_classify computes */
+#define DYNACARD_CLASSIFY 1             /* state and edges */
+#define DYNACARD_SHAPE_PROPERTIES 2     /* area and distances */
+#define DYNACARD_ONE_PASS 4             /* both in one pass: the shape measured on the classifier's
+                                           cycle and edges, close to but not the same as
+                                           compute_shape_properties' numbers, for about half the cost */
+
+/* Corner methods, as --corners= of the programs */
+#define DYNACARD_CORNERS_HEURISTIC 0
+#define DYNACARD_CORNERS_OPTIMAL 1
+
+typedef struct dynacard_context dynacard_context;
+
+typedef struct dynacard_options {
+	uint32_t struct_size;
+	uint32_t what;                      /* DYNACARD_CLASSIFY and/or DYNACARD_SHAPE_PROPERTIES, or DYNACARD_ONE_PASS */
+	double min_acceptable_peak_weight;  /* below this peak the well is flowing */
+	int32_t corner_method;              /* DYNACARD_CORNERS_ */
+	uint64_t resample_points;           /* resample a cycle of more samples to about this many along its
+	                                       length first, corners kept; 0 (the default) for none */
+} dynacard_options;
+
+/* A line fitted to one edge of the classified cycle */
+typedef struct dynacard_edge_fit {
+	double slope, intercept, r2;        /* weight on length */
+	double inverse_slope, inverse_r2;   /* length on weight */
+	double length;                      /* of the edge, in normalized units */
+} dynacard_edge_fit;
+
+typedef struct dynacard_result {
+	uint32_t struct_size;
+	char state[32];                     /* pump state, NUL terminated; "" if not classified */
+	dynacard_edge_fit edges[4];         /* left, top, right, bottom; NaN if not classified by shape */
+	uint64_t cycle_first, cycle_end;    /* samples [first, end) of the recording that were classified */
+	double area;                        /* of the cycle, normalized; NaN if not measured */
+	double distance_from_shape;         /* mean distance of the points from the fitted FourSidedFigure */
+	double distance_from_rotated_shape; /* and from it rotated 180 degrees */
+} dynacard_result;
+
+/* DYNACARD_ABI_VERSION of the library */
+DYNACARD_API int dynacard_abi_version(void);
+
+/* Defaults: classify and measure, min_acceptable_peak_weight 60, heuristic corners, no resampling */
+DYNACARD_API void dynacard_default_options(dynacard_options* options);
+
+/* A context, or NULL if out of memory */
+DYNACARD_API dynacard_context* dynacard_create(void);
+DYNACARD_API void dynacard_destroy(dynacard_context* ctx);
+
+/*
+Classify and/or measure the first cycle of a recording of n_samples
+samples.  With DYNACARD_ERROR_NO_CYCLE result still holds what could be
+found: the state is "other??" for an empty cycle, as the programs print,
+and the shape properties that could not be measured are NaN.
+*/
+DYNACARD_API int dynacard_classify(dynacard_context* ctx, const double* position, const double* length, const double* weight,
+	size_t n_samples, const dynacard_options* options, dynacard_result* result);
+
+/*
+Classify and/or measure n_cards recordings packed one after another into
+the same three columns: recording i is samples [offsets[i], offsets[i+1]),
+so offsets has n_cards + 1 entries.  results is an array of n_cards
+results, each results[0].struct_size bytes long, filled in as
+dynacard_classify fills one; codes, if not NULL, gets what
+dynacard_classify would have returned for each.  Returns
+DYNACARD_ERROR_ARGUMENT without classifying anything if the arguments are
+wrong, offsets going backwards included, and DYNACARD_OK otherwise.  The
+scratch memory of the context serves every card, and the next card is
+loaded into the cache while one is classified, so this is the fastest way
+through a large number of cards.
+*/
+DYNACARD_API int dynacard_classify_batch(dynacard_context* ctx, const double* position, const double* length, const double* weight,
+	const uint64_t* offsets, size_t n_cards, const dynacard_options* options, dynacard_result* results, int32_t* codes);
+
+/* The same for a card file, CSV or .card */
+DYNACARD_API int dynacard_classify_file(dynacard_context* ctx, const char* path, const dynacard_options* options,
+	dynacard_result* result);
+
+/* What a return code means, in English */
+DYNACARD_API const char* dynacard_error_message(int code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DYNACARD_H */